@@ -788,6 +788,15 @@ namespace fl
 
   // class MatrixStrided<T> ---------------------------------------------------
 
+  template<class T>
+  double MatrixStrided<T>::crossoverBLAS = 1000;
+
+  template<class T>
+  double MatrixStrided<T>::crossoverBlocked = 4096;
+
+  template<class T>
+  float MatrixStrided<T>::threadsBlocked = 0;
+
   template<class T>
   MatrixStrided<T>::MatrixStrided ()
   {
@@ -1080,6 +1089,19 @@ namespace fl
   {
 	Matrix<T> * result = new Matrix<T> (columns_, columns_);
 	T * base = (T *) data + offset;
+
+	// The blocked kernel and BLAS compute the full product rather than just
+	// the upper triangle, but are still far ahead of the loop below.
+	double crossover = crossoverBlocked;
+#   ifdef HAVE_BLAS
+	crossover = std::min (crossover, crossoverBLAS);
+#   endif
+	if ((double) columns_ * columns_ * rows_ >= crossover)
+	{
+	  multiply (columns_, columns_, rows_, base, strideC, strideR, base, strideR, strideC, (T *) result->data);
+	  return result;
+	}
+
 	for (int i = 0; i < columns_; i++)
 	{
 	  for (int j = i; j < columns_; j++)
@@ -1100,6 +1122,20 @@ namespace fl
 	return result;
   }
 
+  template<class T>
+  MatrixResult<T>
+  MatrixStrided<T>::transposeTimes (const MatrixAbstract<T> & B) const
+  {
+	if ((B.classID () & MatrixStridedID) == 0) return transposeTimes (MatrixStrided (B));
+
+	const MatrixStrided & MB = (const MatrixStrided &) B;
+	const int w  = std::min (rows_, MB.rows_);
+	const int bw = MB.columns_;
+	Matrix<T> * result = new Matrix<T> (columns_, bw);
+	multiply (columns_, bw, w, (T *) data + offset, strideC, strideR, (T *) MB.data + MB.offset, MB.strideR, MB.strideC, (T *) result->data);
+	return result;
+  }
+
   template<class T>
   MatrixResult<T>
   MatrixStrided<T>::visit (T (*function) (const T &)) const
@@ -1281,65 +1317,61 @@ namespace fl
 	const int w  = std::min (columns_, MB.rows_);
 	const int bw = MB.columns_;
 	Matrix<T> * result = new Matrix<T> (rows_, bw);
-	T * c = (T *) result->data;
+	multiply (rows_, bw, w, (T *) data + offset, strideR, strideC, (T *) MB.data + MB.offset, MB.strideR, MB.strideC, (T *) result->data);
+	return result;
+  }
+
+  template<class T>
+  void
+  MatrixStrided<T>::multiply (int m, int n, int k, const T * a, int aR, int aC, const T * b, int bR, int bC, T * c)
+  {
+	const double work = (double) m * n * k;
 
 #   ifdef HAVE_BLAS
-	if (rows_ * bw * w > 1000)  // Only run BLAS for non-trivial sized problems.  Should really be a tuneable parameter.
-	{
-	  if (strideR == 1)
-	  {
-		if (MB.strideR == 1)
-		{
-		  gemm ('n', 'n', rows_, bw, w, (T) 1, (T *) data + offset, strideC, (T *) MB.data + MB.offset, MB.strideC, (T) 0, c, rows_);
-		  return result;
-		}
-		if (MB.strideC == 1)
-		{
-		  gemm ('n', 'T', rows_, bw, w, (T) 1, (T *) data + offset, strideC, (T *) MB.data + MB.offset, MB.strideR, (T) 0, c, rows_);
-		  return result;
-		}
-	  }
-	  else if (strideC == 1)
-	  {
-		if (MB.strideR == 1)
-		{
-		  gemm ('T', 'n', rows_, bw, w, (T) 1, (T *) data + offset, strideR, (T *) MB.data + MB.offset, MB.strideC, (T) 0, c, rows_);
-		  return result;
-		}
-		if (MB.strideC == 1)
-		{
-		  gemm ('T', 'T', rows_, bw, w, (T) 1, (T *) data + offset, strideR, (T *) MB.data + MB.offset, MB.strideR, (T) 0, c, rows_);
-		  return result;
-		}
+	if (work >= crossoverBLAS)
+	{
+	  // BLAS needs unit stride along one dimension of each operand.
+	  char transA = 0;
+	  char transB = 0;
+	  int  lda;
+	  int  ldb;
+	  if      (aR == 1) {transA = 'n'; lda = aC;}
+	  else if (aC == 1) {transA = 'T'; lda = aR;}
+	  if      (bR == 1) {transB = 'n'; ldb = bC;}
+	  else if (bC == 1) {transB = 'T'; ldb = bR;}
+	  if (transA  &&  transB)
+	  {
+		gemm (transA, transB, m, n, k, (T) 1, (T *) a, lda, (T *) b, ldb, (T) 0, c, m);
+		return;
 	  }
 	}
 #   endif
 
-	T * aa  = (T *)    data +    offset;
-	T * b   = (T *) MB.data + MB.offset;
-	T * end = c + rows_ * bw;
+	// Reached without BLAS, or with operands BLAS can't take.
+	if (work >= crossoverBlocked  &&  multiplyBlocked (m, n, k, a, aR, aC, b, bR, bC, c, m, threadsBlocked)) return;
+
+	T * end = c + m * n;
 	while (c < end)
 	{
-	  T * a = aa;
-	  T * columnEnd = c + rows_;
+	  const T * ai = a;
+	  T * columnEnd = c + m;
 	  while (c < columnEnd)
 	  {
 		register T element = (T) 0;
-		T * i = a;
-		T * j = b;
-		T * rowEnd = j + w * MB.strideR;
+		const T * i = ai;
+		const T * j = b;
+		const T * rowEnd = j + k * bR;
 		while (j != rowEnd)
 		{
 		  element += (*i) * (*j);
-		  i +=    strideC;
-		  j += MB.strideR;
+		  i += aC;
+		  j += bR;
 		}
 		*c++ = element;
-		a += strideR;
+		ai += aR;
 	  }
-	  b += MB.strideC;
+	  b += bC;
 	}
-	return result;
   }
 
   template<class T>
@@ -2060,6 +2092,18 @@ namespace fl
 	this->strideC  = rows;
   }
 
+  template<class T>
+  void
+  Matrix<T>::resize (const int rows, const int columns, const int alignment)
+  {
+	assert (alignment % sizeof (T) == 0);
+	const int stride = Pointer::padStride (rows * sizeof (T), alignment) / sizeof (T);
+	this->data.grow (stride * columns * sizeof (T), alignment);
+	this->rows_    = rows;
+	this->columns_ = columns;
+	this->strideC  = stride;
+  }
+
   /**
 	 Unwind the elements columnwise and reflow them into a matrix of the
 	 given size.  If the new matrix has a larger number of elements, then
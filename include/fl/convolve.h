@@ -22,6 +22,7 @@ for details.
 #include "fl/matrix.h"
 #include "fl/point.h"
 #include "fl/archive.h"
+#include "fl/fourier.h"
 
 #include <ostream>
 
@@ -85,6 +86,8 @@ namespace fl
 
   // 2D Convolutions ----------------------------------------------------------
 
+  class SHARED ConvolutionDiscrete1D;
+
   /**
 	 Stores the kernel as a discrete set of points (a raster).
   **/
@@ -95,15 +98,54 @@ namespace fl
 						   const PixelFormat & format = GrayFloat);
 	ConvolutionDiscrete2D (const Image & image, const BorderMode mode = Crop);
 
-	virtual Image filter (const Image & image);
+	virtual Image filter (const Image & image);  ///< Automatically uses two 1D passes if the kernel is separable.
 	virtual double response (const Image & image, const Point & p) const;  ///< Strength of response of filter to image at input pixel (x, y).  Crop mode is treated as if ZeroFill mode, ie: no shift between input and output coordinate system.
+	bool separable (ConvolutionDiscrete1D & horizontal, ConvolutionDiscrete1D & vertical) const;  ///< Determines if kernel is rank 1, by finding its leading singular vectors.  If so, returns true and sets the two 1D kernels such that applying both is equivalent to applying this kernel.  Copies mode and format into the 1D kernels.
 
 	virtual void serialize (Archive & archive, uint32_t version);
 
 	void normalFloats ();  ///< Zero out any sub-normal floats in kernel, because they cause numerical exceptions that really drag down performance.
 
 	static uint32_t serializeVersion;
+	static double fourierCost;  ///< Cost of one unit of FFT work (N log2 N) relative to one kernel tap of direct convolution.  When FFTW is available, filter() uses ConvolutionFourier if that is estimated to be cheaper.
+  };
+
+#ifdef HAVE_FFTW
+  /**
+	 Convolves in the frequency domain, using overlap-add over fixed-size
+	 tiles.  Stores the forward transform of one image, so that every kernel
+	 in a filter bank can be applied for the cost of one kernel transform plus
+	 one inverse transform per tile.  Construct with the size of the largest
+	 kernel in the bank, call prepare() once per image, and then call filter()
+	 once per kernel.  ConvolutionDiscrete2D::filter() uses this class
+	 automatically for single large kernels.
+  **/
+  template<class T>
+  class SHARED ConvolutionFourier
+  {
+  public:
+	ConvolutionFourier (int kernelWidth, int kernelHeight);
+
+	void  prepare (const Image & image);  ///< Transforms all tiles of image.  Converts image to GrayFloat or GrayDouble, as appropriate for T.
+	Image filter (const ConvolutionDiscrete2D & kernel);  ///< Convolves prepared image with kernel, honoring kernel.mode.  Result is the same as ConvolutionDiscrete2D::filter(), up to numerical precision.  Kernel must be no larger than the size given to the constructor.
+
+	static int    fastSize (int n);  ///< Smallest integer >= n whose only prime factors are 2, 3 and 5.
+	static double cost (int imageWidth, int imageHeight, int kernelWidth, int kernelHeight);  ///< Estimated work for prepare() plus one filter(), in units of N log2 N.
+
+	int kernelWidth;  ///< Largest kernel this object can apply.
+	int kernelHeight;
+	int fftWidth;  ///< Size of each transform.
+	int fftHeight;
+	int tileWidth;  ///< Size of the block of image in each transform.  The remainder of the transform is zero padding that absorbs the spread of the kernel.
+	int tileHeight;
+	int tilesH;
+	int tilesV;
+	Image image;  ///< The prepared image.  Needed for border modes that refer to the original pixels.
+	std::vector<Matrix<std::complex<T> > > spectra;  ///< Transform of each tile, in row-major order.
+	Fourier<T> forward;
+	Fourier<T> inverse;
   };
+#endif
 
   class SHARED Gaussian2D : public ConvolutionDiscrete2D
   {
@@ -239,12 +281,20 @@ namespace fl
 	 This is a direct adaptation of Krystian's implementation.
 	 The "kernels" are only in double format, and the only BorderMode is
 	 (sort of like) Boost.
+
+	 <p>Cost per pixel is independent of sigma.  Several sequences run
+	 together across the vector lanes: adjacent columns for a vertical
+	 pass, and blocks of rows transposed into a scratch buffer for a
+	 horizontal pass.  The blocks are then spread across threads.
    **/
   class SHARED ConvolutionRecursive1D : public Convolution1D
   {
   public:
+	ConvolutionRecursive1D ();
+
 	virtual Image filter (const Image & image);
 	virtual double response (const Image & image, const Point & p) const;
+	static void block (const ConvolutionRecursive1D & c, const ImageOf<double> & input, ImageOf<double> & output, int b);  ///< Subroutine of filter().  Filters the b-th group of columns (Vertical) or rows (Horizontal), as many as fit in the vector lanes, in a single pass.
 
 	void set_nii_and_dii (double sigma,
 						  double a0, double a1,
@@ -270,6 +320,9 @@ namespace fl
 	double d33m;
 	double d44m;
 	double scale;
+
+	float     threadRequest;  ///< Blocks of columns or rows are spread across threads.  Same meaning as in ParallelFor.  Default is 0 (all hardware threads).
+	ptrdiff_t minimumPixels;  ///< Images smaller than this are filtered on the calling thread.  Default is 64K.
   };
 
   class SHARED GaussianRecursive1D : public ConvolutionRecursive1D
@@ -367,6 +420,57 @@ namespace fl
 	int offset2;
   };
 
+  /**
+	 Box-filter approximation of the scale-normalized second derivatives,
+	 in the manner of SURF.  Each derivative is a sum of a few boxes read
+	 from an integral image, so the cost per pixel is the same at every
+	 scale.  Lxx is three lobes side by side with weights 1, -2, 1, each lobe
+	 lobe pixels wide and 2 * lobe - 1 tall.  Lyy is the transpose, and Lxy
+	 is four lobe x lobe squares around the center with alternating signs.
+	 The components are normalized so that a quadratic surface with unit
+	 curvature produces sigma^2, as with FilterHessian.
+  **/
+  class SHARED FilterHessianBox : public Filter
+  {
+  public:
+	FilterHessianBox (double sigma = 1.2, bool determinant = false);
+
+	virtual Image filter (const Image & image);  ///< Integrates image, then calls filterIntegral().
+	Image filterIntegral (const Image & integral);  ///< Takes the output of IntegralImage (for example from EntryIntegral) directly, so that several scales can share it.  Result has the same geometry as the result of filter().
+	void derivatives (const double * integral, int stride, int x, int y, double & xx, double & yy, double & xy) const;  ///< Computes all three components for pixel (x,y) of the original image.  stride is the row length of integral, in doubles.  (x,y) must be at least offset pixels from every border.
+
+	double sigma;        ///< Effective scale, 0.4 * lobe.  This may differ from the value passed to the constructor, since lobe is quantized.
+	int    lobe;         ///< Width of one lobe of Lxx, in pixels.  Always odd, and at least 3.  lobe = 3 gives the 9x9 filter of SURF.
+	int    offset;       ///< Number of pixels removed from each border.
+	bool   determinant;  ///< Result is Lxx * Lyy - Lxy^2 instead of Lxx + Lyy.
+	double scaleDiagonal;  ///< Normalizes Lxx and Lyy.
+	double scaleCross;     ///< Normalizes Lxy.
+  };
+
+  /**
+	 Box-filter approximation of FilterHarris.  Gradients are Haar wavelet
+	 responses and the second-moment matrix is averaged over a square, both
+	 read from integral images, so the cost per pixel does not depend on
+	 sigmaD or sigmaI.  Each box is sized so that its variance matches that
+	 of the Gaussian it replaces.  The result is laid out like the result of
+	 FilterHarris, with offset pixels removed from each border.
+  **/
+  class SHARED FilterHarrisBox : public Filter
+  {
+  public:
+	FilterHarrisBox (double sigmaD = 1.0, double sigmaI = 1.4);
+
+	virtual Image filter (const Image & image);  ///< Integrates image, then calls filterIntegral().
+	Image filterIntegral (const Image & integral);  ///< Takes the output of IntegralImage directly.
+	static int halfWidth (double sigma);  ///< Half-width h of a box of 2h+1 pixels with the same variance as a Gaussian of the given sigma.
+
+	double sigmaD;   ///< Derivation scale
+	double sigmaI;   ///< Integration scale
+	int    offsetD;  ///< Half-width of the Haar wavelet, and border removed by differentiation.
+	int    offsetI;  ///< Half-width of the integration box, and border removed by integration.
+	int    offset;   ///< Total amount of one image border removed
+  };
+
 
   // Misc -----------------------------------------------------------------------
 
@@ -387,6 +491,30 @@ namespace fl
 	virtual double response (const Image & image, const Point & p) const;
   };
 
+  /**
+	 Summed-area table.  The result is one pixel larger than the input in
+	 each dimension.  Pixel (x,y) holds the sum of all input pixels above
+	 and to the left of (x,y), exclusive, so row 0 and column 0 are zero.
+	 The sum over the box [x0,x1) x [y0,y1) is then
+	 I(x1,y1) - I(x0,y1) - I(x1,y0) + I(x0,y0), at a cost that doesn't
+	 depend on the size of the box.
+
+	 <p>Input is read as gray float.  Sums are always accumulated in double.
+	 GrayDouble output (the default) keeps box sums accurate for any
+	 practical image size.  GrayFloat halves memory, but box sums lose
+	 precision as the running totals grow, so it suits only small images.
+  **/
+  class SHARED IntegralImage : public Filter
+  {
+  public:
+	IntegralImage (const PixelFormat & format = GrayDouble);
+
+	virtual Image filter (const Image & image);
+	static double sum (const Image & integral, int x0, int y0, int x1, int y1);  ///< Convenience function for occasional lookups.  integral must be GrayDouble.  Loops should address the buffer directly.
+
+	const PixelFormat * format;
+  };
+
   class SHARED NonMaxSuppress : public Filter
   {
   public:
@@ -507,6 +635,7 @@ namespace fl
 	void initialize (const Matrix<double> & A, bool inverse = false);  ///< A should be at least 2x2
 
 	virtual Image filter (const Image & image);
+	static const PixelFormat & workingFormat (const Image & image);  ///< Subroutine of filter().  GrayChar, GrayShort, RGBChar and RGBAChar are warped natively in fixed point.  Other monochrome formats go through GrayFloat (or GrayDouble) and color formats through RGBAFloat.
 
 	void setPeg (float centerX = NAN, float centerY = NAN, int width = -1, int height = -1);
 	void setWindow (float centerX, float centerY, int width = -1, int height = -1);
@@ -518,6 +647,7 @@ namespace fl
 			   double & dLo, double & dHi, bool & openHi, bool & openLo);
 	void prepareResult (const Image & image, int & w, int & h, MatrixFixed<double,3,3> & H, int & lo, int & hi);  ///< Subroutine of filter ().  Finalizes parameters that control fit between source and destination images.
 	Transform operator * (const Transform & that) const;
+	virtual Transform * clone () const;  ///< Polymorphic copy, so that FilterParallel can give each band its own viewport.
 
 	MatrixFixed<double,3,3> A;  ///< Maps coordinates from input image to output image.
 	MatrixFixed<double,3,3> IA;  ///< Inverse of A.  Maps coordinates from output image back to input image.
@@ -542,6 +672,7 @@ namespace fl
 	void prepareG ();
 
 	virtual Image filter (const Image & image);
+	virtual Transform * clone () const {return new TransformGauss (*this);}
 
 	/** Desired blur of resampling kernel in terms of destination image.
 		Default is 0.5.  It is impossible avoid adding blur to an image using
@@ -572,6 +703,7 @@ namespace fl
 	TransformNeighbor (const Transform & that)                         : Transform (that)           {}
 
 	virtual Image filter (const Image & image);
+	virtual Transform * clone () const {return new TransformNeighbor (*this);}
   };
 
   /** Emulate the classic Eagle upsampling algorithm to clip corners. **/
@@ -585,6 +717,7 @@ namespace fl
 	TransformEagle (const Transform & that)                         : Transform (that)           {}
 
 	virtual Image filter (const Image & image);
+	virtual Transform * clone () const {return new TransformEagle (*this);}
   };
 
   /**
@@ -683,6 +816,103 @@ namespace fl
 
 	unsigned int color;
   };
+
+
+  // Parallel execution ---------------------------------------------------------
+
+  /**
+	 Runs another filter on several threads by splitting the image into
+	 horizontal bands.  Each band carries enough extra rows (the halo) above
+	 and below it that the filter computes exactly the same values for the
+	 rows it owns as it would on the whole image.  The bands are then
+	 stitched back together into a single result.
+
+	 <p>The constructor that takes only a filter recognizes
+	 ConvolutionDiscrete1D, ConvolutionDiscrete2D, ConvolutionRecursive1D
+	 (horizontal only), FiniteDifference, Median, Transform and PixelFormat,
+	 and determines the halo from the kernel size or radius.  Any other
+	 filter simply runs single-threaded, unless the caller supplies the halo
+	 explicitly, thereby promising that the filter is thread-safe and purely
+	 local.  Transform is not local, so instead of splitting its input, we
+	 split its output viewport and give each band a clone() of the
+	 transform.
+
+	 <p>The input must be a packed, planar or groups buffer.  Other buffer
+	 types, as well as images too small to be worth splitting, go straight to
+	 the wrapped filter.
+  **/
+  class SHARED FilterParallel : public Filter
+  {
+  public:
+	FilterParallel (const Filter & filter, float threadRequest = 0);  ///< Determines halo automatically.  See ParallelFor for semantics of threadRequest.
+	FilterParallel (const Filter & filter, int haloTop, int haloBottom, bool crop = false, float threadRequest = 0);  ///< Caller promises that filter is thread-safe and only needs the given rows of context.
+
+	virtual Image filter (const Image & image);
+	Image filterTransform (const Image & image);  ///< Subroutine of filter().  Splits output viewport rather than input.
+	static Image band (const Image & image, int y, int height);  ///< Creates a view of rows [y, y + height) that shares memory with image.  Returns an image with no buffer if the buffer type is not supported.
+	static int alignment (const Image & image);  ///< Bands must start on a multiple of this many rows, due to vertical subsampling in the buffer.
+
+	Filter & target;
+	int   haloTop;     ///< Rows of context needed above each output row.
+	int   haloBottom;  ///< Rows of context needed below each output row.
+	bool  crop;        ///< Output is shorter than input by haloTop + haloBottom rows, as in BorderMode Crop.
+	bool  parallel;    ///< Indicates that target is known (or promised) to be safe to split.
+	float threadRequest;
+	int   minimumRows;  ///< Smallest band worth handing to a thread.  Default is 32.
+  };
+
+
+  // Pipelines ----------------------------------------------------------------
+
+  /**
+	 Records a chain of filters and applies it to an image in horizontal
+	 strips, so that intermediate results stay in cache rather than being
+	 materialized as full images.  For example:
+	 <pre>
+	 Image result = image * (FilterPipeline () .append (GrayFloat) .append (Gaussian1D (s, Boost, GrayFloat, Horizontal)) .append (Gaussian1D (s, Boost, GrayFloat, Vertical)));
+	 </pre>
+	 produces the same values as image * GrayFloat * gx * gy, but only ever
+	 holds a few dozen rows of each intermediate.
+
+	 <p>Each stage is classified the same way as FilterParallel classifies
+	 its target.  A run of two or more consecutive stages that only need a
+	 bounded number of rows of context is streamed.  Every stage keeps a
+	 sliding window over its own output, holding just the rows that the
+	 next stage still needs, so no row is computed twice.  Any other stage
+	 (Transform, vertical ConvolutionRecursive1D, etc.) runs on the whole
+	 image, as it would with operator *.  If a streamed stage produces
+	 something other than a packed image, or its output changes shape from
+	 one strip to the next, that run of stages falls back to whole-image
+	 evaluation.
+
+	 <p>The pipeline holds references to its filters, not copies.  Either
+	 keep them alive for the life of the pipeline, or build and apply the
+	 pipeline within a single expression as above.
+  **/
+  class SHARED FilterPipeline : public Filter
+  {
+  public:
+	FilterPipeline ();
+
+	FilterPipeline & append (const Filter & filter);  ///< Determines row context automatically.  See FilterParallel for which filters are recognized.
+	FilterPipeline & append (const Filter & filter, int haloTop, int haloBottom, bool crop = false);  ///< Caller promises that filter only needs the given rows of context, and that it yields exactly one output row per input row (or per window of rows, if crop).
+
+	virtual Image filter (const Image & image);
+	Image stream (const Image & image, int first, int last);  ///< Subroutine of filter().  Runs stages [first, last) in strips.  Falls back to whole-image evaluation if that isn't possible.
+
+	struct Stage
+	{
+	  Filter * filter;
+	  int      haloTop;     ///< Rows of context needed above each output row.
+	  int      haloBottom;  ///< Rows of context needed below each output row.
+	  bool     crop;        ///< Output is shorter than input by haloTop + haloBottom rows.
+	  bool     streams;     ///< Indicates that this stage can run on a strip.
+	};
+	std::vector<Stage> stages;
+
+	int stripRows;   ///< Number of final output rows produced per strip.  Zero (the default) means choose automatically from cacheBytes.
+	int cacheBytes;  ///< Approximate amount of memory the intermediate windows may occupy, assuming one float per pixel.  Default is 512KiB.
+  };
 }
 
 
@@ -0,0 +1,61 @@
+/*
+Author: Fred Rothganger
+
+Copyright 2010 Sandia Corporation.
+Under the terms of Contract DE-AC04-94AL85000 with Sandia Corporation,
+the U.S. Government retains certain rights in this software.
+Distributed under the GNU Lesser General Public License.  See the file LICENSE
+for details.
+*/
+
+
+#ifndef fl_cpu_h
+#define fl_cpu_h
+
+
+/**
+   Run-time tests for instruction set extensions beyond the compile-time
+   baseline.  Each kernel is compiled for every target it supports, and the
+   dispatcher asks one of these functions which to run.  The answer is
+   computed once per process.  On processors without such extensions, or
+   with compilers that can't test for them, all functions return false and
+   callers fall back to their baseline code.
+**/
+
+namespace fl
+{
+# if defined (__GNUC__)  &&  (defined (__x86_64__)  ||  defined (__i386__))
+
+  inline bool
+  haveAVX2 ()
+  {
+	static bool result = (__builtin_cpu_init (), __builtin_cpu_supports ("avx2"));
+	return result;
+  }
+
+  inline bool
+  haveFMA ()
+  {
+	static bool result = (__builtin_cpu_init (), __builtin_cpu_supports ("fma"));
+	return result;
+  }
+
+  /// F16C instructions are VEX encoded, so they also need AVX.
+  inline bool
+  haveF16C ()
+  {
+	static bool result = (__builtin_cpu_init (), __builtin_cpu_supports ("f16c")  &&  __builtin_cpu_supports ("avx"));
+	return result;
+  }
+
+# else
+
+  inline bool haveAVX2 () {return false;}
+  inline bool haveFMA  () {return false;}
+  inline bool haveF16C () {return false;}
+
+# endif
+}
+
+
+#endif
@@ -175,6 +175,15 @@ namespace fl
 
   // Descriptor ---------------------------------------------------------------
 
+  /**
+	 Computes a feature vector from the image region around a point.
+
+	 <p>values() describes a whole set of points at once, spreading them
+	 across threads.  A Descriptor that keeps working storage in its members
+	 must override clone(), so that each thread gets a private instance.
+	 One whose value() only reads its members returns 0 from clone(), and
+	 all threads share it.
+  **/
   class SHARED Descriptor
   {
   public:
@@ -188,6 +197,8 @@ namespace fl
 	virtual Image patch (const Vector<float> & value);  ///< Return a graphical representation of the descriptor.  Preferrably an image patch that would stimulate this descriptor to return the given value.
 	virtual Comparison * comparison ();  ///< Return an instance of the recommended Comparison for feature vectors from this type of Descriptor.  Caller is responsible to destroy instance.
 	virtual int dimension ();  ///< Number of elements in result of value().  0 if dimension can change from one call to the next.
+	virtual Matrix<float> values (ImageCache & cache, const PointSet & points, float threadRequest = 0);  ///< Describes every point in the set.  Column i of the result holds the feature vector of points[i].  Requires a fixed dimension().  threadRequest has the same semantics as in ParallelFor.
+	virtual Descriptor * clone () const;  ///< Polymorphic copy with its own working storage, for use by another thread in values().  Returns 0 if value() never modifies this object.  Caller is responsible to destroy instance.
 
 	void serialize (Archive & archive, uint32_t version);
 	static uint32_t serializeVersion;
@@ -214,6 +225,7 @@ namespace fl
 	Image patch (int index, const Vector<float> & value);  ///< Returns a visualization of one specific feature vector in the set.
 	virtual Comparison * comparison ();
 	virtual int dimension ();
+	virtual Matrix<float> values (ImageCache & cache, const PointSet & points, float threadRequest = 0);  ///< Stacks the batched results of each descriptor, so no clone of the combination is needed.
 	void serialize (Archive & archive, uint32_t version);
 
 	std::vector<Descriptor *> descriptors;
@@ -267,7 +279,8 @@ namespace fl
 
   /**
 	 Finds characteristic angle of point using a histogram of gradient
-	 directions.  Follows David Lowe's approach.
+	 directions.  Follows David Lowe's approach.  Like DescriptorSIFT,
+	 samples an EntryGradient directly when the point has no shape change.
    **/
   class SHARED DescriptorOrientationHistogram : public Descriptor
   {
@@ -426,6 +439,9 @@ namespace fl
 	 Note on supportRadial: supportRadial * point.scale gives pixel distance
 	 from center to edge of bins when they overlay the image. The pixel
 	 diameter of one bin is 2 * supportRadial * point.scale / width.
+	 Points with no shape change are binned straight from the EntryGradient
+	 of the nearest pyramid level.  Other points are rectified into a patch
+	 first.
   **/
   class SHARED DescriptorSIFT : public Descriptor
   {
@@ -435,6 +451,7 @@ namespace fl
 
 	void init ();  ///< Computes certain working data based on current values of parameters.
 	float * getKernel (int size);  ///< Generates/caches Gaussian weighting kernels for various sizes of rectified patch.
+	void sample (const EntryGradient & gradient, const PointAffine & point, float * result);  ///< Subroutine of value().  Bins gradients straight from a pyramid level, for points with no shape change.
 
 	virtual Vector<float> value (ImageCache & cache, const PointAffine & point);
 	using Descriptor::value;
@@ -443,6 +460,7 @@ namespace fl
 	void patch (Canvas * canvas, const Vector<float> & value, int size);  ///< Subroutine used by other patch() methods.
 	virtual Comparison * comparison ();  ///< Return a MetricEuclidean, rather than the default (NormalizedCorrelation).
 	virtual int dimension ();
+	virtual Descriptor * clone () const;  ///< Copies parameters, but leaves the kernel cache empty.
 	void serialize (Archive & archive, uint32_t version);
 
 	// Parameters
@@ -485,12 +503,13 @@ namespace fl
 	virtual Image patch (const Vector<float> & value);
 	virtual Comparison * comparison ();
 	virtual int dimension ();
+	virtual Descriptor * clone () const;
 	void serialize (Archive & archive, uint32_t version);
 
 	int width;  ///< Number of bins in the U and V dimensions.
 	int dim;
 	Matrix<bool> valid;  ///< Stores true for every bin that translates to a valid RGB color.
-	Matrix<float> histogram;  ///< Working histogram.  Forces this Descriptor object to be single threaded.
+	Matrix<float> histogram;  ///< Working histogram.  Each thread in values() gets its own through clone().
   };
 
   /**
@@ -517,13 +536,14 @@ namespace fl
 	virtual Image patch (const Vector<float> & value);
 	virtual Comparison * comparison ();
 	virtual int dimension ();
+	virtual Descriptor * clone () const;
 	void serialize (Archive & archive, uint32_t version);
 
 	int dim;
 	int width;  ///< Number of bins in the U and V dimensions.
 	int height;  ///< Number of bins in the Y dimension.
 	bool * valid;  ///< A 3D block of booleans that stores true for every bin that translates to a valid RGB color.
-	float * histogram;  ///< Working histogram.  Forces this Descriptor object to be single threaded.
+	float * histogram;  ///< Working histogram.  Each thread in values() gets its own through clone().
   };
 
   /**
@@ -621,6 +641,7 @@ namespace fl
 	void extract (ImageCache & cache, std::vector<Vector<float> > & descriptors);
 	virtual Comparison * comparison ();
 	virtual int dimension ();
+	virtual Matrix<float> values (ImageCache & cache, const PointSet & points, float threadRequest = 0);  ///< Always runs single threaded, because the wrapped detector, descriptor and cluster method are shared.
 	void serialize (Archive & archive, uint32_t version);
 
 	int levels;
@@ -27,6 +27,7 @@ for details.
 #include <vector>
 
 #include <assert.h>
+#include <stdio.h>
 
 #undef SHARED
 #ifdef _MSC_VER
@@ -47,6 +48,7 @@ namespace fl
   class SHARED PixelFormat;
   class SHARED Pixel;
   class SHARED ImageFileFormat;
+  class SHARED ImageFileDelegate;
 
 
   // Image --------------------------------------------------------------------
@@ -115,6 +117,14 @@ namespace fl
 	void     blend    (int x, int y, uint32_t rgba);      ///< similar setRGBA(), but respects semantics of alpha channels
 	void     blend    (int x, int y, float    values[]);  ///< similar setRGBA(), but respects semantics of alpha channels
 
+	// Span accessors.  Each covers count pixels starting at (x,y) and moving
+	// right.  These make one virtual call per span rather than two per pixel.
+	void     getRGBA  (int x, int y, int count, uint32_t rgba[]  ) const;
+	void     getRGBA  (int x, int y, int count, float    values[]) const;  ///< values must have 4 * count elements
+	void     getGray  (int x, int y, int count, float    gray[]  ) const;
+	void     setRGBA  (int x, int y, int count, const uint32_t rgba[]);
+	void     setGray  (int x, int y, int count, const float    gray[]);
+
 	// Data
 	PointerPoly<PixelBuffer>       buffer;
 	PointerPoly<const PixelFormat> format;
@@ -133,6 +143,7 @@ namespace fl
   class SHARED Filter
   {
   public:
+	virtual ~Filter () {}
 	virtual Image filter (const Image & image) = 0;  ///< This could be const, but it is useful to allow filters to collect statistics.  Note that such filters are not thread safe.
   };
 
@@ -163,8 +174,9 @@ namespace fl
   /**
 	 Changes the stride and height of a dense raster in memory.  Used mainly as
 	 a utility function by PixelBuffer, but sometimes useful elsewhere.
+	 alignment is passed to Pointer::grow() for any new block.
   **/
-  extern SHARED void reshapeBuffer (Pointer & memory, int oldStride, int newStride, int newHeight, int pad = 0);
+  extern SHARED void reshapeBuffer (Pointer & memory, int oldStride, int newStride, int newHeight, int pad = 0, int alignment = 0);
 
   /**
 	 An interface for various classes that manage the storage of image data.
@@ -189,6 +201,26 @@ namespace fl
 	   multiple instances of PixelBuffer that hold the same underlying storage.
 	**/
 	virtual void * pixel (int x, int y) = 0;
+	/**
+	   Same as pixel(), but the caller promises only to read through the
+	   result.  Buffers that write modified storage back somewhere
+	   (PixelBufferBig) use this to tell reads from writes.  The default
+	   simply calls pixel().
+	**/
+	virtual void * pixelRead (int x, int y);
+	/**
+	   Returns the start of row y, for use with the span methods of
+	   PixelFormat.  For packed and grouped buffers this is the address of
+	   the first byte in the row.  For planar buffers it is storage, filled
+	   with one pointer per plane, each positioned on the row (after
+	   vertical subsampling).  Since the caller owns storage, this function
+	   is thread-safe as long as the underlying memory doesn't move.
+	   Returns null if the buffer can't address a whole row at once, in
+	   which case the caller must fall back on pixel().
+	   \param storage Room for at least 3 pointers.  Only planar buffers
+	   write to it.
+	**/
+	virtual void * row (int y, void ** storage);
 	virtual void resize (int width, int height, const PixelFormat & format, bool preserve = false) = 0;  ///< Same semantics as Image::resize()
 	virtual PixelBuffer * duplicate () const = 0;  ///< Make a copy of self on the heap, with deap-copy semantics.
 	virtual void clear () = 0;  ///< Fill buffer(s) with zeros.
@@ -239,7 +271,9 @@ namespace fl
 	virtual ~PixelBufferPacked ();
 
 	virtual void * pixel (int x, int y);
-	virtual void resize (int width, int height, const PixelFormat & format, bool preserve = false);  ///< We assume that stride must now be set to width.  The alternative, if width < stride, would be to take no action.
+	virtual void * pixelRead (int x, int y);
+	virtual void * row (int y, void ** storage);
+	virtual void resize (int width, int height, const PixelFormat & format, bool preserve = false);  ///< We assume that stride must now be set to width * depth, padded according to alignment.  The alternative, if width < stride, would be to take no action.
 	virtual PixelBuffer * duplicate () const;
 	virtual void clear ();
 	virtual bool operator == (const PixelBuffer & that) const;
@@ -250,6 +284,7 @@ namespace fl
 	int offset;
 	int stride;
 	int depth;
+	int alignment;  ///< If positive, resize() pads stride as given by Pointer::padStride(), so every row starts aligned.  Zero (the default) keeps stride == width * depth, which some code assumes.
 	Pointer memory;
   };
 
@@ -275,6 +310,8 @@ namespace fl
 	virtual ~PixelBufferPlanar ();
 
 	virtual void * pixel (int x, int y);
+	virtual void * pixelRead (int x, int y);
+	virtual void * row (int y, void ** storage);
 	virtual void resize (int width, int height, const PixelFormat & format, bool preserve = false);  ///< Assumes that ratioH and ratioV are already set correctly.
 	virtual PixelBuffer * duplicate () const;
 	virtual void clear ();
@@ -288,7 +325,7 @@ namespace fl
 	int ratioH;
 	int ratioV;
 
-	void * pixelArray[3];  ///< Temporary storage for marshalled addresses.  Not thread-safe.
+	void * pixelArray[3];  ///< Temporary storage for marshalled addresses returned by pixel().  Not thread-safe.
   };
 
   /**
@@ -311,6 +348,8 @@ namespace fl
 	virtual ~PixelBufferGroups ();
 
 	virtual void * pixel (int x, int y);
+	virtual void * pixelRead (int x, int y);
+	virtual void * row (int y, void ** storage);
 	virtual void resize (int width, int height, const PixelFormat & format, bool preserve = false);  ///< stride will be set to ceil (width * groupBytes / groupPixels).
 	virtual PixelBuffer * duplicate () const;
 	virtual void clear ();
@@ -337,6 +376,8 @@ namespace fl
 	PixelBufferBlocks (void * buffer, int stride, int height, int pixelsH, int pixelsV, int bytes);
 
 	virtual void * pixel (int x, int y);
+	virtual void * pixelRead (int x, int y);
+	virtual void * row (int y, void ** storage);  ///< Returns null, since a block spans several rows.
 	virtual void resize (int width, int height, const PixelFormat & format, bool preserve = false);  ///< stride will be set to ceil (width * groupBytes / groupPixels).
 	virtual PixelBuffer * duplicate () const;
 	virtual bool operator == (const PixelBuffer & that) const;
@@ -348,12 +389,82 @@ namespace fl
 	 Encapsulates an image that is too big to fit in memory.  Instead, the
 	 image resides on disk, and a subset of its blocks are kept in cache at
 	 any given time.
+
+	 <p>The raster is divided into fixed-size tiles.  The first time pixel()
+	 touches a tile, it is fetched either from the source file (via
+	 ImageFileDelegate::read() with a region), from a scratch file if it
+	 was evicted earlier, or simply zero-filled.  At most cacheTiles tiles
+	 are resident at once, and the least recently used one is evicted to
+	 make room for a new one.  Only packed formats (planes == 1) are
+	 supported.  The source codec must be able to read arbitrary regions
+	 (for example TIFF or NITF), since tiles are fetched in random order.
+
+	 <p>A pointer returned by pixel() remains valid until a later call to
+	 pixel() misses the cache.  The cache always holds at least two tiles,
+	 so code that works with a pair of pixels (source and destination) is
+	 safe.  As for all PixelBuffers, this class is not thread-safe.  Create a
+	 duplicate() for each thread instead.
+
+	 <p>pixel() can't tell whether the caller will write through the pointer
+	 it returns, so any tile it touches is saved to scratch when evicted,
+	 even if it came from source.  To scan large areas without that cost,
+	 use read(), which leaves tiles clean.
+
+	 <p>Only code that goes through pixel() (such as Image::getRGBA() and
+	 setRGBA()) works on this buffer.  Most filters and format conversions
+	 require a PixelBufferPacked, so use read() to extract a region into a
+	 packed image, process that, and write() the result back.
    **/
   class SHARED PixelBufferBig : public PixelBuffer
   {
   public:
-	PixelBufferBig ();
+	PixelBufferBig (int tileWidth = 256, int tileHeight = 256, ptrdiff_t cacheBytes = 0x10000000);
+	PixelBufferBig (ImageFileDelegate * source, const PixelFormat & format, int width, int height, int tileWidth = 256, int tileHeight = 256, ptrdiff_t cacheBytes = 0x10000000);  ///< Binds to the raster of an open file.  Caller must supply the geometry and format of the raster.
 	virtual ~PixelBufferBig ();
+
+	virtual void * pixel (int x, int y);  ///< Marks the tile dirty, since the caller may write through the result.  Throws if (x,y) is outside the raster.
+	virtual void * pixelRead (int x, int y);  ///< Leaves the tile clean, so it is simply dropped on eviction.  Throws if (x,y) is outside the raster.
+	virtual void resize (int width, int height, const PixelFormat & format, bool preserve = false);  ///< Detaches from source and creates a blank raster backed by a scratch file.  Does not support preserve, except in the trivial case where geometry and format are unchanged.
+	virtual PixelBuffer * duplicate () const;  ///< Shares the source file, but has its own cache and its own copy of any modified tiles.
+	virtual void clear ();
+	virtual bool operator == (const PixelBuffer & that) const;
+
+	void read  (Image & image, int x, int y, int width, int height);  ///< Copies the given region into a packed image with the same format as this buffer.  Much faster than pixel-by-pixel access.
+	void write (const Image & image, int x = 0, int y = 0);  ///< Copies image into the given position, converting format if needed.
+	void setCache (ptrdiff_t bytes);  ///< Changes the upper bound on resident tiles.  Evicts immediately if necessary.
+	void flush ();  ///< Evict all resident tiles, saving dirty ones to scratch.
+
+	struct Tile
+	{
+	  int      index;    ///< Position of this tile in the raster, as tileY * tilesH + tileX.
+	  uint64_t lastUse;  ///< Value of clock when this tile was last touched by fetch().
+	  bool     dirty;    ///< pixel() (as opposed to pixelRead()) has handed out a pointer into this tile since it was loaded, so it may differ from source or scratch.
+	  Pointer  memory;
+	};
+	Tile * fetch (int index);  ///< Returns given tile, loading it if needed, without marking it dirty.
+	Tile * load (int index);  ///< Brings given tile into cache, evicting another one if needed.
+	void   evict (Tile * tile);  ///< Saves tile if dirty, then marks it as not resident.  Does not release memory.
+	void   reset ();  ///< Drops all tiles and scratch storage.
+
+	PointerPoly<ImageFileDelegate> source;  ///< Where pristine tiles come from.  If null, then new tiles are zero-filled.
+	PointerPoly<const PixelFormat> format;  ///< Format of the tiles, needed to convert the output of source.
+	int                            width;
+	int                            height;
+	int                            depth;  ///< Bytes per pixel.
+	int                            tileWidth;
+	int                            tileHeight;
+	int                            tileStride;  ///< Bytes per row of one tile.
+	int                            tilesH;  ///< Number of tiles across the raster.
+	int                            tilesV;  ///< Number of tiles down the raster.
+	ptrdiff_t                      cacheBytes;  ///< Memory budget for resident tiles, as given to setCache().
+	int                            cacheTiles;  ///< Maximum number of resident tiles, derived from cacheBytes.  Always at least 2.
+
+	std::vector<Tile *>            tiles;  ///< One entry per tile in the raster.  Null when not resident.
+	std::vector<uint8_t>           stored;  ///< One entry per tile in the raster.  Nonzero if a copy of the tile is in the scratch file.
+	std::vector<Tile *>            resident;  ///< All allocated tiles, at most cacheTiles of them.
+	Tile *                         last;  ///< Most recent result of pixel(), to short-circuit the lookup for runs of pixels in the same tile.
+	uint64_t                       clock;  ///< Counts switches between tiles, for LRU ordering.
+	FILE *                         scratch;  ///< Anonymous temporary file that holds modified tiles.  Created on first eviction of a dirty tile.
   };
 
 
@@ -547,6 +658,18 @@ namespace fl
 	virtual Image filter (const Image & image);  ///< Return an Image in this format
 	virtual void fromAny (const Image & image, Image & result) const;
 
+	/**
+	   Converts one row of width pixels directly from one format to another.
+	   Each pointer follows the same convention as PixelBuffer::pixel():
+	   for packed and grouped buffers it addresses the first byte of the row,
+	   while for planar buffers it addresses an array of plane pointers, each
+	   already positioned on the row (with vertical subsampling applied).
+	**/
+	typedef void (* RowConverter) (void * from, void * to, int width);
+	static void         addConverter  (const PixelFormat & from, const PixelFormat & to, RowConverter converter);  ///< Registers a direct converter for the given pair.  Replaces any existing entry for the same pair.  Both formats must outlive the registry, so generally they should be the predefined global formats.
+	static RowConverter findConverter (const PixelFormat & from, const PixelFormat & to);  ///< @return The registered converter for the given pair, or null if there is none.  A registered format matches only formats of the same class that also compare equal.
+	bool                convert       (const Image & image, Image & result) const;  ///< Fills result, which must already be sized and in this format, using a registered row converter.  @return false if no converter applies, in which case result is left untouched.
+
 	virtual PixelBuffer * buffer () const;  ///< Construct a PixelBuffer suitable for holding data of the type described by this object.
 	virtual PixelBuffer * attach (void * block, int width, int height, bool copy = false) const;  ///< Creates a suitable PixelBuffer bound to the given external block of memory.  Makes best effort to guess the start of each plane in the case of planar formats.  (Default implementation assumes packed buffer.)
 
@@ -577,6 +700,17 @@ namespace fl
 	virtual void     blend    (void * pixel, uint32_t rgba    ) const;
 	virtual void     blend    (void * pixel, float    values[]) const;
 
+	// Span accessors.  Each covers count pixels starting at x in a row
+	// returned by PixelBuffer::row().  The default implementations walk the
+	// row and call the per-pixel methods above, which already saves the
+	// virtual call to PixelBuffer::pixel().  Common formats override these
+	// with tight loops.
+	virtual void     getRGBA  (void * row, int x, int count, uint32_t rgba[]  ) const;
+	virtual void     getRGBA  (void * row, int x, int count, float    values[]) const;  ///< values must have 4 * count elements
+	virtual void     getGray  (void * row, int x, int count, float    gray[]  ) const;
+	virtual void     setRGBA  (void * row, int x, int count, const uint32_t rgba[]) const;
+	virtual void     setGray  (void * row, int x, int count, const float    gray[]) const;
+
 	int planes;  ///< The number of entries in the array passed through the "pixel" parameter.  See PixelBuffer::planes for semantics.  This format must agree with the PixelBuffer on the meaning of the pixel pointer.
 	float depth;  ///< Number of bytes per pixel, including any padding.  This could have been defined as bits per pixel, but there actually exists a format (4CC==IF09) which has a non-integral number of bits per pixel.  Defined as bytes, this field allows one to compute the total number of bytes needed by the image (even for planar formats) as width * height * depth.
 	int precedence;  ///< Imposes a (partial?) order on formats according to information content.  Bigger numbers have more information.
@@ -688,6 +822,11 @@ namespace fl
 	virtual void     setXYZ  (void * pixel, float    values[]) const;
 	virtual void     setGray (void * pixel, uint8_t  gray    ) const;
 	virtual void     setGray (void * pixel, float    gray    ) const;
+
+	virtual void     getRGBA (void * row, int x, int count, uint32_t rgba[]) const;
+	virtual void     getGray (void * row, int x, int count, float    gray[]) const;
+	virtual void     setRGBA (void * row, int x, int count, const uint32_t rgba[]) const;
+	virtual void     setGray (void * row, int x, int count, const float    gray[]) const;
   };
 
   class SHARED PixelFormatGrayAlphaChar : public PixelFormat
@@ -725,6 +864,11 @@ namespace fl
 	virtual void     setGray (void * pixel, uint8_t  gray    ) const;
 	virtual void     setGray (void * pixel, float    gray    ) const;
 
+	virtual void     getRGBA (void * row, int x, int count, uint32_t rgba[]) const;
+	virtual void     getGray (void * row, int x, int count, float    gray[]) const;
+	virtual void     setRGBA (void * row, int x, int count, const uint32_t rgba[]) const;
+	virtual void     setGray (void * row, int x, int count, const float    gray[]) const;
+
 	uint16_t grayMask;  ///< Indicates what (contiguous) bit in the pixel actually carry intensity info.
 	int      grayShift; ///< How many bits to shift grayMask to align the msb with bit 15.
   };
@@ -765,6 +909,49 @@ namespace fl
 	virtual void     setRGBA (void * pixel, uint32_t rgba) const;
   };
 
+  /**
+	 Conversions between IEEE 754 binary16 and single precision.  The array
+	 forms use F16C instructions when the processor supports them.
+	 floatToHalf() rounds to nearest even, and values beyond the range of
+	 half become infinity.
+  **/
+  extern SHARED float    halfToFloat (uint16_t value);
+  extern SHARED uint16_t floatToHalf (float value);
+  extern SHARED void     halfToFloat (const uint16_t * from, float * to, int count);
+  extern SHARED void     floatToHalf (const float * from, uint16_t * to, int count);
+
+  /**
+	 Stores each sample as an IEEE 754 binary16 ("half") value.  Same
+	 semantics as GrayFloat, with 11 bits of precision and a range of about
+	 6e-8 to 65504.  Intended for large intermediate results, such as scale
+	 pyramids, where halving memory and bandwidth matters more than the
+	 last few bits.
+  **/
+  class SHARED PixelFormatGrayHalf : public PixelFormat
+  {
+  public:
+	PixelFormatGrayHalf ();
+
+	void serialize (Archive & archive, uint32_t version);
+
+	virtual void fromAny (const Image & image, Image & result) const;
+
+	virtual uint32_t getRGBA (void * pixel                   ) const;
+	virtual void     getRGBA (void * pixel, float    values[]) const;
+	virtual void     getXYZ  (void * pixel, float    values[]) const;
+	virtual uint8_t  getGray (void * pixel                   ) const;
+	virtual void     getGray (void * pixel, float &  gray    ) const;
+	virtual void     setRGBA (void * pixel, uint32_t rgba    ) const;
+	virtual void     setRGBA (void * pixel, float    values[]) const;
+	virtual void     setXYZ  (void * pixel, float    values[]) const;
+	virtual void     setGray (void * pixel, uint8_t  gray    ) const;
+	virtual void     setGray (void * pixel, float    gray    ) const;
+
+	virtual void     getRGBA (void * row, int x, int count, float    values[]) const;
+	virtual void     getGray (void * row, int x, int count, float    gray[]  ) const;
+	virtual void     setGray (void * row, int x, int count, const float    gray[]) const;
+  };
+
   class SHARED PixelFormatGrayFloat : public PixelFormat
   {
   public:
@@ -792,6 +979,12 @@ namespace fl
 	virtual void     setXYZ  (void * pixel, float    values[]) const;
 	virtual void     setGray (void * pixel, uint8_t  gray    ) const;
 	virtual void     setGray (void * pixel, float    gray    ) const;
+
+	virtual void     getRGBA (void * row, int x, int count, uint32_t rgba[]  ) const;
+	virtual void     getRGBA (void * row, int x, int count, float    values[]) const;
+	virtual void     getGray (void * row, int x, int count, float    gray[]  ) const;
+	virtual void     setRGBA (void * row, int x, int count, const uint32_t rgba[]) const;
+	virtual void     setGray (void * row, int x, int count, const float    gray[]) const;
   };
 
   class SHARED PixelFormatGrayDouble : public PixelFormat
@@ -821,6 +1014,12 @@ namespace fl
 	virtual void     setXYZ  (void * pixel, float    values[]) const;
 	virtual void     setGray (void * pixel, uint8_t  gray    ) const;
 	virtual void     setGray (void * pixel, float    gray    ) const;
+
+	virtual void     getRGBA (void * row, int x, int count, uint32_t rgba[]  ) const;
+	virtual void     getRGBA (void * row, int x, int count, float    values[]) const;
+	virtual void     getGray (void * row, int x, int count, float    gray[]  ) const;
+	virtual void     setRGBA (void * row, int x, int count, const uint32_t rgba[]) const;
+	virtual void     setGray (void * row, int x, int count, const float    gray[]) const;
   };
 
   /**
@@ -858,6 +1057,9 @@ namespace fl
 	virtual void     setRGBA  (void * pixel, uint32_t rgba ) const;
 	virtual void     setAlpha (void * pixel, uint8_t  alpha) const;
 
+	virtual void     getRGBA  (void * row, int x, int count, uint32_t rgba[]) const;
+	virtual void     setRGBA  (void * row, int x, int count, const uint32_t rgba[]) const;
+
 	void shift (uint32_t redMask, uint32_t greenMask, uint32_t blueMask, uint32_t alphaMask, int & redShift, int & greenShift, int & blueShift, int & alphaShift) const;
 	static int countBits (uint32_t mask);
 
@@ -890,6 +1092,9 @@ namespace fl
 	virtual uint8_t  getAlpha (void * pixel                ) const;
 	virtual void     setRGBA  (void * pixel, uint32_t rgba ) const;
 	virtual void     setAlpha (void * pixel, uint8_t  alpha) const;
+
+	virtual void     getRGBA  (void * row, int x, int count, uint32_t rgba[]) const;
+	virtual void     setRGBA  (void * row, int x, int count, const uint32_t rgba[]) const;
   };
 
   class SHARED PixelFormatRGBChar : public PixelFormatRGBABits
@@ -908,6 +1113,9 @@ namespace fl
 
 	virtual uint32_t getRGBA  (void * pixel) const;
 	virtual void     setRGBA  (void * pixel, uint32_t rgba) const;
+
+	virtual void     getRGBA  (void * row, int x, int count, uint32_t rgba[]) const;
+	virtual void     setRGBA  (void * row, int x, int count, const uint32_t rgba[]) const;
   };
 
   class SHARED PixelFormatRGBAShort : public PixelFormat
@@ -952,6 +1160,30 @@ namespace fl
 	virtual void     setRGBA  (void * pixel, float    values[]) const;
 	virtual void     setAlpha (void * pixel, uint8_t  alpha   ) const;
 	virtual void     blend    (void * pixel, float    values[]) const;
+
+	virtual void     getRGBA  (void * row, int x, int count, uint32_t rgba[]  ) const;
+	virtual void     getRGBA  (void * row, int x, int count, float    values[]) const;
+	virtual void     setRGBA  (void * row, int x, int count, const uint32_t rgba[]) const;
+  };
+
+  /// Same as RGBAFloat, but each channel is stored as a binary16 value.  See PixelFormatGrayHalf.
+  class SHARED PixelFormatRGBAHalf : public PixelFormat
+  {
+  public:
+	PixelFormatRGBAHalf ();
+
+	void serialize (Archive & archive, uint32_t version);
+
+	virtual void fromAny (const Image & image, Image & result) const;
+
+	virtual uint32_t getRGBA  (void * pixel                   ) const;
+	virtual void     getRGBA  (void * pixel, float    values[]) const;
+	virtual uint8_t  getAlpha (void * pixel                   ) const;
+	virtual void     setRGBA  (void * pixel, uint32_t rgba    ) const;
+	virtual void     setRGBA  (void * pixel, float    values[]) const;
+	virtual void     setAlpha (void * pixel, uint8_t  alpha   ) const;
+
+	virtual void     getRGBA  (void * row, int x, int count, float    values[]) const;
   };
 
   class SHARED PixelFormatPlanarRGB : public PixelFormat
@@ -1118,10 +1350,12 @@ namespace fl
   extern SHARED PixelFormatGrayShort          GrayShort;
   extern SHARED PixelFormatGrayShortSigned    GrayShortSigned;
   extern SHARED PixelFormatGrayAlphaShort     GrayAlphaShort;
+  extern SHARED PixelFormatGrayHalf           GrayHalf;
   extern SHARED PixelFormatGrayFloat          GrayFloat;
   extern SHARED PixelFormatGrayDouble         GrayDouble;
   extern SHARED PixelFormatRGBAChar           RGBAChar;
   extern SHARED PixelFormatRGBAShort          RGBAShort;
+  extern SHARED PixelFormatRGBAHalf           RGBAHalf;
   extern SHARED PixelFormatRGBAFloat          RGBAFloat;
   extern SHARED PixelFormatRGBChar            RGBChar;
   extern SHARED PixelFormatPlanarRGB          RGBPlanar;  // Implicitly char
@@ -1338,6 +1572,16 @@ namespace fl
 	**/
 	void write (const Image & image, int x = 0, int y = 0);
 
+	/**
+	   Binds image to the raster in this file via a PixelBufferBig, rather
+	   than reading the entire raster into memory.  Pixels are fetched
+	   lazily, one block at a time.  If the codec can't read arbitrary
+	   regions, then every block would decode the whole raster, so in that
+	   case image simply receives the entire raster in an ordinary buffer.
+	   \param cacheBytes Upper bound on memory used for cached blocks.
+	**/
+	void attach (Image & image, ptrdiff_t cacheBytes = 0x10000000);
+
 	void get (const std::string & name,       std::string & value);
 	void set (const std::string & name, const std::string & value);
 	using Metadata::get;
@@ -1519,63 +1763,63 @@ namespace fl
   Image::getRGBA (int x, int y) const
   {
 	assert (x >= 0  &&  x < width  &&  y >= 0  &&  y < height);
-	return format->getRGBA (buffer->pixel (x, y));
+	return format->getRGBA (buffer->pixelRead (x, y));
   }
 
   inline void
   Image::getRGBA (int x, int y, float values[]) const
   {
 	assert (x >= 0  &&  x < width  &&  y >= 0  &&  y < height);
-	format->getRGBA (buffer->pixel (x, y), values);
+	format->getRGBA (buffer->pixelRead (x, y), values);
   }
 
   inline void
   Image::getXYZ (int x, int y, float values[]) const
   {
 	assert (x >= 0  &&  x < width  &&  y >= 0  &&  y < height);
-	format->getXYZ (buffer->pixel (x, y), values);
+	format->getXYZ (buffer->pixelRead (x, y), values);
   }
 
   inline uint32_t
   Image::getYUV (int x, int y) const
   {
 	assert (x >= 0  &&  x < width  &&  y >= 0  &&  y < height);
-	return format->getYUV (buffer->pixel (x, y));
+	return format->getYUV (buffer->pixelRead (x, y));
   }
 
   inline void
   Image::getHSL (int x, int y, float values[]) const
   {
 	assert (x >= 0  &&  x < width  &&  y >= 0  &&  y < height);
-	format->getHSL (buffer->pixel (x, y), values);
+	format->getHSL (buffer->pixelRead (x, y), values);
   }
 
   inline void
   Image::getHSV (int x, int y, float values[]) const
   {
 	assert (x >= 0  &&  x < width  &&  y >= 0  &&  y < height);
-	format->getHSV (buffer->pixel (x, y), values);
+	format->getHSV (buffer->pixelRead (x, y), values);
   }
 
   inline uint8_t
   Image::getGray (int x, int y) const
   {
 	assert (x >= 0  &&  x < width  &&  y >= 0  &&  y < height);
-	return format->getGray (buffer->pixel (x, y));
+	return format->getGray (buffer->pixelRead (x, y));
   }
 
   inline void
   Image::getGray (int x, int y, float & gray) const
   {
 	assert (x >= 0  &&  x < width  &&  y >= 0  &&  y < height);
-	format->getGray (buffer->pixel (x, y), gray);
+	format->getGray (buffer->pixelRead (x, y), gray);
   }
 
   inline uint8_t
   Image::getAlpha (int x, int y) const
   {
 	assert (x >= 0  &&  x < width  &&  y >= 0  &&  y < height);
-	return format->getAlpha (buffer->pixel (x, y));
+	return format->getAlpha (buffer->pixelRead (x, y));
   }
 
   inline void
@@ -16,11 +16,16 @@ for details.
 
 #include "fl/image.h"
 #include "fl/convolve.h"
+#include "fl/pointer.h"
 
 #include <set>
 #include <ostream>
 #include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <vector>
 #include <stddef.h>
+#include <stdint.h>
 
 #undef SHARED
 #ifdef _MSC_VER
@@ -49,19 +54,34 @@ namespace fl
 	 Alternately, it is permissible to preemptively fill the image member
 	 and not do anything when the generate function is called.  In this case
 	 the client code should be careful to avoid wasted computation.
+
+	 <p>Entries are reference counted.  The cache holds one reference to each
+	 entry it contains, and the acquire functions return a PointerPoly that
+	 holds another.  An entry with any outstanding PointerPoly is never
+	 evicted, and if it is removed from the cache anyway (by clear()), it
+	 stays alive until the last PointerPoly releases it.  The get functions
+	 return a raw pointer instead, and pin the entry so that pointer stays
+	 valid until the next clear().  Code that works within a memory budget
+	 should use acquire, so that entries it is done with can be evicted.
    **/
-  class SHARED ImageCacheEntry
+  class SHARED ImageCacheEntry : public ReferenceCounted
   {
   public:
+	ImageCacheEntry ();
 	virtual ~ImageCacheEntry ();
 
-	virtual void      generate (ImageCache & cache);  ///< Fill the image member.  Note on thread-safety: cache always locks its mutex before calling this function.
+	virtual void      generate (ImageCache & cache);  ///< Fill the image member.  Note on thread-safety: cache does not hold its mutex while calling this function, so other threads can look up and generate unrelated entries concurrently.  Any direct access to cache.cache must lock cache.mutex, and an entry found that way must be held in a PointerPoly before unlocking.
 	virtual ptrdiff_t memory   () const;  ///< @return an estimate of how many bytes this entry uses.  Need only account for large things like the pixel buffer itself.
 	virtual bool      compare  (const ImageCacheEntry & that) const;  ///< @return true if this < that. IE: true if this comes before that. false if this comes after that OR this sorts the same as that.
 	virtual float     distance (const ImageCacheEntry & that) const;  ///< Returns zero if that is exactly same as this, otherwise a positive number that indicates how different they are.  Returns INFINITY if that is not same class as this, or otherwise not substitutable.
 	virtual void      print    (std::ostream & stream) const;
 
 	Image image; ///< The actual cached data.
+
+	bool     pinned;    ///< Never evict this entry.  Subclasses that accumulate results in image across calls should set this.  The get functions set this on their result, since the caller may keep the raw pointer.  The cache's original is always treated as pinned.
+	double   cost;      ///< Seconds spent in generate().  Entries that are expensive to rebuild are kept longer.
+	double   priority;  ///< Eviction rank maintained by ImageCache.  Lowest value goes first.
+	uint64_t lastUsed;  ///< Value of ImageCache::clock at most recent access.  Breaks ties in priority, in LRU order.
   };
   SHARED std::ostream & operator << (std::ostream & stream, const ImageCacheEntry & data);
 
@@ -73,15 +93,19 @@ namespace fl
   public:
 	ImageCache ();
 	~ImageCache ();
-	void clear ();
-	void clear (ImageCacheEntry * query);  ///< Remove all entries that have equivalent ordering to query.  query itself will also be deleted.
+	void clear ();  ///< Waits for any in-flight generation to finish, then removes all entries.  Throws if called from within generate() on the same cache, since that would wait forever.
+	void clear (ImageCacheEntry * query);  ///< Remove all entries that have equivalent ordering to query.  query itself will also be deleted.  Like clear(), waits for in-flight generation, and throws if called from within generate().
 
-	void setOriginal (const Image & image, float scale = 0.5f);  ///< Compares image to original. If same, does nothing. If different, flushes cache and sets new original.
-	void setOriginal (EntryPyramid * entry);                     ///< If entry is already in cache, simply sets original=entry. Otherwise, flushes cache first.
+	void setOriginal (const Image & image, float scale = 0.5f);  ///< Compares image to original. If same, does nothing. If different, flushes cache and sets new original.  Like clear(), throws if it needs to flush while called from within generate().
+	void setOriginal (EntryPyramid * entry);                     ///< If entry is already in cache, simply sets original=entry. Otherwise, flushes cache first.  Like clear(), throws if it needs to flush while called from within generate().
 
-	ImageCacheEntry * get        (ImageCacheEntry * query);  ///< Ensures that the desired datum exists.  Assumes ownership of the query object.  Result will be equivalent, but may or may not be the same as the query object.
-	ImageCacheEntry * getClosest (ImageCacheEntry * query);  ///< Returns entry with smallest distance from query, or null if no acceptable entry exists.  Always deletes query before returning.
-	ImageCacheEntry * getLE      (ImageCacheEntry * query);  ///< Returns entry that satisfies the query, or the closest one for which entry < query, or null if no acceptable entry exists.  Always deletes query before returning.
+	ImageCacheEntry * get        (ImageCacheEntry * query);  ///< Same as acquire(), but pins the result so the raw pointer remains valid until the cache is cleared.
+	ImageCacheEntry * getClosest (ImageCacheEntry * query);  ///< Same as acquireClosest(), but pins the result.
+	ImageCacheEntry * getLE      (ImageCacheEntry * query);  ///< Same as acquireLE(), but pins the result.
+
+	PointerPoly<ImageCacheEntry> acquire        (ImageCacheEntry * query);  ///< Ensures that the desired datum exists.  Assumes ownership of the query object.  Result will be equivalent, but may or may not be the same as the query object.  If another thread is already generating an equivalent entry, waits for that one rather than holding up the whole cache.  If generate() throws, query is deleted and the exception passes to the caller.
+	PointerPoly<ImageCacheEntry> acquireClosest (ImageCacheEntry * query);  ///< Returns entry with smallest distance from query, or null if no acceptable entry exists.  Always deletes query before returning.
+	PointerPoly<ImageCacheEntry> acquireLE      (ImageCacheEntry * query);  ///< Returns entry that satisfies the query, or the closest one for which entry < query, or null if no acceptable entry exists.  Always deletes query before returning.
 
 	struct EntryCompare
 	{
@@ -91,8 +115,25 @@ namespace fl
 	  }
 	};
 
+	void waitPending (std::unique_lock<std::recursive_mutex> & lock);  ///< Blocks until no entries are pending.  Throws if the calling thread is itself generating an entry, which would otherwise deadlock.  Caller must hold mutex via lock.
+	void finish   (ImageCacheEntry * query);  ///< Remove query from pending, along with its entry in generators.  Caller must hold mutex.
+	bool inFlight (const ImageCacheEntry * query) const;  ///< @return true if an entry equivalent to query is currently being generated by some thread.  Caller must hold mutex.
+	void touch    (ImageCacheEntry * entry);  ///< Record an access to entry for the eviction policy.  Caller must hold mutex.
+	ImageCacheEntry * pin (const PointerPoly<ImageCacheEntry> & entry);  ///< Mark entry pinned, for the functions that return raw pointers.  @return the raw pointer, or null if entry is null.
+	void evict    (const ImageCacheEntry * keep = 0);  ///< Remove unpinned entries, least valuable first, until memory is within budget.  Never removes keep, nor any entry that is still held by a PointerPoly.  Caller must hold mutex.
+	static void release (ImageCacheEntry * entry);  ///< Drop the cache's reference to an entry that has been taken out of the cache structure.  Deletes it if no PointerPoly holds it.
+
 	std::recursive_mutex mutex;  ///< All accesses that change or depend on the cache structure must be thread-safe.
+	std::condition_variable_any generated;  ///< Signaled whenever an in-flight entry finishes, successfully or not.
+	std::vector<ImageCacheEntry *> pending;  ///< Entries currently being generated.  They are added to cache only once complete.  Threads that need one of these wait on generated rather than duplicating the work.
+	std::vector<std::thread::id>   generators;  ///< Thread running generate() for the corresponding element of pending.
 	ptrdiff_t memory;  ///< Total amount of memory used by entries.  Must be maintained any time an entry is added or removed.
+	ptrdiff_t budget;  ///< Upper limit on memory, enforced by evicting entries.  Zero (the default) means unlimited.  Entries that callers still hold are exempt, so memory can temporarily exceed the budget.
+	double    inflation;  ///< Priority of the most recently evicted entry.  New priorities start from here, so entries that have not been touched in a while age out (GreedyDual-Size).
+	uint64_t  clock;      ///< Counts accesses, for lastUsed.
+	uint64_t  hits;       ///< Number of queries satisfied by an existing (or in-flight) entry.
+	uint64_t  misses;     ///< Number of queries that required generate().
+	uint64_t  evictions;  ///< Number of entries removed to stay within budget.
 	EntryPyramid * original;  ///< Base image from which all others are derived
 	typedef std::set<ImageCacheEntry *, EntryCompare> cacheType;
 	cacheType cache;
@@ -153,10 +194,54 @@ namespace fl
 	float scale;
   };
 
+  /**
+	 Gradient of a GrayFloat pyramid level, in polar form.  The image member
+	 holds the magnitude and the angle member holds atan2(dy,dx) in
+	 [-pi,pi].  dx and dy are the same as FiniteDifference produces, so
+	 descriptors that bin gradients can sample this directly rather than
+	 differentiating a warped patch around each point.
+  **/
+  class SHARED EntryGradient : public ImageCacheEntry
+  {
+  public:
+	EntryGradient (float scale = 0.5f, int width = 0);
+
+	static int levelWidth (int originalWidth, float scale, int width);  ///< Halves width for as long as scale (which is relative to originalWidth) still spans at least minimumScale pixels of the smaller level.  Keeps the number of pixels under a point's support region bounded.
+	static float minimumScale;
+
+	virtual void      generate (ImageCache & cache);
+	virtual ptrdiff_t memory   () const;
+	virtual bool      compare  (const ImageCacheEntry & that) const;
+	virtual float     distance (const ImageCacheEntry & that) const;
+	virtual void      print    (std::ostream & stream) const;
+
+	float scale;
+	ImageOf<float> angle;
+  };
+
+  /**
+	 Integral image of a GrayFloat pyramid level.  See IntegralImage.
+	 Since the integral image is one pixel wider than its source, the
+	 width of the source is kept separately for matching.
+  **/
+  class SHARED EntryIntegral : public ImageCacheEntry
+  {
+  public:
+	EntryIntegral (float scale = 0.5f, int width = 0, const PixelFormat & format = GrayDouble);
+
+	virtual void  generate (ImageCache & cache);
+	virtual bool  compare  (const ImageCacheEntry & that) const;
+	virtual float distance (const ImageCacheEntry & that) const;
+	virtual void  print    (std::ostream & stream) const;
+
+	float scale;
+	int   width;  ///< Width of the source level.  Zero in a query means any.
+  };
+
   class SHARED EntryDOG : public ImageCacheEntry
   {
   public:
-	EntryDOG (float sigmaPlus, float sigmaMinus, int width = 0);
+	EntryDOG (float sigmaPlus, float sigmaMinus, int width = 0, const PixelFormat & format = GrayFloat);  ///< format selects storage for the result.  GrayHalf halves memory.  The difference itself is always computed in float from GrayFloat pyramid levels.
 
 	virtual void  generate (ImageCache & cache);
 	virtual bool  compare  (const ImageCacheEntry & that) const;
@@ -80,6 +80,7 @@ namespace fl
 	FilterHarris filter;
 	int maxPoints;  ///< Max number of interest points allowable
 	float thresholdFactor;  ///< Percent of max interest response level at which to cut off interest points.
+	bool box;  ///< Use FilterHarrisBox, with the same sigmaD and sigmaI as filter, on a cached integral image.  Default is false.  Not serialized.
   };
 
   class SHARED InterestHarrisLaplacian : public InterestOperator
@@ -128,6 +129,12 @@ namespace fl
   /**
 	 Like InterestLaplacian, but uses a separable kernel.  Better for handling
 	 larger scales.  Should deprecate InterestLaplacian.
+
+	 <p>Each filter runs on the coarsest octave of the image pyramid where
+	 its scale is still at least minimumScale pixels, so the kernels never
+	 grow beyond about twice that size.  The octave levels come from the
+	 ImageCache as ordinary EntryPyramid entries, shared with
+	 InterestHarrisLaplacian and anything else that reads the pyramid.
   **/
   class SHARED InterestHessian : public InterestOperator
   {
@@ -139,20 +146,28 @@ namespace fl
 
 	void serialize (Archive & archive, uint32_t version);
 
-	std::vector<FilterHessian> filters;
-	std::vector<Laplacian> laplacians;
+	std::vector<FilterHessian> filters;  ///< Sized for the octave each one runs on.  Scale with respect to the original image is filters[i].sigma * ratios[i].
+	std::vector<int> ratios;  ///< Downsampling factor of the octave each filter runs on.
+	std::vector<std::vector<Laplacian> > laplacians;  ///< For each filter, the 2 * extraSteps + 1 scale-normalized Laplacians used to select its characteristic scale, sized for the same octave.
 	int maxPoints;
 	float thresholdFactor;
 	float neighborhood;
 	int firstStep;
 	int extraSteps;
 	float stepSize;
+	bool box;  ///< Use FilterHessianBox at the scale of each filter, reading a cached integral image of its octave.  Default is false.  Not serialized.
+	static const float minimumScale;  ///< Smallest filter scale, in pixels of a downsampled octave, at which a filter is moved to that octave.
   };
 
   /**
 	 Implements David Lowe's scale pyramid approach to finding difference of
 	 Gaussian extrema.  The shape of a difference-of-Gaussian kernel is very
 	 similar to a Laplacian of Gaussian.
+
+	 <p>The Gaussian levels of all octaves are built first, in order.  Then
+	 the octaves are differenced and searched on separate threads, with the
+	 results merged at the end, so the output doesn't depend on the number
+	 of threads.
   **/
   class SHARED InterestDOG : public InterestOperator
   {
@@ -164,9 +179,9 @@ namespace fl
 
 	void serialize (Archive & archive, uint32_t version);
 
-	bool isLocalMax (float value, ImageOf<float> & dog, int x, int y);
 	bool notOnEdge (ImageOf<float> & dog, int x, int y);
 	float fitQuadratic (ImageOf<float> & dog0, ImageOf<float> & dog1, ImageOf<float> & dog2, int x, int y, Vector<float> & result);
+	void searchOctave (ImageCache & cache, int ratio, std::vector<PointInterest> & result);  ///< Subroutine of run().  Finds the extrema in one octave, which is downsampled by ratio.  Thread-safe.
 
 	float firstScale;
 	float lastScale;
@@ -175,6 +190,8 @@ namespace fl
 	float thresholdEdge;  ///< Gives smallest permissible ratio of det(H) / trace(H)^2, where H is the Hessian of the DoG function on intensity.
 	float thresholdPeak;  ///< Minimum permissible strength of DoG function at a local maximum.
 	bool fast;  ///< Indicates to use fast mode:  23% faster,  23% more points.  Under strictest conditions (matching scale), repeatability goes down.  However, larger numer of points detected compensates for this as scale criterion is relaxed.
+	bool halfPrecision;  ///< Store the DoG images in the cache as GrayHalf, which halves their memory.  Default is false.  Not serialized, since it only affects resource use.
+	float threadRequest;  ///< Octaves are searched concurrently.  Same meaning as in ParallelFor.  Default is 0 (all hardware threads).  Not serialized.
   };
 
   class SHARED InterestMSER : public InterestOperator
@@ -206,21 +223,29 @@ namespace fl
 	struct Node;
 
 	/**
-	   Structure to track meta-data associated with a region (tree) in the
-	   union-find algorithm.
+	   The part of a region's state that decides stability.  Independent of
+	   how the regions are grown.
 	**/
-	struct Root
+	struct History
 	{
-	  Root * next;
-	  Root * previous;
-
 	  unsigned char level;  ///< The gray-level where this region was created.
 	  unsigned char lower;  ///< Lower bound of scan for local minimum
 	  unsigned char center;  ///< Curent gray-level that is a candidate local minimum
 
-	  int size;  ///< Number of pixels in this tree
 	  int sizes[256];  ///< History of sizes for all gray-levels
 	  float rates[256];  ///< History of change rates w.r.t. gray-level.  Calculated from sizes[].
+	};
+
+	/**
+	   Structure to track meta-data associated with a region (tree) in the
+	   union-find algorithm.
+	**/
+	struct Root : public History
+	{
+	  Root * next;
+	  Root * previous;
+
+	  int size;  ///< Number of pixels in this tree
 
 	  // Info for generating Gaussians
 	  Node * head;  ///< Start of LIFO linked list of pixels.  IE: points to most recently added pixels.
@@ -261,6 +286,78 @@ namespace fl
 	Node * findSet (Node * n);
 	void join (Node * i, Node * n);
 	void addGrayLevel (unsigned char level, bool sign, std::vector<PointMSER *> & regions);
+	bool nextStable (History * r, int c, bool sign) const;
+  };
+
+  /**
+	 Finds the same regions as InterestMSER using the linear-time algorithm of
+	 Nister and Stewenius ("Linear Time Maximally Stable Extremal Regions",
+	 ECCV 2008).  Instead of sorting the pixels and growing every region at
+	 once with union-find, it floods the image from a single pixel, always
+	 moving next to the darkest pixel on the boundary of the flooded area.
+	 The pending boundary pixels are kept in one stack per gray-level, with
+	 a bitmask to find the lowest non-empty one.  Only a stack of nested
+	 components is alive at any time (at most one per gray-level), and each
+	 keeps a history of its moments instead of its pixels.
+	 Dark regions are found by flooding the inverted image.
+
+	 <p>All working memory belongs to the object and is only reallocated when
+	 the image grows, so processing a sequence of frames allocates nothing.
+	 Both polarities have their own workspace, and can be flooded
+	 concurrently.
+
+	 <p>The result can differ slightly from InterestMSER where two regions
+	 of nearly equal size merge, because the two algorithms visit the pixels
+	 of a gray-level in different orders, and so may disagree about which
+	 region survives.
+  **/
+  class SHARED InterestMSERLinear : public InterestMSER
+  {
+  public:
+	InterestMSERLinear (int delta = 5, float sizeRatio = 0.9f);
+
+	virtual void run (ImageCache & cache, PointSet & result);
+	using InterestOperator::run;
+
+	float threadRequest;  ///< If not 1, bright and dark regions are found concurrently.  Same meaning as in ParallelFor.  Default is 0.  Not serialized.
+
+	/**
+	   A component on the flooding stack.
+	**/
+	struct Component : public History
+	{
+	  int current;  ///< Gray-level the component has been flooded up to.  Its history is complete below this level.
+	  int seed;  ///< Index of the first pixel, which is at the lowest gray-level of the component.
+	  int size;
+	  double moments[5];  ///< Sums of x, y, xx, xy and yy over all pixels.
+	  double momentHistory[256][5];
+	};
+
+	/**
+	   Working memory for one polarity.
+	**/
+	struct Flood
+	{
+	  int width;  ///< of padded image
+	  int height;  ///< of padded image
+	  std::vector<unsigned char> levels;  ///< Copy of image with a one pixel border.  Inverted for dark regions.
+	  std::vector<uint64_t> accessible;  ///< One bit per pixel of the padded image.  Border is always set.
+	  std::vector<uint32_t> boundary;  ///< Storage for the stacks of boundary pixels, partitioned by gray-level.  Each entry is a pixel index shifted left 3 bits, plus the next edge to explore.
+	  uint32_t * bottoms[256];  ///< Start of the stack for each gray-level.
+	  uint32_t * tops[256];  ///< One past the last entry in the stack for each gray-level.
+	  uint64_t nonempty[4];  ///< Bitmask of gray-levels with pending boundary pixels.
+	  std::vector<Component> components;  ///< Pool of 257 components, enough for the deepest possible stack.
+	  std::vector<Component *> idle;
+	  std::vector<Component *> stack;
+	  std::vector<PointMSER *> regions;  ///< Output of the most recent flood.
+	};
+	Flood floods[2];  ///< Workspace for bright (0) and dark (1) regions.
+
+	void flood (const Image & image, bool sign);  ///< Subroutine of run().  Finds all regions of one polarity and puts them in floods[!sign].regions.
+	void queue (Flood & f, int level, uint32_t entry);  ///< Put a pixel on the boundary stack for the given gray-level.
+	void push (Flood & f, int level, int seed);  ///< Start a new component on the stack.
+	void advance (Flood & f, Component * c, int level, bool sign);  ///< Complete the history of c up to (but not including) level, checking each finished level for stable regions.
+	void processStack (Flood & f, int level, bool sign);  ///< Raise the top component to level, merging it with any components below it on the stack.
   };
 }
 
@@ -220,17 +220,20 @@ namespace fl
   class SHARED NearestDescriptors : public MatchFinder
   {
   public:
-	NearestDescriptors (PointSet & reference);
+	NearestDescriptors (PointSet & reference, Neighbor * neighbor = 0);  ///< @param neighbor The search structure to use.  We take ownership.  Must be configured to return at least 2 results.  Default is an exact KDTreeFlat.  Pass a KDForest to trade some accuracy for speed.
+	NearestDescriptors (const NearestDescriptors &) = delete;  ///< We own neighbor and the entries in data, so a copy would free them twice.
+	NearestDescriptors & operator = (const NearestDescriptors &) = delete;
 	~NearestDescriptors ();
 	void clear ();
 
 	virtual void set (PointSet & reference);
 	virtual void run (PointSet & query, MatchSet & result) const;
 
-	KDTree tree;
+	Neighbor * neighbor;
 	std::vector<MatrixAbstract<float> *> data;
 	double threshold;  ///< descriptors have to be closer than this to pass.  default = 1.0
 	double ratio;  ///< of nearest descriptor over next nearest must be less than this.  default = 0.8
+	float threads;  ///< Number of threads for searching the query set, with the same meaning as for ParallelFor.  default = 0 (all hardware threads)
   };
 }
 
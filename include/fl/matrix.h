@@ -88,6 +88,28 @@ namespace fl
   #define MatrixBlockID     0x200
 
 
+  // Matrix multiplication kernel ---------------------------------------------
+
+  /**
+	 Computes C = A * B using a packed, cache-blocked and register-blocked
+	 kernel, multithreaded when the problem is large enough.  A is m x k and
+	 B is k x n, each given by a pointer to its first element along with its
+	 row and column strides (in elements).  C is column-major with leading
+	 dimension ldc, and is overwritten.
+	 Only float and double have a native kernel.  For other numeric types,
+	 this returns false and leaves C untouched, so the caller can fall back
+	 to a simple loop.
+	 @param threadRequest Same meaning as in ParallelFor.
+  **/
+  template<class T>
+  inline bool multiplyBlocked (int m, int n, int k, const T * a, int aR, int aC, const T * b, int bR, int bC, T * c, int ldc, float threadRequest = 0)
+  {
+	return false;
+  }
+  SHARED bool multiplyBlocked (int m, int n, int k, const float  * a, int aR, int aC, const float  * b, int bR, int bC, float  * c, int ldc, float threadRequest = 0);
+  SHARED bool multiplyBlocked (int m, int n, int k, const double * a, int aR, int aC, const double * b, int bR, int bC, double * c, int ldc, float threadRequest = 0);
+
+
   // Matrix general interface -------------------------------------------------
 
   /**
@@ -438,6 +460,8 @@ namespace fl
 	virtual double norm (double n) const;
 	virtual T sumSquares () const;
 	virtual MatrixResult<T> transposeSquare () const;
+	virtual MatrixResult<T> transposeTimes (const MatrixAbstract<T> & B) const;
+	using MatrixAbstract<T>::transposeTimes;
 	virtual MatrixResult<T> visit (T (*function) (const T &)) const;
 	virtual MatrixResult<T> visit (T (*function) (const T)) const;
 	virtual T dot (const MatrixAbstract<T> & B) const;
@@ -485,6 +509,13 @@ namespace fl
 
 	void serialize (Archive & archive, uint32_t version);
 
+	static void multiply (int m, int n, int k, const T * a, int aR, int aC, const T * b, int bR, int bC, T * c);  ///< C = A * B, with each operand described by strides as in multiplyBlocked().  C is column-major with leading dimension m.  Chooses between BLAS, multiplyBlocked() and a simple loop according to the global parameters below.
+
+	// Global data
+	static double crossoverBLAS;     ///< Minimum size of a product (m * n * k multiply-adds) that is passed to BLAS, when available and the strides permit.  BLAS is tested first.  It beat multiplyBlocked() at every size we measured, so this is deliberately below crossoverBlocked.
+	static double crossoverBlocked;  ///< Minimum size of a product that is passed to multiplyBlocked().  Below this, a simple loop has less overhead.  multiplyBlocked() is the fallback when there is no BLAS, or when neither stride of an operand is 1 so BLAS can't take it.
+	static float  threadsBlocked;    ///< Thread request passed to multiplyBlocked().  Same meaning as in ParallelFor.
+
 	// Data
 	Pointer data;
 	int offset;
@@ -520,6 +551,7 @@ namespace fl
 	  return ((T *) this->data)[row];
 	}
 	virtual void resize (const int rows, const int columns = 1);  ///< Always sets strideC = rows.
+	void resize (const int rows, const int columns, const int alignment);  ///< Sets strideC so that each column starts on a multiple of alignment bytes, as given by Pointer::padStride().  alignment must be a multiple of sizeof(T).  Afterward, operator[] only reaches the first column.
 
 	virtual Matrix reshape (const int rows, const int columns = 1, bool inPlace = false) const;
 
@@ -16,6 +16,7 @@ for details.
 #include "fl/matrix.h"
 
 #include <vector>
+#include <random>
 
 #undef SHARED
 #ifdef _MSC_VER
@@ -51,7 +52,8 @@ namespace fl
 	   iterate over the others with a pointer.
 	**/
 	virtual void set  (const std::vector<MatrixAbstract<float> *> & data) = 0;
-	virtual void find (const MatrixAbstract<float> & query, std::vector<MatrixAbstract<float> *> & result) const = 0;
+	virtual void find (const MatrixAbstract<float> & query, std::vector<MatrixAbstract<float> *> & result) const = 0;  ///< Must be safe to call from several threads at once.
+	void findBatch    (const std::vector<MatrixAbstract<float> *> & queries, std::vector<std::vector<MatrixAbstract<float> *> > & results, float threadRequest = 0) const;  ///< Equivalent to calling find() on each query, but spreads the work across threads.  threadRequest has the same meaning as for ParallelFor.
 
 	/**
 	   Helper class for storing an arbitrary object along with an arbitrary matrix.
@@ -157,6 +159,105 @@ namespace fl
 	float epsilon;  ///< Nodes must have at least this much overlap with the current radius (which is always the lesser of the initial radius and the kth nearest neighbor).
 	int maxNodes;  ///< Expand no more than this number of nodes. Forces a search to be approximate rather than exhaustive.
   };
+
+  /**
+	 Same search algorithm and parameters as KDTree, but laid out for speed
+	 on large sets of high-dimensional points.  set() copies all points into
+	 one contiguous row-major array, in leaf order, with each row padded to
+	 a multiple of 8 floats.  Nodes live in a flat array and refer to each
+	 other by index.  Leaves compute distances with vector instructions, and
+	 the search queue is a binary heap.
+   **/
+  class SHARED KDTreeFlat : public Neighbor
+  {
+  public:
+	KDTreeFlat ();
+	virtual ~KDTreeFlat ();
+	void clear ();
+
+	virtual void set  (const std::vector<MatrixAbstract<float> *> & data);
+	virtual void find (const MatrixAbstract<float> & query, std::vector<MatrixAbstract<float> *> & result) const;
+	void search       (const float * query, std::vector<int> & indices, std::vector<float> & distances) const;  ///< Core of find().  query must have stride elements, with zeros past dimensions.  Returns positions in items, nearest first, along with squared distances.
+
+	struct Node
+	{
+	  int   dimension;  ///< Split dimension for a branch, or -1 for a leaf.
+	  float lo;  ///< Lowest value along the dimension
+	  float hi;  ///< Highest value along the dimension
+	  float mid;  ///< The cut point along the dimension
+	  int   low;  ///< Branch: index of node below mid.  Leaf: index of first point.
+	  int   high;  ///< Branch: index of node above mid.  Leaf: one past index of last point.
+	};
+
+	static float distance (const float * a, const float * b, int stride, float limit = INFINITY);  ///< Squared Euclidean distance between two padded rows, using vector instructions where available.  May stop early and return a partial sum once it reaches limit.
+	int construct (std::vector<int> & order, int begin, int end, const float * raw);  ///< Recursively construct nodes for the points order[begin,end), whose values are in raw.  Returns index of the new node, or -1 if range is empty.
+
+	int dimensions;
+	int stride;  ///< Number of floats in each row of points.
+	std::vector<float> points;  ///< Copy of all the data, one row per point, in leaf order.
+	std::vector<MatrixAbstract<float> *> items;  ///< Original object for each row of points.
+	std::vector<Node> nodes;  ///< nodes[0] is the root.
+	Vector<float> lo;
+	Vector<float> hi;
+
+	int bucketSize;
+	int k;
+	float radius;  ///< Maximum distance between query point and any result point. Initially set to INFINITY by constructor.
+	float epsilon;  ///< Nodes must have at least this much overlap with the current radius (which is always the lesser of the initial radius and the kth nearest neighbor).
+	int maxNodes;  ///< Expand no more than this number of nodes. Forces a search to be approximate rather than exhaustive.
+  };
+
+  /**
+	 Approximate search with several randomized KD trees, in the manner of
+	 "Optimised KD-trees for fast image descriptor matching" by Silpa-Anan and
+	 Hartley.  Each tree splits on a dimension chosen at random among those
+	 with the highest variance, at the mean value.  A query descends all
+	 trees through a single priority queue, and stops after examining
+	 checks points.  Raising checks trades speed for recall.  Once checks
+	 reaches the number of points, the result is exact.
+   **/
+  class SHARED KDForest : public Neighbor
+  {
+  public:
+	KDForest (int trees = 4, int checks = 128);
+	virtual ~KDForest ();
+	void clear ();
+
+	virtual void set  (const std::vector<MatrixAbstract<float> *> & data);
+	virtual void find (const MatrixAbstract<float> & query, std::vector<MatrixAbstract<float> *> & result) const;
+	void search       (const float * query, std::vector<int> & indices, std::vector<float> & distances) const;  ///< Core of find().  query must have stride elements, with zeros past dimensions.  Returns positions in items, nearest first, along with squared distances.
+
+	struct Node
+	{
+	  int   dimension;  ///< Split dimension for a branch, or -1 for a leaf.
+	  float lo;  ///< Lowest value along the dimension
+	  float hi;  ///< Highest value along the dimension
+	  float mid;  ///< The cut point along the dimension
+	  int   low;  ///< Branch: index of node below mid.  Leaf: index of first entry in order.
+	  int   high;  ///< Branch: index of node above mid.  Leaf: one past index of last entry in order.
+	};
+
+	int construct (int tree, int begin, int end);  ///< Recursively construct nodes of the given tree for the points order[tree][begin,end).  Returns index of the new node.
+
+	int dimensions;
+	int stride;  ///< Number of floats in each row of points.
+	std::vector<float> points;  ///< Copy of all the data, one row per point, in original order.
+	std::vector<MatrixAbstract<float> *> items;  ///< Original object for each row of points.
+	std::vector<std::vector<Node> > nodes;  ///< One array of nodes per tree.  Element 0 is the root.
+	std::vector<std::vector<int> > order;  ///< For each tree, rows of points in leaf order.
+	Vector<float> lo;
+	Vector<float> hi;
+
+	int   trees;  ///< Number of trees to build.
+	int   checks;  ///< Maximum number of points to compare against each query.
+	int   k;
+	int   bucketSize;
+	float radius;  ///< Maximum distance between query point and any result point. Initially set to INFINITY by constructor.
+	int   candidates;  ///< Number of highest-variance dimensions to choose the split from.
+	int   sample;  ///< Number of points used to estimate variance at each node.
+	unsigned int seed;  ///< Drives the random choices in set(), so the structure is reproducible.
+	std::mt19937 random;  ///< Private generator for set(), so building a forest neither disturbs nor depends on the process-wide rand().
+  };
 }
 
 
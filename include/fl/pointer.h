@@ -29,22 +29,105 @@ for details.
 #include <ostream>
 #include <atomic>
 
+#undef SHARED
+#ifdef _MSC_VER
+#  ifdef flBase_EXPORTS
+#    define SHARED __declspec(dllexport)
+#  else
+#    define SHARED __declspec(dllimport)
+#  endif
+#else
+#  define SHARED
+#endif
+
 
 namespace fl
 {
+  /**
+	 Recycles large blocks released by Pointer, so that chains of filters
+	 which create and discard same-sized temporaries don't go back to the
+	 system (and take fresh page faults) at every step.  Sizes are rounded
+	 up to classes four per power of two, so similar requests share blocks.
+	 Each thread keeps a private cache, which overflows into a global pool
+	 guarded by a mutex.  Blocks are only reused for requests with the same
+	 size class, alignment and huge-page setting.  Blocks beyond the caps go
+	 back to the system.
+  **/
+  class SHARED PointerPool
+  {
+  public:
+	static bool      enabled;         ///< Set false to send every block straight back to the system.  Doesn't flush blocks already pooled; call clear() for that.
+	static ptrdiff_t minimum;         ///< Blocks smaller than this many bytes bypass the pool, since malloc() handles them well.  Default is 64KB.
+	static ptrdiff_t capacity;        ///< Most bytes held by the pool as a whole, counting the global pool and every thread's cache, so retained memory doesn't grow with the number of threads.  Default is 256MB.
+	static ptrdiff_t threadCapacity;  ///< Most bytes held by each thread's cache, within the overall capacity.  Default is 32MB.
+
+	struct Stats
+	{
+	  uint64_t  hits;     ///< Allocations satisfied from the pool.
+	  uint64_t  misses;   ///< Allocations of pooled size that went to the system.
+	  uint64_t  returns;  ///< Blocks accepted by the pool.
+	  uint64_t  dropped;  ///< Blocks of pooled size freed to the system because the pool was full or disabled.
+	  ptrdiff_t bytes;    ///< Total currently held by the global pool and all thread caches.
+	  double reuse () const {return hits + misses ? (double) hits / (hits + misses) : 0;}  ///< Fraction of pooled-size allocations that were recycled.
+	};
+	static Stats stats ();
+	static void  resetStats ();  ///< Zeroes all counters except bytes.
+	static void  clear ();  ///< Frees every block in the global pool and in the calling thread's cache.
+
+	static ptrdiff_t round (ptrdiff_t bytes);  ///< @return The size class that holds the given number of bytes.
+	static char *    take  (ptrdiff_t capacity, uint32_t offset, bool huge);  ///< @return A block with exactly the given capacity, previously used with the same offset and huge-page setting, or null if none is pooled.
+	static bool      give  (char * block, ptrdiff_t capacity, uint32_t offset, bool huge);  ///< @return true if the pool accepted the block.  Otherwise the caller must free it.  Only accepts capacities that are a size class, as given by round().
+  };
+
   /**
 	 Keeps track of a block of memory, which can be shared by multiple objects
 	 and multiple threads.  The block can either be managed by Pointer, or
 	 it can belong to any other part of the system.  Only managed blocks get
 	 reference counting, automatic deletion, and reallocation.
 
+	 <p>Managed blocks start on a multiple of Pointer::alignment bytes.
+	 Code that wants vector loads from the beginning of the block to be
+	 aligned, or doesn't want the block to share a cache line with other
+	 data, can pass a larger alignment to grow().  The refcount lives in a
+	 small header just before the block.
+
 	 <p>This code assumes that <code>sizeof(int32_t) <= sizeof(ptrdiff_t)</code>.
   **/
-  class Pointer
+  class SHARED Pointer
   {
   public:
 	typedef std::atomic_uint RefCount;
 
+	/**
+	   Prepended to each managed block.  count must come last, so that it
+	   sits immediately before the block.
+	**/
+	struct Header
+	{
+	  ptrdiff_t capacity;    ///< Size in bytes of the underlying allocation, including this header and any padding before it.
+	  uint32_t  offset : 31;  ///< Distance in bytes from start of underlying allocation to start of block.
+	  uint32_t  huge   : 1;   ///< The underlying allocation starts on a huge-page boundary and was advised to use huge pages.
+	  RefCount  count;
+	};
+
+	static int       alignment;  ///< Managed blocks start on a multiple of this many bytes, unless the caller asks for a specific alignment.  Must be a power of two.  Default is 16, which keeps the header the same size as the granule of a typical malloc().  Changes only affect subsequent allocations.
+	static ptrdiff_t hugePages;  ///< Managed blocks at least this many bytes are advised to use transparent huge pages, where the system supports it.  Zero (the default) disables.
+
+	/**
+	   Rounds bytes up to a multiple of alignment, for use as the stride
+	   between rows of an image or columns of a matrix.  If the result is a
+	   multiple of 4096, adds one more unit of alignment, so that successive
+	   rows don't all land in the same cache sets.  alignment <= 0 returns
+	   bytes unchanged.
+	**/
+	static ptrdiff_t padStride (ptrdiff_t bytes, int alignment)
+	{
+	  if (alignment <= 0) return bytes;
+	  ptrdiff_t result = (bytes + alignment - 1) / alignment * alignment;
+	  if (result % 4096 == 0) result += alignment;
+	  return result;
+	}
+
 	Pointer ()
 	{
 	  memory = 0;
@@ -134,18 +217,26 @@ namespace fl
 	  }
 	}
 
-	void grow (ptrdiff_t size)
+	/**
+	   Ensures the block holds at least size bytes, replacing it if not.
+	   \param alignment If positive, the block must also start on a multiple
+	   of this many bytes, which must be a power of two.  A block that is big
+	   enough but not aligned is replaced as well.  Zero means the block is
+	   only replaced for size, and a new one gets Pointer::alignment.
+	**/
+	void grow (ptrdiff_t size, int alignment = 0)
 	{
+	  bool aligned = alignment <= 0  ||  (uintptr_t) memory % alignment == 0;
 	  if (metaData < 0)
 	  {
-		if (-metaData >= size) return;
+		if (-metaData >= size  &&  aligned) return;
 		detach ();
 	  }
-	  else if (metaData >= size)
+	  else if (metaData >= size  &&  aligned)
 	  {
 		return;
 	  }
-	  if (size > 0) allocate (size);
+	  if (size > 0) allocate (size, alignment);
 	}
 
 	void clear ()  // Erase block of memory
@@ -191,13 +282,7 @@ namespace fl
 	{
 	  if (metaData < 0)
 	  {
-		if (--memory[-1] == 0)
-		{
-		  // Technically, we should not use delete (memory - 1), because it was
-		  // allocated with malloc(), not new.
-		  (memory - 1)->~RefCount ();  // placement dtor, in case atomic_uint needs destruction
-		  free (memory - 1);
-		}
+		if (--memory[-1] == 0) release (memory);
 	  }
 	  memory = 0;
 	  metaData = 0;
@@ -217,22 +302,8 @@ namespace fl
 	  if (metaData < 0) memory[-1]++;
 	}
 
-	void allocate (ptrdiff_t size)
-	{
-	  memory = (RefCount *) malloc (sizeof (RefCount) + size);
-	  if (memory)
-	  {
-		memory = & memory[1];
-		new (memory - 1) RefCount ();  // in case atomic_uint needs construction
-		memory[-1] = 1;
-		metaData = -size;
-	  }
-	  else
-	  {
-		metaData = 0;
-		throw "Unable to allocate memory";
-	  }
-	}
+	void allocate (ptrdiff_t size, int alignment = 0);  ///< Sets memory to a new managed block with refcount 1.  Throws if the system can't supply the block.  alignment <= 0 means Pointer::alignment.
+	static void release (RefCount * memory);  ///< Frees a managed block, given the same pointer that allocate() stored in memory.
 
 	RefCount * memory;  ///< Pointer to block in heap. Must be offset and typecast to access managed data.
 
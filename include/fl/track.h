@@ -62,13 +62,14 @@ namespace fl
 
 	virtual void nextImage (const Image & image);
 	virtual void track (Point & point);
-	float track (const Point & point0, const int level, Point & point1);  ///< Subroutine of track().
+	std::vector<int> track (PointSet & points);  ///< Tracks each point in place, spreading the work across threads.  @return For each point, the code that track(Point&) would have thrown, or 0 on success.
+	float track (const Point & point0, const int level, Point & point1) const;  ///< Subroutine of track().  Thread-safe.
 
 	std::vector<ImageOf<float> > pyramid0;  ///< "previous" image.  First entry is full sized image, and each subsequent entry is downsampled by pyramidRatio.
 	std::vector<ImageOf<float> > pyramid1;  ///< "current" image.  Same structure as pyramid0
 	// Blurring brings some information from each pixel in one image to the
 	// position of the corresponding pixel in the other image.
-	std::vector<Gaussian1D *> blursPre;  ///< Blurring kernel applied to image from previous level to bring it up to sufficient blur to enable accurate downsampling.
+	std::vector<BlurDecimate *> decimators;  ///< Blurs the image from previous level just enough to enable accurate downsampling, and downsamples it.  Zero if the previous level is already blurred enough, in which case it is simply decimated.
 	std::vector<Gaussian1D *> blursPost;  ///< Blurring kernel applied after downsampling to produce desired scale at current level.
 	int pyramidRatio;  ///< Ratio between number of pixels in adjacent levels of pyramid.
 	int windowRadius;  ///< Number of pixels from center to edge of search window.
@@ -76,6 +77,7 @@ namespace fl
 	float minDisplacement;  ///< Convergence threshold on change in location.
 	int maxIterations;  ///< To quit iterating even without convergence.
 	float maxError;  ///< Largest allowable root mean squared error of pixel intensity within the window.  Note that intensity is in the range [0,1].
+	float threadRequest;  ///< Number of threads used by track(PointSet&).  Same meaning as in ParallelFor.  Default is 0 (all hardware threads).
   };
 }
 
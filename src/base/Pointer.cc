@@ -0,0 +1,347 @@
+/*
+Author: Fred Rothganger
+
+Copyright 2010 Sandia Corporation.
+Under the terms of Contract DE-AC04-94AL85000 with Sandia Corporation,
+the U.S. Government retains certain rights in this software.
+Distributed under the GNU Lesser General Public License.  See the file LICENSE
+for details.
+*/
+
+
+#include "fl/pointer.h"
+
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <new>
+#include <vector>
+
+#ifdef __linux__
+#  include <sys/mman.h>
+#endif
+
+
+using namespace fl;
+using namespace std;
+
+
+// System allocation ----------------------------------------------------------
+
+static const ptrdiff_t hugePageSize = 2 * 1024 * 1024;
+
+static char *
+systemAllocate (size_t size, size_t alignment)
+{
+# ifdef _MSC_VER
+  return (char *) _aligned_malloc (size, alignment);
+# else
+  void * result;
+  if (posix_memalign (&result, max (alignment, sizeof (void *)), size)) return 0;
+  return (char *) result;
+# endif
+}
+
+static void
+systemFree (char * block)
+{
+# ifdef _MSC_VER
+  _aligned_free (block);
+# else
+  free (block);
+# endif
+}
+
+
+// class PointerPool ----------------------------------------------------------
+
+bool      PointerPool::enabled        = true;
+ptrdiff_t PointerPool::minimum        = 64 * 1024;
+ptrdiff_t PointerPool::capacity       = 256 * 1024 * 1024;
+ptrdiff_t PointerPool::threadCapacity = 32 * 1024 * 1024;
+
+static atomic<uint64_t>  poolHits    (0);
+static atomic<uint64_t>  poolMisses  (0);
+static atomic<uint64_t>  poolReturns (0);
+static atomic<uint64_t>  poolDropped (0);
+static atomic<ptrdiff_t> poolBytes   (0);
+
+namespace
+{
+/**
+   Free blocks sorted by capacity, offset and huge-page setting.  Used both
+   for the global pool and for each thread's cache.
+**/
+class PoolShelf
+{
+public:
+  struct Key
+  {
+	Key (ptrdiff_t capacity, uint32_t offset, bool huge)
+	: capacity (capacity), offset (offset), huge (huge)
+	{
+	}
+
+	bool operator < (const Key & that) const
+	{
+	  if (capacity != that.capacity) return capacity < that.capacity;
+	  if (offset   != that.offset)   return offset   < that.offset;
+	  return huge < that.huge;
+	}
+
+	ptrdiff_t capacity;
+	uint32_t  offset;
+	bool      huge;
+  };
+
+  PoolShelf ()
+  {
+	bytes = 0;
+  }
+
+  char * take (const Key & key)
+  {
+	auto it = blocks.find (key);
+	if (it == blocks.end ()  ||  it->second.empty ()) return 0;
+	char * result = it->second.back ();
+	it->second.pop_back ();
+	bytes -= key.capacity;
+	return result;
+  }
+
+  bool give (char * block, const Key & key, ptrdiff_t limit)
+  {
+	if (bytes + key.capacity > limit) return false;
+	blocks[key].push_back (block);
+	bytes += key.capacity;
+	return true;
+  }
+
+  /// Moves every block into that, or frees it if that is null or full.
+  void flush (PoolShelf * that, ptrdiff_t limit)
+  {
+	for (auto & it : blocks)
+	{
+	  for (char * block : it.second)
+	  {
+		if (! that  ||  ! that->give (block, it.first, limit))
+		{
+		  systemFree (block);
+		  poolBytes -= it.first.capacity;
+		}
+	  }
+	}
+	blocks.clear ();
+	bytes = 0;
+  }
+
+  map<Key, vector<char *>> blocks;
+  ptrdiff_t bytes;
+};
+}
+
+/**
+   The global pool is allocated once and never destroyed, so that Pointers
+   released during static destruction can still reach it.
+**/
+static PoolShelf & globalShelf ()
+{
+  static PoolShelf * shelf = new PoolShelf;
+  return *shelf;
+}
+
+static mutex & globalMutex ()
+{
+  static mutex * m = new mutex;
+  return *m;
+}
+
+namespace
+{
+/**
+   Returns its blocks to the global pool when the thread exits.  After
+   that, threadShelf is null and the thread goes directly to the global
+   pool.
+**/
+class ThreadShelf : public PoolShelf
+{
+public:
+  ThreadShelf ();
+  ~ThreadShelf ();
+};
+}
+
+static thread_local ThreadShelf * threadShelf = 0;
+static thread_local bool          threadDone  = false;
+
+ThreadShelf::ThreadShelf ()
+{
+  threadShelf = this;
+}
+
+ThreadShelf::~ThreadShelf ()
+{
+  threadShelf = 0;
+  threadDone  = true;
+  lock_guard<mutex> lock (globalMutex ());
+  flush (&globalShelf (), PointerPool::capacity);
+}
+
+static PoolShelf *
+getThreadShelf ()
+{
+  if (threadShelf  ||  threadDone) return threadShelf;
+  static thread_local ThreadShelf shelf;
+  return threadShelf;
+}
+
+ptrdiff_t
+PointerPool::round (ptrdiff_t bytes)
+{
+  // Four classes per power of two, so at most 25% waste.
+  ptrdiff_t step = 1;
+  while (step * 8 <= bytes) step *= 2;
+  return (bytes + step - 1) / step * step;
+}
+
+char *
+PointerPool::take (ptrdiff_t capacity, uint32_t offset, bool huge)
+{
+  PoolShelf::Key key (capacity, offset, huge);
+  char * result = 0;
+  if (PoolShelf * shelf = getThreadShelf ()) result = shelf->take (key);
+  if (! result)
+  {
+	lock_guard<mutex> lock (globalMutex ());
+	result = globalShelf ().take (key);
+  }
+  if (result)
+  {
+	poolHits++;
+	poolBytes -= capacity;
+  }
+  else
+  {
+	poolMisses++;
+  }
+  return result;
+}
+
+/**
+   poolBytes counts every shelf, so reserving from it first enforces
+   capacity across all threads together.  The reservation is undone if no
+   shelf takes the block.
+**/
+bool
+PointerPool::give (char * block, ptrdiff_t capacity, uint32_t offset, bool huge)
+{
+  bool accepted = false;
+  if (enabled  &&  round (capacity) == capacity)  // A block allocated while the pool was disabled has a capacity that take() never asks for.
+  {
+	if (poolBytes.fetch_add (capacity) + capacity <= PointerPool::capacity)
+	{
+	  PoolShelf::Key key (capacity, offset, huge);
+	  PoolShelf * shelf = getThreadShelf ();
+	  accepted = shelf  &&  shelf->give (block, key, threadCapacity);
+	  if (! accepted)
+	  {
+		lock_guard<mutex> lock (globalMutex ());
+		accepted = globalShelf ().give (block, key, PointerPool::capacity);
+	  }
+	}
+	if (! accepted) poolBytes -= capacity;
+  }
+  if (accepted) poolReturns++;
+  else          poolDropped++;
+  return accepted;
+}
+
+PointerPool::Stats
+PointerPool::stats ()
+{
+  Stats result;
+  result.hits    = poolHits;
+  result.misses  = poolMisses;
+  result.returns = poolReturns;
+  result.dropped = poolDropped;
+  result.bytes   = poolBytes;
+  return result;
+}
+
+void
+PointerPool::resetStats ()
+{
+  poolHits    = 0;
+  poolMisses  = 0;
+  poolReturns = 0;
+  poolDropped = 0;
+}
+
+void
+PointerPool::clear ()
+{
+  if (PoolShelf * shelf = getThreadShelf ()) shelf->flush (0, 0);
+  lock_guard<mutex> lock (globalMutex ());
+  globalShelf ().flush (0, 0);
+}
+
+
+// class Pointer --------------------------------------------------------------
+
+int       Pointer::alignment = 16;
+ptrdiff_t Pointer::hugePages = 0;
+
+static_assert (offsetof (Pointer::Header, count) + sizeof (Pointer::RefCount) == sizeof (Pointer::Header), "Pointer::Header must end with its refcount");
+
+void
+Pointer::allocate (ptrdiff_t size, int alignment)
+{
+  // The header must fit in front of the block, so it also sets a floor on
+  // alignment.
+  if (alignment <= 0) alignment = Pointer::alignment;
+  size_t a = max ((size_t) alignment, sizeof (Header));
+  ptrdiff_t total = a + size;
+  bool huge = hugePages > 0  &&  size >= hugePages;
+
+  char * block = 0;
+  if (PointerPool::enabled  &&  size >= PointerPool::minimum)
+  {
+	total = PointerPool::round (total);
+	block = PointerPool::take (total, a, huge);
+  }
+  if (! block)
+  {
+	block = systemAllocate (total, huge ? hugePageSize : a);
+	if (! block)
+	{
+	  memory = 0;
+	  metaData = 0;
+	  throw "Unable to allocate memory";
+	}
+#   if defined (__linux__)  &&  defined (MADV_HUGEPAGE)
+	if (huge) madvise (block, total & ~(ptrdiff_t) 0xFFF, MADV_HUGEPAGE);  // block is 2MB aligned, so just trim the length to whole pages
+#   endif
+  }
+
+  Header * header = (Header *) (block + a) - 1;
+  new (header) Header;  // in case atomic_uint needs construction
+  header->capacity = total;
+  header->offset   = a;
+  header->huge     = huge;
+  header->count    = 1;
+  memory   = & header->count + 1;
+  metaData = -size;
+}
+
+void
+Pointer::release (RefCount * memory)
+{
+  Header * header = (Header *) memory - 1;
+  ptrdiff_t capacity = header->capacity;
+  uint32_t  offset   = header->offset;
+  bool      huge     = header->huge;
+  char * block = (char *) memory - offset;
+  header->~Header ();  // placement dtor, in case atomic_uint needs destruction
+  if (capacity - offset >= PointerPool::minimum  &&  PointerPool::give (block, capacity, offset, huge)) return;
+  systemFree (block);
+}
@@ -17,6 +17,7 @@ for details.
 #include <fl/factory.h>
 #include <fl/thread.h>
 #include <fl/time.h>
+#include <fl/pointer.h>
 
 #include <iostream>
 #include <fstream>
@@ -485,6 +486,191 @@ testVectorsparse ()
 
 }
 
+void
+testPointer ()
+{
+  // Alignment of managed blocks, including when the setting changes while
+  // blocks are live.
+  int original = Pointer::alignment;
+  vector<Pointer> blocks;
+  int alignments[] = {64, 8, 4096, 64};
+  for (int a = 0; a < 4; a++)
+  {
+	Pointer::alignment = alignments[a];
+	for (int size = 1; size < 100000; size *= 3)
+	{
+	  Pointer p (size);
+	  if ((uintptr_t) (char *) p % alignments[a])
+	  {
+		cerr << "block of size " << size << " not aligned to " << alignments[a] << endl;
+		throw "Pointer fails";
+	  }
+	  if (p.refcount () != 1  ||  p.size () != size) throw "Pointer has wrong metadata";
+	  memset ((char *) p, 0xFF, size);
+	  blocks.push_back (p);
+	  if (p.refcount () != 2) throw "Pointer has wrong refcount";
+	}
+  }
+  blocks.clear ();
+
+  // Huge pages only change advice to the kernel, so just exercise the path.
+  ptrdiff_t originalHuge = Pointer::hugePages;
+  Pointer::hugePages = 1 << 20;
+  {
+	Pointer p (5 << 20);
+	if ((uintptr_t) (char *) p % Pointer::alignment) throw "Huge block not aligned";
+	memset ((char *) p, 0, p.size ());
+  }
+  Pointer::hugePages   = originalHuge;
+  Pointer::alignment   = original;
+
+  // Individual blocks can ask for more than the default alignment.
+  if (Pointer::alignment != 16) throw "Pointer has wrong default alignment";
+  for (int size = 1; size < 100000; size *= 3)
+  {
+	Pointer p;
+	p.grow (size, 64);
+	if ((uintptr_t) (char *) p % 64) throw "Pointer::grow ignored alignment";
+	if (p.size () != size) throw "Pointer::grow has wrong size";
+  }
+  {
+	Pointer p;
+	while (true)  // Find a block that is big enough but only aligned to the default.
+	{
+	  p.detach ();
+	  p.grow (1000);
+	  if ((uintptr_t) (char *) p % 64) break;
+	  blocks.push_back (p);
+	}
+	blocks.clear ();
+	p.grow (100, 64);
+	if ((uintptr_t) (char *) p % 64) throw "Pointer::grow kept a misaligned block";
+  }
+
+  // Padded strides
+  if (Pointer::padStride (100, 0)    != 100 ) throw "padStride changed unpadded value";
+  if (Pointer::padStride (100, 64)   != 128 ) throw "padStride didn't round up";
+  if (Pointer::padStride (4096, 64)  != 4160) throw "padStride didn't break power-of-two stride";
+
+  cout << "Pointer passes" << endl;
+}
+
+void
+testPointerPool ()
+{
+  PointerPool::clear ();
+  PointerPool::resetStats ();
+
+  // Same-sized temporaries should recycle one block.
+  const int size = 1 << 20;
+  void * first;
+  {
+	Pointer p (size);
+	first = p;
+  }
+  for (int i = 0; i < 10; i++)
+  {
+	Pointer p (size + i * 1000);  // same size class
+	if ((void *) p != first) throw "PointerPool did not recycle block";
+	memset ((char *) p, i, p.size ());
+  }
+  PointerPool::Stats s = PointerPool::stats ();
+  if (s.hits != 10  ||  s.misses != 1  ||  s.returns != 11  ||  s.bytes < size) throw "PointerPool has wrong stats";
+
+  // Small blocks bypass the pool.
+  {
+	Pointer p (100);
+  }
+  if (PointerPool::stats ().misses != 1) throw "PointerPool handled small block";
+
+  // Opt out
+  PointerPool::enabled = false;
+  {
+	Pointer p (size);
+	if ((void *) p == first) throw "Disabled PointerPool recycled block";
+  }
+  PointerPool::enabled = true;
+  if (PointerPool::stats ().dropped != 1) throw "Disabled PointerPool kept block";
+
+  // A block allocated while disabled doesn't have a size-class capacity, so
+  // take() could never find it.
+  PointerPool::enabled = false;
+  {
+	Pointer p (size);
+	PointerPool::enabled = true;
+  }
+  if (PointerPool::stats ().dropped != 2) throw "PointerPool kept block of unrounded capacity";
+
+  // Caps
+  ptrdiff_t oldThread = PointerPool::threadCapacity;
+  ptrdiff_t oldGlobal = PointerPool::capacity;
+  PointerPool::clear ();
+  PointerPool::resetStats ();
+  PointerPool::threadCapacity = 3 * size;
+  PointerPool::capacity       = 3 * size;
+  {
+	vector<Pointer> blocks;
+	for (int i = 0; i < 10; i++) blocks.push_back (Pointer (size));
+  }
+  s = PointerPool::stats ();
+  if (s.bytes > 3 * size  ||  s.dropped < 7) throw "PointerPool exceeded its caps";
+
+  // The cap covers the global pool and every thread's cache together.
+  PointerPool::clear ();
+  {
+	vector<Pointer> blocks;
+	for (int i = 0; i < 3; i++) blocks.push_back (Pointer (size));
+  }
+  ptrdiff_t inWorker = 0;
+  thread capped ([size, &inWorker] ()
+  {
+	{
+	  vector<Pointer> blocks;
+	  for (int i = 0; i < 3; i++) blocks.push_back (Pointer (size));
+	}
+	inWorker = PointerPool::stats ().bytes;
+  });
+  capped.join ();
+  if (inWorker > 3 * size) throw "PointerPool cap does not cover all threads";
+
+  // A thread's cache passes to the global pool when the thread exits.
+  PointerPool::clear ();
+  PointerPool::resetStats ();
+  thread worker ([size] ()
+  {
+	Pointer p (size);
+  });
+  worker.join ();
+  if (PointerPool::stats ().bytes < size) throw "PointerPool lost block from thread";
+  {
+	Pointer p (size);
+  }
+  if (PointerPool::stats ().hits != 1) throw "PointerPool did not share block from thread";
+
+  PointerPool::threadCapacity = oldThread;
+  PointerPool::capacity       = oldGlobal;
+
+  // Huge-page requests don't get blocks that were allocated without them.
+  PointerPool::clear ();
+  ptrdiff_t oldHuge = Pointer::hugePages;
+  {
+	Pointer p (5 * size);
+  }
+  uint64_t hits = PointerPool::stats ().hits;
+  Pointer::hugePages = size;
+  {
+	Pointer p (5 * size);
+	Pointer::Header * header = (Pointer::Header *) (char *) p - 1;
+	if (PointerPool::stats ().hits != hits  ||  ((uintptr_t) (char *) p - header->offset) % (2 * size)) throw "PointerPool returned ordinary block for huge-page request";
+  }
+  Pointer::hugePages = oldHuge;
+
+  PointerPool::clear ();
+  if (PointerPool::stats ().bytes != 0) throw "PointerPool::clear left blocks behind";
+
+  cout << "PointerPool passes" << endl;
+}
+
 
 int main (int argc, char * argv[])
 {
@@ -495,6 +681,8 @@ int main (int argc, char * argv[])
 	testFactory ();
 	testArchive ();
 	testVectorsparse ();
+	testPointer ();
+	testPointerPool ();
   }
   catch (const char * message)
   {
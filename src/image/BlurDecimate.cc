@@ -12,12 +12,68 @@ for details.
 
 
 #include "fl/convolve.h"
+#include "fl/cpu.h"
+
+#include <string.h>
 
 
 using namespace std;
 using namespace fl;
 
 
+/// to[x] = sum_i weights[i] * rows[i][x] for x in [start, width)
+static inline void
+sumRowsScalar (const float * const * rows, const float * weights, int count, float * to, int start, int width)
+{
+  for (int x = start; x < width; x++)
+  {
+	float sum = 0;
+	for (int i = 0; i < count; i++) sum += weights[i] * rows[i][x];
+	to[x] = sum;
+  }
+}
+
+#if defined (__GNUC__)  &&  (defined (__x86_64__)  ||  defined (__SSE2__))
+
+template<int bytes>
+static inline __attribute__ ((always_inline)) void
+sumRowsVector (const float * const * rows, const float * weights, int count, float * to, int width)
+{
+  typedef float V __attribute__ ((vector_size (bytes)));
+  const int N = bytes / sizeof (float);
+
+  int x = 0;
+  for (; x + N <= width; x += N)
+  {
+	V s = {};
+	for (int i = 0; i < count; i++)
+	{
+	  V f;
+	  memcpy (&f, rows[i] + x, bytes);
+	  s += weights[i] * f;
+	}
+	memcpy (to + x, &s, bytes);
+  }
+  sumRowsScalar (rows, weights, count, to, x, width);
+}
+
+__attribute__ ((target ("avx2"))) static void sumRowsAVX2 (const float * const * rows, const float * weights, int count, float * to, int width) {sumRowsVector<32> (rows, weights, count, to, width);}
+static                            void sumRowsSSE2 (const float * const * rows, const float * weights, int count, float * to, int width) {sumRowsVector<16> (rows, weights, count, to, width);}
+
+#endif
+
+static void
+sumRows (const float * const * rows, const float * weights, int count, float * to, int width)
+{
+# if defined (__GNUC__)  &&  (defined (__x86_64__)  ||  defined (__SSE2__))
+  if (haveAVX2 ()) sumRowsAVX2 (rows, weights, count, to, width);
+  else             sumRowsSSE2 (rows, weights, count, to, width);
+# else
+  sumRowsScalar (rows, weights, count, to, 0, width);
+# endif
+}
+
+
 // class BlurDecimate ---------------------------------------------------------
 
 BlurDecimate::BlurDecimate (int ratioX, double sigmaXbefore, double sigmaXafter,
@@ -56,25 +112,63 @@ BlurDecimate::filter (const Image & image)
 	blurY = Gaussian1D (s, Boost, GrayFloat, Vertical);
   }
 
-  // Blur and downsample
+  // Blur and downsample.  The vertical pass runs first, and only on the
+  // rows that survive, so it can accumulate whole rows at a time.  The
+  // horizontal pass then only visits the surviving columns of that much
+  // smaller image.  Near the borders, taps that fall outside the image are
+  // dropped and the rest renormalized, as in Boost mode.
 
-  Image temp = image * GrayFloat * blurX;
+  ImageOf<float> gray = image * GrayFloat;
   ImageOf<float> result (image.width / ratioX, image.height / ratioY, GrayFloat);
+  if (result.width == 0  ||  result.height == 0) return result;
 
   int startX = (ratioX > 2) ? ratioX / 2 : 0;
   int startY = (ratioY > 2) ? ratioY / 2 : 0;
 
-  Point t;
-  t.y = startY;
+  const float * kx = (float *) ((PixelBufferPacked *) blurX.buffer)->base ();
+  const float * ky = (float *) ((PixelBufferPacked *) blurY.buffer)->base ();
+  const int lastX = blurX.width - 1;
+  const int lastY = blurY.width - 1;
+  const int midX  = blurX.width / 2;
+  const int midY  = blurY.width / 2;
+
+  ImageOf<float> temp (image.width, result.height, GrayFloat);
+  vector<const float *> rows (blurY.width);
+  for (int y = 0; y < temp.height; y++)
+  {
+	const int c    = startY + y * ratioY;
+	const int low  = max (0,     c + midY - (image.height - 1));
+	const int high = min (lastY, c + midY);
+	for (int i = low; i <= high; i++) rows[i - low] = &gray(0, c + midY - i);
+	float * out = &temp(0,y);
+	sumRows (&rows[0], ky + low, high - low + 1, out, temp.width);
+	if (low > 0  ||  high < lastY)
+	{
+	  float weight = 0;
+	  for (int i = low; i <= high; i++) weight += ky[i];
+	  for (int x = 0; x < temp.width; x++) out[x] /= weight;
+	}
+  }
+
   for (int y = 0; y < result.height; y++)
   {
-	t.x = startX;
+	const float * in  = &temp(0,y);
+	float *       out = &result(0,y);
 	for (int x = 0; x < result.width; x++)
 	{
-	  result(x,y) = blurY.response (temp, t);
-	  t.x += ratioX;
+	  const int c    = startX + x * ratioX;
+	  const int low  = max (0,     c + midX - (image.width - 1));
+	  const int high = min (lastX, c + midX);
+	  const float * b = in + c + midX - low;
+	  float sum    = 0;
+	  float weight = 0;
+	  for (int i = low; i <= high; i++)
+	  {
+		sum    += kx[i] * *b--;
+		weight += kx[i];
+	  }
+	  out[x] = (low > 0  ||  high < lastX) ? sum / weight : sum;
 	}
-	t.y += ratioY;
   }
 
   return result;
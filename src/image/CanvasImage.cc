@@ -375,6 +375,7 @@ CanvasImage::drawSegment (const Point & a, const Point & b, uint32_t color)
   double w = r / c;  // width along pixel row
   double cap = r * s;  // bound where end-cap begins to cut off eges of line
   uint32_t alpha = color & 0xFF;
+  vector<uint32_t> span;  // run of solid color, grown as needed
   if (steep)
   {
 	int y0 = (int) ceil  (ta.y - cap);
@@ -394,8 +395,16 @@ CanvasImage::drawSegment (const Point & a, const Point & b, uint32_t color)
 	  else
 	  {
 		blend (xlo, y, (color & 0xFFFFFF00) | (uint32_t) (alpha * (xlo + 0.5 - lo)));
-		if (alpha == 0xFF) for (int x = xlo + 1; x < xhi; x++) setRGBA (x, y, color);
-		else               for (int x = xlo + 1; x < xhi; x++) blend   (x, y, color);
+		int count = xhi - xlo - 1;
+		if (alpha == 0xFF  &&  count > 0)
+		{
+		  if (span.size () < count) span.resize (count, color);
+		  setRGBA (xlo + 1, y, count, &span[0]);
+		}
+		else
+		{
+		  for (int x = xlo + 1; x < xhi; x++) blend (x, y, color);
+		}
 		blend (xhi, y, (color & 0xFFFFFF00) | (uint32_t) (alpha * (hi - xhi + 0.5)));
 	  }
 	}
@@ -735,13 +744,8 @@ CanvasImage::drawFilledRectangle (const Point & corner0, const Point & corner1,
   y0 = max (y0, 0);
   y1 = min (y1, height - 1);
 
-  for (int y = y0; y <= y1; y++)
-  {
-	for (int x = x0; x <= x1; x++)
-	{
-	  setRGBA (x, y, colorFill);
-	}
-  }
+  vector<uint32_t> span (x1 - x0 + 1, colorFill);
+  for (int y = y0; y <= y1; y++) setRGBA (x0, y, span.size (), &span[0]);
 }
 
 void
@@ -15,9 +15,7 @@ for details.
 
 
 #include "fl/convolve.h"
-
-// for debugging only
-#include "fl/time.h"
+#include "fl/cpu.h"
 
 
 using namespace std;
@@ -40,152 +38,226 @@ ConvolutionDiscrete1D::ConvolutionDiscrete1D (const Image & image, const BorderM
   this->mode = mode;
 }
 
+// Row kernels ----------------------------------------------------------------
+//
+// All the arithmetic in this file reduces to two primitives:
+//   rowH -- Slides a reversed kernel along a single row.
+//   rowV -- Forms one row as a weighted sum of several other rows.
+// Each has a scalar version, and a version written against GCC vector
+// extensions.  The vector version is instantiated for SSE2 and AVX2, and the
+// wider one is selected at runtime when the processor supports it.
+
 /**
-   Generic template for horizontal main loop.
+   Scalar horizontal kernel.  Computes to[x] = sum_k reverse[k] * from[x+k]
+   for x in [0, count).
    Validated by test.cc w/ threshold = 3e-6
 **/
 template<class T>
 static inline void
-asmH (T * reverse, T * fromPixel, T * toPixel, T * end,
-	  int rowWidth, int last, int fromStep, int toStep)
+rowHscalar (const T * reverse, int kernelWidth, const T * from, T * to, int count)
 {
-  T * reverseEnd = reverse + last;
+  const T * reverseEnd = reverse + kernelWidth;
+  T * end = to + count;
+  while (to < end)
+  {
+	T sum = 0;
+	const T * r = reverse;
+	const T * f = from++;
+	while (r < reverseEnd) sum += *r++ * *f++;
+	*to++ = sum;
+  }
+}
 
-  while (toPixel < end)
+/**
+   Scalar vertical kernel.  Computes to[x] = sum_i weights[i] * rows[i][x]
+   for x in [start, width).
+**/
+template<class T>
+static inline void
+rowVscalar (T ** rows, const T * weights, int count, T * to, int start, int width)
+{
+  for (int x = start; x < width; x++)
   {
-	T * rowEnd = toPixel + rowWidth;
-	while (toPixel < rowEnd)
-	{
-	  register T sum = 0;
-	  T * r = reverse;
-	  while (r <= reverseEnd)
-	  {
-		sum += *r++ * *fromPixel++;
-	  }
-	  *toPixel++ = sum;
-	  fromPixel -= last;  // net advance of 1 pixel
-	}
-	toPixel   = (T *) ((char *) toPixel   + toStep);
-	fromPixel = (T *) ((char *) fromPixel + fromStep);
+	T sum = 0;
+	for (int i = 0; i < count; i++) sum += weights[i] * rows[i][x];
+	to[x] = sum;
   }
 }
 
-#if defined (__GNUC__)  &&  defined (__i386__)
+#if defined (__GNUC__)  &&  (defined (__x86_64__)  ||  defined (__SSE2__))
+
+namespace
+{
+template<class T, int bytes>
+struct Lanes
+{
+  typedef T V __attribute__ ((vector_size (bytes)));
+  static const int count = bytes / sizeof (T);
+
+  // Vectors are passed by reference so that AVX types never cross a function boundary compiled without AVX.
+  static inline __attribute__ ((always_inline)) void load  (V & v, const T * p) {memcpy (&v, p, bytes);}
+  static inline __attribute__ ((always_inline)) void store (T * p, const V & v) {memcpy (p, &v, bytes);}
+};
+}
 
 /**
-   Float specialization of horizontal main loop.
+   Vector horizontal kernel.  Same contract as rowHscalar().
+   Works on four vectors of output at a time, so each kernel element is
+   loaded once per 4 * lanes pixels.
 **/
-template<>
-inline void
-asmH (float * reverse, float * fromPixel, float * toPixel, float * end,
-	  int rowWidth, int last, int fromStep, int toStep)
+template<class T, int bytes>
+static inline __attribute__ ((always_inline)) void
+rowHvector (const T * reverse, int kernelWidth, const T * from, T * to, int count)
 {
-  reverse--;
-  fromPixel--;
-  last++;  // same as kernelWidth
-  rowWidth *= sizeof (float);  // pre-scale for convenience
-
-  __asm (
-		 // Load registers  (don't trust gcc to do this right)
-		 "movl   %0, %%eax\n"  // toPixel
-		 "movl   %1, %%ebx\n"  // fromPixel
-		 //  ecx is inner loop index
-		 "movl   %2, %%edx\n"  // reverse
-		 "movl   %3, %%esi\n"  // last
-		 //  edi is rowEnd
-
-		 // while (toPixel < end)
-		 "jmp    5f\n"
-		 "1:"
-		 "movl   %%eax, %%edi\n"
-		 "addl   %4, %%edi\n"  // rowEnd = toPixel + rowWidth
-
-		 // while (toPixel < rowEnd)
-		 "jmp    4f\n"
-		 "2:"
-		 "movl   %%esi, %%ecx\n"
-		 "fldz\n"
-		 "3:"
-		 "flds   (%%ebx,%%ecx,4)\n"
-		 "fmuls  (%%edx,%%ecx,4)\n"
-		 "decl   %%ecx\n"
-		 "faddp\n"
-		 "jnz    3b\n"
-		 "fstps  (%%eax)\n"
-
-		 "addl   $4, %%eax\n"  // toPixel++
-		 "addl   $4, %%ebx\n"  // fromPixel++
-		 "4:"
-		 "cmpl   %%edi, %%eax\n"
-		 "jb     2b\n"
-
-		 "addl   %5, %%eax\n"   // toPixel += toStep
-		 "addl   %6, %%ebx\n"   // fromPixel += fromStep
-		 "5:"
-		 "cmpl   %7, %%eax\n"
-		 "jb     1b\n"
-		 
-		 :
-		 : "m" (toPixel), "m" (fromPixel), "m" (reverse), "m" (last), "m" (rowWidth), "m" (toStep), "m" (fromStep), "m" (end)
-		 : "eax", "ebx", "ecx", "edx", "esi", "edi"
-		 );
+  typedef Lanes<T,bytes> L;
+  typedef typename L::V V;
+  const int N = L::count;
+
+  int x = 0;
+  for (; x + 4 * N <= count; x += 4 * N)
+  {
+	V s0 = {};
+	V s1 = {};
+	V s2 = {};
+	V s3 = {};
+	const T * f = from + x;
+	for (int k = 0; k < kernelWidth; k++)
+	{
+	  const T r = reverse[k];
+	  V f0, f1, f2, f3;
+	  L::load (f0, f + k);
+	  L::load (f1, f + k + N);
+	  L::load (f2, f + k + 2 * N);
+	  L::load (f3, f + k + 3 * N);
+	  s0 += r * f0;
+	  s1 += r * f1;
+	  s2 += r * f2;
+	  s3 += r * f3;
+	}
+	L::store (to + x,         s0);
+	L::store (to + x + N,     s1);
+	L::store (to + x + 2 * N, s2);
+	L::store (to + x + 3 * N, s3);
+  }
+  for (; x + N <= count; x += N)
+  {
+	V s = {};
+	const T * f = from + x;
+	for (int k = 0; k < kernelWidth; k++)
+	{
+	  V f0;
+	  L::load (f0, f + k);
+	  s += reverse[k] * f0;
+	}
+	L::store (to + x, s);
+  }
+  rowHscalar (reverse, kernelWidth, from + x, to + x, count - x);
 }
 
 /**
-   Double specialization of horizontal main loop.
+   Vector vertical kernel.  Same contract as rowVscalar(), but always
+   starts at column 0.
 **/
-template<>
-inline void
-asmH (double * reverse, double * fromPixel, double * toPixel, double * end,
-	  int rowWidth, int last, int fromStep, int toStep)
+template<class T, int bytes>
+static inline __attribute__ ((always_inline)) void
+rowVvector (T ** rows, const T * weights, int count, T * to, int width)
+{
+  typedef Lanes<T,bytes> L;
+  typedef typename L::V V;
+  const int N = L::count;
+
+  int x = 0;
+  for (; x + 4 * N <= width; x += 4 * N)
+  {
+	V s0 = {};
+	V s1 = {};
+	V s2 = {};
+	V s3 = {};
+	for (int i = 0; i < count; i++)
+	{
+	  const T w = weights[i];
+	  const T * f = rows[i] + x;
+	  V f0, f1, f2, f3;
+	  L::load (f0, f);
+	  L::load (f1, f + N);
+	  L::load (f2, f + 2 * N);
+	  L::load (f3, f + 3 * N);
+	  s0 += w * f0;
+	  s1 += w * f1;
+	  s2 += w * f2;
+	  s3 += w * f3;
+	}
+	L::store (to + x,         s0);
+	L::store (to + x + N,     s1);
+	L::store (to + x + 2 * N, s2);
+	L::store (to + x + 3 * N, s3);
+  }
+  for (; x + N <= width; x += N)
+  {
+	V s = {};
+	for (int i = 0; i < count; i++)
+	{
+	  V f0;
+	  L::load (f0, rows[i] + x);
+	  s += weights[i] * f0;
+	}
+	L::store (to + x, s);
+  }
+  rowVscalar (rows, weights, count, to, x, width);
+}
+
+__attribute__ ((target ("avx2"))) static void rowHavx2 (const float  * reverse, int kernelWidth, const float  * from, float  * to, int count) {rowHvector<float, 32> (reverse, kernelWidth, from, to, count);}
+__attribute__ ((target ("avx2"))) static void rowHavx2 (const double * reverse, int kernelWidth, const double * from, double * to, int count) {rowHvector<double,32> (reverse, kernelWidth, from, to, count);}
+__attribute__ ((target ("avx2"))) static void rowVavx2 (float  ** rows, const float  * weights, int count, float  * to, int width) {rowVvector<float, 32> (rows, weights, count, to, width);}
+__attribute__ ((target ("avx2"))) static void rowVavx2 (double ** rows, const double * weights, int count, double * to, int width) {rowVvector<double,32> (rows, weights, count, to, width);}
+
+template<class T>
+static inline void
+rowH (const T * reverse, int kernelWidth, const T * from, T * to, int count)
 {
-  reverse--;
-  fromPixel--;
-  last++;
-  rowWidth *= sizeof (double);
-
-  __asm (
-		 "movl   %0, %%eax\n"
-		 "movl   %1, %%ebx\n"
-		 "movl   %2, %%edx\n"
-		 "movl   %3, %%esi\n"
-
-		 "jmp    5f\n"
-		 "1:"
-		 "movl   %%eax, %%edi\n"
-		 "addl   %4, %%edi\n"
-
-		 "jmp    4f\n"
-		 "2:"
-		 "movl   %%esi, %%ecx\n"
-		 "fldz\n"
-		 "3:"
-		 "fldl   (%%ebx,%%ecx,8)\n"
-		 "fmull  (%%edx,%%ecx,8)\n"
-		 "decl   %%ecx\n"
-		 "faddp\n"
-		 "jnz    3b\n"
-		 "fstpl  (%%eax)\n"
-
-		 "addl   $8, %%eax\n"
-		 "addl   $8, %%ebx\n"
-		 "4:"
-		 "cmpl   %%edi, %%eax\n"
-		 "jb     2b\n"
-
-		 "addl   %5, %%eax\n"
-		 "addl   %6, %%ebx\n"
-		 "5:"
-		 "cmpl   %7, %%eax\n"
-		 "jb     1b\n"
-		 :
-		 : "m" (toPixel), "m" (fromPixel), "m" (reverse), "m" (last), "m" (rowWidth), "m" (toStep), "m" (fromStep), "m" (end)
-		 : "eax", "ebx", "ecx", "edx", "esi", "edi"
-		 );
+  if (haveAVX2 ()) rowHavx2         (reverse, kernelWidth, from, to, count);
+  else             rowHvector<T,16> (reverse, kernelWidth, from, to, count);
+}
+
+template<class T>
+static inline void
+rowV (T ** rows, const T * weights, int count, T * to, int width)
+{
+  if (haveAVX2 ()) rowVavx2         (rows, weights, count, to, width);
+  else             rowVvector<T,16> (rows, weights, count, to, width);
+}
+
+#else
+
+template<class T>
+static inline void
+rowH (const T * reverse, int kernelWidth, const T * from, T * to, int count)
+{
+  rowHscalar (reverse, kernelWidth, from, to, count);
+}
+
+template<class T>
+static inline void
+rowV (T ** rows, const T * weights, int count, T * to, int width)
+{
+  rowVscalar (rows, weights, count, to, 0, width);
 }
 
 #endif
 
+/**
+   Sum of kernel weights in reverse[lo..hi], accumulated in double.
+   Used by Boost mode to renormalize outputs whose support is truncated.
+**/
+template<class T>
+static inline T
+partialTotal (const T * reverse, int lo, int hi)
+{
+  double total = 0;
+  for (int k = lo; k <= hi; k++) total += reverse[k];
+  return (T) total;
+}
+
 template<class T>
 static void
 convolveH (T * kernel, T * image, T * result,
@@ -193,37 +265,31 @@ convolveH (T * kernel, T * image, T * result,
 		   int kernelWidth, int width, int height,
 		   int fromStride, int toStride)
 {
-  // Main convolution
-
   int mid        = kernelWidth / 2;
   int last       = kernelWidth - 1;
   int leftWidth  = last - mid;
   int rightWidth = mid;
   int rowWidth   = width - last;
-  int fromStep   = fromStride - rowWidth * sizeof (T);
-  int toStep     = toStride   - rowWidth * sizeof (T);
-  T * kernelEnd  = kernel + last;
-  T * fromPixel  = image;
-  T * toPixel    = result;
-  T * end        = (T *) ((char *) result + height * toStride);
-  if (mode != Crop) toPixel += leftWidth;
-
-  //   Reverse the kernel for use in assembly optimization
+
+  //   Reverse the kernel, so it can be applied by a forward scan of the image.
   T * reverse = (T *) alloca (kernelWidth * sizeof (T));
-  T * r = reverse;
-  T * k = kernelEnd;
-  while (k >= kernel) *r++ = *k--;
+  for (int k = 0; k < kernelWidth; k++) reverse[k] = kernel[last - k];
 
+  // Main convolution
   if (rowWidth > 0)
   {
-	//Stopwatch timer;
-	asmH (reverse, fromPixel, toPixel, end, rowWidth, last, fromStep, toStep);
-	//timer.stop ();
-	//cerr << "time = " << timer << endl;
+	int offset = mode == Crop ? 0 : leftWidth;
+	char * fromRow = (char *) image;
+	char * toRow   = (char *) result;
+	for (int y = 0; y < height; y++)
+	{
+	  rowH (reverse, kernelWidth, (T *) fromRow, (T *) toRow + offset, rowWidth);
+	  fromRow += fromStride;
+	  toRow   += toStride;
+	}
   }
 
   // Edge cases
-  end = (T *) ((char *) result + height * toStride);
   switch (mode)
   {
 	case ZeroFill:
@@ -234,252 +300,99 @@ convolveH (T * kernel, T * image, T * result,
 		break;
 	  }
 
-	  // left
-	  toStep  = toStride - leftWidth * sizeof (T);
-	  toPixel = result;
-	  while (toPixel < end)
-	  {
-		T * rowEnd = toPixel + leftWidth;
-		while (toPixel < rowEnd) *toPixel++ = (T) 0.0;
-		toPixel = (T *) ((char *) toPixel + toStep);
-	  }
-
-	  // right
-	  toStep  = toStride - rightWidth * sizeof (T);
-	  toPixel = result + (leftWidth + rowWidth);
-	  while (toPixel < end)
+	  char * toRow = (char *) result;
+	  for (int y = 0; y < height; y++)
 	  {
-		T * rowEnd = toPixel + rightWidth;
-		while (toPixel < rowEnd) *toPixel++ = (T) 0.0;
-		toPixel = (T *) ((char *) toPixel + toStep);
+		memset (toRow,                                0, leftWidth  * sizeof (T));
+		memset ((T *) toRow + (leftWidth + rowWidth), 0, rightWidth * sizeof (T));
+		toRow += toStride;
 	  }
-
 	  break;
 	}
 	case UseZeros:
-	{
-	  T * kernelStart = kernel + mid;
-
-	  if (rowWidth <= 0)
-	  {
-		toStep    = toStride - width * sizeof (T);
-		fromPixel = image;
-		toPixel   = result;
-		while (toPixel < end)
-		{
-		  T * ks     = kernelStart;
-		  T * fp     = fromPixel;
-		  T * rowEnd = toPixel + width;
-		  int w = width - 1;
-		  while (toPixel < rowEnd)
-		  {
-			T * k  = ks;
-			T * ke = max (kernel, ks - w);
-			T * f  = fp;
-			if (ks < kernelEnd)
-			{
-			  ks++;
-			}
-			else
-			{
-			  fp++;
-			  w--;
-			}
-
-			register T sum = 0;
-			while (k >= ke) sum += *k-- * *f++;
-
-			*toPixel++ = sum;
-		  }
-		  fromPixel = (T *) ((char *) fromPixel + fromStride);
-		  toPixel   = (T *) ((char *) toPixel   + toStep);
-		}
-		break;
-	  }
-
-	  // left
-	  toStep    = toStride - leftWidth * sizeof (T);
-	  fromPixel = image;
-	  toPixel   = result;
-	  while (toPixel < end)
-	  {
-		T * ks = kernelStart;
-		while (ks < kernelEnd)
-		{
-		  T * k = ks++;
-		  T * f = fromPixel;
-		  register T sum = 0;
-		  while (k >= kernel) sum += *k-- * *f++;
-		  *toPixel++ = sum;
-		}
-		fromPixel = (T *) ((char *) fromPixel + fromStride);
-		toPixel   = (T *) ((char *) toPixel   + toStep);
-	  }
-
-	  // right
-	  toStep    = toStride + rightWidth * sizeof (T);
-	  fromPixel = image  + (width - 1);
-	  toPixel   = result + (width - 1);
-	  while (toPixel < end)
-	  {
-		T * ks = kernelStart;
-		while (ks > kernel)
-		{
-		  T * k = ks--;
-		  T * f = fromPixel;
-		  register T sum = 0;
-		  while (k <= kernelEnd) sum += *k++ * *f--;
-		  *toPixel-- = sum;
-		}
-		fromPixel = (T *) ((char *) fromPixel + fromStride);
-		toPixel   = (T *) ((char *) toPixel   + toStep);
-	  }
-
-	  break;
-	}
 	case Boost:
 	{
-	  // Pre-compute partial sums of the kernel.
-	  // Need separate left and right totals in case kernel is not symmetric.
-	  // leftTotal also carries a zero entry for computing partial sums when
-	  // both ends of kernel are truncated.
-	  T * leftTotal  = (T *) alloca ((kernelWidth + 1) * sizeof (T));
-	  T * rightTotal = (T *) alloca ( kernelWidth      * sizeof (T));
-
-	  double total = 0;
-	  T * k = kernelEnd;
-	  T * t = rightTotal + last;
-	  while (k >= kernel)
+	  // Outputs whose support hangs off the end of the row are computed from
+	  // a zero-padded copy of the relevant part of the row.  This lets them
+	  // share the main kernel.  Boost then rescales each output by the
+	  // portion of the kernel that actually landed on the image.
+	  int spanStart[2];
+	  int spanStop[2];
+	  int spans;
+	  if (rowWidth > 0)
 	  {
-		*t-- = (T) (total += *k--);
+		spanStart[0] = 0;
+		spanStop[0]  = leftWidth;
+		spanStart[1] = leftWidth + rowWidth;
+		spanStop[1]  = width;
+		spans = 2;
 	  }
-
-	  total = 0;
-	  k = kernel;
-	  t = leftTotal;
-	  *t++ = 0;
-	  while (k <= kernelEnd)
+	  else
 	  {
-		*t++ = (T) (total += *k++);
+		spanStart[0] = 0;
+		spanStop[0]  = width;
+		spans = 1;
 	  }
 
-	  T * kernelStart     = kernel     + mid;
-	  T * leftTotalStart  = leftTotal  + mid + 1;
-	  T * rightTotalStart = rightTotal + mid;
-
-	  if (rowWidth <= 0)
+	  // A span is never wider than the kernel, so these are small.
+	  T * padded = (T *) alloca (2 * kernelWidth * sizeof (T));
+	  T * totals = (T *) alloca (    kernelWidth * sizeof (T));
+	  for (int s = 0; s < spans; s++)
 	  {
-		toStep    = toStride - width * sizeof (T);
-		fromPixel = image;
-		toPixel   = result;
-		while (toPixel < end)
+		int x0 = spanStart[s];
+		int count = spanStop[s] - x0;
+		if (count <= 0) continue;
+
+		// Range of input columns covered by this span, and the part of it that lies on the image
+		int inStart = x0 - leftWidth;
+		int inStop  = spanStop[s] + rightWidth;
+		int lo      = max (0,     inStart);
+		int hi      = min (width, inStop);
+		memset (padded, 0, (inStop - inStart) * sizeof (T));
+		T * paddedLo = padded + (lo - inStart);
+		int bytes    = (hi - lo) * sizeof (T);
+
+		if (mode == Boost)
 		{
-		  T * ks     = kernelStart;
-		  T * ts     = leftTotalStart;
-		  T * fp     = fromPixel;
-		  T * rowEnd = toPixel + width;
-		  int w = width;
-		  while (toPixel < rowEnd)
+		  for (int i = 0; i < count; i++)
 		  {
-			T * k  = ks;
-			T * ke = max (kernel, ks - (w - 1));
-			T * t  = ts;
-			T * te = max (leftTotal, ts - w);
-			T * f  = fp;
-			if (ks < kernelEnd)
-			{
-			  ks++;
-			  ts++;
-			}
-			else
-			{
-			  fp++;
-			  w--;
-			}
-
-			register T sum = 0;
-			while (k >= ke) sum += *k-- * *f++;
-			*toPixel++ = sum / (*t - *te);
+			int x = x0 + i;
+			totals[i] = partialTotal (reverse, max (0, leftWidth - x), min (last, leftWidth - x + width - 1));
 		  }
-		  fromPixel = (T *) ((char *) fromPixel + fromStride);
-		  toPixel   = (T *) ((char *) toPixel   + toStep);
 		}
-		break;
-	  }
 
-	  // left
-	  toStep    = toStride - leftWidth * sizeof (T);
-	  fromPixel = image;
-	  toPixel   = result;
-	  while (toPixel < end)
-	  {
-		T * ks = kernelStart;
-		T * lt = leftTotalStart;
-		while (ks < kernelEnd)
+		char * fromRow = (char *) image;
+		char * toRow   = (char *) result;
+		for (int y = 0; y < height; y++)
 		{
-		  T * k = ks++;
-		  T * f = fromPixel;
-		  register T sum = 0;
-		  while (k >= kernel) sum += *k-- * *f++;
-		  *toPixel++ = sum / *lt++;
+		  memcpy (paddedLo, (T *) fromRow + lo, bytes);
+		  T * to = (T *) toRow + x0;
+		  rowH (reverse, kernelWidth, padded, to, count);
+		  if (mode == Boost) for (int i = 0; i < count; i++) to[i] /= totals[i];
+		  fromRow += fromStride;
+		  toRow   += toStride;
 		}
-		fromPixel = (T *) ((char *) fromPixel + fromStride);
-		toPixel   = (T *) ((char *) toPixel   + toStep);
-	  }
-
-	  // right
-	  toStep    = toStride + rightWidth * sizeof (T);
-	  fromPixel = image  + (width - 1);
-	  toPixel   = result + (width - 1);
-	  while (toPixel < end)
-	  {
-		T * ks = kernelStart;
-		T * rt = rightTotalStart;
-		while (ks > kernel)
-		{
-		  T * k = ks--;
-		  T * f = fromPixel;
-		  register T sum = 0;
-		  while (k <= kernelEnd) sum += *k++ * *f--;
-		  *toPixel-- = sum / *rt--;
-		}
-		fromPixel = (T *) ((char *) fromPixel + fromStride);
-		toPixel   = (T *) ((char *) toPixel   + toStep);
 	  }
 	  break;
 	}
 	case Copy:
 	{
-	  if (rowWidth <= 0)
+	  char * fromRow = (char *) image;
+	  char * toRow   = (char *) result;
+	  for (int y = 0; y < height; y++)
 	  {
-		memcpy (result, image, height * toStride);
-		break;
-	  }
-
-	  // left
-	  fromStep  = fromStride - leftWidth * sizeof (T);
-	  toStep    = toStride   - leftWidth * sizeof (T);
-	  fromPixel = image;
-	  toPixel   = result;
-	  while (toPixel < end)
-	  {
-		T * rowEnd = toPixel + leftWidth;
-		while (toPixel < rowEnd) *toPixel++ = *fromPixel++;
-		fromPixel = (T *) ((char *) fromPixel + fromStep);
-		toPixel   = (T *) ((char *) toPixel   + toStep);
-	  }
-
-	  // right
-	  fromStep  = fromStride - rightWidth * sizeof (T);
-	  toStep    = toStride   - rightWidth * sizeof (T);
-	  fromPixel = image  + (leftWidth + rowWidth);
-	  toPixel   = result + (leftWidth + rowWidth);
-	  while (toPixel < end)
-	  {
-		T * rowEnd = toPixel + rightWidth;
-		while (toPixel < rowEnd) *toPixel++ = *fromPixel++;
-		fromPixel = (T *) ((char *) fromPixel + fromStep);
-		toPixel   = (T *) ((char *) toPixel   + toStep);
+		if (rowWidth <= 0)
+		{
+		  memcpy (toRow, fromRow, width * sizeof (T));
+		}
+		else
+		{
+		  int right = leftWidth + rowWidth;
+		  memcpy (toRow,               fromRow,               leftWidth  * sizeof (T));
+		  memcpy ((T *) toRow + right, (T *) fromRow + right, rightWidth * sizeof (T));
+		}
+		fromRow += fromStride;
+		toRow   += toStride;
 	  }
 	}
   }
@@ -492,37 +405,22 @@ convolveV (T * kernel, T * image, T * result,
 		   int kernelHeight, int width, int height,
 		   int fromStride, int toStride)
 {
-  // Main convolution
   int mid          = kernelHeight / 2;
   int last         = kernelHeight - 1;
   int topHeight    = last - mid;
   int bottomHeight = mid;
   int cropHeight   = height - last;
-  int rowStep      = sizeof (T) - fromStride * kernelHeight;
-  int fromStep     = fromStride - width * sizeof (T);
-  int toStep       = toStride   - width * sizeof (T);
-  T * kernelEnd    = kernel + last;
-  T * fromPixel    = image;
-  T * toPixel      = result;
-  if (mode != Crop) toPixel = (T *) ((char *) toPixel + topHeight * toStride);
-  T * end          = (T *) ((char *) toPixel + cropHeight * toStride);
-  while (toPixel < end)
+
+  T *  reverse = (T *)  alloca (kernelHeight * sizeof (T));
+  T ** rows    = (T **) alloca (kernelHeight * sizeof (T *));
+  for (int k = 0; k < kernelHeight; k++) reverse[k] = kernel[last - k];
+
+  // Main convolution
+  int offset = mode == Crop ? 0 : topHeight;
+  for (int y = 0; y < cropHeight; y++)
   {
-	T * rowEnd = toPixel + width;
-	while (toPixel < rowEnd)
-	{
-	  register T sum = 0;
-	  T * k = kernelEnd;
-	  while (k >= kernel)
-	  {
-		sum += *k-- * *fromPixel;
-		fromPixel = (T *) ((char *) fromPixel + fromStride);
-	  }
-	  *toPixel++ = sum;
-	  fromPixel = (T *) ((char *) fromPixel + rowStep);
-	}
-	toPixel   = (T *) ((char *) toPixel   + toStep);
-	fromPixel = (T *) ((char *) fromPixel + fromStep);
+	for (int k = 0; k < kernelHeight; k++) rows[k] = (T *) ((char *) image + (y + k) * fromStride);
+	rowV (rows, reverse, kernelHeight, (T *) ((char *) result + (y + offset) * toStride), width);
   }
 
   // Edge cases
@@ -535,225 +433,32 @@ convolveV (T * kernel, T * image, T * result,
 		memset (result, 0, height * toStride);
 		break;
 	  }
-	  memset (result, 0, toStride * topHeight);
-	  memset (end,    0, toStride * bottomHeight);
+	  memset (result,                                                0, toStride * topHeight);
+	  memset ((char *) result + (topHeight + cropHeight) * toStride, 0, toStride * bottomHeight);
 	  break;
 	}
 	case UseZeros:
-	{
-	  T * kernelStart = kernel + mid;
-
-	  if (cropHeight <= 0)
-	  {
-		fromPixel   = image;
-		T * toStart = result;
-		T * rowEnd  = result + width;
-		end         = (T *) ((char *) result + height * toStride);
-		while (toStart < rowEnd)
-		{
-		  T * ks  = kernelStart;
-		  T * fp  = fromPixel++;
-		  toPixel = toStart++;
-		  int h = height - 1;
-		  while (toPixel < end)
-		  {
-			T * k  = ks;
-			T * ke = max (kernel, ks - h);
-			T * f = fp;
-			if (ks < kernelEnd)
-			{
-			  ks++;
-			}
-			else
-			{
-			  fp = (T *) ((char *) fp + fromStride);
-			  h--;
-			}
-
-			register T sum = 0;
-			while (k >= ke)
-			{
-			  sum += *k-- * *f;
-			  f = (T *) ((char *) f + fromStride);
-			}
-			*toPixel = sum;
-			toPixel = (T *) ((char *) toPixel + toStride);
-		  }
-		}
-		break;
-	  }
-
-	  // top
-	  fromPixel   = image;
-	  T * toStart = result;
-	  T * rowEnd  = result + width;
-	  while (toStart < rowEnd)
-	  {
-		T * ks  = kernelStart;
-		toPixel = toStart++;
-		while (ks < kernelEnd)
-		{
-		  T * k = ks++;
-		  T * f = fromPixel;
-		  register T sum = 0;
-		  while (k >= kernel)
-		  {
-			sum += *k-- * *f;
-			f = (T *) ((char *) f + fromStride);
-		  }
-		  *toPixel = sum;
-		  toPixel = (T *) ((char *) toPixel + toStride);
-		}
-		fromPixel++;
-	  }
-
-	  // bottom
-	  fromPixel = (T *) ((char *) image  + (height - 1) * fromStride);
-	  toStart   = (T *) ((char *) result + (height - 1) * toStride);
-	  rowEnd    = toStart + width;
-	  while (toStart < rowEnd)
-	  {
-		T * ks  = kernelStart;
-		toPixel = toStart++;
-		while (ks > kernel)
-		{
-		  T * k = ks--;
-		  T * f = fromPixel;
-		  register T sum = 0;
-		  while (k <= kernelEnd)
-		  {
-			sum += *k++ * *f;
-			f = (T *) ((char *) f - fromStride);
-		  }
-		  *toPixel = sum;
-		  toPixel = (T *) ((char *) toPixel - toStride);
-		}
-		fromPixel++;
-	  }
-
-	  break;
-	}
 	case Boost:
 	{
-	  // Pre-compute partial sums of the kernel.
-	  T * topTotal    = (T *) alloca ((kernelHeight + 1) * sizeof (T));
-	  T * bottomTotal = (T *) alloca ( kernelHeight      * sizeof (T));
-
-	  double total = 0;
-	  T * k = kernelEnd;
-	  T * t = bottomTotal + last;
-	  while (k >= kernel)
-	  {
-		*t-- = (T) (total += *k--);
-	  }
-
-	  total = 0;
-	  k = kernel;
-	  t = topTotal;
-	  *t++ = 0;
-	  while (k <= kernelEnd)
-	  {
-		*t++ = (T) (total += *k++);
-	  }
-
-	  T * kernelStart      = kernel      + mid;
-	  T * topTotalStart    = topTotal    + mid + 1;
-	  T * bottomTotalStart = bottomTotal + mid;
-
-	  if (cropHeight <= 0)
-	  {
-		fromPixel   = image;
-		T * toStart = result;
-		T * rowEnd  = result + width;
-		end         = (T *) ((char *) result + height * toStride);
-		while (toStart < rowEnd)
-		{
-		  T * ks  = kernelStart;
-		  T * ts  = topTotalStart;
-		  T * fp  = fromPixel++;
-		  toPixel = toStart++;
-		  int h = height;
-		  while (toPixel < end)
-		  {
-			T * k  = ks;
-			T * ke = max (kernel, ks - (h - 1));
-			T * t  = ts;
-			T * te = max (topTotal, ts - h);
-			T * f  = fp;
-			if (ks < kernelEnd)
-			{
-			  ks++;
-			  ts++;
-			}
-			else
-			{
-			  fp = (T *) ((char *) fp + fromStride);
-			  h--;
-			}
-
-			register T sum = 0;
-			while (k >= ke)
-			{
-			  sum += *k-- * *f;
-			  f = (T *) ((char *) f + fromStride);
-			}
-			*toPixel = sum / (*t - *te);
-			toPixel = (T *) ((char *) toPixel + toStride);
-		  }
-		}
-		break;
-	  }
-
-	  // top
-	  fromPixel   = image;
-	  T * toStart = result;
-	  T * rowEnd  = result + width;
-	  while (toStart < rowEnd)
-	  {
-		T * ks  = kernelStart;
-		T * tt  = topTotalStart;
-		toPixel = toStart++;
-		while (ks < kernelEnd)
-		{
-		  T * k = ks++;
-		  T * f = fromPixel;
-		  register T sum = 0;
-		  while (k >= kernel)
-		  {
-			sum += *k-- * *f;
-			f = (T *) ((char *) f + fromStride);
-		  }
-		  *toPixel = sum / *tt++;
-		  toPixel = (T *) ((char *) toPixel + toStride);
-		}
-		fromPixel++;
-	  }
-
-	  // bottom
-	  fromPixel = (T *) ((char *) image  + (height - 1) * fromStride);
-	  toStart   = (T *) ((char *) result + (height - 1) * toStride);
-	  rowEnd    = toStart + width;
-	  while (toStart < rowEnd)
+	  // Each border row is a weighted sum of just those input rows that are
+	  // on the image.  Boost rescales by the total of the weights used.
+	  for (int y = 0; y < height; y++)
 	  {
-		T * ks  = kernelStart;
-		T * bt  = bottomTotalStart;
-		toPixel = toStart++;
-		while (ks > kernel)
+		if (cropHeight > 0  &&  y == topHeight) y += cropHeight;  // skip rows handled by main convolution
+		if (y >= height) break;
+
+		int lo    = max (0,    topHeight - y);
+		int hi    = min (last, topHeight - y + height - 1);
+		int count = hi - lo + 1;
+		for (int k = 0; k < count; k++) rows[k] = (T *) ((char *) image + (y - topHeight + lo + k) * fromStride);
+		T * to = (T *) ((char *) result + y * toStride);
+		rowV (rows, reverse + lo, count, to, width);
+		if (mode == Boost)
 		{
-		  T * k = ks--;
-		  T * f = fromPixel;
-		  register T sum = 0;
-		  while (k <= kernelEnd)
-		  {
-			sum += *k++ * *f;
-			f = (T *) ((char *) f - fromStride);
-		  }
-		  *toPixel = sum / *bt--;
-		  toPixel = (T *) ((char *) toPixel - toStride);
+		  T total = partialTotal (reverse, lo, hi);
+		  for (int x = 0; x < width; x++) to[x] /= total;
 		}
-		fromPixel++;
 	  }
-
 	  break;
 	}
 	case Copy:
@@ -15,6 +15,7 @@ for details.
 
 
 #include "fl/convolve.h"
+#include "fl/cpu.h"
 
 
 using namespace std;
@@ -24,6 +25,7 @@ using namespace fl;
 // class ConvolutionDiscrete2D ------------------------------------------------
 
 uint32_t ConvolutionDiscrete2D::serializeVersion = 0;
+double   ConvolutionDiscrete2D::fourierCost      = 3.0;
 
 ConvolutionDiscrete2D::ConvolutionDiscrete2D (const BorderMode mode, const PixelFormat & format)
 : Image (format)
@@ -37,285 +39,419 @@ ConvolutionDiscrete2D::ConvolutionDiscrete2D (const Image & image, const BorderM
   this->mode = mode;
 }
 
-Image
-ConvolutionDiscrete2D::filter (const Image & image)
+// Row kernel -----------------------------------------------------------------
+//
+// The interior of the image is handled by a single primitive that computes
+// one row of output from kernelHeight rows of input:
+//   to[x] = sum_v sum_h reverse[v * kernelWidth + h] * rows[v][x + h]
+// where reverse is the kernel rotated 180 degrees.  As in Convolution1D.cc,
+// there is a scalar version and one written against GCC vector extensions,
+// which is instantiated for SSE2 and AVX2 and selected at runtime.
+
+template<class T>
+static inline void
+rowScalar (const T * reverse, int kernelWidth, int kernelHeight, T ** rows, T * to, int start, int count)
 {
-  if (*format != *image.format)
+  for (int x = start; x < count; x++)
   {
-	if (format->precedence <= image.format->precedence)
+	T sum = 0;
+	const T * r = reverse;
+	for (int v = 0; v < kernelHeight; v++)
 	{
-	  ConvolutionDiscrete2D temp (*image.format, mode);
-	  (Image &) temp = (*this) * (*image.format);
-	  return image * temp;
+	  const T * f = rows[v] + x;
+	  for (int h = 0; h < kernelWidth; h++) sum += *r++ * f[h];
 	}
-	return filter (image * (*format));
+	to[x] = sum;
   }
+}
 
-  PixelBufferPacked * pbp = (PixelBufferPacked *) buffer;
-  if (! pbp) throw "Convolution kernel must be packed";
+#if defined (__GNUC__)  &&  (defined (__x86_64__)  ||  defined (__SSE2__))
 
-  int lastH = width - 1;
-  int lastV = height - 1;
-  int midX = width / 2;
-  int midY = height / 2;
+template<class T, int bytes>
+static inline __attribute__ ((always_inline)) void
+rowVector (const T * reverse, int kernelWidth, int kernelHeight, T ** rows, T * to, int count)
+{
+  typedef T V __attribute__ ((vector_size (bytes)));
+  const int N = bytes / sizeof (T);
 
-  switch (mode)
+  int x = 0;
+  for (; x + 4 * N <= count; x += 4 * N)
   {
-    case ZeroFill:
+	V s0 = {};
+	V s1 = {};
+	V s2 = {};
+	V s3 = {};
+	const T * r = reverse;
+	for (int v = 0; v < kernelHeight; v++)
 	{
-	  if (*format == GrayFloat)
+	  const T * f = rows[v] + x;
+	  for (int h = 0; h < kernelWidth; h++)
 	  {
-		ImageOf<float> result (image.width, image.height, *format);
-		result.clear ();
-		ImageOf<float> that (image);
-		float * buffer = (float *) pbp->base ();
-
-		for (int y = midY; y < result.height - midY; y++)
-		{
-		  for (int x = midX; x < result.width - midX; x++)
-		  {
-			float sum = 0;
-			for (int v = 0; v <= lastV; v++)
-			{
-			  for (int h = 0; h <= lastH; h++)
-			  {
-				sum += buffer[v * width + h] * that (x - h + midX, y - v + midY);
-			  }
-			}
-			result (x, y) = sum;
-		  }
-		}
-
-		return result;
+		const T w = *r++;
+		V f0, f1, f2, f3;
+		memcpy (&f0, f + h,         bytes);
+		memcpy (&f1, f + h + N,     bytes);
+		memcpy (&f2, f + h + 2 * N, bytes);
+		memcpy (&f3, f + h + 3 * N, bytes);
+		s0 += w * f0;
+		s1 += w * f1;
+		s2 += w * f2;
+		s3 += w * f3;
 	  }
-	  else if (*format == GrayDouble)
+	}
+	memcpy (to + x,         &s0, bytes);
+	memcpy (to + x + N,     &s1, bytes);
+	memcpy (to + x + 2 * N, &s2, bytes);
+	memcpy (to + x + 3 * N, &s3, bytes);
+  }
+  for (; x + N <= count; x += N)
+  {
+	V s = {};
+	const T * r = reverse;
+	for (int v = 0; v < kernelHeight; v++)
+	{
+	  const T * f = rows[v] + x;
+	  for (int h = 0; h < kernelWidth; h++)
 	  {
-		ImageOf<double> result (image.width, image.height, *format);
-		result.clear ();
-		ImageOf<double> that (image);
-		double * buffer = (double *) pbp->base ();
+		V f0;
+		memcpy (&f0, f + h, bytes);
+		s += *r++ * f0;
+	  }
+	}
+	memcpy (to + x, &s, bytes);
+  }
+  rowScalar (reverse, kernelWidth, kernelHeight, rows, to, x, count);
+}
 
-		for (int y = midY; y < result.height - midY; y++)
-		{
-		  for (int x = midX; x < result.width - midX; x++)
-		  {
-			double sum = 0;
-			for (int v = 0; v <= lastV; v++)
-			{
-			  for (int h = 0; h <= lastH; h++)
-			  {
-				sum += buffer[v * width + h] * that (x - h + midX, y - v + midY);
-			  }
-			}
-			result (x, y) = sum;
-		  }
-		}
+__attribute__ ((target ("avx2"))) static void rowAVX2 (const float  * reverse, int kernelWidth, int kernelHeight, float  ** rows, float  * to, int count) {rowVector<float, 32> (reverse, kernelWidth, kernelHeight, rows, to, count);}
+__attribute__ ((target ("avx2"))) static void rowAVX2 (const double * reverse, int kernelWidth, int kernelHeight, double ** rows, double * to, int count) {rowVector<double,32> (reverse, kernelWidth, kernelHeight, rows, to, count);}
+
+template<class T>
+static inline void
+row (const T * reverse, int kernelWidth, int kernelHeight, T ** rows, T * to, int count)
+{
+  if (haveAVX2 ()) rowAVX2         (reverse, kernelWidth, kernelHeight, rows, to, count);
+  else             rowVector<T,16> (reverse, kernelWidth, kernelHeight, rows, to, count);
+}
+
+#else
+
+template<class T>
+static inline void
+row (const T * reverse, int kernelWidth, int kernelHeight, T ** rows, T * to, int count)
+{
+  rowScalar (reverse, kernelWidth, kernelHeight, rows, to, 0, count);
+}
+
+#endif
+
+/**
+   Direct convolution with a general (non-separable) kernel.
+   Result must already be sized according to mode.  The interior is done by
+   row() with no bounds checks.  The border strips are then done according
+   to mode, with UseZeros and Boost clipping the kernel to the image.
+   @param bordersOnly Skip the interior, because it was filled some other way.
+**/
+template<class T>
+static void
+convolve (const Image & kernelImage, const Image & image, Image & result, BorderMode mode, bool bordersOnly = false)
+{
+  // Gather kernel into a contiguous block, both as-is and rotated 180 degrees.
+  int kernelWidth  = kernelImage.width;
+  int kernelHeight = kernelImage.height;
+  int count        = kernelWidth * kernelHeight;
+  vector<T> kernelBlock (count);
+  vector<T> reverseBlock (count);
+  ImageOf<T> K (kernelImage);
+  for (int v = 0; v < kernelHeight; v++)
+  {
+	for (int h = 0; h < kernelWidth; h++) kernelBlock[v * kernelWidth + h] = K(h,v);
+  }
+  for (int k = 0; k < count; k++) reverseBlock[k] = kernelBlock[count - 1 - k];
+  const T * kernel  = &kernelBlock[0];
+  const T * reverse = &reverseBlock[0];
+
+  PixelBufferPacked * i = (PixelBufferPacked *) image.buffer;
+  PixelBufferPacked * o = (PixelBufferPacked *) result.buffer;
+  char * input      = (char *) i->base ();
+  char * output     = (char *) o->base ();
+  int    fromStride = i->stride;
+  int    toStride   = o->stride;
+
+  int lastH  = kernelWidth  - 1;
+  int lastV  = kernelHeight - 1;
+  int midX   = kernelWidth  / 2;
+  int midY   = kernelHeight / 2;
+  int left   = lastH - midX;  // columns of context before the center pixel
+  int top    = lastV - midY;
+  int right  = midX;
+  int bottom = midY;
+  int cropWidth  = image.width  - lastH;
+  int cropHeight = image.height - lastV;
+
+  // Interior
+  if (! bordersOnly  &&  cropWidth > 0  &&  cropHeight > 0)
+  {
+	T ** rows = (T **) alloca (kernelHeight * sizeof (T *));
 
-		return result;
+	int offsetX = mode == Crop ? 0 : left;
+	int offsetY = mode == Crop ? 0 : top;
+	for (int y = 0; y < cropHeight; y++)
+	{
+	  for (int v = 0; v < kernelHeight; v++) rows[v] = (T *) (input + (y + v) * fromStride);
+	  row (reverse, kernelWidth, kernelHeight, rows, (T *) (output + (y + offsetY) * toStride) + offsetX, cropWidth);
+	}
+  }
+  if (mode == Crop  ||  mode == Undefined) return;
+
+  // Border strips
+  bool interior = cropWidth > 0  &&  cropHeight > 0;
+  for (int y = 0; y < image.height; y++)
+  {
+	T * to   = (T *) (output + y * toStride);
+	T * from = (T *) (input  + y * fromStride);
+	bool fullRow = ! interior  ||  y < top  ||  y >= image.height - bottom;
+	int spanStart[2] = {0,                         image.width - right};
+	int spanStop[2]  = {fullRow ? image.width : left, image.width};
+	int spans        =  fullRow ? 1 : 2;
+	for (int s = 0; s < spans; s++)
+	{
+	  if (mode == ZeroFill)
+	  {
+		memset (to + spanStart[s], 0, (spanStop[s] - spanStart[s]) * sizeof (T));
+		continue;
 	  }
-	  else
+	  if (mode == Copy)
 	  {
-		throw "ConvolutionDiscrete2D::filter: unimplemented format";
+		memcpy (to + spanStart[s], from + spanStart[s], (spanStop[s] - spanStart[s]) * sizeof (T));
+		continue;
 	  }
-	}
-    case UseZeros:
-	{
-	  if (*format == GrayFloat)
+
+	  // UseZeros or Boost
+	  int vh = min (lastV, y + midY);
+	  int vl = max (0,     y + midY - (image.height - 1));
+	  for (int x = spanStart[s]; x < spanStop[s]; x++)
 	  {
-		ImageOf<float> result (image.width, image.height, *format);
-		ImageOf<float> that (image);
-		float * buffer = (float *) pbp->base ();
+		int hh = min (lastH, x + midX);
+		int hl = max (0,     x + midX - (image.width - 1));
 
-		for (int y = 0; y < result.height; y++)
+		T sum    = 0;
+		T weight = 0;
+		for (int v = vl; v <= vh; v++)
 		{
-		  for (int x = 0; x < result.width; x++)
+		  const T * k = kernel + v * kernelWidth;
+		  const T * f = (T *) (input + (y - v + midY) * fromStride) + (x + midX);
+		  for (int h = hl; h <= hh; h++)
 		  {
-			int hh = min (lastH, x + midX);
-			int hl = max (0,     x + midX - (image.width - 1));
-			int vh = min (lastV, y + midY);
-			int vl = max (0,     y + midY - (image.height - 1));
-
-			float sum = 0;
-			for (int v = vl; v <= vh; v++)
-			{
-			  for (int h = hl; h <= hh; h++)
-			  {
-				sum += buffer[v * width + h] * that (x - h + midX, y - v + midY);
-			  }
-			}
-			result (x, y) = sum;
+			sum    += k[h] * f[-h];
+			weight += k[h];
 		  }
 		}
-
-		return result;
+		to[x] = mode == Boost ? sum / weight : sum;
 	  }
-	  else if (*format == GrayDouble)
-	  {
-		ImageOf<double> result (image.width, image.height, *format);
-		ImageOf<double> that (image);
-		double * buffer = (double *) pbp->base ();
+	}
+  }
+}
 
-		for (int y = midY; y < result.height - midY; y++)
-		{
-		  for (int x = midX; x < result.width - midX; x++)
-		  {
-			int hh = min (lastH, x + midX);
-			int hl = max (0,     x + midX - (image.width - 1));
-			int vh = min (lastV, y + midY);
-			int vl = max (0,     y + midY - (image.height - 1));
-
-			double sum = 0;
-			for (int v = vl; v <= vh; v++)
-			{
-			  for (int h = hl; h <= hh; h++)
-			  {
-				sum += buffer[v * width + h] * that (x - h + midX, y - v + midY);
-			  }
-			}
-			result (x, y) = sum;
-		  }
-		}
+/**
+   Extract a rank-1 factorization of the kernel.
+   Finds the leading singular triplet (sigma, u, v) of the kernel by power
+   iteration.  For a kernel that really is rank 1, the iteration is exact
+   after the first step.  For any other kernel the residual stays large, so
+   a handful of steps is enough to decide.
+   @return true if the residual K - sigma u v' is negligible relative to
+   sigma, in which case horizontal and vertical are filled so that applying
+   both gives the same result as this kernel.
+**/
+template<class T>
+static bool
+factor (const Image & kernelImage, double threshold, ConvolutionDiscrete1D & horizontal, ConvolutionDiscrete1D & vertical)
+{
+  ImageOf<T> K (kernelImage);
+  int w = K.width;
+  int h = K.height;
+
+  // Start with the row of largest norm, which can't be orthogonal to the leading right singular vector.
+  vector<double> u (h);
+  vector<double> v (w);
+  double largest = -1;
+  for (int y = 0; y < h; y++)
+  {
+	double n = 0;
+	for (int x = 0; x < w; x++) n += (double) K(x,y) * K(x,y);
+	if (n > largest)
+	{
+	  largest = n;
+	  for (int x = 0; x < w; x++) v[x] = K(x,y);
+	}
+  }
+  if (largest <= 0) return false;
 
-		return result;
-	  }
-	  else
-	  {
-		throw "ConvolutionDiscrete2D::filter: unimplemented format";
-	  }
+  double sigma = 0;
+  for (int i = 0; i < 8; i++)
+  {
+	// u = K v / |K v|
+	sigma = 0;
+	for (int y = 0; y < h; y++)
+	{
+	  double sum = 0;
+	  for (int x = 0; x < w; x++) sum += K(x,y) * v[x];
+	  u[y] = sum;
+	  sigma += sum * sum;
 	}
-    case Boost:
+	sigma = sqrt (sigma);
+	if (sigma == 0) return false;
+	for (int y = 0; y < h; y++) u[y] /= sigma;
+
+	// v = K' u / |K' u|
+	double n = 0;
+	for (int x = 0; x < w; x++)
 	{
-	  if (*format == GrayFloat)
-	  {
-		ImageOf<float> result (image.width, image.height, *format);
-		ImageOf<float> that (image);
-		float * buffer = (float *) pbp->base ();
+	  double sum = 0;
+	  for (int y = 0; y < h; y++) sum += K(x,y) * u[y];
+	  v[x] = sum;
+	  n += sum * sum;
+	}
+	sigma = sqrt (n);
+	for (int x = 0; x < w; x++) v[x] /= sigma;
+  }
 
-		for (int y = 0; y < result.height; y++)
-		{
-		  for (int x = 0; x < result.width; x++)
-		  {
-			int hh = min (lastH, x + midX);
-			int hl = max (0,     x + midX - (image.width - 1));
-			int vh = min (lastV, y + midY);
-			int vl = max (0,     y + midY - (image.height - 1));
-
-			float sum = 0;
-			float weight = 0;
-			for (int v = vl; v <= vh; v++)
-			{
-			  for (int h = hl; h <= hh; h++)
-			  {
-				float value = buffer[v * width + h];
-				sum += value * that (x - h + midX, y - v + midY);
-				weight += value;
-			  }
-			}
-			result (x, y) = sum / weight;
-		  }
-		}
+  double residual = 0;
+  for (int y = 0; y < h; y++)
+  {
+	for (int x = 0; x < w; x++)
+	{
+	  double e = K(x,y) - sigma * u[y] * v[x];
+	  residual += e * e;
+	}
+  }
+  if (sqrt (residual) > threshold * sigma) return false;
+
+  // Move all the gain into the vertical kernel, so that if this kernel sums
+  // to 1 then so do both factors.  Boost mode depends on this.
+  double scaleH = sqrt (sigma);
+  double scaleV = scaleH;
+  double total = 0;
+  for (int x = 0; x < w; x++) total += v[x];
+  if (fabs (total) > threshold)
+  {
+	scaleH = 1 / total;
+	scaleV = sigma * total;
+  }
 
-		return result;
-	  }
-	  else if (*format == GrayDouble)
-	  {
-		ImageOf<double> result (image.width, image.height, *format);
-		ImageOf<double> that (image);
-		double * buffer = (double *) pbp->base ();
+  horizontal.resize (w, 1);
+  vertical  .resize (h, 1);
+  ImageOf<T> H (horizontal);
+  ImageOf<T> V (vertical);
+  for (int x = 0; x < w; x++) H(x,0) = (T) (v[x] * scaleH);
+  for (int y = 0; y < h; y++) V(y,0) = (T) (u[y] * scaleV);
+  return true;
+}
 
-		for (int y = midY; y < result.height - midY; y++)
-		{
-		  for (int x = midX; x < result.width - midX; x++)
-		  {
-			int hh = min (lastH, x + midX);
-			int hl = max (0,     x + midX - (image.width - 1));
-			int vh = min (lastV, y + midY);
-			int vl = max (0,     y + midY - (image.height - 1));
-
-			double sum = 0;
-			double weight = 0;
-			for (int v = vl; v <= vh; v++)
-			{
-			  for (int h = hl; h <= hh; h++)
-			  {
-				double value = buffer[v * width + h];
-				sum += value * that (x - h + midX, y - v + midY);
-				weight += value;
-			  }
-			}
-			result (x, y) = sum / weight;
-		  }
-		}
+template<class T>
+static double
+total (const Image & kernelImage)
+{
+  ImageOf<T> K (kernelImage);
+  double result = 0;
+  for (int y = 0; y < K.height; y++) for (int x = 0; x < K.width; x++) result += K(x,y);
+  return result;
+}
 
-		return result;
-	  }
-	  else
-	  {
-		throw "ConvolutionDiscrete2D::filter: unimplemented format";
-	  }
-	}
-    case Crop:
-    default:
+Image
+ConvolutionDiscrete2D::filter (const Image & image)
+{
+  if (*format != *image.format)
+  {
+	if (format->precedence <= image.format->precedence)
 	{
-	  if (image.width < width  ||  image.height < height)
-	  {
-		return Image (*format);
-	  }
+	  ConvolutionDiscrete2D temp (*image.format, mode);
+	  (Image &) temp = (*this) * (*image.format);
+	  return image * temp;
+	}
+	return filter (image * (*format));
+  }
 
-	  if (*format == GrayFloat)
-	  {
-		ImageOf<float> result (image.width - lastH, image.height - lastV, *format);
-		ImageOf<float> that (image);
-		float * buffer = (float *) pbp->base ();
+  if (! (PixelBufferPacked *) buffer) throw "Convolution kernel must be packed";
+  if (*format != GrayFloat  &&  *format != GrayDouble) throw "ConvolutionDiscrete2D::filter: unimplemented format";
+  if (! (PixelBufferPacked *) image.buffer) throw "Convolution2D only handles packed buffers for now";
 
-		for (int y = 0; y < result.height; y++)
-		{
-		  for (int x = 0; x < result.width; x++)
-		  {
-			float sum = 0;
-			for (int v = 0; v <= lastV; v++)
-			{
-			  for (int h = 0; h <= lastH; h++)
-			  {
-				sum += buffer[v * width + h] * that (x - h + lastH, y - v + lastV);
-			  }
-			}
-			result (x, y) = sum;
-		  }
-		}
+  Image result (*format);
+  if (mode == Crop)
+  {
+	if (image.width < width  ||  image.height < height) return result;
+	result.resize (image.width - (width - 1), image.height - (height - 1));
+  }
+  else
+  {
+	result.resize (image.width, image.height);
+  }
+  if (result.width == 0  ||  result.height == 0) return result;
 
-		return result;
-	  }
-	  else if (*format == GrayDouble)
-	  {
-		ImageOf<double> result (image.width - lastH, image.height - lastV, *format);
-		ImageOf<double> that (image);
-		double * buffer = (double *) pbp->base ();
+  // Separable kernels cost width + height per pixel rather than width * height.
+  ConvolutionDiscrete1D horizontal;
+  ConvolutionDiscrete1D vertical;
+  bool normalized = true;
+  if (mode == Boost)  // Factors only reproduce Boost exactly when each sums to 1.
+  {
+	double t = *format == GrayFloat ? total<float> (*this) : total<double> (*this);
+	normalized = fabs (t - 1) < 1e-5;
+  }
+  bool split = width > 1  &&  height > 1  &&  normalized  &&  separable (horizontal, vertical);
 
-		for (int y = 0; y < result.height; y++)
-		{
-		  for (int x = 0; x < result.width; x++)
-		  {
-			double sum = 0;
-			for (int v = 0; v <= lastV; v++)
-			{
-			  for (int h = 0; h <= lastH; h++)
-			  {
-				sum += buffer[v * width + h] * that (x - h + lastH, y - v + lastV);
-			  }
-			}
-			result (x, y) = sum;
-		  }
-		}
+# ifdef HAVE_FFTW
+  // Large general kernels are cheaper in the frequency domain.
+  double taps = split ? width + height : width * height;
+  if (fourierCost * ConvolutionFourier<float>::cost (image.width, image.height, width, height) < taps * image.width * image.height)
+  {
+	if (*format == GrayFloat)
+	{
+	  ConvolutionFourier<float> fourier (width, height);
+	  fourier.prepare (image);
+	  return fourier.filter (*this);
+	}
+	ConvolutionFourier<double> fourier (width, height);
+	fourier.prepare (image);
+	return fourier.filter (*this);
+  }
+# endif
 
-		return result;
-	  }
-	  else
-	  {
-		throw "ConvolutionDiscrete2D::filter: unimplemented format";
-	  }
+  if (split)
+  {
+	// The 1D Copy mode would pass unfiltered pixels from the first pass
+	// through the second, so leave borders undefined and fill them at the end.
+	if (mode == Copy)
+	{
+	  horizontal.mode = Undefined;
+	  vertical  .mode = Undefined;
+	}
+	result = image * horizontal * vertical;
+	if (mode == Copy)
+	{
+	  if (*format == GrayFloat) convolve<float>  (*this, image, result, Copy, true);
+	  else                      convolve<double> (*this, image, result, Copy, true);
 	}
+	return result;
   }
+
+  if (*format == GrayFloat) convolve<float>  (*this, image, result, mode);
+  else                      convolve<double> (*this, image, result, mode);
+  return result;
+}
+
+bool
+ConvolutionDiscrete2D::separable (ConvolutionDiscrete1D & horizontal, ConvolutionDiscrete1D & vertical) const
+{
+  if (! (PixelBufferPacked *) buffer  ||  width == 0  ||  height == 0) return false;
+  horizontal.format    = format;
+  horizontal.mode      = mode;
+  horizontal.direction = Horizontal;
+  vertical  .format    = format;
+  vertical  .mode      = mode;
+  vertical  .direction = Vertical;
+  if (*format == GrayFloat)  return factor<float>  (*this, 1e-6,  horizontal, vertical);
+  if (*format == GrayDouble) return factor<double> (*this, 1e-12, horizontal, vertical);
+  return false;
 }
 
 double
@@ -494,3 +630,192 @@ ConvolutionDiscrete2D::serialize (Archive & archive, uint32_t version)
 	archive.out->write ((char *) pbp->base (), height * pbp->stride);
   }
 }
+
+
+// class ConvolutionFourier ---------------------------------------------------
+
+#ifdef HAVE_FFTW
+
+/**
+   Chooses the transform size along one dimension.  Tiles several times
+   larger than the kernel keep the overhead of the padding low, but if the
+   whole image fits in one transform there is no need to go bigger.
+**/
+static inline void
+tiling (int kernel, int image, int & fftSize, int & tileSize, int & tiles)
+{
+  int spread = kernel - 1;
+  fftSize = ConvolutionFourier<float>::fastSize (max (64, 4 * spread));
+  if (fftSize >= image + spread) fftSize = ConvolutionFourier<float>::fastSize (image + spread);
+  tileSize = fftSize - spread;
+  tiles    = (image + tileSize - 1) / tileSize;
+}
+
+template<class T>
+ConvolutionFourier<T>::ConvolutionFourier (int kernelWidth, int kernelHeight)
+: kernelWidth (kernelWidth),
+  kernelHeight (kernelHeight),
+  forward (false, false),
+  inverse (false, true)
+{
+  tilesH = 0;
+  tilesV = 0;
+}
+
+template<class T>
+void
+ConvolutionFourier<T>::prepare (const Image & image)
+{
+  this->image = image * (sizeof (T) == sizeof (float) ? (PixelFormat &) GrayFloat : (PixelFormat &) GrayDouble);
+  tiling (kernelWidth,  image.width,  fftWidth,  tileWidth,  tilesH);
+  tiling (kernelHeight, image.height, fftHeight, tileHeight, tilesV);
+
+  // Matrix is column-major, so rows of the matrix run along x.
+  ImageOf<T> I (this->image);
+  Matrix<T> block (fftWidth, fftHeight);
+  spectra.clear ();
+  spectra.resize (tilesH * tilesV);
+  for (int j = 0; j < tilesV; j++)
+  {
+	for (int i = 0; i < tilesH; i++)
+	{
+	  int x0 = i * tileWidth;
+	  int y0 = j * tileHeight;
+	  int w  = min (tileWidth,  image.width  - x0);
+	  int h  = min (tileHeight, image.height - y0);
+	  block.clear ();
+	  for (int y = 0; y < h; y++)
+	  {
+		memcpy (&block(0,y), &I(x0,y0+y), w * sizeof (T));
+	  }
+	  forward.dft (block, spectra[j * tilesH + i]);
+	}
+  }
+}
+
+template<class T>
+Image
+ConvolutionFourier<T>::filter (const ConvolutionDiscrete2D & kernelImage)
+{
+  if (kernelImage.width > kernelWidth  ||  kernelImage.height > kernelHeight) throw "ConvolutionFourier: kernel is larger than the size this object was prepared for";
+  const PixelFormat & format = *image.format;
+  ConvolutionDiscrete2D kernel (kernelImage * format, kernelImage.mode);
+
+  int lastH = kernel.width  - 1;
+  int lastV = kernel.height - 1;
+  Image result (format);
+  if (kernel.mode == Crop)
+  {
+	if (image.width < kernel.width  ||  image.height < kernel.height) return result;
+	result.resize (image.width - lastH, image.height - lastV);
+  }
+  else
+  {
+	result.resize (image.width, image.height);
+  }
+  if (result.width == 0  ||  result.height == 0) return result;
+
+  // Transform of kernel.  The inverse transform is unnormalized, so fold 1/N in here.
+  ImageOf<T> K (kernel);
+  Matrix<T> block (fftWidth, fftHeight);
+  block.clear ();
+  T scale = (T) 1 / ((T) fftWidth * fftHeight);
+  for (int y = 0; y < kernel.height; y++)
+  {
+	for (int x = 0; x < kernel.width; x++) block(x,y) = K(x,y) * scale;
+  }
+  Matrix<std::complex<T> > kernelSpectrum;
+  forward.dft (block, kernelSpectrum);
+
+  // Overlap-add.  full holds the linear convolution, which is larger than
+  // the image by the spread of the kernel.
+  int fullWidth  = image.width  + lastH;
+  int fullHeight = image.height + lastV;
+  Matrix<T> full (fullWidth, fullHeight);
+  full.clear ();
+  Matrix<std::complex<T> > product;
+  const int count = kernelSpectrum.rows () * kernelSpectrum.columns ();
+  for (int j = 0; j < tilesV; j++)
+  {
+	for (int i = 0; i < tilesH; i++)
+	{
+	  product.copyFrom (spectra[j * tilesH + i]);
+	  std::complex<T> * p = &product(0,0);
+	  std::complex<T> * k = &kernelSpectrum(0,0);
+	  for (int n = 0; n < count; n++) p[n] *= k[n];
+	  inverse.dft (product, block);
+
+	  int x0 = i * tileWidth;
+	  int y0 = j * tileHeight;
+	  int w  = min (fftWidth,  fullWidth  - x0);
+	  int h  = min (fftHeight, fullHeight - y0);
+	  for (int y = 0; y < h; y++)
+	  {
+		T * from = &block(0,y);
+		T * to   = &full(x0,y0+y);
+		for (int x = 0; x < w; x++) to[x] += from[x];
+	  }
+	}
+  }
+
+  // Extract result.  The linear convolution at p is sum_h K[h] I[p-h], so
+  // output pixel x (which is centered on input pixel x + mid) is at x + mid.
+  int offsetX = kernel.mode == Crop ? lastH : kernel.width  / 2;
+  int offsetY = kernel.mode == Crop ? lastV : kernel.height / 2;
+  ImageOf<T> R (result);
+  for (int y = 0; y < result.height; y++)
+  {
+	memcpy (&R(0,y), &full(offsetX,offsetY+y), result.width * sizeof (T));
+  }
+
+  // The linear convolution already gives UseZeros at the borders, and
+  // Undefined and Crop don't care.
+  if (kernel.mode == ZeroFill  ||  kernel.mode == Copy  ||  kernel.mode == Boost)
+  {
+	convolve<T> (kernel, image, result, kernel.mode, true);
+  }
+
+  return result;
+}
+
+template<class T>
+int
+ConvolutionFourier<T>::fastSize (int n)
+{
+  if (n < 1) return 1;
+  while (true)
+  {
+	int m = n;
+	while (m % 2 == 0) m /= 2;
+	while (m % 3 == 0) m /= 3;
+	while (m % 5 == 0) m /= 5;
+	if (m == 1) return n;
+	n++;
+  }
+}
+
+template<class T>
+double
+ConvolutionFourier<T>::cost (int imageWidth, int imageHeight, int kernelWidth, int kernelHeight)
+{
+  int fftWidth;
+  int fftHeight;
+  int tileWidth;
+  int tileHeight;
+  int tilesH;
+  int tilesV;
+  tiling (kernelWidth,  imageWidth,  fftWidth,  tileWidth,  tilesH);
+  tiling (kernelHeight, imageHeight, fftHeight, tileHeight, tilesV);
+  double N = (double) fftWidth * fftHeight;
+  int tiles = tilesH * tilesV;
+  // Forward and inverse transform of each tile, plus one transform of the kernel.
+  return (2 * tiles + 1) * N * log2 (N);
+}
+
+namespace fl
+{
+  template class ConvolutionFourier<float>;
+  template class ConvolutionFourier<double>;
+}
+
+#endif
@@ -15,14 +15,176 @@ for details.
 
 
 #include "fl/convolve.h"
+#include "fl/cpu.h"
+#include "fl/thread.h"
+
+#include <string.h>
 
 
 using namespace std;
 using namespace fl;
 
 
+// Recursion kernel ----------------------------------------------------------
+
+/**
+   Runs the causal and anti-causal passes over a group of independent
+   sequences at once, one sequence per lane of V.  Element k of every
+   sequence is at in[k * inStride] (and out[k * outStride]), and the lanes
+   are contiguous from there.
+   V may be plain double, in which case there is one lane.
+
+   <p>Beyond either end of the sequence, input and output are held at the
+   value of the end element.  Seeding the history this way reproduces the
+   steady-state start-up terms of the original formulation (zp and zm), and
+   also copes with sequences shorter than the filter order.
+
+   <p>The causal result is written into out, and the anti-causal pass then
+   folds itself in on the way back, so no other scratch memory is needed.
+**/
+template<class V>
+static inline __attribute__ ((always_inline)) void
+recurse (const ConvolutionRecursive1D & c, const double * in, int inStride, double * out, int outStride, int n)
+{
+  const double n00p = c.n00p;
+  const double n11p = c.n11p;
+  const double n22p = c.n22p;
+  const double n33p = c.n33p;
+  const double n11m = c.n11m;
+  const double n22m = c.n22m;
+  const double n33m = c.n33m;
+  const double n44m = c.n44m;
+  const double d11p = c.d11p;
+  const double d22p = c.d22p;
+  const double d33p = c.d33p;
+  const double d44p = c.d44p;
+  const double d11m = c.d11m;
+  const double d22m = c.d22m;
+  const double d33m = c.d33m;
+  const double d44m = c.d44m;
+  const double scale = c.scale;
+  const double zp = (n00p + n11p + n22p + n33p) / (1 + d11p + d22p + d33p + d44p);
+  const double zm = (n11m + n22m + n33m + n44m) / (1 + d11m + d22m + d33m + d44m);
+
+  V i0, i1, i2, i3;  // most recent input first
+  V o1, o2, o3, o4;  // most recent output first
+
+  memcpy (&i1, in, sizeof (V));
+  i2 = i1;
+  i3 = i1;
+  o1 = zp * i1;
+  o2 = o1;
+  o3 = o1;
+  o4 = o1;
+  for (int k = 0; k < n; k++)
+  {
+	memcpy (&i0, in + k * inStride, sizeof (V));
+	V p =   n00p * i0 + n11p * i1 + n22p * i2 + n33p * i3
+	      - d11p * o1 - d22p * o2 - d33p * o3 - d44p * o4;
+	memcpy (out + k * outStride, &p, sizeof (V));
+	i3 = i2;  i2 = i1;  i1 = i0;
+	o4 = o3;  o3 = o2;  o2 = o1;  o1 = p;
+  }
+
+  memcpy (&i0, in + (n - 1) * inStride, sizeof (V));
+  i1 = i0;
+  i2 = i0;
+  i3 = i0;
+  o1 = zm * i0;
+  o2 = o1;
+  o3 = o1;
+  o4 = o1;
+  for (int k = n - 1; k >= 0; k--)
+  {
+	// i0..i3 hold input at k+1..k+4
+	V m =   n11m * i0 + n22m * i1 + n33m * i2 + n44m * i3
+	      - d11m * o1 - d22m * o2 - d33m * o3 - d44m * o4;
+	V p;
+	memcpy (&p, out + k * outStride, sizeof (V));
+	p = scale * (p + m);
+	memcpy (out + k * outStride, &p, sizeof (V));
+	i3 = i2;  i2 = i1;  i1 = i0;
+	memcpy (&i0, in + k * inStride, sizeof (V));
+	o4 = o3;  o3 = o2;  o2 = o1;  o1 = m;
+  }
+}
+
+#if defined (__GNUC__)  &&  (defined (__x86_64__)  ||  defined (__SSE2__))
+
+/**
+   Eight lanes, so each step of the recursion touches exactly one cache line
+   per row.  On SSE2 the compiler splits this into four vector operations.
+**/
+typedef double VD __attribute__ ((vector_size (64)));
+
+__attribute__ ((target ("avx2"))) static void recurseAVX2 (const ConvolutionRecursive1D & c, const double * in, int inStride, double * out, int outStride, int n) {recurse<VD> (c, in, inStride, out, outStride, n);}
+static                            void recurseSSE2 (const ConvolutionRecursive1D & c, const double * in, int inStride, double * out, int outStride, int n) {recurse<VD> (c, in, inStride, out, outStride, n);}
+
+static const int lanes = sizeof (VD) / sizeof (double);
+
+static inline void
+recurseLanes (const ConvolutionRecursive1D & c, const double * in, int inStride, double * out, int outStride, int n)
+{
+  if (haveAVX2 ()) recurseAVX2 (c, in, inStride, out, outStride, n);
+  else             recurseSSE2 (c, in, inStride, out, outStride, n);
+}
+
+#else
+
+static const int lanes = 1;
+
+static inline void
+recurseLanes (const ConvolutionRecursive1D & c, const double * in, int inStride, double * out, int outStride, int n)
+{
+  recurse<double> (c, in, inStride, out, outStride, n);
+}
+
+#endif
+
+
+// class RecursiveRunner ------------------------------------------------------
+
+namespace
+{
+/**
+   Splits the image into blocks of lanes columns (for a vertical pass) or
+   rows (for a horizontal pass) and filters each block as one group of
+   sequences.  Columns of a row are already adjacent, so a vertical block
+   reads straight from the image.  A horizontal block is first transposed
+   into a scratch buffer, so the same kernel can walk it with unit stride.
+**/
+class RecursiveRunner : public ParallelFor<int>
+{
+public:
+  RecursiveRunner (const ConvolutionRecursive1D & c, const ImageOf<double> & input, ImageOf<double> & output, float threadRequest)
+  : ParallelFor<int> (threadRequest),
+	c (c),
+	input (input),
+	output (output)
+  {
+  }
+
+  virtual void process (const int b)
+  {
+	ConvolutionRecursive1D::block (c, input, output, b);
+  }
+
+  const ConvolutionRecursive1D & c;
+  const ImageOf<double> &        input;
+  ImageOf<double> &              output;
+};
+}
+
+
 // class ConvolutionRecursive1D -----------------------------------------------
 
+ConvolutionRecursive1D::ConvolutionRecursive1D ()
+{
+  direction     = Horizontal;
+  threadRequest = 0;
+  minimumPixels = 1 << 16;
+}
+
 Image
 ConvolutionRecursive1D::filter (const Image & image)
 {
@@ -31,116 +193,68 @@ ConvolutionRecursive1D::filter (const Image & image)
 	return filter (image * GrayDouble);
   }
 
-  int w = image.width;
-  int h = image.height;
+  ImageOf<double> input (image);
+  ImageOf<double> output (image.width, image.height, GrayDouble);
+  output.timestamp = image.timestamp;
+  if (image.width == 0  ||  image.height == 0) return output;
 
-  ImageOf<double> i (image);
-  ImageOf<double> p (w, h, GrayDouble);  // "plus"
-  ImageOf<double> m (w, h, GrayDouble);  // "minus"
+  int sequences = direction == Horizontal ? image.height : image.width;
+  int blocks = (sequences + lanes - 1) / lanes;
+  if ((ptrdiff_t) image.width * image.height < minimumPixels  ||  blocks < 2  ||  threadRequest == 1)
+  {
+	for (int b = 0; b < blocks; b++) block (*this, input, output, b);
+  }
+  else
+  {
+	RecursiveRunner runner (*this, input, output, threadRequest);
+	runner.run (0, blocks);
+  }
 
-  double np = n00p + n11p + n22p + n33p;
-  double dp = d11p + d22p + d33p + d44p;
-  double nm = n11m + n22m + n33m + n44m;
-  double dm = d11m + d22m + d33m + d44m;
-  double zp = np / (1 + dp);
-  double zm = nm / (1 + dm);
+  return output;
+}
 
-  if (direction == Horizontal)
+void
+ConvolutionRecursive1D::block (const ConvolutionRecursive1D & c, const ImageOf<double> & input, ImageOf<double> & output, int b)
+{
+  const int w = input.width;
+  const int h = input.height;
+  const PixelBufferPacked * ib = (PixelBufferPacked *) input.buffer;
+  const PixelBufferPacked * ob = (PixelBufferPacked *) output.buffer;
+  const double * in  = (double *) ib->base ();
+  double *       out = (double *) ob->base ();
+  const int istride = ib->stride / sizeof (double);
+  const int ostride = ob->stride / sizeof (double);
+
+  const int first = b * lanes;
+  if (c.direction == Vertical)
   {
-	for (int y = 0; y < h; y++)
-	{
-	  p(0,y) = zp * i(0,y);
-	  p(1,y) =   n00p * i(1,y) + n11p * i(0,y)
-		       + n22p * i(0,y) + n33p * i(0,y)
-		       - dp * p(0,y);
-	  p(2,y) =   n00p * i(2,y) + n11p * i(1,y)
-		       + n22p * i(0,y) + n33p * i(0,y)
-		       - d11p * p(1,y) - d22p * p(0,y)
-		       - d33p * p(0,y) - d44p * p(0,y);
-	  p(3,y) =   n00p * i(3,y) + n11p * i(2,y)
-		       + n22p * i(1,y) + n33p * i(0,y)
-		       - d11p * p(2,y) - d22p * p(1,y)
-		       - d33p * p(0,y) - d44p * p(0,y);
-
-	  for (int x = 4; x < w; x++)
-	  {
-		p(x,y) =   n00p * i(x,  y) + n11p * i(x-1,y)
-		         + n22p * i(x-2,y) + n33p * i(x-3,y)
-		         - d11p * p(x-1,y) - d22p * p(x-2,y)
-		         - d33p * p(x-3,y) - d44p * p(x-4,y);
-	  }
-
-	  m(w-1,y) = zm * i(w-1,y);
-	  m(w-2,y) = nm * i(w-1,y) - dm * m(w-1,y);
-	  m(w-3,y) =   n11m * i(w-2,y) + n22m * i(w-1,y)
-		         + n33m * i(w-1,y) + n44m * i(w-1,y)
-		         - d11m * m(w-2,y) - d22m * m(w-1,y)
-		         - d33m * m(w-1,y) - d44m * m(w-1,y);
-	  m(w-4,y) =   n11m * i(w-3,y) + n22m * i(w-2,y)
-		         + n33m * i(w-1,y) + n44m * i(w-1,y)
-		         - d11m * m(w-3,y) - d22m * m(w-2,y)
-		         - d33m * m(w-1,y) - d44m * m(w-1,y);
-
-	  for (int x = w-5; x >= 0; x--)
-	  {
-		m(x,y) =   n11m * i(x+1,y) + n22m * i(x+2,y)
-		         + n33m * i(x+3,y) + n44m * i(x+4,y)
-		         - d11m * m(x+1,y) - d22m * m(x+2,y)
-		         - d33m * m(x+3,y) - d44m * m(x+4,y);
-	  }
-	}
+	int last = min (w, first + lanes);
+	if (last - first == lanes) recurseLanes (c, in + first, istride, out + first, ostride, h);
+	else for (int x = first; x < last; x++) recurse<double> (c, in + x, istride, out + x, ostride, h);
+	return;
   }
-  else  // direction == Vertical
+
+  int last = min (h, first + lanes);
+  if (last - first < lanes)
   {
-	for (int x = 0; x < w; x++)
-	{
-	  p(x,0) = zp * i(x,0);
-	  p(x,1) =   n00p * i(x,1) + n11p * i(x,0)
-		       + n22p * i(x,0) + n33p * i(x,0)
-		       - dp * p(x,0);
-	  p(x,2) =   n00p * i(x,2) + n11p * i(x,1)
-		       + n22p * i(x,0) + n33p * i(x,0)
-		       - d11p * p(x,1) - d22p * p(x,0)
-		       - d33p * p(x,0) - d44p * p(x,0);
-	  p(x,3) =   n00p * i(x,3) + n11p * i(x,2)
-		       + n22p * i(x,1) + n33p * i(x,0)
-		       - d11p * p(x,2) - d22p * p(x,1)
-		       - d33p * p(x,0) - d44p * p(x,0);
-
-	  for (int y = 4; y < h; y++)
-	  {
-		p(x,y) =   n00p * i(x,y)   + n11p * i(x,y-1)
-		         + n22p * i(x,y-2) + n33p * i(x,y-3)
-		         - d11p * p(x,y-1) - d22p * p(x,y-2)
-		         - d33p * p(x,y-3) - d44p * p(x,y-4);
-	  }
-
-
-	  m(x,h-1) = zm * i(x,h-1);
-	  m(x,h-2) = nm * i(x,h-1) - dm * m(x,h-1);
-	  m(x,h-3) =   n11m * i(x,h-2) + n22m * i(x,h-1)
-		         + n33m * i(x,h-1) + n44m * i(x,h-1)
-		         - d11m * m(x,h-2) - d22m * m(x,h-1)
-		         - d33m * m(x,h-1) - d44m * m(x,h-1);
-	  m(x,h-4) =   n11m * i(x,h-3) + n22m * i(x,h-2)
-		         + n33m * i(x,h-1) + n44m * i(x,h-1)
-		         - d11m * m(x,h-3) - d22m * m(x,h-2)
-		         - d33m * m(x,h-1) - d44m * m(x,h-1);
-
-	  for (int y = h-5; y >= 0; y--)
-	  {
-		m(x,y) =   n11m * i(x,y+1) + n22m * i(x,y+2)
-		         + n33m * i(x,y+3) + n44m * i(x,y+4)
-		         - d11m * m(x,y+1) - d22m * m(x,y+2)
-		         - d33m * m(x,y+3) - d44m * m(x,y+4);
-	  }
-	}
+	for (int y = first; y < last; y++) recurse<double> (c, in + y * istride, 1, out + y * ostride, 1, w);
+	return;
   }
 
-  p = p + m;
-  p *= scale;
-
-  return p;
+  vector<double> scratch (2 * w * lanes);
+  double * t = &scratch[0];
+  double * u = t + w * lanes;
+  for (int j = 0; j < lanes; j++)
+  {
+	const double * row = in + (first + j) * istride;
+	for (int x = 0; x < w; x++) t[x * lanes + j] = row[x];
+  }
+  recurseLanes (c, t, lanes, u, lanes, w);
+  for (int j = 0; j < lanes; j++)
+  {
+	double * row = out + (first + j) * ostride;
+	for (int x = 0; x < w; x++) row[x] = u[x * lanes + j];
+  }
 }
 
 double
@@ -192,6 +306,8 @@ ConvolutionRecursive1D::set_nii_and_dii (double sigma, double a0, double a1, dou
 
 GaussianRecursive1D::GaussianRecursive1D (double sigma, const Direction direction)
 {
+  this->direction = direction;
+
   double a0 =  1.68;
   double a1 =  3.735;
   double b0 =  1.783;
@@ -221,6 +337,8 @@ GaussianRecursive1D::GaussianRecursive1D (double sigma, const Direction directio
 
 GaussianDerivativeRecursive1D::GaussianDerivativeRecursive1D (double sigma, const Direction direction)
 {
+  this->direction = direction;
+
   double a0 = -0.6472;
   double a1 = -4.531;
   double b0 =  1.527;
@@ -250,6 +368,8 @@ GaussianDerivativeRecursive1D::GaussianDerivativeRecursive1D (double sigma, cons
 
 GaussianDerivativeSecondRecursive1D::GaussianDerivativeSecondRecursive1D (double sigma, const Direction direction)
 {
+  this->direction = direction;
+
   double a0 = -1.331;
   double a1 =  3.661;
   double b0 =  1.24;
@@ -15,12 +15,149 @@ for details.
 
 
 #include "fl/descriptor.h"
+#include "fl/thread.h"
+
+#include <exception>
 
 
 using namespace std;
 using namespace fl;
 
 
+/**
+   Computes the feature vector of one point and stores it in the given column
+   of result.  An empty feature vector, which some descriptors return when
+   they can't handle a point, produces a column of zeros.
+**/
+static void
+describe (Descriptor & descriptor, ImageCache & cache, const Point * p, Matrix<float> & result, int column)
+{
+  Vector<float> value;
+  const PointAffine * a = dynamic_cast<const PointAffine *> (p);
+  if (a)
+  {
+	value = descriptor.value (cache, *a);
+  }
+  else
+  {
+	// Start from the Point part only, because copying a PointInterest would
+	// share ownership of its descriptor_.
+	PointAffine temp (*p);
+	const PointInterest * i = dynamic_cast<const PointInterest *> (p);
+	if (i)
+	{
+	  temp.weight   = i->weight;
+	  temp.scale    = i->scale;
+	  temp.detector = i->detector;
+	}
+	value = descriptor.value (cache, temp);
+  }
+
+  const int rows = result.rows ();
+  float * r = &result(0,column);
+  if (value.rows () == 0)
+  {
+	for (int j = 0; j < rows; j++) r[j] = 0;
+  }
+  else
+  {
+	if (value.rows () != rows) throw "Descriptor returned a feature vector of unexpected size";
+	for (int j = 0; j < rows; j++) r[j] = value[j];
+  }
+}
+
+
+// class DescribeRunner -------------------------------------------------------
+
+namespace
+{
+/**
+   Does the work of Descriptor::values().  Points are handed out in chunks.
+   Each chunk borrows a private copy of the descriptor from a pool, so no more
+   copies are made than there are threads.
+**/
+class DescribeRunner : public ParallelFor<int>
+{
+public:
+  DescribeRunner (Descriptor & owner, ImageCache & cache, const PointSet & points, Matrix<float> & result, int first, int chunk, float threadRequest)
+  : ParallelFor<int> (threadRequest),
+	owner (owner),
+	cache (cache),
+	points (points),
+	result (result),
+	first (first),
+	chunk (chunk)
+  {
+	Descriptor * d = owner.clone ();
+	shared = ! d;
+	if (d)
+	{
+	  clones.push_back (d);
+	  idle.push_back (d);
+	}
+  }
+
+  ~DescribeRunner ()
+  {
+	for (int i = 0; i < clones.size (); i++) delete clones[i];
+  }
+
+  Descriptor * acquire ()
+  {
+	if (shared) return &owner;
+	std::lock_guard<std::mutex> lock (mutexWorkspace);
+	if (idle.size ())
+	{
+	  Descriptor * d = idle.back ();
+	  idle.pop_back ();
+	  return d;
+	}
+	Descriptor * d = owner.clone ();
+	clones.push_back (d);
+	return d;
+  }
+
+  void release (Descriptor * d)
+  {
+	if (shared) return;
+	std::lock_guard<std::mutex> lock (mutexWorkspace);
+	idle.push_back (d);
+  }
+
+  virtual void process (const int c)
+  {
+	Descriptor * d = 0;
+	try
+	{
+	  d = acquire ();
+	  int lo = first + c * chunk;
+	  int hi = min ((int) points.size (), lo + chunk);
+	  for (int i = lo; i < hi; i++) describe (*d, cache, points[i], result, i);
+	}
+	catch (...)  // Anything that escapes a worker thread would terminate the process, so carry it back to the caller of run().
+	{
+	  std::lock_guard<std::mutex> lock (mutexError);
+	  if (! error) error = std::current_exception ();
+	}
+	if (d) release (d);
+  }
+
+  Descriptor &              owner;
+  ImageCache &              cache;
+  const PointSet &          points;
+  Matrix<float> &           result;
+  int                       first;   ///< Index of first point to describe.
+  int                       chunk;   ///< Number of points per job.
+  bool                      shared;  ///< owner.clone() returned 0, so all threads use owner directly.
+  std::vector<Descriptor *> clones;  ///< Every copy we made, for destruction.
+  std::vector<Descriptor *> idle;    ///< Copies not currently in use by a thread.
+  std::mutex                mutexWorkspace;
+  std::exception_ptr        error;   ///< First exception thrown by any chunk.
+  std::mutex                mutexError;
+};
+}
+
+
 // class Descriptor -----------------------------------------------------------
 
 uint32_t Descriptor::serializeVersion = 0;
@@ -80,6 +217,38 @@ Descriptor::dimension ()
   return 0;
 }
 
+Matrix<float>
+Descriptor::values (ImageCache & cache, const PointSet & points, float threadRequest)
+{
+  const int rows  = dimension ();
+  const int count = points.size ();
+  if (! rows) throw "values() requires a descriptor with fixed dimension";
+  Matrix<float> result (rows, count);
+  if (! count) return result;
+
+  // Describe the first point on this thread, so that any lazy initialization
+  // of this object finishes before it is cloned or shared.
+  describe (*this, cache, points[0], result, 0);
+
+  if (threadRequest == 1)
+  {
+	for (int i = 1; i < count; i++) describe (*this, cache, points[i], result, i);
+	return result;
+  }
+
+  const int chunk = 16;
+  DescribeRunner runner (*this, cache, points, result, 1, chunk, threadRequest);
+  runner.run (0, (count - 1 + chunk - 1) / chunk);
+  if (runner.error) std::rethrow_exception (runner.error);
+  return result;
+}
+
+Descriptor *
+Descriptor::clone () const
+{
+  return 0;
+}
+
 void
 Descriptor::serialize (Archive & archive, uint32_t version)
 {
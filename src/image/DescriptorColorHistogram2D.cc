@@ -278,6 +278,12 @@ DescriptorColorHistogram2D::dimension ()
   return dim;
 }
 
+Descriptor *
+DescriptorColorHistogram2D::clone () const
+{
+  return new DescriptorColorHistogram2D (width, supportRadial);
+}
+
 void
 DescriptorColorHistogram2D::serialize (Archive & archive, uint32_t version)
 {
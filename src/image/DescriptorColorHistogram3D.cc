@@ -343,6 +343,12 @@ DescriptorColorHistogram3D::dimension ()
   return dim;
 }
 
+Descriptor *
+DescriptorColorHistogram3D::clone () const
+{
+  return new DescriptorColorHistogram3D (width, height, supportRadial);
+}
+
 void
 DescriptorColorHistogram3D::serialize (Archive & archive, uint32_t version)
 {
@@ -119,6 +119,20 @@ DescriptorCombo::dimension ()
   return dim;
 }
 
+Matrix<float>
+DescriptorCombo::values (ImageCache & cache, const PointSet & points, float threadRequest)
+{
+  Matrix<float> result (dimension (), points.size ());
+  int r = 0;
+  for (int i = 0; i < descriptors.size (); i++)
+  {
+	Matrix<float> value = descriptors[i]->values (cache, points, threadRequest);
+	if (value.columns ()) result.region (r, 0) = value;
+	r += value.rows ();
+  }
+  return result;
+}
+
 void
 DescriptorCombo::serialize (Archive & archive, uint32_t version)
 {
@@ -37,7 +37,7 @@ public:
 
   virtual void generate (ImageCache & cache)
   {
-	ImageOf<float> grayImage = cache.get (new EntryPyramid (GrayFloat))->image;
+	ImageOf<float> grayImage = cache.acquire (new EntryPyramid (GrayFloat))->image;
 	image.format = &GrayChar;
 	image.resize (grayImage.width, grayImage.height);
 
@@ -153,7 +153,7 @@ DescriptorLBP::initialize ()
 Vector<float>
 DescriptorLBP::value (ImageCache & cache, const PointAffine & point)
 {
-  Image image = cache.get (new EntryPyramid (GrayFloat))->image;
+  Image image = cache.acquire (new EntryPyramid (GrayFloat))->image;
 
   Matrix<double> S = ! point.rectification ();
   S(2,0) = 0;
@@ -173,7 +173,7 @@ DescriptorLBP::value (ImageCache & cache, const PointAffine & point)
 	sourceR = (int) roundp (min (S(0,2) + h, (double) image.width - 1 - R));
 	sourceT = (int) roundp (max (S(1,2) - v, (double) R));
 	sourceB = (int) roundp (min (S(1,2) + v, (double) image.height - 1 - R));
-	categoryImage = cache.get (new EntryLBP (*this))->image;
+	categoryImage = cache.acquire (new EntryLBP (*this))->image;
   }
   else  // Shape change, so we must compute a transformed patch
   {
@@ -184,7 +184,7 @@ DescriptorLBP::value (ImageCache & cache, const PointAffine & point)
 	Image patch = image * t;
 	ImageCache tempCache;
 	tempCache.setOriginal (patch);
-	categoryImage = tempCache.get (new EntryLBP (*this))->image;
+	categoryImage = tempCache.acquire (new EntryLBP (*this))->image;
 
 	sourceT = (int) ceilf (R);
 	sourceL = sourceT;
@@ -210,7 +210,7 @@ Vector<float>
 DescriptorLBP::value (ImageCache & cache)
 {
   Image image = cache.original->image;
-  ImageOf<uint8_t> categoryImage = cache.get (new EntryLBP (*this))->image;
+  ImageOf<uint8_t> categoryImage = cache.acquire (new EntryLBP (*this))->image;
   int sourceL = (int) ceilf (R);
   int sourceR = (int) floorf (categoryImage.width - 1 - R);
   int sourceT = sourceL;
@@ -38,17 +38,16 @@ DescriptorOrientationHistogram::DescriptorOrientationHistogram (float supportRad
 Vector<float>
 DescriptorOrientationHistogram::value (ImageCache & cache, const PointAffine & point)
 {
-  // First, grab the patch and prepare the derivative images I_x and I_y.
-
   // Find or generate gray image at appropriate blur level
   const float scaleTolerance = pow (2.0f, -1.0f / 6);  // TODO: parameterize "6", should be 2 * octaveSteps
-  EntryPyramid * entry = (EntryPyramid *) cache.getClosest (new EntryPyramid (GrayFloat, point.scale));
-  if (! entry  ||  scaleTolerance > (entry->scale > point.scale ? point.scale / entry->scale : entry->scale / point.scale))
+  // Both entry and gradient are held, so neither can be evicted while the other is fetched.
+  PointerPoly<EntryPyramid> entry = (EntryPyramid *) cache.acquireClosest (new EntryPyramid (GrayFloat, point.scale));
+  if (! entry.memory  ||  scaleTolerance > (entry->scale > point.scale ? point.scale / entry->scale : entry->scale / point.scale))
   {
-	entry = (EntryPyramid *) cache.getLE (new EntryPyramid (GrayFloat, point.scale));
-	if (! entry)  // No smaller image exists, which means base level image (scale == 0.5) does not exist.
+	entry = (EntryPyramid *) cache.acquireLE (new EntryPyramid (GrayFloat, point.scale));
+	if (! entry.memory)  // No smaller image exists, which means base level image (scale == 0.5) does not exist.
 	{
-	  entry = (EntryPyramid *) cache.get (new EntryPyramid (GrayFloat));
+	  entry = (EntryPyramid *) cache.acquire (new EntryPyramid (GrayFloat));
 	}
   }
   const float octave = (float) cache.original->image.width / entry->image.width;
@@ -57,56 +56,106 @@ DescriptorOrientationHistogram::value (ImageCache & cache, const PointAffine & p
   p.y = (p.y + 0.5f) / octave - 0.5f;
   p.scale /= octave;
 
-  Image patch;
-  float sigma;
-  float radius;
-  if (entry->image.width == entry->image.height  &&  p.angle == 0  &&  fabs (2.0f * p.scale * supportRadial - entry->image.width) < 0.5)
+  float * histogram = new float[bins];
+  memset (histogram, 0, bins * sizeof (float));
+
+  bool whole = entry->image.width == entry->image.height  &&  p.angle == 0  &&  fabs (2.0f * p.scale * supportRadial - entry->image.width) < 0.5;
+  bool similar = p.A(0,0) == 1  &&  p.A(0,1) == 0  &&  p.A(1,0) == 0  &&  p.A(1,1) == 1;
+  const int originalWidth = cache.original->image.width;
+  const int sampleWidth = EntryGradient::levelWidth (originalWidth, entry->scale, entry->image.width);
+  if (similar  &&  ! whole  &&  supportRadial * point.scale * sampleWidth <= M_SQRT2 * supportPixel * originalWidth)
   {
-	// patch == entire image, so no need to transform
-	// Note that the test above should also verify that p is at the center
-	// of the image.  However, if the other tests pass, then this is almost
-	// certainly the case.
-	patch = entry->image;
-	radius = p.scale * supportRadial;
-	sigma = p.scale;
+	// No shape change, so take gradients straight from a pyramid level,
+	// decimated as far as its blur allows.  This beats warping a patch as
+	// long as the support region covers no more than about twice as many
+	// pixels as the patch would.
+	PointerPoly<EntryGradient> gradient = (EntryGradient *) cache.acquire (new EntryGradient (entry->scale, sampleWidth));
+	const float ratio = (float) originalWidth / gradient->image.width;
+	p = point;
+	p.x = (p.x + 0.5f) / ratio - 0.5f;
+	p.y = (p.y + 0.5f) / ratio - 0.5f;
+	p.scale /= ratio;
+	ImageOf<float> magnitude = gradient->image;
+	ImageOf<float> & direction = gradient->angle;
+	const float radius = p.scale * supportRadial;
+	const float radius2 = radius * radius;
+	const float sigma2 = 2.0 * p.scale * p.scale;
+	const int left   = max (0,                    (int) ceilf  (p.x - radius));
+	const int right  = min (magnitude.width  - 1, (int) floorf (p.x + radius));
+	const int top    = max (0,                    (int) ceilf  (p.y - radius));
+	const int bottom = min (magnitude.height - 1, (int) floorf (p.y + radius));
+	for (int y = top; y <= bottom; y++)
+	{
+	  float cy = y - p.y;
+	  for (int x = left; x <= right; x++)
+	  {
+		float cx = x - p.x;
+		float d2 = cx * cx + cy * cy;
+		if (d2 < radius2)
+		{
+		  float angle = direction(x,y) - p.angle;  // relative to the frame of p, as in a rectified patch
+		  if      (angle <  -M_PI) angle += TWOPI;
+		  else if (angle >=  M_PI) angle -= TWOPI;
+		  int bin = (int) ((angle + M_PI) * bins / TWOPI);
+		  bin = min (bin, bins - 1);
+		  bin = max (bin, 0);
+		  histogram[bin] += magnitude(x,y) * expf (- d2 / sigma2);
+		}
+	  }
+	}
   }
   else
   {
-	int patchSize = 2 * supportPixel;
-	const double patchScale = supportPixel / supportRadial;
-	Transform t (p.projection (), patchScale);
-	t.setWindow (0, 0, patchSize, patchSize);
-	patch = entry->image * t;
-	radius = supportPixel;
-	sigma = supportPixel / supportRadial;
-  }
+	// Grab the patch and prepare the derivative images I_x and I_y.
+	Image patch;
+	float sigma;
+	float radius;
+	if (whole)
+	{
+	  // patch == entire image, so no need to transform
+	  // Note that the test above should also verify that p is at the center
+	  // of the image.  However, if the other tests pass, then this is almost
+	  // certainly the case.
+	  patch = entry->image;
+	  radius = p.scale * supportRadial;
+	  sigma = p.scale;
+	}
+	else
+	{
+	  int patchSize = 2 * supportPixel;
+	  const double patchScale = supportPixel / supportRadial;
+	  Transform t (p.projection (), patchScale);
+	  t.setWindow (0, 0, patchSize, patchSize);
+	  patch = entry->image * t;
+	  radius = supportPixel;
+	  sigma = supportPixel / supportRadial;
+	}
 
-  ImageOf<float> I_x = patch * FiniteDifference (Horizontal);
-  ImageOf<float> I_y = patch * FiniteDifference (Vertical);
+	ImageOf<float> I_x = patch * FiniteDifference (Horizontal);
+	ImageOf<float> I_y = patch * FiniteDifference (Vertical);
 
-  // Second, gather up the gradient histogram.
-  float * histogram = new float[bins];
-  memset (histogram, 0, bins * sizeof (float));
-  float radius2 = radius * radius;
-  float sigma2 = 2.0 * sigma * sigma;
-  Point center ((patch.width - 1) / 2.0, (patch.height - 1) / 2.0);
-  for (int y = 0; y < patch.height; y++)
-  {
-	for (int x = 0; x < patch.width; x++)
+	// Gather up the gradient histogram.
+	float radius2 = radius * radius;
+	float sigma2 = 2.0 * sigma * sigma;
+	Point center ((patch.width - 1) / 2.0, (patch.height - 1) / 2.0);
+	for (int y = 0; y < patch.height; y++)
 	{
-	  float cx = x - center.x;
-	  float cy = y - center.y;
-	  float d2 = cx * cx + cy * cy;
-	  if (d2 < radius2)
+	  for (int x = 0; x < patch.width; x++)
 	  {
-		float dx = I_x(x,y);
-		float dy = I_y(x,y);
-		float angle = atan2 (dy, dx);
-		int bin = (int) ((angle + M_PI) * bins / TWOPI);
-		bin = min (bin, bins - 1);  // Technically, these two lines should not be necessary.  They compensate for numerical jitter.
-		bin = max (bin, 0);
-		float weight = sqrtf (dx * dx + dy * dy) * expf (- (cx * cx + cy * cy) / sigma2);
-		histogram[bin] += weight;
+		float cx = x - center.x;
+		float cy = y - center.y;
+		float d2 = cx * cx + cy * cy;
+		if (d2 < radius2)
+		{
+		  float dx = I_x(x,y);
+		  float dy = I_y(x,y);
+		  float angle = atan2 (dy, dx);
+		  int bin = (int) ((angle + M_PI) * bins / TWOPI);
+		  bin = min (bin, bins - 1);  // Technically, these two lines should not be necessary.  They compensate for numerical jitter.
+		  bin = max (bin, 0);
+		  float weight = sqrtf (dx * dx + dy * dy) * expf (- (cx * cx + cy * cy) / sigma2);
+		  histogram[bin] += weight;
+		}
 	  }
 	}
   }
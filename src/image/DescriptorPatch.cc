@@ -38,12 +38,12 @@ Vector<float>
 DescriptorPatch::value (ImageCache & cache, const PointAffine & point)
 {
   // Find or generate gray image at appropriate blur level
-  EntryPyramid * entry = (EntryPyramid *) cache.getLE (new EntryPyramid (GrayFloat, point.scale));
+  PointerPoly<EntryPyramid> entry = (EntryPyramid *) cache.acquireLE (new EntryPyramid (GrayFloat, point.scale));
   float originalScale = cache.original->scale;
   float targetScale = originalScale * pow (2.0, EntryPyramid::octave (point.scale, originalScale));
-  if (! entry  ||  entry->scale < targetScale)
+  if (! entry.memory  ||  entry->scale < targetScale)
   {
-	entry = (EntryPyramid *) cache.get (new EntryPyramid (GrayFloat, targetScale));
+	entry = (EntryPyramid *) cache.acquire (new EntryPyramid (GrayFloat, targetScale));
   }
 
   // Adjust point position to scale of selected image
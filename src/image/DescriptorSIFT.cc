@@ -97,20 +97,91 @@ DescriptorSIFT::getKernel (int size)
   return & (* it->second)(0,0);
 }
 
+/**
+   Uses trilinear method to distribute weight to 8 adjacent bins in histogram.
+   (qx, qy) is position in bin units and angle is in units of angleStep.
+   Dimensions of result are: y, x, angle.
+**/
+static inline void
+distribute (float * r, const int width, const int angles, const float qx, const float qy, const float angle, const float weight)
+{
+  const int yl = (int) floorf (qy);
+  const int yh = yl + 1;
+  const float yf = qy - yl;
+  const float yf1 = 1.0f - yf;
+
+  const int xl = (int) floorf (qx);
+  const int xh = xl + 1;
+  const float xf = qx - xl;
+
+  const int al = (int) floorf (angle);
+  int ah = al + 1;
+  if (ah >= angles)
+  {
+	ah = 0;
+  }
+  const float af = angle - al;
+  const float af1 = 1.0f - af;
+
+  // Variable naming scheme for pointers: r{row}{column}
+  // Below are base pointers for the rows...
+  const int rowStep = width * angles;
+  float * const rl = r + yl * rowStep;
+  float * const rh = rl + rowStep;
+
+  int step = xl * angles;
+  if (xl >= 0)
+  {
+	const float xweight = (1.0f - xf) * weight;
+	if (yl >= 0)
+	{
+	  float yweight = yf1 * xweight;
+	  float * rll = rl + step;
+	  rll[al] += af1 * yweight;
+	  rll[ah] += af  * yweight;
+	}
+	if (yh < width)
+	{
+	  float yweight = yf * xweight;
+	  float * rhl = rh + step;
+	  rhl[al] += af1 * yweight;
+	  rhl[ah] += af  * yweight;
+	}
+  }
+  step += angles;
+  if (xh < width)
+  {
+	const float xweight = xf * weight;
+	if (yl >= 0)
+	{
+	  float yweight = yf1 * xweight;
+	  float * rlh = rl + step;
+	  rlh[al] += af1 * yweight;
+	  rlh[ah] += af  * yweight;
+	}
+	if (yh < width)
+	{
+	  float yweight = yf * xweight;
+	  float * rhh = rh + step;
+	  rhh[al] += af1 * yweight;
+	  rhh[ah] += af  * yweight;
+	}
+  }
+}
+
 Vector<float>
 DescriptorSIFT::value (ImageCache & cache, const PointAffine & point)
 {
-  // First, grab the patch and prepeare the derivative images I_x and I_y.
-
   // Find or generate gray image at appropriate blur level
   const float scaleTolerance = pow (2.0f, -1.0f / 6);  // TODO: parameterize "6", should be 2 * octaveSteps
-  EntryPyramid * entry = (EntryPyramid *) cache.getClosest (new EntryPyramid (GrayFloat, point.scale));
-  if (! entry  ||  scaleTolerance > (entry->scale > point.scale ? point.scale / entry->scale : entry->scale / point.scale))
+  // Both entry and gradient are held, so neither can be evicted while the other is fetched.
+  PointerPoly<EntryPyramid> entry = (EntryPyramid *) cache.acquireClosest (new EntryPyramid (GrayFloat, point.scale));
+  if (! entry.memory  ||  scaleTolerance > (entry->scale > point.scale ? point.scale / entry->scale : entry->scale / point.scale))
   {
-	entry = (EntryPyramid *) cache.getLE (new EntryPyramid (GrayFloat, point.scale));
-	if (! entry)  // No smaller image exists, which means base level image (scale == 0.5) does not exist.
+	entry = (EntryPyramid *) cache.acquireLE (new EntryPyramid (GrayFloat, point.scale));
+	if (! entry.memory)  // No smaller image exists, which means base level image (scale == 0.5) does not exist.
 	{
-	  entry = (EntryPyramid *) cache.get (new EntryPyramid (GrayFloat));
+	  entry = (EntryPyramid *) cache.acquire (new EntryPyramid (GrayFloat));
 	}
   }
   const float octave = (float) cache.original->image.width / entry->image.width;
@@ -119,119 +190,76 @@ DescriptorSIFT::value (ImageCache & cache, const PointAffine & point)
   p.y = (p.y + 0.5f) / octave - 0.5f;
   p.scale /= octave;
 
-  Image patch;
-  if (entry->image.width == entry->image.height  &&  p.angle == 0  &&  fabs (2.0f * p.scale * supportRadial - entry->image.width) < 0.5)
+  Vector<float> result (width * width * angles);
+  result.clear ();
+
+  // patch == entire image, so no need to transform
+  // Note that the test below should also verify that p is at the center
+  // of the image.  However, if the other tests pass, then this is almost
+  // certainly the case.
+  bool whole = entry->image.width == entry->image.height  &&  p.angle == 0  &&  fabs (2.0f * p.scale * supportRadial - entry->image.width) < 0.5;
+  bool similar = p.A(0,0) == 1  &&  p.A(0,1) == 0  &&  p.A(1,0) == 0  &&  p.A(1,1) == 1;
+  const int originalWidth = cache.original->image.width;
+  const int sampleWidth = EntryGradient::levelWidth (originalWidth, entry->scale, entry->image.width);
+  if (similar  &&  ! whole  &&  supportRadial * point.scale * sampleWidth <= M_SQRT2 * supportPixel * originalWidth)
   {
-	// patch == entire image, so no need to transform
-	// Note that the test above should also verify that p is at the center
-	// of the image.  However, if the other tests pass, then this is almost
-	// certainly the case.
-	patch = entry->image;
+	// No shape change, so take gradients straight from a pyramid level,
+	// decimated as far as its blur allows.  This beats warping a patch as
+	// long as the support region covers no more than about twice as many
+	// pixels as the patch would.
+	PointerPoly<EntryGradient> gradient = (EntryGradient *) cache.acquire (new EntryGradient (entry->scale, sampleWidth));
+	const float ratio = (float) originalWidth / gradient->image.width;
+	p = point;
+	p.x = (p.x + 0.5f) / ratio - 0.5f;
+	p.y = (p.y + 0.5f) / ratio - 0.5f;
+	p.scale /= ratio;
+	sample (*gradient, p, &result[0]);
   }
   else
   {
-	int patchSize = 2 * supportPixel;
-	const double patchScale = supportPixel / supportRadial;
-	Transform t (p.projection (), patchScale);
-	t.setWindow (0, 0, patchSize, patchSize);
-	patch = entry->image * t;
-  }
-  float * g = getKernel (patch.width);
-
-  ImageOf<float> I_x = patch * fdX;
-  ImageOf<float> I_y = patch * fdY;
-
-  const float keyScale = (float) width / patch.width;
-  const float keyOffset = 0.5f * keyScale - 0.5f;
-
-  const int rowStep = width * angles;
-
-  // Second, gather up the gradient histogram that constitutes the SIFT key.
-  Vector<float> result (width * width * angles);
-  result.clear ();
-  float * r = & result[0];
-  float * dx = & I_x(0,0);
-  float * dy = & I_y(0,0);
-  float qy = keyOffset;
-  for (int y = 0; y < I_x.height; y++)
-  {
-	float qx = keyOffset;
+	// Grab the patch and prepare the derivative images I_x and I_y.
+	Image patch;
+	if (whole)
+	{
+	  patch = entry->image;
+	}
+	else
+	{
+	  int patchSize = 2 * supportPixel;
+	  const double patchScale = supportPixel / supportRadial;
+	  Transform t (p.projection (), patchScale);
+	  t.setWindow (0, 0, patchSize, patchSize);
+	  patch = entry->image * t;
+	}
+	float * g = getKernel (patch.width);
 
-	const int yl = (int) floorf (qy);
-	const int yh = yl + 1;
-	const float yf = qy - yl;
-	const float yf1 = 1.0f - yf;
+	ImageOf<float> I_x = patch * fdX;
+	ImageOf<float> I_y = patch * fdY;
 
-	// Variable naming scheme for pointers: r{row}{column}
-	// Below are base pointers for the rows...
-	float * const rl = r + yl * rowStep;
-	float * const rh = rl + rowStep;
+	const float keyScale = (float) width / patch.width;
+	const float keyOffset = 0.5f * keyScale - 0.5f;
 
-	for (int x = 0; x < I_x.width; x++)
+	// Gather up the gradient histogram that constitutes the SIFT key.
+	float * r = & result[0];
+	float * dx = & I_x(0,0);
+	float * dy = & I_y(0,0);
+	float qy = keyOffset;
+	for (int y = 0; y < I_x.height; y++)
 	{
-	  float angle = atan2 (*dy, *dx);
-	  if (angle < 0.0f) angle += angleRange;
-	  angle /= angleStep;
-	  const float weight = sqrtf (*dx * *dx + *dy * *dy) * *g++;
-	  dx++;
-	  dy++;
-
-	  const int xl = (int) floorf (qx);
-	  const int xh = xl + 1;
-	  const float xf = qx - xl;
-
-	  const int al = (int) floorf (angle);
-	  int ah = al + 1;
-	  if (ah >= angles)
-	  {
-		ah = 0;
-	  }
-	  const float af = angle - al;
-	  const float af1 = 1.0f - af;
-
-	  // Use trilinear method to distribute weight to 8 adjacent bins in histogram.
-	  int step = xl * angles;
-	  if (xl >= 0)
-	  {
-		const float xweight = (1.0f - xf) * weight;
-		if (yl >= 0)
-		{
-		  float yweight = yf1 * xweight;
-		  float * rll = rl + step;
-		  rll[al] += af1 * yweight;
-		  rll[ah] += af  * yweight;
-		}
-		if (yh < width)
-		{
-		  float yweight = yf * xweight;
-		  float * rhl = rh + step;
-		  rhl[al] += af1 * yweight;
-		  rhl[ah] += af  * yweight;
-		}
-	  }
-	  step += angles;
-	  if (xh < width)
+	  float qx = keyOffset;
+	  for (int x = 0; x < I_x.width; x++)
 	  {
-		const float xweight = xf * weight;
-		if (yl >= 0)
-		{
-		  float yweight = yf1 * xweight;
-		  float * rlh = rl + step;
-		  rlh[al] += af1 * yweight;
-		  rlh[ah] += af  * yweight;
-		}
-		if (yh < width)
-		{
-		  float yweight = yf * xweight;
-		  float * rhh = rh + step;
-		  rhh[al] += af1 * yweight;
-		  rhh[ah] += af  * yweight;
-		}
+		float angle = atan2 (*dy, *dx);
+		if (angle < 0.0f) angle += angleRange;
+		angle /= angleStep;
+		const float weight = sqrtf (*dx * *dx + *dy * *dy) * *g++;
+		dx++;
+		dy++;
+		distribute (r, width, angles, qx, qy, angle, weight);
+		qx += keyScale;
 	  }
-
-	  qx += keyScale;
+	  qy += keyScale;
 	}
-	qy += keyScale;
   }
 
   result.normalize ();
@@ -252,6 +280,70 @@ DescriptorSIFT::value (ImageCache & cache, const PointAffine & point)
   return result;
 }
 
+/**
+   Visits every pixel of the pyramid level that falls inside the square
+   support region of p, and rotates its position and gradient into the frame
+   of p.  The weights are the same Gaussian as getKernel(), so the result
+   agrees with the patch method up to resampling.
+   @param p Point in the coordinates of the pyramid level.  Must have no
+   shape change (A is identity).
+**/
+void
+DescriptorSIFT::sample (const EntryGradient & gradient, const PointAffine & p, float * r)
+{
+  ImageOf<float> magnitude = gradient.image;
+  const ImageOf<float> & direction = gradient.angle;
+
+  const float c = cosf (p.angle);
+  const float s = sinf (p.angle);
+  const float toBin  = width / (2 * supportRadial * p.scale);  // bins per pixel
+  const float half   = width / 2.0f;
+  const float center = (width - 1) / 2.0f;
+  const float sigma2 = 2.0f * sigmaWeight * sigmaWeight;
+
+  const float radius = M_SQRT2 * supportRadial * p.scale;
+  const int left   = max (0,                    (int) ceilf  (p.x - radius));
+  const int right  = min (magnitude.width  - 1, (int) floorf (p.x + radius));
+  const int top    = max (0,                    (int) ceilf  (p.y - radius));
+  const int bottom = min (magnitude.height - 1, (int) floorf (p.y + radius));
+  if (left > right  ||  top > bottom) return;
+
+  // The Gaussian weight doesn't depend on rotation, so it factors into a
+  // column term and a row term.
+  const float k = toBin * toBin / sigma2;
+  vector<float> weightX (right - left + 1);
+  for (int x = left; x <= right; x++)
+  {
+	const float dx = x - p.x;
+	weightX[x - left] = expf (- k * dx * dx);
+  }
+
+  float base = fmodf (p.angle, angleRange);
+  if (base < 0) base += angleRange;
+  for (int y = top; y <= bottom; y++)
+  {
+	const float dy = y - p.y;
+	const float weightY = expf (- k * dy * dy);
+	const float * m = &magnitude(0,y);
+	const float * d = &direction(0,y);
+	for (int x = left; x <= right; x++)
+	{
+	  const float dx = x - p.x;
+	  const float qx = (c * dx + s * dy) * toBin;
+	  const float qy = (c * dy - s * dx) * toBin;
+	  if (fabsf (qx) > half  ||  fabsf (qy) > half) continue;
+
+	  // d is in [-pi,pi] and base in [0,angleRange), so a few steps bring
+	  // the difference into [0,angleRange).
+	  float angle = d[x] - base;
+	  if (angle < 0) angle += angleRange;
+	  if (angle < 0) angle += angleRange;
+	  if (angle >= angleRange) angle -= angleRange;
+	  distribute (r, width, angles, qx + center, qy + center, angle / angleStep, m[x] * weightX[x - left] * weightY);
+	}
+  }
+}
+
 inline void
 DescriptorSIFT::patch (Canvas * canvas, const Vector<float> & value, int size)
 {
@@ -321,6 +413,14 @@ DescriptorSIFT::dimension ()
   return width * width * angles;
 }
 
+Descriptor *
+DescriptorSIFT::clone () const
+{
+  DescriptorSIFT * result = new DescriptorSIFT (*this);
+  result->kernels.clear ();  // The kernels belong to this object.  The copy regenerates its own on demand.
+  return result;
+}
+
 void
 DescriptorSIFT::serialize (Archive & archive, uint32_t version)
 {
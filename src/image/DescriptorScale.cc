@@ -55,7 +55,7 @@ Vector<float>
 DescriptorScale::value (ImageCache & cache, const PointAffine & point)
 {
   if (laplacians.size () == 0) initialize ();
-  Image image = cache.get (new EntryPyramid (GrayFloat))->image;
+  Image image = cache.acquire (new EntryPyramid (GrayFloat))->image;
 
   Vector<float> result (1);
   result[0] = 1;
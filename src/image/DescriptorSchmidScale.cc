@@ -70,7 +70,7 @@ DescriptorSchmidScale::~DescriptorSchmidScale ()
 Vector<float>
 DescriptorSchmidScale::value (ImageCache & cache, const PointAffine & point)
 {
-  Image image = cache.get (new EntryPyramid (GrayFloat))->image;
+  Image image = cache.acquire (new EntryPyramid (GrayFloat))->image;
 
   Vector<float> result (9);
 
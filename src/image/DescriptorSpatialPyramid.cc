@@ -107,7 +107,7 @@ DescriptorSpatialPyramid::value (ImageCache & cache)
 	  //cerr << p.scale << " " << l << " " << t << " " << r << " " << b << " " << stepX << " " << stepY << " " << stepsX << " " << stepsY << endl;
 
 	  // Gather descriptors and increment histogram bins
-	  cache.get (new EntryPyramid (GrayFloat, p.scale));  // Force generation of scale pyramid, because descriptor->value() generally uses only the closest existing entry.
+	  cache.acquire (new EntryPyramid (GrayFloat, p.scale));  // Force generation of scale pyramid, because descriptor->value() generally uses only the closest existing entry.
 	  for (p.y = t; p.y <= b; p.y += stepY)
 	  {
 		for (p.x = l; p.x <= r; p.x += stepX)
@@ -197,7 +197,7 @@ DescriptorSpatialPyramid::extract (ImageCache & cache, vector<Vector<float> > &
 	  //cerr << p.scale << " " << l << " " << t << " " << r << " " << b << " " << stepX << " " << stepY << " " << stepsX << " " << stepsY << endl;
 
 	  // Gather descriptors
-	  cache.get (new EntryPyramid (GrayFloat, p.scale));
+	  cache.acquire (new EntryPyramid (GrayFloat, p.scale));
 	  for (p.y = t; p.y <= b; p.y += stepY)
 	  {
 		for (p.x = l; p.x <= r; p.x += stepX)
@@ -226,6 +226,12 @@ DescriptorSpatialPyramid::dimension ()
   return histogramCount * classCount;
 }
 
+Matrix<float>
+DescriptorSpatialPyramid::values (ImageCache & cache, const PointSet & points, float threadRequest)
+{
+  return Descriptor::values (cache, points, 1);
+}
+
 void
 DescriptorSpatialPyramid::serialize (Archive & archive, uint32_t version)
 {
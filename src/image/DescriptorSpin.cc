@@ -34,7 +34,7 @@ DescriptorSpin::DescriptorSpin (int binsRadial, int binsIntensity, float support
 Vector<float>
 DescriptorSpin::value (ImageCache & cache, const PointAffine & point)
 {
-  ImageOf<float> image = cache.get (new EntryPyramid (GrayFloat))->image;
+  ImageOf<float> image = cache.acquire (new EntryPyramid (GrayFloat))->image;
 
   // Determine square region in source image to scan
 
@@ -36,6 +36,7 @@ public:
   {
 	image.width  = width;
 	image.height = height;
+	pinned       = true;  // Responses are filled in lazily, so losing this entry would lose work.
   }
 
   virtual void generate (ImageCache & cache)
@@ -150,19 +151,19 @@ DescriptorTextonScale::value (ImageCache & cache, const PointAffine & point)
   if (filters.size () == 0) initialize ();
 
   // Collect all working images
-  Image image = cache.get (new EntryPyramid (GrayFloat))->image;
+  Image image = cache.acquire (new EntryPyramid (GrayFloat))->image;
   const int width  = image.width;
   const int height = image.height;
-  ImageOf<float> scaleImage = cache.get (new EntryTextonScale (-1, width, height))->image;
+  ImageOf<float> scaleImage = cache.acquire (new EntryTextonScale (-1, width, height))->image;
   vector<ImageOf<float> > dogs (scales.size () - 1);
   for (int i = 0; i < dogs.size (); i++)
   {
-	dogs[i] = cache.get (new EntryDOG (scales[i+1], scales[i], width))->image;
+	dogs[i] = cache.acquire (new EntryDOG (scales[i+1], scales[i], width))->image;
   }
   vector<ImageOf<float> > responses (bankSize);
   for (int i = 0; i < bankSize; i++)
   {
-	responses[i] = cache.get (new EntryTextonScale (i, width, height))->image;
+	responses[i] = cache.acquire (new EntryTextonScale (i, width, height))->image;
   }
 
   // Project the patch into the image.
@@ -254,19 +255,19 @@ DescriptorTextonScale::value (ImageCache & cache)
   if (filters.size () == 0) initialize ();
 
   // Collect all working images
-  Image image = cache.get (new EntryPyramid (GrayFloat))->image;
+  Image image = cache.acquire (new EntryPyramid (GrayFloat))->image;
   const int width  = image.width;
   const int height = image.height;
-  ImageOf<float> scaleImage = cache.get (new EntryTextonScale (-1, width, height))->image;
+  ImageOf<float> scaleImage = cache.acquire (new EntryTextonScale (-1, width, height))->image;
   vector<ImageOf<float> > dogs (scales.size () - 1);
   for (int i = 0; i < dogs.size (); i++)
   {
-	dogs[i] = cache.get (new EntryDOG (scales[i+1], scales[i], width))->image;
+	dogs[i] = cache.acquire (new EntryDOG (scales[i+1], scales[i], width))->image;
   }
   vector<ImageOf<float> > responses (bankSize);
   for (int i = 0; i < bankSize; i++)
   {
-	responses[i] = cache.get (new EntryTextonScale (i, width, height))->image;
+	responses[i] = cache.acquire (new EntryTextonScale (i, width, height))->image;
   }
 
   Matrix<float> result (bankSize, 2);
@@ -20,10 +20,11 @@ using namespace std;
 
 // class EntryDOG -------------------------------------------------------------
 
-EntryDOG::EntryDOG (float sigmaPlus, float sigmaMinus, int width)
+EntryDOG::EntryDOG (float sigmaPlus, float sigmaMinus, int width, const PixelFormat & format)
 : sigmaPlus (sigmaPlus),
   sigmaMinus (sigmaMinus)
 {
+  image.format = &format;
   image.width = width;
   scale = DifferenceOfGaussians::crossover (sigmaPlus, sigmaMinus);
 }
@@ -31,21 +32,38 @@ EntryDOG::EntryDOG (float sigmaPlus, float sigmaMinus, int width)
 void
 EntryDOG::generate (ImageCache & cache)
 {
-  Image imageMinus = cache.get (new EntryPyramid (GrayFloat, sigmaMinus, image.width))->image;
+  Image imageMinus = cache.acquire (new EntryPyramid (GrayFloat, sigmaMinus, image.width))->image;
   int w = imageMinus.width;
   int h = imageMinus.height;
-  Image imagePlus  = cache.get (new EntryPyramid (GrayFloat, sigmaPlus,  image.width))->image;  // imagePlus *must* match width of imageMinus.
+  // imagePlus *must* match width of imageMinus.  When image.width is zero
+  // (any width), asking for that again could match a level of some other
+  // width, depending on what other threads have already put in the cache.
+  // Pin the width to the one actually found.
+  Image imagePlus  = cache.acquire (new EntryPyramid (GrayFloat, sigmaPlus, w))->image;
+  if (imagePlus.width != w  ||  imagePlus.height != h) throw "EntryDOG: pyramid levels differ in size";
 
-  image.format = &GrayFloat;
   image.resize (w, h);
 
   float * plus  = (float *) ((PixelBufferPacked *) imagePlus .buffer)->base ();
   float * minus = (float *) ((PixelBufferPacked *) imageMinus.buffer)->base ();
-  float * dest  = (float *) ((PixelBufferPacked *) image     .buffer)->base ();
-  float * end   = dest + w * h;
-  while (dest < end)
+  if (*image.format == GrayFloat)
   {
-	*dest++ = *plus++ - *minus++;
+	float * dest  = (float *) ((PixelBufferPacked *) image.buffer)->base ();
+	float * end   = dest + w * h;
+	while (dest < end)
+	{
+	  *dest++ = *plus++ - *minus++;
+	}
+	return;
+  }
+
+  // Reduced-precision storage.  Take the difference at full precision, then
+  // narrow one row at a time.
+  vector<float> row (w);
+  for (int y = 0; y < h; y++)
+  {
+	for (int x = 0; x < w; x++) row[x] = *plus++ - *minus++;
+	image.setGray (0, y, w, &row[0]);
   }
 }
 
@@ -56,6 +74,8 @@ EntryDOG::compare (const ImageCacheEntry & that) const
   const EntryDOG * o = dynamic_cast<const EntryDOG *> (&that);
   if (! o) return false;
 
+  if (*image.format != *o->image.format) return typeid (*image.format).before (typeid (*o->image.format));
+
   // Scale always matters for DOGs
   if (o->scale /    scale - 1 > EntryPyramid::toleranceScaleRatio) return true;
   if (   scale / o->scale - 1 > EntryPyramid::toleranceScaleRatio) return false;
@@ -69,6 +89,7 @@ EntryDOG::distance (const ImageCacheEntry & that) const
 {
   if (typeid (*this) != typeid (that)) return INFINITY;
   const EntryDOG & o = (const EntryDOG &) that;
+  if (*image.format != *o.image.format) return INFINITY;
 
   float result = 0;
   result += EntryPyramid::ratioDistance (scale,       o.scale)       * 1000;
@@ -30,7 +30,7 @@ EntryFiniteDifference::EntryFiniteDifference (Direction direction, float scale,
 void
 EntryFiniteDifference::generate (ImageCache & cache)
 {
-  image = cache.get (new EntryPyramid (GrayFloat, scale, image.width))->image * FiniteDifference (direction);
+  image = cache.acquire (new EntryPyramid (GrayFloat, scale, image.width))->image * FiniteDifference (direction);
 }
 
 bool
@@ -0,0 +1,113 @@
+/*
+Author: Fred Rothganger
+
+Copyright 2010 Sandia Corporation.
+Under the terms of Contract DE-AC04-94AL85000 with Sandia Corporation,
+the U.S. Government retains certain rights in this software.
+Distributed under the GNU Lesser General Public License.  See the file LICENSE
+for details.
+*/
+
+
+#include "fl/imagecache.h"
+
+#include <math.h>
+
+
+using namespace fl;
+using namespace std;
+
+
+// class EntryGradient --------------------------------------------------------
+
+float EntryGradient::minimumScale = 1.6f;
+
+EntryGradient::EntryGradient (float scale, int width)
+: scale (scale),
+  angle (GrayFloat)
+{
+  image.width = width;
+}
+
+void
+EntryGradient::generate (ImageCache & cache)
+{
+  ImageOf<float> source = cache.acquire (new EntryPyramid (GrayFloat, scale, image.width))->image;
+  const int width  = source.width;
+  const int height = source.height;
+
+  ImageOf<float> magnitude (width, height, GrayFloat);
+  angle.resize (width, height);
+  magnitude.timestamp = source.timestamp;
+  angle    .timestamp = source.timestamp;
+
+  // Same differences as FiniteDifference: central in the interior, and
+  // twice the one-sided difference at the borders.
+  const int lastX = width  - 1;
+  const int lastY = height - 1;
+  for (int y = 0; y < height; y++)
+  {
+	const float * c = &source(0,y);
+	const float * u = &source(0,max (y - 1, 0));
+	const float * d = &source(0,min (y + 1, lastY));
+	const float scaleY = (y == 0  ||  y == lastY) ? 2 : 1;
+	float * m = &magnitude(0,y);
+	float * a = &angle(0,y);
+	for (int x = 0; x < width; x++)
+	{
+	  float dx;
+	  if      (width < 2)  dx = 0;
+	  else if (x == 0)     dx = 2 * (c[1] - c[0]);
+	  else if (x == lastX) dx = 2 * (c[lastX] - c[lastX-1]);
+	  else                 dx = c[x+1] - c[x-1];
+	  float dy = height < 2 ? 0 : scaleY * (d[x] - u[x]);
+	  m[x] = sqrtf (dx * dx + dy * dy);
+	  a[x] = atan2 (dy, dx);
+	}
+  }
+  image = magnitude;
+}
+
+int
+EntryGradient::levelWidth (int originalWidth, float scale, int width)
+{
+  while (width > 1  &&  scale * (width / 2) >= minimumScale * originalWidth) width /= 2;
+  return width;
+}
+
+ptrdiff_t
+EntryGradient::memory () const
+{
+  return 2 * ImageCacheEntry::memory ();
+}
+
+bool
+EntryGradient::compare (const ImageCacheEntry & that) const
+{
+  if (typeid (*this).before (typeid (that))) return true;
+  const EntryGradient * o = dynamic_cast<const EntryGradient *> (&that);
+  if (! o) return false;
+
+  if (scale  &&  o->scale)
+  {
+	if (o->scale /    scale - 1 > EntryPyramid::toleranceScaleRatio) return true;
+	if (   scale / o->scale - 1 > EntryPyramid::toleranceScaleRatio) return false;
+  }
+
+  if (image.width  &&  o->image.width  &&  image.width > o->image.width) return true;
+  return false;
+}
+
+float
+EntryGradient::distance (const ImageCacheEntry & that) const
+{
+  if (typeid (*this) != typeid (that)) return INFINITY;
+  const EntryGradient & o = (const EntryGradient &) that;
+  return EntryPyramid::ratioDistance (scale, o.scale) * 4 + EntryPyramid::ratioDistance (image.width, o.image.width);
+}
+
+void
+EntryGradient::print (ostream & stream) const
+{
+  stream << "EntryGradient(" << scale << " " << image.width << ")";
+}
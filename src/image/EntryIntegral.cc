@@ -0,0 +1,70 @@
+/*
+Author: Fred Rothganger
+
+Copyright 2010 Sandia Corporation.
+Under the terms of Contract DE-AC04-94AL85000 with Sandia Corporation,
+the U.S. Government retains certain rights in this software.
+Distributed under the GNU Lesser General Public License.  See the file LICENSE
+for details.
+*/
+
+
+#include "fl/imagecache.h"
+#include "fl/convolve.h"
+
+
+using namespace fl;
+using namespace std;
+
+
+// class EntryIntegral --------------------------------------------------------
+
+EntryIntegral::EntryIntegral (float scale, int width, const PixelFormat & format)
+: scale (scale),
+  width (width)
+{
+  image.format = &format;
+}
+
+void
+EntryIntegral::generate (ImageCache & cache)
+{
+  Image source = cache.acquire (new EntryPyramid (GrayFloat, scale, width))->image;
+  width = source.width;
+  image = source * IntegralImage (*image.format);
+}
+
+bool
+EntryIntegral::compare (const ImageCacheEntry & that) const
+{
+  if (typeid (*this).before (typeid (that))) return true;
+  const EntryIntegral * o = dynamic_cast<const EntryIntegral *> (&that);
+  if (! o) return false;
+
+  if (*image.format != *o->image.format) return typeid (*image.format).before (typeid (*o->image.format));
+
+  if (scale  &&  o->scale)
+  {
+	if (o->scale /    scale - 1 > EntryPyramid::toleranceScaleRatio) return true;
+	if (   scale / o->scale - 1 > EntryPyramid::toleranceScaleRatio) return false;
+  }
+
+  if (width  &&  o->width  &&  width > o->width) return true;
+  return false;
+}
+
+float
+EntryIntegral::distance (const ImageCacheEntry & that) const
+{
+  if (typeid (*this) != typeid (that)) return INFINITY;
+  const EntryIntegral & o = (const EntryIntegral &) that;
+  if (*image.format != *o.image.format) return INFINITY;
+
+  return EntryPyramid::ratioDistance (scale, o.scale) * 4 + EntryPyramid::ratioDistance (width, o.width);
+}
+
+void
+EntryIntegral::print (ostream & stream) const
+{
+  stream << "EntryIntegral(" << typeid (*image.format).name () << " " << scale << " " << width << ")";
+}
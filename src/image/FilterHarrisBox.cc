@@ -0,0 +1,123 @@
+/*
+Author: Fred Rothganger
+
+Copyright 2010 Sandia Corporation.
+Under the terms of Contract DE-AC04-94AL85000 with Sandia Corporation,
+the U.S. Government retains certain rights in this software.
+Distributed under the GNU Lesser General Public License.  See the file LICENSE
+for details.
+*/
+
+
+#include "fl/convolve.h"
+#include "fl/math.h"
+
+
+using namespace std;
+using namespace fl;
+
+
+/// Sum over the half-open box [x0,x1) x [y0,y1) of the original image.
+static inline double
+box (const double * integral, int stride, int x0, int y0, int x1, int y1)
+{
+  const double * top    = integral + y0 * stride;
+  const double * bottom = integral + y1 * stride;
+  return bottom[x1] - bottom[x0] - top[x1] + top[x0];
+}
+
+
+// class FilterHarrisBox ------------------------------------------------------
+
+FilterHarrisBox::FilterHarrisBox (double sigmaD, double sigmaI)
+: sigmaD (sigmaD),
+  sigmaI (sigmaI)
+{
+  offsetD = halfWidth (sigmaD);
+  offsetI = halfWidth (sigmaI);
+  offset  = offsetD + offsetI;
+}
+
+/**
+   A box of 2h+1 pixels has variance h(h+1)/3.  Solve for the h that makes
+   this equal to sigma^2.
+**/
+int
+FilterHarrisBox::halfWidth (double sigma)
+{
+  return max (1, (int) roundp (sqrt (3 * sigma * sigma + 0.25) - 0.5));
+}
+
+Image
+FilterHarrisBox::filter (const Image & image)
+{
+  return filterIntegral (image * IntegralImage ());
+}
+
+Image
+FilterHarrisBox::filterIntegral (const Image & integral)
+{
+  if (*integral.format != GrayDouble) return filterIntegral (integral * GrayDouble);
+
+  PixelBufferPacked * buffer = (PixelBufferPacked *) integral.buffer;
+  const double * I = (double *) buffer->base ();
+  const int stride = buffer->stride / sizeof (double);
+
+  // Products of Haar gradients.  Each wavelet covers a (2h+1) x (2h+1)
+  // square, split by the center column (or row), and is normalized so that
+  // a unit ramp gives sigmaD, the same as the boosted derivative kernel in
+  // FilterHarris.
+  const int h = offsetD;
+  const int w = integral.width  - 1 - 2 * h;
+  const int v = integral.height - 1 - 2 * h;
+  if (w <= 2 * offsetI  ||  v <= 2 * offsetI) return ImageOf<float> (0, 0, GrayFloat);
+  const double normalize = sigmaD / ((2 * h + 1) * h * (h + 1.0));
+  ImageOf<double> xx (w, v, GrayDouble);
+  ImageOf<double> xy (w, v, GrayDouble);
+  ImageOf<double> yy (w, v, GrayDouble);
+  for (int y = 0; y < v; y++)
+  {
+	const int cy = y + h;
+	double * rxx = &xx(0,y);
+	double * rxy = &xy(0,y);
+	double * ryy = &yy(0,y);
+	for (int x = 0; x < w; x++)
+	{
+	  const int cx = x + h;
+	  double dx = box (I, stride, cx + 1, cy - h, cx + h + 1, cy + h + 1) - box (I, stride, cx - h, cy - h, cx, cy + h + 1);
+	  double dy = box (I, stride, cx - h, cy + 1, cx + h + 1, cy + h + 1) - box (I, stride, cx - h, cy - h, cx + h + 1, cy);
+	  dx *= normalize;
+	  dy *= normalize;
+	  rxx[x] = dx * dx;
+	  rxy[x] = dx * dy;
+	  ryy[x] = dy * dy;
+	}
+  }
+
+  // Average the products over a square.
+  IntegralImage integrate;
+  Image Sxx = xx * integrate;
+  Image Sxy = xy * integrate;
+  Image Syy = yy * integrate;
+  const double * Ixx = (double *) ((PixelBufferPacked *) Sxx.buffer)->base ();
+  const double * Ixy = (double *) ((PixelBufferPacked *) Sxy.buffer)->base ();
+  const double * Iyy = (double *) ((PixelBufferPacked *) Syy.buffer)->base ();
+  const int s = ((PixelBufferPacked *) Sxx.buffer)->stride / sizeof (double);
+
+  const int r = offsetI;
+  const double area = (2 * r + 1) * (2 * r + 1);
+  ImageOf<float> result (w - 2 * r, v - 2 * r, GrayFloat);
+  result.timestamp = integral.timestamp;
+  for (int y = 0; y < result.height; y++)
+  {
+	float * row = &result(0,y);
+	for (int x = 0; x < result.width; x++)
+	{
+	  double txx = box (Ixx, s, x, y, x + 2 * r + 1, y + 2 * r + 1) / area;
+	  double txy = box (Ixy, s, x, y, x + 2 * r + 1, y + 2 * r + 1) / area;
+	  double tyy = box (Iyy, s, x, y, x + 2 * r + 1, y + 2 * r + 1) / area;
+	  row[x] = (txx * tyy - txy * txy) - FilterHarris::alpha * (txx + tyy) * (txx + tyy);
+	}
+  }
+  return result;
+}
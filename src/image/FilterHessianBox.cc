@@ -0,0 +1,110 @@
+/*
+Author: Fred Rothganger
+
+Copyright 2010 Sandia Corporation.
+Under the terms of Contract DE-AC04-94AL85000 with Sandia Corporation,
+the U.S. Government retains certain rights in this software.
+Distributed under the GNU Lesser General Public License.  See the file LICENSE
+for details.
+*/
+
+
+#include "fl/convolve.h"
+#include "fl/math.h"
+
+
+using namespace std;
+using namespace fl;
+
+
+/// Sum over the inclusive box [x0,x1] x [y0,y1] of the original image.
+static inline double
+box (const double * integral, int stride, int x0, int y0, int x1, int y1)
+{
+  const double * top    = integral + y0       * stride;
+  const double * bottom = integral + (y1 + 1) * stride;
+  return bottom[x1+1] - bottom[x0] - top[x1+1] + top[x0];
+}
+
+/// Sum of u^2 for u in [-m,m]
+static inline double
+sumSquares (int m)
+{
+  return m * (m + 1) * (2 * m + 1) / 3.0;
+}
+
+
+// class FilterHessianBox -----------------------------------------------------
+
+FilterHessianBox::FilterHessianBox (double sigma, bool determinant)
+: determinant (determinant)
+{
+  lobe = 2 * (int) roundp ((sigma / 0.4 - 1) / 2) + 1;  // nearest odd
+  lobe = max (3, lobe);
+  this->sigma = 0.4 * lobe;
+  offset = (3 * lobe - 1) / 2;
+
+  // Response of each component to a quadratic with unit curvature, so that
+  // the result can be scaled to sigma^2 like a Gaussian derivative.
+  int outer = offset;
+  int inner = (lobe - 1) / 2;
+  double diagonal = (2 * lobe - 1) * (sumSquares (outer) - 3 * sumSquares (inner)) / 2;
+  double cross    = (double) lobe * lobe * (lobe + 1) * (lobe + 1);
+  double sigma2   = this->sigma * this->sigma;
+  scaleDiagonal = sigma2 / diagonal;
+  scaleCross    = sigma2 / cross;
+}
+
+Image
+FilterHessianBox::filter (const Image & image)
+{
+  return filterIntegral (image * IntegralImage ());
+}
+
+Image
+FilterHessianBox::filterIntegral (const Image & integral)
+{
+  if (*integral.format != GrayDouble) return filterIntegral (integral * GrayDouble);
+
+  PixelBufferPacked * buffer = (PixelBufferPacked *) integral.buffer;
+  const double * I = (double *) buffer->base ();
+  const int stride = buffer->stride / sizeof (double);
+  const int width  = integral.width  - 1 - 2 * offset;
+  const int height = integral.height - 1 - 2 * offset;
+
+  ImageOf<float> result (max (0, width), max (0, height), GrayFloat);
+  result.timestamp = integral.timestamp;
+  for (int y = 0; y < height; y++)
+  {
+	float * r = &result(0,y);
+	for (int x = 0; x < width; x++)
+	{
+	  double xx;
+	  double yy;
+	  double xy;
+	  derivatives (I, stride, x + offset, y + offset, xx, yy, xy);
+	  r[x] = determinant ? xx * yy - xy * xy : xx + yy;
+	}
+  }
+  return result;
+}
+
+void
+FilterHessianBox::derivatives (const double * I, int stride, int x, int y, double & xx, double & yy, double & xy) const
+{
+  const int outer = offset;           // half-length along the derivative
+  const int inner = (lobe - 1) / 2;   // half-length of center lobe
+  const int side  = lobe - 1;         // half-length across the derivative
+
+  // Each of Lxx and Lyy is the whole span minus three times the center lobe.
+  xx = box (I, stride, x - outer, y - side,  x + outer, y + side)  - 3 * box (I, stride, x - inner, y - side,  x + inner, y + side);
+  yy = box (I, stride, x - side,  y - outer, x + side,  y + outer) - 3 * box (I, stride, x - side,  y - inner, x + side,  y + inner);
+  xy =   box (I, stride, x - lobe, y - lobe, x - 1,    y - 1)
+	   - box (I, stride, x + 1,    y - lobe, x + lobe, y - 1)
+	   - box (I, stride, x - lobe, y + 1,    x - 1,    y + lobe)
+	   + box (I, stride, x + 1,    y + 1,    x + lobe, y + lobe);
+
+  xx *= scaleDiagonal;
+  yy *= scaleDiagonal;
+  xy *= scaleCross;
+}
@@ -0,0 +1,342 @@
+/*
+Author: Fred Rothganger
+
+Copyright 2010 Sandia Corporation.
+Under the terms of Contract DE-AC04-94AL85000 with Sandia Corporation,
+the U.S. Government retains certain rights in this software.
+Distributed under the GNU Lesser General Public License.  See the file LICENSE
+for details.
+*/
+
+
+#include "fl/convolve.h"
+#include "fl/thread.h"
+
+#include <exception>
+#include <memory>
+
+
+using namespace std;
+using namespace fl;
+
+
+// class BandRunner -----------------------------------------------------------
+
+namespace
+{
+/**
+   Does the work of FilterParallel in two phases.  First each band is
+   filtered into its own image, then (once the format and width of the
+   result are known) each band is copied into the final result.
+**/
+class BandRunner : public ParallelFor<int>
+{
+public:
+  BandRunner (FilterParallel & owner, const Image & image, int outHeight)
+  : ParallelFor<int> (owner.threadRequest),
+	owner (owner),
+	image (image),
+	outHeight (outHeight)
+  {
+	transform = dynamic_cast<Transform *> (&owner.target);
+	stitch    = false;
+  }
+
+  void split (int bands)
+  {
+	int align = FilterParallel::alignment (image);
+	int rows  = (outHeight + bands - 1) / bands;
+	rows = (rows + align - 1) / align * align;
+	starts.clear ();
+	for (int y = 0; y < outHeight; y += rows) starts.push_back (y);
+	starts.push_back (outHeight);
+	bands = starts.size () - 1;
+	results.resize (bands);
+	skips.resize (bands, 0);
+  }
+
+  virtual void process (const int i)
+  {
+	try
+	{
+	  if (stitch) copy    (i);
+	  else        compute (i);
+	}
+	catch (...)  // Anything that escapes a worker thread would terminate the process, so carry it back to the caller of run().
+	{
+	  std::lock_guard<std::mutex> lock (mutexError);
+	  if (! error) error = std::current_exception ();
+	}
+  }
+
+  void compute (int i)
+  {
+	int a = starts[i];
+	int e = starts[i+1];
+
+	if (transform)
+	{
+	  std::unique_ptr<Transform> t (transform->clone ());
+	  t->setWindow (left + (width - 1) / 2.0, top + a + (e - a - 1) / 2.0, width, e - a);
+	  results[i] = t->filter (image);
+	  return;
+	}
+
+	int inA;
+	int inE;
+	if (owner.crop)
+	{
+	  inA = a;
+	  inE = e + owner.haloTop + owner.haloBottom;
+	}
+	else
+	{
+	  int align = FilterParallel::alignment (image);
+	  inA = max (0, a - owner.haloTop) / align * align;
+	  inE = min (image.height, e + owner.haloBottom);
+	}
+	skips[i] = a - inA;
+	if (owner.crop) skips[i] = 0;
+	results[i] = owner.target.filter (FilterParallel::band (image, inA, inE - inA));
+  }
+
+  void copy (int i)
+  {
+	PixelBufferPacked * from = (PixelBufferPacked *) results[i].buffer;
+	PixelBufferPacked * to   = (PixelBufferPacked *) result.buffer;
+	int    bytes  = result.width * to->depth;
+	int    rows   = starts[i+1] - starts[i];
+	char * source = (char *) from->base () + skips[i]  * from->stride;
+	char * target = (char *) to  ->base () + starts[i] * to  ->stride;
+	for (int r = 0; r < rows; r++)
+	{
+	  memcpy (target, source, bytes);
+	  source += from->stride;
+	  target += to  ->stride;
+	}
+  }
+
+  /**
+	 Check that all bands produced compatible packed images, and allocate
+	 the final result.
+	 @return false if stitching is not possible, in which case the caller
+	 should fall back to filtering the whole image.
+  **/
+  bool prepareStitch ()
+  {
+	if (error) std::rethrow_exception (error);
+	const Image & first = results[0];
+	if (! (PixelBufferPacked *) first.buffer) return false;
+	for (int i = 0; i < results.size (); i++)
+	{
+	  const Image & r = results[i];
+	  if (! (PixelBufferPacked *) r.buffer  ||  *r.format != *first.format  ||  r.width != first.width) return false;
+	  if (r.height < skips[i] + starts[i+1] - starts[i]) return false;
+	}
+	result.format = first.format;
+	result.resize (first.width, outHeight);
+	result.timestamp = first.timestamp;
+	stitch = true;
+	return true;
+  }
+
+  FilterParallel & owner;
+  Transform *      transform;
+  const Image &    image;
+  int              outHeight;
+  double           left;  ///< For Transform, the position of the output viewport in the virtual destination image.
+  double           top;
+  int              width;
+
+  std::vector<int>   starts;  ///< First output row of each band, plus one extra entry for the end of the last band.
+  std::vector<int>   skips;  ///< Number of halo rows at the top of each band result that do not belong in the final result.
+  std::vector<Image> results;
+  Image              result;
+  bool               stitch;
+  std::exception_ptr error;  ///< First exception thrown by any band.
+  std::mutex         mutexError;
+};
+}
+
+
+// class FilterParallel -------------------------------------------------------
+
+FilterParallel::FilterParallel (const Filter & filter, float threadRequest)
+: target ((Filter &) filter),
+  threadRequest (threadRequest)
+{
+  haloTop     = 0;
+  haloBottom  = 0;
+  crop        = false;
+  parallel    = true;
+  minimumRows = 32;
+
+  // For kernels, the rows above and below the center are last - mid and mid,
+  // respectively.  In modes that preserve image size, the border handling
+  // treats both sides symmetrically with mid rows, so use the larger value.
+  if (const ConvolutionDiscrete1D * c = dynamic_cast<const ConvolutionDiscrete1D *> (&filter))
+  {
+	if (c->direction == Vertical)
+	{
+	  int last = c->width - 1;  // 1D kernels are always stored as a single row.
+	  int mid  = c->width / 2;
+	  crop       = c->mode == Crop;
+	  haloTop    = crop ? last - mid : mid;
+	  haloBottom = mid;
+	}
+  }
+  else if (const ConvolutionDiscrete2D * c = dynamic_cast<const ConvolutionDiscrete2D *> (&filter))
+  {
+	int last = c->height - 1;
+	int mid  = c->height / 2;
+	crop       = c->mode == Crop;
+	haloTop    = crop ? last - mid : mid;
+	haloBottom = mid;
+  }
+  else if (const ConvolutionRecursive1D * c = dynamic_cast<const ConvolutionRecursive1D *> (&filter))
+  {
+	parallel = c->direction == Horizontal;  // Recursive filter has infinite support, so can't split along its direction.
+  }
+  else if (const FiniteDifference * c = dynamic_cast<const FiniteDifference *> (&filter))
+  {
+	if (c->direction == Vertical)
+	{
+	  haloTop    = 1;
+	  haloBottom = 1;
+	}
+  }
+  else if (const Median * c = dynamic_cast<const Median *> (&filter))
+  {
+	haloTop    = c->radius;
+	haloBottom = c->radius;
+  }
+  else if (const PixelFormat * c = dynamic_cast<const PixelFormat *> (&filter))
+  {
+	parallel = c->planes == 1;  // Stitching only works for packed results.
+  }
+  else if (! dynamic_cast<const Transform *> (&filter))
+  {
+	parallel = false;
+  }
+}
+
+FilterParallel::FilterParallel (const Filter & filter, int haloTop, int haloBottom, bool crop, float threadRequest)
+: target ((Filter &) filter),
+  haloTop (haloTop),
+  haloBottom (haloBottom),
+  crop (crop),
+  threadRequest (threadRequest)
+{
+  parallel    = true;
+  minimumRows = 32;
+}
+
+Image
+FilterParallel::filter (const Image & image)
+{
+  if (! parallel) return target.filter (image);
+  if (dynamic_cast<Transform *> (&target)) return filterTransform (image);
+  PixelFormat * format = dynamic_cast<PixelFormat *> (&target);
+  if (format  &&  *format == *image.format) return image;
+
+  int outHeight = crop ? image.height - haloTop - haloBottom : image.height;
+  if (outHeight < 2 * minimumRows  ||  ! band (image, 0, 1).buffer.memory) return target.filter (image);
+
+  BandRunner runner (*this, image, outHeight);
+  int bands = min ((int) runner.threads.size (), outHeight / minimumRows);
+  if (bands < 2) return target.filter (image);
+  runner.split (bands);
+
+  runner.run (0, runner.results.size ());
+  if (! runner.prepareStitch ()) return target.filter (image);
+  runner.run (0, runner.results.size ());
+  if (runner.error) std::rethrow_exception (runner.error);
+  return runner.result;
+}
+
+Image
+FilterParallel::filterTransform (const Image & image)
+{
+  Transform * t = (Transform *) &target;
+
+  // Do format conversion once for the whole image, rather than in each band.
+  // Only the base class has known conversion rules.
+  Image converted = image;
+  if (typeid (*t) == typeid (Transform))
+  {
+	const PixelFormat & working = Transform::workingFormat (image);
+	if (working != *image.format) converted = image * working;
+  }
+
+  // Resolve the viewport for the entire result
+  std::unique_ptr<Transform> whole (t->clone ());
+  MatrixFixed<double,3,3> C;
+  int w;
+  int h;
+  int lo;
+  int hi;
+  whole->prepareResult (converted, w, h, C, lo, hi);
+  //   C = IA * [I | topLeft] up to scale, so A * C recovers position of top-left output pixel in the virtual destination image.
+  MatrixFixed<double,3,3> T = whole->A * C;
+
+  if (h < 2 * minimumRows) return target.filter (image);
+
+  BandRunner runner (*this, converted, h);
+  int bands = min ((int) runner.threads.size (), h / minimumRows);
+  if (bands < 2) return target.filter (image);
+  runner.left  = T(0,2) / T(0,0);
+  runner.top   = T(1,2) / T(1,1);
+  runner.width = w;
+  runner.split (bands);
+
+  runner.run (0, runner.results.size ());
+  if (! runner.prepareStitch ()) return target.filter (image);
+  runner.run (0, runner.results.size ());
+  if (runner.error) std::rethrow_exception (runner.error);
+  return runner.result;
+}
+
+Image
+FilterParallel::band (const Image & image, int y, int height)
+{
+  Image result (*image.format);
+  result.width     = image.width;
+  result.height    = height;
+  result.timestamp = image.timestamp;
+
+  if (PixelBufferPacked * p = (PixelBufferPacked *) image.buffer)
+  {
+	result.buffer = new PixelBufferPacked (p->memory, p->stride, p->depth, p->offset + y * p->stride);
+  }
+  else if (PixelBufferPlanar * p = (PixelBufferPlanar *) image.buffer)
+  {
+	int y12 = y / p->ratioV;
+	result.buffer = new PixelBufferPlanar ((char *) p->plane0 + y   * p->stride0,
+										   (char *) p->plane1 + y12 * p->stride12,
+										   (char *) p->plane2 + y12 * p->stride12,
+										   p->stride0, p->stride12, height, p->ratioH, p->ratioV);
+  }
+  else if (PixelBufferBlocks * p = (PixelBufferBlocks *) image.buffer)
+  {
+	result.buffer = new PixelBufferBlocks ((char *) p->memory + y / p->pixelsV * p->stride, p->stride, height, p->pixelsH, p->pixelsV, p->bytes);
+  }
+  else if (PixelBufferGroups * p = (PixelBufferGroups *) image.buffer)
+  {
+	result.buffer = new PixelBufferGroups ((char *) p->memory + y * p->stride, p->stride, height, p->pixelsH, p->bytes);
+  }
+  else
+  {
+	result.width  = 0;
+	result.height = 0;
+  }
+
+  return result;
+}
+
+int
+FilterParallel::alignment (const Image & image)
+{
+  if (PixelBufferPlanar * p = (PixelBufferPlanar *) image.buffer) return p->ratioV;
+  if (PixelBufferBlocks * p = (PixelBufferBlocks *) image.buffer) return p->pixelsV;
+  return 1;
+}
@@ -0,0 +1,293 @@
+/*
+Author: Fred Rothganger
+
+Copyright 2010 Sandia Corporation.
+Under the terms of Contract DE-AC04-94AL85000 with Sandia Corporation,
+the U.S. Government retains certain rights in this software.
+Distributed under the GNU Lesser General Public License.  See the file LICENSE
+for details.
+*/
+
+
+#include "fl/convolve.h"
+
+#include <string.h>
+
+
+using namespace std;
+using namespace fl;
+
+
+// class StripRunner ----------------------------------------------------------
+
+namespace
+{
+/**
+   Does the work of FilterPipeline::stream().  Evaluation is driven from the
+   last stage.  To produce a range of its output rows, a stage asks the
+   stage before it for enough rows to cover its halo, filters a band of that
+   stage's window, and keeps only the rows that are exact.  Those rows are
+   appended to its own window (or, for the last stage, copied straight into
+   the result).  Before appending, a window drops whatever rows the next
+   stage will no longer ask for, so it never holds much more than one strip
+   plus the next stage's halo.
+**/
+class StripRunner
+{
+public:
+  StripRunner (FilterPipeline & owner, const Image & image, int first, int last)
+  : owner (owner),
+	image (image),
+	first (first),
+	count (last - first)
+  {
+	heightIn .resize (count);
+	heightOut.resize (count);
+	done     .resize (count, 0);
+	base     .resize (count, 0);
+	windows  .resize (count);
+
+	int h = image.height;
+	for (int i = 0; i < count; i++)
+	{
+	  const FilterPipeline::Stage & s = stage (i);
+	  heightIn[i] = h;
+	  if (s.crop) h -= s.haloTop + s.haloBottom;
+	  heightOut[i] = h;
+	}
+	align = FilterParallel::alignment (image);
+  }
+
+  const FilterPipeline::Stage & stage (int i)
+  {
+	return owner.stages[first + i];
+  }
+
+  /**
+	 Extend the output of stage i up to (but not including) row q.
+	 @return false if the stage produced something that can't be kept in a
+	 window, in which case the caller should abandon streaming.
+  **/
+  bool produce (int i, int q)
+  {
+	int p = done[i];
+	if (q <= p) return true;
+
+	// Determine which input rows are needed.  Output row r of a band that
+	// starts at input row lo is global output row lo + r, both for cropped
+	// and full-size results.
+	const FilterPipeline::Stage & s = stage (i);
+	int shift = s.crop ? s.haloTop : 0;
+	int lo = max (0,           p + shift - s.haloTop);
+	int hi = min (heightIn[i], q + shift + s.haloBottom);
+
+	Image input;
+	if (i == 0)
+	{
+	  lo = lo / align * align;
+	  input = FilterParallel::band (image, lo, hi - lo);
+	}
+	else
+	{
+	  if (! produce (i - 1, hi)) return false;
+	  input = FilterParallel::band (windows[i-1], lo - base[i-1], hi - lo);
+	}
+	Image output = s.filter->filter (input);
+
+	PixelBufferPacked * from = (PixelBufferPacked *) output.buffer;
+	if (! from  ||  output.height < q - lo) return false;
+
+	if (i == count - 1)
+	{
+	  if (! result.buffer.memory)
+	  {
+		result.format = output.format;
+		result.resize (output.width, heightOut[i]);
+		if (! (PixelBufferPacked *) result.buffer) return false;
+	  }
+	  if (! append (result, 0, output, p - lo, q - p, p)) return false;
+	}
+	else
+	{
+	  // The next stage will next ask for rows starting here.
+	  const FilterPipeline::Stage & n = stage (i + 1);
+	  int keep = max (base[i], done[i+1] + (n.crop ? n.haloTop : 0) - n.haloTop);
+	  keep = min (keep, p);
+	  if (! slide (i, keep, output, q - p)) return false;
+	  if (! append (windows[i], base[i], output, p - lo, q - p, p)) return false;
+	}
+	result.timestamp = output.timestamp;
+	done[i] = q;
+	return true;
+  }
+
+  /**
+	 Discard rows of window i before row keep, and ensure there is room for
+	 another rows more.
+  **/
+  bool slide (int i, int keep, const Image & output, int rows)
+  {
+	Image & w = windows[i];
+	int kept = done[i] - keep;
+	if (! w.buffer.memory)
+	{
+	  w.format = output.format;
+	  w.resize (output.width, kept + rows);
+	  if (! (PixelBufferPacked *) w.buffer) return false;
+	  base[i] = keep;
+	  return true;
+	}
+
+	PixelBufferPacked * b = (PixelBufferPacked *) w.buffer;
+	char * start = (char *) b->base ();
+	if (kept + rows > w.height)
+	{
+	  Image bigger (*w.format);
+	  bigger.resize (w.width, kept + rows);
+	  PixelBufferPacked * c = (PixelBufferPacked *) bigger.buffer;
+	  char * to = (char *) c->base ();
+	  char * from = start + (keep - base[i]) * b->stride;
+	  int bytes = w.width * b->depth;
+	  for (int r = 0; r < kept; r++)
+	  {
+		memcpy (to, from, bytes);
+		to   += c->stride;
+		from += b->stride;
+	  }
+	  w = bigger;
+	}
+	else if (keep > base[i])
+	{
+	  memmove (start, start + (keep - base[i]) * b->stride, kept * b->stride);
+	}
+	base[i] = keep;
+	return true;
+  }
+
+  /**
+	 Copy rows of output, starting at row from, into target so that the
+	 first one lands on global row y.  targetBase is the global row held in
+	 the first row of target.
+  **/
+  static bool append (Image & target, int targetBase, const Image & output, int from, int rows, int y)
+  {
+	if (*output.format != *target.format  ||  output.width != target.width) return false;
+	PixelBufferPacked * s = (PixelBufferPacked *) output.buffer;
+	PixelBufferPacked * d = (PixelBufferPacked *) target.buffer;
+	if (s->depth != d->depth) return false;
+	int    bytes  = target.width * d->depth;
+	char * source = (char *) s->base () + from * s->stride;
+	char * dest   = (char *) d->base () + (y - targetBase) * d->stride;
+	for (int r = 0; r < rows; r++)
+	{
+	  memcpy (dest, source, bytes);
+	  source += s->stride;
+	  dest   += d->stride;
+	}
+	return true;
+  }
+
+  FilterPipeline & owner;
+  const Image &    image;
+  int              first;
+  int              count;
+  int              align;  ///< Bands of the input image must start on a multiple of this many rows.
+
+  std::vector<int>   heightIn;
+  std::vector<int>   heightOut;
+  std::vector<int>   done;     ///< Number of output rows of each stage produced so far.
+  std::vector<int>   base;     ///< Global row held in the first row of each window.
+  std::vector<Image> windows;  ///< Recent output of each stage except the last.
+  Image              result;
+};
+}
+
+
+// class FilterPipeline -------------------------------------------------------
+
+FilterPipeline::FilterPipeline ()
+{
+  stripRows  = 0;
+  cacheBytes = 512 * 1024;
+}
+
+FilterPipeline &
+FilterPipeline::append (const Filter & filter)
+{
+  FilterParallel p (filter);
+  Stage s;
+  s.filter     = (Filter *) &filter;
+  s.haloTop    = p.haloTop;
+  s.haloBottom = p.haloBottom;
+  s.crop       = p.crop;
+  s.streams    = p.parallel  &&  ! dynamic_cast<const Transform *> (&filter);
+  stages.push_back (s);
+  return *this;
+}
+
+FilterPipeline &
+FilterPipeline::append (const Filter & filter, int haloTop, int haloBottom, bool crop)
+{
+  Stage s;
+  s.filter     = (Filter *) &filter;
+  s.haloTop    = haloTop;
+  s.haloBottom = haloBottom;
+  s.crop       = crop;
+  s.streams    = true;
+  stages.push_back (s);
+  return *this;
+}
+
+Image
+FilterPipeline::filter (const Image & image)
+{
+  Image result = image;
+  int count = stages.size ();
+  int i = 0;
+  while (i < count)
+  {
+	int j = i + 1;
+	if (stages[i].streams)
+	{
+	  while (j < count  &&  stages[j].streams) j++;
+	}
+	if (j - i > 1) result = stream (result, i, j);
+	else           result = stages[i].filter->filter (result);
+	i = j;
+  }
+  return result;
+}
+
+Image
+FilterPipeline::stream (const Image & image, int first, int last)
+{
+  int halo   = 0;
+  int height = image.height;
+  for (int i = first; i < last; i++)
+  {
+	halo += stages[i].haloTop + stages[i].haloBottom;
+	if (stages[i].crop) height -= stages[i].haloTop + stages[i].haloBottom;
+  }
+
+  int rows = stripRows;
+  if (rows <= 0) rows = cacheBytes / (max (1, image.width) * sizeof (float) * (last - first));
+  rows = max (rows, max (16, 2 * halo));
+
+  bool whole = height <= rows  ||  ! FilterParallel::band (image, 0, 1).buffer.memory;
+  if (! whole)
+  {
+	StripRunner runner (*this, image, first, last);
+	int y = 0;
+	while (y < height)
+	{
+	  int e = min (height, y + rows);
+	  if (! runner.produce (last - first - 1, e)) break;
+	  y = e;
+	}
+	if (y >= height) return runner.result;
+  }
+
+  Image result = image;
+  for (int i = first; i < last; i++) result = stages[i].filter->filter (result);
+  return result;
+}
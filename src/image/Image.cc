@@ -385,52 +385,20 @@ Image::bitblt (const Image & from, int toX, int toY, int fromX, int fromY, int w
   }
   else  // Must use indirect pixel read and write
   {
-    if (offsetX < 0)
-    {
-      if (offsetY < 0)
-	  {
-		for (int y = needHeight - 1; y >= toY; y--)
-        {
-		  for (int x = needWidth - 1; x >= toX; x--)
-	      {
-			setRGBA (x, y, source.getRGBA (x + offsetX, y + offsetY));
-	      }
-	    }
-      }
-      else
-      {
-		for (int y = toY; y < needHeight; y++)
-        {
-		  for (int x = needWidth - 1; x >= toX; x--)
-	      {
-			setRGBA (x, y, source.getRGBA (x + offsetX, y + offsetY));
-	      }
-	    }
-      }
+	// Copy one row at a time through a temporary span.  Reading the whole
+	// row before writing any of it makes overlap harmless.  The direction
+	// of writes along x is still preserved, because formats that share
+	// chroma between neighboring pixels keep whichever value was written
+	// last.
+	vector<uint32_t> span (width);
+	int yStep = offsetY < 0 ? -1 : 1;
+	int y0    = offsetY < 0 ? needHeight - 1 : toY;
+	for (int y = y0; y >= toY  &&  y < needHeight; y += yStep)
+	{
+	  source.getRGBA (fromX, y + offsetY, width, &span[0]);
+	  if (offsetX < 0) for (int x = width - 1; x >= 0; x--) setRGBA (toX + x, y, span[x]);
+	  else             setRGBA (toX, y, width, &span[0]);
 	}
-    else
-    {
-	  if (offsetY < 0)
-	  {
-		for (int y = needHeight - 1; y >= toY; y--)
-        {
-		  for (int x = toX; x < needWidth; x++)
-	      {
-			setRGBA (x, y, source.getRGBA (x + offsetX, y + offsetY));
-	      }
-	    }
-	  }
-      else
-      {
-		for (int y = toY; y < needHeight; y++)
-        {
-		  for (int x = toX; x < needWidth; x++)
-	      {
-			setRGBA (x, y, source.getRGBA (x + offsetX, y + offsetY));
-	      }
-	    }
-      }
-    }
   }
 }
 
@@ -439,13 +407,8 @@ Image::clear (unsigned int rgba)
 {
   if (rgba)
   {
-	for (int y = 0; y < height; y++)
-	{
-	  for (int x = 0; x < width; x++)
-	  {
-		format->setRGBA (buffer->pixel (x, y), rgba);
-	  }
-	}
+	vector<uint32_t> span (width, rgba);
+	for (int y = 0; y < height; y++) setRGBA (0, y, width, &span[0]);
   }
   else
   {
@@ -453,6 +416,51 @@ Image::clear (unsigned int rgba)
   }
 }
 
+void
+Image::getRGBA (int x, int y, int count, uint32_t rgba[]) const
+{
+  assert (x >= 0  &&  x + count <= width  &&  y >= 0  &&  y < height);
+  void * storage[3];
+  if (void * r = buffer->row (y, storage)) return format->getRGBA (r, x, count, rgba);
+  for (int i = 0; i < count; i++) rgba[i] = format->getRGBA (buffer->pixelRead (x + i, y));
+}
+
+void
+Image::getRGBA (int x, int y, int count, float values[]) const
+{
+  assert (x >= 0  &&  x + count <= width  &&  y >= 0  &&  y < height);
+  void * storage[3];
+  if (void * r = buffer->row (y, storage)) return format->getRGBA (r, x, count, values);
+  for (int i = 0; i < count; i++) format->getRGBA (buffer->pixelRead (x + i, y), values + 4 * i);
+}
+
+void
+Image::getGray (int x, int y, int count, float gray[]) const
+{
+  assert (x >= 0  &&  x + count <= width  &&  y >= 0  &&  y < height);
+  void * storage[3];
+  if (void * r = buffer->row (y, storage)) return format->getGray (r, x, count, gray);
+  for (int i = 0; i < count; i++) format->getGray (buffer->pixelRead (x + i, y), gray[i]);
+}
+
+void
+Image::setRGBA (int x, int y, int count, const uint32_t rgba[])
+{
+  assert (x >= 0  &&  x + count <= width  &&  y >= 0  &&  y < height);
+  void * storage[3];
+  if (void * r = buffer->row (y, storage)) return format->setRGBA (r, x, count, rgba);
+  for (int i = 0; i < count; i++) format->setRGBA (buffer->pixel (x + i, y), rgba[i]);
+}
+
+void
+Image::setGray (int x, int y, int count, const float gray[])
+{
+  assert (x >= 0  &&  x + count <= width  &&  y >= 0  &&  y < height);
+  void * storage[3];
+  if (void * r = buffer->row (y, storage)) return format->setGray (r, x, count, gray);
+  for (int i = 0; i < count; i++) format->setGray (buffer->pixel (x + i, y), gray[i]);
+}
+
 Image
 Image::operator + (const Image & that)
 {
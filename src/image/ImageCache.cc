@@ -14,8 +14,10 @@ for details.
 #include "fl/math.h"
 #include "fl/imagecache.h"
 #include "fl/convolve.h"
+#include "fl/time.h"
 
 #include <float.h>
+#include <algorithm>
 
 
 using namespace fl;
@@ -24,6 +26,14 @@ using namespace std;
 
 // class ImageCacheEntry ------------------------------------------------------
 
+ImageCacheEntry::ImageCacheEntry ()
+{
+  pinned   = false;
+  cost     = 0;
+  priority = 0;
+  lastUsed = 0;
+}
+
 ImageCacheEntry::~ImageCacheEntry ()
 {
 }
@@ -74,8 +84,14 @@ ImageCache ImageCache::shared;  // instantiate the global cache
 
 ImageCache::ImageCache ()
 {
-  original = 0;
-  memory = 0;
+  original  = 0;
+  memory    = 0;
+  budget    = 0;
+  inflation = 0;
+  clock     = 0;
+  hits      = 0;
+  misses    = 0;
+  evictions = 0;
 }
 
 ImageCache::~ImageCache ()
@@ -86,82 +102,247 @@ ImageCache::~ImageCache ()
 void
 ImageCache::clear ()
 {
-  mutex.lock ();
+  unique_lock<recursive_mutex> lock (mutex);
+  waitPending (lock);  // Generators may still be looking through the cache structure.
   cacheType::iterator i;
   for (i = cache.begin (); i != cache.end (); i++)
   {
-	delete *i;
+	release (*i);
   }
   cache.clear ();
-  original = 0;
-  memory = 0;
-  mutex.unlock ();
+  original  = 0;
+  memory    = 0;
+  inflation = 0;
 }
 
 void
 ImageCache::clear (ImageCacheEntry * query)
 {
-  mutex.lock ();
+  unique_lock<recursive_mutex> lock (mutex);
+  waitPending (lock);
   cacheType::iterator i = cache.find (query);
   while (i != cache.end ())
   {
 	memory -= (*i)->memory ();
 	if (*i == original) original = 0;  // don't keep pointer to something we delete
-	if (*i != query) delete *i;  // query itself will be deleted below; this avoids double free
+	if (*i == query) query->PointerPolyReferenceCount--;  // query itself is handled below; this avoids double free
+	else             release (*i);
 	cache.erase (i);
 	i = cache.find (query);
   }
-  mutex.unlock ();
-  delete query;
+  lock.unlock ();
+  if (query->PointerPolyReferenceCount == 0) delete query;
 }
 
 void
 ImageCache::setOriginal (const Image & image, float scale)
 {
-  mutex.lock ();
-  if (original == 0  ||  original->image != image  ||  original->scale != scale)
   {
-	setOriginal (new EntryPyramid (image, scale));
+	lock_guard<recursive_mutex> lock (mutex);
+	if (original  &&  original->image == image  &&  original->scale == scale) return;
   }
-  mutex.unlock ();
+  setOriginal (new EntryPyramid (image, scale));
 }
 
 void
 ImageCache::setOriginal (EntryPyramid * entry)
 {
-  mutex.lock ();
+  unique_lock<recursive_mutex> lock (mutex);
   if (cache.find (entry) == cache.end ())
   {
-	clear ();
+	waitPending (lock);
+	clear ();  // No waiting, since lock is held and nothing is pending.
 	cache.insert (entry);
+	entry->PointerPolyReferenceCount++;
 	memory = entry->memory ();
   }
   original = entry;
-  mutex.unlock ();
+  touch (entry);
 }
 
-ImageCacheEntry *
-ImageCache::get (ImageCacheEntry * query)
+/**
+   The mutex is only held while examining or changing the structure of the
+   cache, not while generating.  A query that is not yet in the cache goes
+   into the pending list while its generate() runs, so that other threads
+   asking for the same thing wait for this result rather than computing it
+   again.  Requests for unrelated entries proceed in parallel.
+
+   The result is attached to a PointerPoly while the mutex is still held,
+   so it can't be evicted between lookup and use.
+ **/
+PointerPoly<ImageCacheEntry>
+ImageCache::acquire (ImageCacheEntry * query)
 {
-  mutex.lock ();
-  cacheType::iterator i = cache.find (query);
-  if (i != cache.end ())
+  unique_lock<recursive_mutex> lock (mutex);
+  while (true)
+  {
+	cacheType::iterator i = cache.find (query);
+	if (i != cache.end ())
+	{
+	  PointerPoly<ImageCacheEntry> result = *i;
+	  hits++;
+	  touch (result);
+	  lock.unlock ();
+	  delete query;
+	  return result;
+	}
+	if (! inFlight (query)) break;
+	generated.wait (lock);  // If the generator fails, we wake up to find nothing pending, and take over the job.
+  }
+  misses++;
+  pending.push_back (query);
+  generators.push_back (this_thread::get_id ());
+  lock.unlock ();
+
+  try
+  {
+	double start = getTimestamp ();
+	query->generate (*this);
+	query->cost = getTimestamp () - start;
+  }
+  catch (...)
   {
-	mutex.unlock ();
+	lock.lock ();
+	finish (query);
+	generated.notify_all ();
+	lock.unlock ();
+	delete query;  // We own it, and it never made it into the cache.
+	throw;
+  }
+
+  lock.lock ();
+  finish (query);
+  PointerPoly<ImageCacheEntry> result;
+  pair<cacheType::iterator, bool> inserted = cache.insert (query);
+  if (inserted.second)
+  {
+	query->PointerPolyReferenceCount++;
+	memory += query->memory ();
+	result = query;
+  }
+  else  // An equivalent entry was stored directly (for example, by setOriginal()) while we were working.
+  {
+	result = *inserted.first;
 	delete query;
-	return *i;
   }
-  query->generate (*this);
-  cache.insert (i, query);
-  memory += query->memory ();
-  mutex.unlock ();
-  return query;
+  touch (result);
+  evict (result);
+  generated.notify_all ();
+  return result;
+}
+
+ImageCacheEntry *
+ImageCache::get (ImageCacheEntry * query)
+{
+  return pin (acquire (query));
 }
 
 ImageCacheEntry *
 ImageCache::getClosest (ImageCacheEntry * query)
 {
-  ImageCacheEntry * result = 0;
+  return pin (acquireClosest (query));
+}
+
+ImageCacheEntry *
+ImageCache::getLE (ImageCacheEntry * query)
+{
+  return pin (acquireLE (query));
+}
+
+/**
+   The handle keeps entry alive until it is pinned.  Once the handle goes
+   away, only the cache's own reference remains, and pinned keeps evict()
+   from dropping that one.
+ **/
+ImageCacheEntry *
+ImageCache::pin (const PointerPoly<ImageCacheEntry> & entry)
+{
+  if (! entry.memory) return 0;
+  lock_guard<recursive_mutex> lock (mutex);
+  entry->pinned = true;
+  return entry;
+}
+
+/**
+   Implements the GreedyDual-Size policy: priority is the current inflation
+   value plus the cost of regenerating the entry per byte it occupies.
+   Evicting an entry raises inflation to its priority, so entries that
+   have not been touched since then rank below newly touched ones of equal
+   cost density.
+ **/
+void
+ImageCache::touch (ImageCacheEntry * entry)
+{
+  ptrdiff_t bytes = max ((ptrdiff_t) 1, entry->memory ());
+  entry->priority = inflation + max (entry->cost, 1e-6) / bytes;  // floor on cost, so timer resolution doesn't make cheap entries free
+  entry->lastUsed = ++clock;
+}
+
+void
+ImageCache::evict (const ImageCacheEntry * keep)
+{
+  if (budget <= 0) return;
+  while (memory > budget)
+  {
+	cacheType::iterator victim = cache.end ();
+	for (cacheType::iterator i = cache.begin (); i != cache.end (); i++)
+	{
+	  ImageCacheEntry * e = *i;
+	  if (e == keep  ||  e == original  ||  e->pinned  ||  e->PointerPolyReferenceCount > 1) continue;  // Only the cache's own reference may remain.
+	  if (victim == cache.end ()) victim = i;
+	  else
+	  {
+		ImageCacheEntry * v = *victim;
+		if (e->priority < v->priority  ||  (e->priority == v->priority  &&  e->lastUsed < v->lastUsed)) victim = i;
+	  }
+	}
+	if (victim == cache.end ()) return;  // Everything left is pinned or in use.
+
+	ImageCacheEntry * v = *victim;
+	inflation = max (inflation, v->priority);
+	memory -= v->memory ();
+	evictions++;
+	cache.erase (victim);
+	release (v);
+  }
+}
+
+void
+ImageCache::release (ImageCacheEntry * entry)
+{
+  if (--entry->PointerPolyReferenceCount == 0) delete entry;
+}
+
+void
+ImageCache::waitPending (unique_lock<recursive_mutex> & lock)
+{
+  if (find (generators.begin (), generators.end (), this_thread::get_id ()) != generators.end ()) throw "ImageCache: can't clear or replace original from within generate()";
+  while (! pending.empty ()) generated.wait (lock);
+}
+
+void
+ImageCache::finish (ImageCacheEntry * query)
+{
+  int i = find (pending.begin (), pending.end (), query) - pending.begin ();
+  pending   .erase (pending   .begin () + i);
+  generators.erase (generators.begin () + i);
+}
+
+bool
+ImageCache::inFlight (const ImageCacheEntry * query) const
+{
+  for (int i = 0; i < pending.size (); i++)
+  {
+	const ImageCacheEntry * p = pending[i];
+	if (! query->compare (*p)  &&  ! p->compare (*query)) return true;
+  }
+  return false;
+}
+
+PointerPoly<ImageCacheEntry>
+ImageCache::acquireClosest (ImageCacheEntry * query)
+{
+  PointerPoly<ImageCacheEntry> result;
   float di = INFINITY;
   float dj = INFINITY;
   mutex.lock ();
@@ -173,17 +354,22 @@ ImageCache::getClosest (ImageCacheEntry * query)
 	i--;  // one entry before j
 	if (i != cache.end ()) di = query->distance (**i);
   }
-  mutex.unlock ();
   if      (dj < di)        result = *j;
   else if (di != INFINITY) result = *i;
+  if (result.memory)
+  {
+	hits++;
+	touch (result);
+  }
+  mutex.unlock ();
   delete query;
   return result;
 }
 
-ImageCacheEntry *
-ImageCache::getLE (ImageCacheEntry * query)
+PointerPoly<ImageCacheEntry>
+ImageCache::acquireLE (ImageCacheEntry * query)
 {
-  ImageCacheEntry * result = 0;
+  PointerPoly<ImageCacheEntry> result;
   float di = INFINITY;
   float dj = INFINITY;
   mutex.lock ();
@@ -191,9 +377,14 @@ ImageCache::getLE (ImageCacheEntry * query)
   cacheType::iterator j = i--;
   if (i != cache.end ()) di = query->distance (**i);
   if (j != cache.end ()) dj = query->distance (**j);
-  mutex.unlock ();
   if      (dj == 0)        result = *j;  // only use j if it exactly equals the query
   else if (di != INFINITY) result = *i;
+  if (result.memory)
+  {
+	hits++;
+	touch (result);
+  }
+  mutex.unlock ();
   delete query;
   return result;
 }
@@ -264,6 +455,10 @@ EntryPyramid::generate (ImageCache & cache)
   // If image preloaded, then done.
   if (image.height > 0  &&  image.format != 0  &&  image.buffer != 0) return;
 
+  // Search the cache structure under lock.  Whatever entry we settle on is
+  // held in a PointerPoly, so it stays valid after unlocking.
+  unique_lock<recursive_mutex> lock (cache.mutex);
+
   // Find closest entry that comes after this one.  If same scale, then
   // resample and done.
   ImageCache::cacheType::iterator i = cache.cache.lower_bound (this);
@@ -272,14 +467,16 @@ EntryPyramid::generate (ImageCache & cache)
   {
 	if (*o->image.format == *image.format  &&  o->scale == scale)
 	{
-	  resample (cache, o);
+	  PointerPoly<EntryPyramid> source = o;
+	  lock.unlock ();
+	  resample (cache, source);
 	  return;
 	}
   }
 
   // Search below us for an image to blur/resample.
   float minScale = scale / 2;  // only search within one octave
-  EntryPyramid * bestEntry = 0;
+  PointerPoly<EntryPyramid> bestEntry;
   float bestRatio = INFINITY;
   while (i != cache.cache.begin ())
   {
@@ -288,7 +485,7 @@ EntryPyramid::generate (ImageCache & cache)
 	if (! o) break;
 	if (*o->image.format != *image.format) break;
 	if (o->scale < minScale) break;
-	if (bestEntry  &&  o->scale < bestEntry->scale) break;
+	if (bestEntry.memory  &&  o->scale < bestEntry->scale) break;
 	float ratio = ratioDistance (o->image.width, image.width);
 	if (ratio < bestRatio)
 	{
@@ -296,7 +493,7 @@ EntryPyramid::generate (ImageCache & cache)
 	  bestRatio = ratio;
 	}
   }
-  if (! bestEntry)
+  if (! bestEntry.memory)
   {
 	if (! cache.original) throw "ImageCache::original not set";
 	if (minScale < cache.original->scale)
@@ -307,6 +504,7 @@ EntryPyramid::generate (ImageCache & cache)
 	{
 	  float originalScale = cache.original->scale;
 	  int   originalWidth = cache.original->image.width;
+	  lock.unlock ();
 	  float octave     = log2 (scale / originalScale);
 	  float nextOctave = floor (octave);  // quantize to the nearest containing octave
 	  float ratio      = pow (2, octave);
@@ -315,9 +513,10 @@ EntryPyramid::generate (ImageCache & cache)
 	  float nextScale  = nextRatio * originalScale;
 	  int   nextWidth  = originalWidth / (int) nextRatio;
 	  if (! fast) nextWidth = max (nextWidth, image.width);
-	  bestEntry = (EntryPyramid *) cache.get (new EntryPyramid (*image.format, nextScale, nextWidth));
+	  bestEntry = (EntryPyramid *) cache.acquire (new EntryPyramid (*image.format, nextScale, nextWidth));
 	}
   }
+  if (lock.owns_lock ()) lock.unlock ();
 
   resample (cache, bestEntry);
 }
@@ -338,7 +537,8 @@ EntryPyramid::compare (const ImageCacheEntry & that) const
   if (image.format != 0  &&  o->image.format != 0)
   {
 	if (image.format->precedence < o->image.format->precedence) return true;
-	if (*image.format != *o->image.format) return false;
+	if (image.format->precedence > o->image.format->precedence) return false;
+	if (*image.format != *o->image.format) return typeid (*image.format).before (typeid (*o->image.format));  // Distinct formats with equal precedence must not look equivalent.
   }
 
   if (scale  &&  o->scale)
@@ -129,6 +129,54 @@ ImageFile::write (const Image & image, int x, int y)
   delegate->write (image, x, y);
 }
 
+void
+ImageFile::attach (Image & image, ptrdiff_t cacheBytes)
+{
+  if (! delegate.memory) throw "ImageFile not open";
+
+  // Determine format by fetching a single pixel.
+  Image probe;
+  delegate->read (probe, 0, 0, 1, 1);
+  if (probe.width != 1  ||  probe.height != 1)
+  {
+	// The codec ignored the region, so probe is already the entire raster.
+	// Each tile of a PixelBufferBig would decode all of it again.
+	image = probe;
+	if (! std::isnan (timestamp)) image.timestamp = timestamp;
+	return;
+  }
+  const PixelFormat * format = probe.format.memory;
+  if (format->planes != 1) format = &RGBAChar;  // PixelBufferBig only handles packed formats
+
+  int width  = 0;
+  int height = 0;
+  delegate->get ("width",  width);
+  delegate->get ("height", height);
+  if (width <= 0  ||  height <= 0)  // No way to lay out tiles, so fall back on an ordinary read.
+  {
+	read (image);
+	return;
+  }
+
+  // Use the native block structure of the file, but avoid very thin tiles
+  // (such as single-row strips), which would make vertical access expensive.
+  int blockWidth  = 0;
+  int blockHeight = 0;
+  delegate->get ("blockWidth",  blockWidth);
+  delegate->get ("blockHeight", blockHeight);
+  if (blockWidth  <= 0) blockWidth  = 256;
+  if (blockHeight <= 0) blockHeight = 256;
+  blockWidth = min (blockWidth, width);
+  while (blockWidth * blockHeight < 0x4000  &&  blockHeight < height) blockHeight *= 2;
+
+  image.detach ();
+  image.format    = format;
+  image.buffer    = new PixelBufferBig (delegate.memory, *format, width, height, blockWidth, blockHeight, cacheBytes);
+  image.width     = width;
+  image.height    = height;
+  image.timestamp = std::isnan (timestamp) ? probe.timestamp : timestamp;
+}
+
 void
 ImageFile::get (const std::string & name, std::string & value)
 {
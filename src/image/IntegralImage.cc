@@ -0,0 +1,83 @@
+/*
+Author: Fred Rothganger
+
+Copyright 2010 Sandia Corporation.
+Under the terms of Contract DE-AC04-94AL85000 with Sandia Corporation,
+the U.S. Government retains certain rights in this software.
+Distributed under the GNU Lesser General Public License.  See the file LICENSE
+for details.
+*/
+
+
+#include "fl/convolve.h"
+
+#include <string.h>
+
+
+using namespace std;
+using namespace fl;
+
+
+// class IntegralImage --------------------------------------------------------
+
+IntegralImage::IntegralImage (const PixelFormat & format)
+: format (&format)
+{
+  if (format != GrayDouble  &&  format != GrayFloat) throw "IntegralImage only produces GrayDouble or GrayFloat";
+}
+
+Image
+IntegralImage::filter (const Image & image)
+{
+  const int width  = image.width;
+  const int height = image.height;
+
+  Image result (width + 1, height + 1, *format);
+  result.timestamp = image.timestamp;
+  PixelBufferPacked * buffer = (PixelBufferPacked *) result.buffer;
+  char * base = (char *) buffer->base ();
+
+  // Each row is the row above plus a running sum along the current row.
+  // Rows are accumulated in double regardless of output format.
+  vector<float>  gray (width);
+  vector<double> above (width + 1, 0.0);
+  memset (base, 0, buffer->stride);
+  for (int y = 0; y < height; y++)
+  {
+	image.getGray (0, y, width, &gray[0]);
+	char * row = base + (y + 1) * buffer->stride;
+	double running = 0;
+	if (*format == GrayDouble)
+	{
+	  double * r = (double *) row;
+	  r[0] = 0;
+	  for (int x = 0; x < width; x++)
+	  {
+		running += gray[x];
+		r[x+1] = above[x+1] += running;
+	  }
+	}
+	else
+	{
+	  float * r = (float *) row;
+	  r[0] = 0;
+	  for (int x = 0; x < width; x++)
+	  {
+		running += gray[x];
+		r[x+1] = above[x+1] += running;
+	  }
+	}
+  }
+
+  return result;
+}
+
+double
+IntegralImage::sum (const Image & integral, int x0, int y0, int x1, int y1)
+{
+  PixelBufferPacked * buffer = (PixelBufferPacked *) integral.buffer;
+  const char * base   = (char *) buffer->base ();
+  const double * top    = (double *) (base + y0 * buffer->stride);
+  const double * bottom = (double *) (base + y1 * buffer->stride);
+  return bottom[x1] - bottom[x0] - top[x1] + top[x0];
+}
@@ -15,9 +15,13 @@ for details.
 
 
 #include "fl/interest.h"
+#include "fl/cpu.h"
 #include "fl/lapack.h"
+#include "fl/thread.h"
 
+#include <exception>
 #include <math.h>
+#include <string.h>
 
 // Include for debugging
 #include "fl/time.h"
@@ -27,6 +31,152 @@ using namespace std;
 using namespace fl;
 
 
+// Extremum scan --------------------------------------------------------------
+
+/*
+  The scan compares each pixel of the middle level with the ring of eight
+  pixels around the same position in each of the three levels.  It has
+  never compared with the centers of the upper and lower levels, and that
+  is kept so detections stay the same.  rows holds rows y-1, y, y+1 of the
+  lower, middle and upper levels in turn, so rows[4] is the row being
+  searched.  A pixel is kept if it exceeds the threshold and every
+  neighbor, or is below -threshold and every neighbor.
+*/
+
+static inline bool
+extremum (const float * const * rows, int x, float threshold)
+{
+  const float value = rows[4][x];
+  bool maximum = value >  threshold;
+  bool minimum = value < -threshold;
+  if (! maximum  &&  ! minimum) return false;
+  for (int r = 0; r < 9; r++)
+  {
+	const float * row = rows[r] + x;
+	for (int dx = -1; dx <= 1; dx++)
+	{
+	  if (r % 3 == 1  &&  dx == 0) continue;
+	  maximum &= value > row[dx];
+	  minimum &= value < row[dx];
+	}
+  }
+  return maximum  ||  minimum;
+}
+
+#if defined (__GNUC__)  &&  (defined (__x86_64__)  ||  defined (__SSE2__))
+
+/**
+   Tests lanes pixels at a time.  Most pixels fail the threshold, so that
+   test alone decides whether the 24 neighbor loads happen at all.
+   @return The first x not yet scanned.
+**/
+template<int bytes>
+static inline __attribute__ ((always_inline)) int
+scanRowVector (const float * const * rows, int x, int last, float threshold, int * hits, int & count)
+{
+  typedef float   V  __attribute__ ((vector_size (bytes)));
+  typedef int32_t VI __attribute__ ((vector_size (bytes)));
+  const int N = bytes / sizeof (float);
+
+  V zero = {};
+  V high = zero + threshold;
+  V low  = zero - threshold;
+  for (; x + N <= last; x += N)
+  {
+	V value;
+	memcpy (&value, rows[4] + x, bytes);
+	VI maximum = value > high;
+	VI minimum = value < low;
+	VI any = maximum | minimum;
+	uint64_t bits[bytes / 8];
+	memcpy (bits, &any, bytes);
+	uint64_t sum = 0;
+	for (int i = 0; i < bytes / 8; i++) sum |= bits[i];
+	if (! sum) continue;
+
+	for (int r = 0; r < 9; r++)
+	{
+	  const float * row = rows[r] + x;
+	  for (int dx = -1; dx <= 1; dx++)
+	  {
+		if (r % 3 == 1  &&  dx == 0) continue;
+		V n;
+		memcpy (&n, row + dx, bytes);
+		maximum &= value > n;
+		minimum &= value < n;
+	  }
+	}
+
+	any = maximum | minimum;
+	int32_t hit[N];
+	memcpy (hit, &any, bytes);
+	for (int i = 0; i < N; i++) if (hit[i]) hits[count++] = x + i;
+  }
+  return x;
+}
+
+__attribute__ ((target ("avx2"))) static int scanRowAVX2 (const float * const * rows, int x, int last, float threshold, int * hits, int & count) {return scanRowVector<32> (rows, x, last, threshold, hits, count);}
+static                            int scanRowSSE2 (const float * const * rows, int x, int last, float threshold, int * hits, int & count) {return scanRowVector<16> (rows, x, last, threshold, hits, count);}
+
+#endif
+
+/**
+   Finds the extrema in [first, last) of the row in rows[4].
+   @return Number of positions written to hits.
+**/
+static int
+scanRow (const float * const * rows, int first, int last, float threshold, int * hits)
+{
+  int count = 0;
+  int x = first;
+# if defined (__GNUC__)  &&  (defined (__x86_64__)  ||  defined (__SSE2__))
+  if (haveAVX2 ()) x = scanRowAVX2 (rows, x, last, threshold, hits, count);
+  else             x = scanRowSSE2 (rows, x, last, threshold, hits, count);
+# endif
+  for (; x < last; x++) if (extremum (rows, x, threshold)) hits[count++] = x;
+  return count;
+}
+
+
+// class OctaveRunner ---------------------------------------------------------
+
+namespace
+{
+class OctaveRunner : public ParallelFor<int>
+{
+public:
+  OctaveRunner (InterestDOG & owner, ImageCache & cache, const vector<int> & ratios, vector<vector<PointInterest> > & found)
+  : ParallelFor<int> (owner.threadRequest),
+	owner (owner),
+	cache (cache),
+	ratios (ratios),
+	found (found)
+  {
+  }
+
+  virtual void process (const int i)
+  {
+	try
+	{
+	  owner.searchOctave (cache, ratios[i], found[i]);
+	}
+	catch (...)  // Anything that escapes a worker thread would terminate the process, so carry it back to the caller of run().
+	{
+	  std::lock_guard<std::mutex> lock (mutexError);
+	  if (! error) error = std::current_exception ();
+	}
+  }
+
+  InterestDOG &                    owner;
+  ImageCache &                     cache;
+  const vector<int> &              ratios;
+  vector<vector<PointInterest> > & found;
+  std::exception_ptr               error;  ///< First exception thrown by any octave.
+  std::mutex                       mutexError;
+};
+}
+
+
 // class InterestDOG ----------------------------------------------------------
 
 InterestDOG::InterestDOG (float firstScale, float lastScale, int extraSteps)
@@ -39,34 +189,9 @@ InterestDOG::InterestDOG (float firstScale, float lastScale, int extraSteps)
   thresholdEdge = 0.06f;
   thresholdPeak = 0.04f / steps;
 
-  fast = false;
-}
-
-inline bool
-InterestDOG::isLocalMax (float value, ImageOf<float> & dog, int x, int y)
-{
-  if (value > 0)
-  {
-	return    dog(x-1,y-1) < value
-	       && dog(x-1,y  ) < value
-	       && dog(x-1,y+1) < value
-	       && dog(x  ,y-1) < value
-	       && dog(x  ,y+1) < value
-	       && dog(x+1,y-1) < value
-	       && dog(x+1,y  ) < value
-	       && dog(x+1,y+1) < value;
-  }
-  else
-  {
-	return    dog(x-1,y-1) > value
-	       && dog(x-1,y  ) > value
-	       && dog(x-1,y+1) > value
-	       && dog(x  ,y-1) > value
-	       && dog(x  ,y+1) > value
-	       && dog(x+1,y-1) > value
-	       && dog(x+1,y  ) > value
-	       && dog(x+1,y+1) > value;
-  }
+  fast          = false;
+  halfPrecision = false;
+  threadRequest = 0;
 }
 
 inline bool
@@ -107,116 +232,173 @@ InterestDOG::fitQuadratic (ImageOf<float> & dog0, ImageOf<float> & dog1, ImageOf
 void
 InterestDOG::run (ImageCache & cache, PointSet & result)
 {
-  multiset<PointInterest> sorted;
-
   // Create our own preblur, to prevent operation from being broken into
   // several steps by image cache mechanism.
-  EntryPyramid * entry = (EntryPyramid *) cache.getLE (new EntryPyramid (GrayFloat, firstScale));
-  if (! entry) entry = (EntryPyramid *) cache.get (new EntryPyramid (GrayFloat));
+  PointerPoly<EntryPyramid> entry = (EntryPyramid *) cache.acquireLE (new EntryPyramid (GrayFloat, firstScale));
+  if (! entry.memory) entry = (EntryPyramid *) cache.acquire (new EntryPyramid (GrayFloat));
   if (entry->scale < firstScale)
   {
 	Gaussian1D blur (sqrt (firstScale * firstScale - entry->scale * entry->scale), Boost, GrayFloat, Horizontal);
 	Image temp = entry->image * blur;
 	blur.direction = Vertical;
 	temp *= blur;
-	cache.get (new EntryPyramid (temp, firstScale));
+	cache.acquire (new EntryPyramid (temp, firstScale));
   }
 
   // Step thru octaves until image is too small to process
   int originalWidth  = cache.original->image.width;
   int originalHeight = cache.original->image.height;
-  float scaleRatio = pow (2.0, 1.0 / steps);
   int minsize = 2 * crop + 3;
-  int ratio = 1;
-  while (ratio * firstScale <= lastScale)
+  vector<int> ratios;
+  for (int ratio = 1; ratio * firstScale <= lastScale; ratio *= 2)
   {
 	int width  = originalWidth  / ratio;
 	int height = originalHeight / ratio;
 	if (width < minsize  ||  height < minsize) break;
+	ratios.push_back (ratio);
+  }
+
+  // Fetch the Gaussian levels serially, in octave order.  Each octave
+  // starts from the top levels of the one below, so this chain can't be
+  // split anyway, and the order determines which entries the cache derives
+  // each level from.  A DoG whose two levels took different paths is full
+  // of spurious extrema, so this order must not depend on thread timing.
+  // The levels are held until the search is done, so that a cache budget
+  // can't evict one and have it rebuilt by a different path.
+  float scaleRatio = pow (2.0, 1.0 / steps);
+  vector<PointerPoly<ImageCacheEntry> > levels;
+  for (int i = 0; i < ratios.size (); i++)
+  {
+	float scale = firstScale * ratios[i];
+	int   width = originalWidth / ratios[i];
+	for (int j = 0; j < steps + 3; j++)
+	{
+	  levels.push_back (cache.acquire (new EntryPyramid (GrayFloat, scale, width)));
+	  scale *= scaleRatio;
+	}
+  }
+
+  // Then difference and search the octaves concurrently.
+  vector<vector<PointInterest> > found (ratios.size ());
+  if (ratios.size () < 2  ||  threadRequest == 1)
+  {
+	for (int i = 0; i < ratios.size (); i++) searchOctave (cache, ratios[i], found[i]);
+  }
+  else
+  {
+	OctaveRunner runner (*this, cache, ratios, found);
+	runner.run (0, ratios.size ());
+	if (runner.error) std::rethrow_exception (runner.error);
+  }
+
+  multiset<PointInterest> sorted;
+  for (int i = 0; i < found.size (); i++) sorted.insert (found[i].begin (), found[i].end ());
+  result.add (sorted);
+}
 
-	// Collect DOG images
-	vector<EntryDOG *> dogs (steps + 2);
-	float scale = firstScale * ratio;
-	for (int i = 0; i < steps + 2; i++)
+void
+InterestDOG::searchOctave (ImageCache & cache, int ratio, vector<PointInterest> & result)
+{
+  int width = cache.original->image.width / ratio;
+
+  // Collect DOG images.  Sibling octaves call cache.acquire() concurrently, so
+  // hold each entry rather than a raw pointer that eviction could free.
+  vector<PointerPoly<EntryDOG> > dogs (steps + 2);
+  float scaleRatio = pow (2.0, 1.0 / steps);
+  float scale = firstScale * ratio;
+  for (int i = 0; i < steps + 2; i++)
+  {
+	float nextScale = scale * scaleRatio;
+	dogs[i] = (EntryDOG *) cache.acquire (new EntryDOG (nextScale, scale, width, halfPrecision ? (const PixelFormat &) GrayHalf : GrayFloat));
+	scale = nextScale;
+  }
+
+  // Search for maxima in DoG at each scale level.  Levels stored in half
+  // precision are widened once each, and only three are held at a time.
+  ImageOf<float> dog1 = dogs[0]->image * GrayFloat;
+  ImageOf<float> dog2 = dogs[1]->image * GrayFloat;
+  vector<int> hits;
+  for (int i = 0; i < steps; i++)
+  {
+	ImageOf<float> dog0 = dog1;
+	dog1 = dog2;
+	dog2 = ImageOf<float> (dogs[i+2]->image * GrayFloat);
+	float scale0 = dogs[i  ]->scale;
+	float scale1 = dogs[i+1]->scale;
+	float scale2 = dogs[i+2]->scale;
+
+	const float * base[3];
+	int           stride[3];
+	ImageOf<float> * level[] = {&dog0, &dog1, &dog2};
+	for (int l = 0; l < 3; l++)
 	{
-	  float nextScale = scale * scaleRatio;
-	  dogs[i] = (EntryDOG *) cache.get (new EntryDOG (nextScale, scale, width));
-	  scale = nextScale;
+	  PixelBufferPacked * buffer = (PixelBufferPacked *) level[l]->buffer;
+	  base[l]   = (float *) buffer->base ();
+	  stride[l] = buffer->stride / sizeof (float);
 	}
+	hits.resize (dog1.width);
 
-	// Search for maxima in DoG at each scale level
-	for (int i = 0; i < steps; i++)
+	for (int y = crop; y < dog1.height - crop; y++)
 	{
-	  ImageOf<float> dog0 = dogs[i  ]->image;
-	  ImageOf<float> dog1 = dogs[i+1]->image;
-	  ImageOf<float> dog2 = dogs[i+2]->image;
-	  float scale0 = dogs[i  ]->scale;
-	  float scale1 = dogs[i+1]->scale;
-	  float scale2 = dogs[i+2]->scale;
-	  for (int y = crop; y < dog1.height - crop; y++)
+	  const float * rows[9];
+	  for (int l = 0; l < 3; l++)
+	  {
+		for (int k = 0; k < 3; k++) rows[3 * l + k] = base[l] + (y - 1 + k) * stride[l];
+	  }
+	  int hitCount = scanRow (rows, crop, dog1.width - crop, 0.8f * thresholdPeak, &hits[0]);
+
+	  for (int h = 0; h < hitCount; h++)
 	  {
-		for (int x = crop; x < dog1.width - crop; x++)
+		int x = hits[h];
+		if (! notOnEdge (dog1, x, y)) continue;
+
+		// Search for precise location of maximum using interpolation.
+		Vector<float> offset;
+		int u = x;
+		int v = y;
+		float peak;
+		int count = 0;
+		bool changed = true;
+		while (changed  &&  count++ < 5)
 		{
-		  float & value = dog1(x,y);
-		  if (   fabsf (value) > 0.8 * thresholdPeak
-			  && isLocalMax (value, dog0, x, y)
-			  && isLocalMax (value, dog1, x, y)
-			  && isLocalMax (value, dog2, x, y)
-			  && notOnEdge (dog1, x, y))
+		  int oldu = u;
+		  int oldv = v;
+		  peak = fitQuadratic (dog0, dog1, dog2, u, v, offset);
+		  if (offset[1] > 0.6f  &&  u < dog1.width - crop)
 		  {
-			// Search for precise location of maximum using interpolation.
-			Vector<float> offset;
-			int u = x;
-			int v = y;
-			float peak;
-			int count = 0;
-			bool changed = true;
-			while (changed  &&  count++ < 5)
-			{
-			  int oldu = u;
-			  int oldv = v;
-			  peak = fitQuadratic (dog0, dog1, dog2, u, v, offset);
-			  if (offset[1] > 0.6f  &&  u < dog1.width - crop)
-			  {
-				u++;
-			  }
-			  if (offset[1] < -0.6f  &&  u > crop)
-			  {
-				u--;
-			  }
-			  if (offset[2] > 0.6f  &&  v < dog1.height - crop)
-			  {
-				v++;
-			  }
-			  if (offset[2] < -0.6f  &&  v > crop)
-			  {
-				v--;
-			  }
-			  changed =  u != oldu  ||  v != oldv;
-			}
-
-			// Store the point if quadratic interpolation returned reasonable
-			// results and the DoG response is strong enough.
-			if (fabs (offset[0]) < 1.5f  &&  fabs (offset[1]) < 1.5f  &&  fabs (offset[2]) < 1.5f  &&  fabs (peak) > thresholdPeak)
-			{
-			  PointInterest p;
-			  if (offset[0] > 0) p.scale =  offset[0] * (scale2 - scale1) + scale1;
-			  else               p.scale = -offset[0] * (scale0 - scale1) + scale1;
-			  p.x = (x + offset[1] + 0.5f) * ratio - 0.5f;  // Coordinates all use center-of-pixel convention.  Must shift to left edge of pixel to properly overly images w/ different scales.
-			  p.y = (y + offset[2] + 0.5f) * ratio - 0.5f;
-			  p.weight = abs (peak);
-			  p.detector = PointInterest::Blob;
-			  sorted.insert (p);
-			}
+			u++;
 		  }
+		  if (offset[1] < -0.6f  &&  u > crop)
+		  {
+			u--;
+		  }
+		  if (offset[2] > 0.6f  &&  v < dog1.height - crop)
+		  {
+			v++;
+		  }
+		  if (offset[2] < -0.6f  &&  v > crop)
+		  {
+			v--;
+		  }
+		  changed =  u != oldu  ||  v != oldv;
+		}
+
+		// Store the point if quadratic interpolation returned reasonable
+		// results and the DoG response is strong enough.
+		if (fabs (offset[0]) < 1.5f  &&  fabs (offset[1]) < 1.5f  &&  fabs (offset[2]) < 1.5f  &&  fabs (peak) > thresholdPeak)
+		{
+		  PointInterest p;
+		  if (offset[0] > 0) p.scale =  offset[0] * (scale2 - scale1) + scale1;
+		  else               p.scale = -offset[0] * (scale0 - scale1) + scale1;
+		  p.x = (x + offset[1] + 0.5f) * ratio - 0.5f;  // Coordinates all use center-of-pixel convention.  Must shift to left edge of pixel to properly overly images w/ different scales.
+		  p.y = (y + offset[2] + 0.5f) * ratio - 0.5f;
+		  p.weight = abs (peak);
+		  p.detector = PointInterest::Blob;
+		  result.push_back (p);
 		}
 	  }
 	}
-
- 	ratio *= 2;
   }
-
-  result.add (sorted);
 }
 
 void
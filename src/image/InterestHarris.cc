@@ -34,15 +34,26 @@ InterestHarris::InterestHarris (int neighborhood, int maxPoints, float threshold
 {
   this->maxPoints       = maxPoints;
   this->thresholdFactor = thresholdFactor;
+  box                   = false;
 }
 
 void
 InterestHarris::run (ImageCache & cache, PointSet & result)
 {
-  int offset = filter.offset;
-
-  Image image = cache.get (new EntryPyramid (GrayFloat))->image;
-  ImageOf<float> i = image * filter;
+  int offset;
+  ImageOf<float> i;
+  if (box)
+  {
+	FilterHarrisBox b (filter.sigmaD, filter.sigmaI);
+	offset = b.offset;
+	i = b.filterIntegral (cache.acquire (new EntryIntegral)->image);
+  }
+  else
+  {
+	offset = filter.offset;
+	Image image = cache.acquire (new EntryPyramid (GrayFloat))->image;
+	i = image * filter;
+  }
   i *= nms;
   float threshold = nms.average * thresholdFactor;
 
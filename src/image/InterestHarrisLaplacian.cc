@@ -107,7 +107,7 @@ InterestHarrisLaplacian::run (ImageCache & cache, PointSet & result)
   while (! done)
   {
 	int width  = originalWidth  / ratio;
-	Image work = cache.get (new EntryPyramid (GrayFloat, originalScale * ratio, width))->image;
+	Image work = cache.acquire (new EntryPyramid (GrayFloat, originalScale * ratio, width))->image;
 
 	for (int i = 0; i < filters.size (); i++)
 	{
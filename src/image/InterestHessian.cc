@@ -58,11 +58,14 @@ using namespace fl;
 
 // class InterestHessian ------------------------------------------------------
 
+const float InterestHessian::minimumScale = 2;
+
 InterestHessian::InterestHessian (int maxPoints, float thresholdFactor, float neighborhood, float firstScale, float lastScale, int extraSteps, float stepSize)
 {
   this->maxPoints       = maxPoints;
   this->thresholdFactor = thresholdFactor;
   this->extraSteps      = extraSteps;
+  box                   = false;
 
   if (neighborhood > 0)
   {
@@ -84,29 +87,33 @@ InterestHessian::InterestHessian (int maxPoints, float thresholdFactor, float ne
   firstStep = max (0, (int) roundp (logf (firstScale) / logf (stepSize)) - extraSteps);
   int lastStep = (int) ceil ((logf (lastScale) / logf (stepSize) - firstStep) / extraSteps) * extraSteps + firstStep;
 
-  // Generate Laplacian filters
-  for (int s = firstStep; s <= lastStep; s++)
-  {
-	float scale = powf (stepSize, s);
-	Laplacian l (scale);
-	l *= scale * scale;
-	laplacians.push_back (l);
-  }
-
-  // Generate Hessian filters
+  // Generate Hessian filters, each with the Laplacians that bracket it in
+  // scale.  The filter and its Laplacians all run on the same octave.
   for (int s = firstStep + extraSteps; s <= lastStep - extraSteps; s += extraSteps)
   {
 	float scale = powf (stepSize, s);
 	cerr << "hessian scale = " << scale << endl;
-	FilterHessian h (scale);
-	filters.push_back (h);
+	int ratio = 1;
+	while (scale / (2 * ratio) >= minimumScale) ratio *= 2;
+	filters.push_back (FilterHessian (scale / ratio));
+	ratios.push_back (ratio);
+
+	laplacians.push_back (vector<Laplacian> ());
+	vector<Laplacian> & bracket = laplacians.back ();
+	for (int t = s - extraSteps; t <= s + extraSteps; t++)
+	{
+	  float l = powf (stepSize, t) / ratio;
+	  bracket.push_back (Laplacian (l));
+	  bracket.back () *= l * l;
+	}
   }
 }
 
 void
 InterestHessian::run (ImageCache & cache, PointSet & result)
 {
-  ImageOf<float> work = cache.get (new EntryPyramid (GrayFloat))->image;
+  float originalScale = cache.original->scale;
+  int   originalWidth = cache.original->image.width;
   multiset<PointInterest> sorted;
 
   AbsoluteValue abs;
@@ -117,9 +124,25 @@ InterestHessian::run (ImageCache & cache, PointSet & result)
 cerr << "filter " << i;
 Stopwatch timer;
 
-    int offset = filters[i].offset;
+	// Filters are in ascending order of scale, so ratio never decreases and
+	// each octave is fetched from the cache just once.
+	int ratio = ratios[i];
+	int width = originalWidth / ratio;
+	ImageOf<float> work = cache.acquire (new EntryPyramid (GrayFloat, originalScale * ratio, width))->image;
 
-	ImageOf<float> filtered = work * filters[i] * abs;
+	int offset = filters[i].offset;
+	ImageOf<float> filtered;
+	if (box)
+	{
+	  FilterHessianBox b (filters[i].sigma);
+	  offset = b.offset;
+	  filtered = b.filterIntegral (cache.acquire (new EntryIntegral (originalScale * ratio, width))->image) * abs;
+	}
+	else
+	{
+	  filtered = work * filters[i] * abs;
+	}
+	if (filtered.width == 0  ||  filtered.height == 0) break;
 
 	int nmsSize;
 	if (neighborhood < 0)
@@ -153,6 +176,8 @@ Stopwatch timer;
 cerr << " " << nms.count << " " << stats.deviation () << " " << threshold;
 
 int added = 0;
+	vector<Laplacian> & bracket = laplacians[i];
+	vector<float> r (bracket.size ());
 	for (int y = 0; y < filtered.height; y++)
 	{
 	  for (int x = 0; x < filtered.width; x++)
@@ -164,12 +189,9 @@ int added = 0;
 		  p.x = x + offset;
 		  p.y = y + offset;
 
-		  int l = i * extraSteps;
-		  int h = l + 2 * extraSteps;
-		  vector<float> r (h - l + 1);
-		  for (int j = l; j <= h; j++)
+		  for (int j = 0; j < r.size (); j++)
 		  {
-			r[j - l] = fabsf (laplacians[j].response (work, p));
+			r[j] = fabsf (bracket[j].response (work, p));
 		  }
 
 		  p.weight = 0;
@@ -179,13 +201,16 @@ int added = 0;
 			if (r[j] > r[j-1]  &&  r[j] > r[j+1]  &&  r[j] > p.weight)
 			{
 			  p.weight = r[j];
-			  p.scale = laplacians[j + l].sigma;
+			  p.scale = bracket[j].sigma;
 			}
 		  }
 
 		  if (p.scale > 0)
 		  {
 added++;
+			p.x = (p.x + 0.5f) * ratio - 0.5f;
+			p.y = (p.y + 0.5f) * ratio - 0.5f;
+			p.scale *= ratio;
 			p.weight = pixel;
 			p.detector = PointInterest::Blob;
 			sorted.insert (p);
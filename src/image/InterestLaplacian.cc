@@ -67,7 +67,7 @@ InterestLaplacian::InterestLaplacian (int maxPoints, float thresholdFactor, floa
 void
 InterestLaplacian::run (ImageCache & cache, PointSet & result)
 {
-  ImageOf<float> work = cache.get (new EntryPyramid (GrayFloat))->image;
+  ImageOf<float> work = cache.acquire (new EntryPyramid (GrayFloat))->image;
   multiset<PointInterest> sorted;
 
   AbsoluteValue abs;
@@ -152,6 +152,76 @@ InterestMSER::join (Node * i, Node * n)
   }
 }
 
+/**
+   Advances r->center toward gray-level c, stopping at the next level that
+   is a local minimum of the rate of change in region size.  Shared by both
+   MSER engines.
+   @param c The most recent gray-level for which r->rates is valid.
+   @return true if r->center is stable, false if the scan has caught up with
+   c for now.
+**/
+bool
+InterestMSER::nextStable (History * r, int c, bool sign) const
+{
+  unsigned char & center = r->center;
+  unsigned char & lower  = r->lower;
+  unsigned char firstRate = sign ? r->level + delta : r->level - delta;
+  while (true)
+  {
+	bool localMinimum = true;
+	if (sign)
+	{
+	  if (c - center <= 1) break;
+	  if ((float) r->sizes[center+1] / r->sizes[c+1] >= sizeRatio) break;
+	  center++;
+	  if (r->rates[center] > maxRate) continue;
+	  if (center - r->level < minLevels) continue;
+	  if (r->sizes[center] < minSize  ||  r->sizes[center] > maxSize) continue;
+	  while ((float) r->sizes[lower] / r->sizes[center] < sizeRatio  &&  center - lower > 1) lower++;
+	  if (lower < firstRate) continue;
+
+	  float localRate = r->rates[center];
+	  int i = lower;
+	  localMinimum = r->rates[i++] > localRate;
+	  while (localMinimum  &&  i < center)
+	  {
+		localMinimum &= r->rates[i++] >= localRate;
+	  }
+	  i++;
+	  while (localMinimum  &&  i <= c)
+	  {
+		localMinimum &= r->rates[i++] > localRate;
+	  }
+	}
+	else
+	{
+	  if (center - c <= 1) break;
+	  if ((float) r->sizes[center-1] / r->sizes[c-1] >= sizeRatio) break;
+	  center--;
+	  if (r->rates[center] > maxRate) continue;
+	  if (r->level - center < minLevels) continue;
+	  if (r->sizes[center] < minSize  ||  r->sizes[center] > maxSize) continue;
+	  while ((float) r->sizes[lower] / r->sizes[center] < sizeRatio  &&  lower - center > 1) lower--;
+	  if (lower > firstRate) continue;
+
+	  float localRate = r->rates[center];
+	  int i = lower;
+	  localMinimum = r->rates[i--] > localRate;
+	  while (localMinimum  &&  i > center)
+	  {
+		localMinimum &= r->rates[i--] >= localRate;
+	  }
+	  i--;
+	  while (localMinimum  &&  i >= c)
+	  {
+		localMinimum &= r->rates[i--] > localRate;
+	  }
+	}
+	if (localMinimum) return true;
+  }
+  return false;
+}
+
 inline void
 InterestMSER::addGrayLevel (unsigned char level, bool sign, vector<PointMSER *> & regions)
 {
@@ -233,61 +303,8 @@ InterestMSER::addGrayLevel (unsigned char level, bool sign, vector<PointMSER *>
 	  r->rates[c] = fabs ((float) (r->sizes[b] - r->sizes[a])) / r->sizes[c];
 
 	  unsigned char & center = r->center;
-	  unsigned char & lower  = r->lower;
-	  unsigned char firstRate = sign ? r->level + delta : r->level - delta;
-	  while (true)
+	  while (nextStable (r, c, sign))
 	  {
-		bool localMinimum = true;
-		if (sign)
-		{
-		  if (c - center <= 1) break;
-		  if ((float) r->sizes[center+1] / r->sizes[c+1] >= sizeRatio) break;
-		  center++;
-		  if (r->rates[center] > maxRate) continue;
-		  if (center - r->level < minLevels) continue;
-		  if (r->sizes[center] < minSize  ||  r->sizes[center] > maxSize) continue;
-		  while ((float) r->sizes[lower] / r->sizes[center] < sizeRatio  &&  center - lower > 1) lower++;
-		  if (lower < firstRate) continue;
-
-		  float localRate = r->rates[center];
-		  int i = lower;
-		  localMinimum = r->rates[i++] > localRate;
-		  while (localMinimum  &&  i < center)
-		  {
-			localMinimum &= r->rates[i++] >= localRate;
-		  }
-		  i++;
-		  while (localMinimum  &&  i <= c)
-		  {
-			localMinimum &= r->rates[i++] > localRate;
-		  }
-		}
-		else
-		{
-		  if (center - c <= 1) break;
-		  if ((float) r->sizes[center-1] / r->sizes[c-1] >= sizeRatio) break;
-		  center--;
-		  if (r->rates[center] > maxRate) continue;
-		  if (r->level - center < minLevels) continue;
-		  if (r->sizes[center] < minSize  ||  r->sizes[center] > maxSize) continue;
-		  while ((float) r->sizes[lower] / r->sizes[center] < sizeRatio  &&  lower - center > 1) lower--;
-		  if (lower > firstRate) continue;
-
-		  float localRate = r->rates[center];
-		  int i = lower;
-		  localMinimum = r->rates[i--] > localRate;
-		  while (localMinimum  &&  i > center)
-		  {
-			localMinimum &= r->rates[i--] >= localRate;
-		  }
-		  i--;
-		  while (localMinimum  &&  i >= c)
-		  {
-			localMinimum &= r->rates[i--] > localRate;
-		  }
-		}
-		if (! localMinimum) continue;
-
 		// Got an MSER!  Now record it and generate shape matrix and scale.
 
 		  Node * head = r->heads[center];
@@ -447,7 +464,7 @@ InterestMSER::addGrayLevel (unsigned char level, bool sign, vector<PointMSER *>
 void
 InterestMSER::run (ImageCache & cache, PointSet & result)
 {
-  Image image = cache.get (new EntryPyramid (GrayChar))->image;
+  Image image = cache.acquire (new EntryPyramid (GrayChar))->image;
 
   PixelBufferPacked * imageBuffer = (PixelBufferPacked *) image.buffer;
   if (! imageBuffer) throw "InterestMSER only handles packed buffers for now";
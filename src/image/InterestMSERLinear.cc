@@ -0,0 +1,341 @@
+/*
+Author: Fred Rothganger
+
+Copyright 2010 Sandia Corporation.
+Under the terms of Contract DE-AC04-94AL85000 with Sandia Corporation,
+the U.S. Government retains certain rights in this software.
+Distributed under the GNU Lesser General Public License.  See the file LICENSE
+for details.
+*/
+
+
+#include "fl/interest.h"
+#include "fl/thread.h"
+
+#include <math.h>
+#include <string.h>
+
+
+using namespace std;
+using namespace fl;
+
+
+// class FloodRunner ----------------------------------------------------------
+
+namespace
+{
+class FloodRunner : public ParallelFor<int>
+{
+public:
+  FloodRunner (InterestMSERLinear & owner, const Image & image)
+  : ParallelFor<int> (owner.threadRequest),
+	owner (owner),
+	image (image)
+  {
+  }
+
+  virtual void process (const int i)
+  {
+	owner.flood (image, i == 0);
+  }
+
+  InterestMSERLinear & owner;
+  const Image &        image;
+};
+}
+
+
+// class InterestMSERLinear ---------------------------------------------------
+
+InterestMSERLinear::InterestMSERLinear (int delta, float sizeRatio)
+: InterestMSER (delta, sizeRatio)
+{
+  threadRequest = 0;
+}
+
+void
+InterestMSERLinear::run (ImageCache & cache, PointSet & result)
+{
+  Image image = cache.acquire (new EntryPyramid (GrayChar))->image;
+  if (! (PixelBufferPacked *) image.buffer) throw "InterestMSERLinear only handles packed buffers for now";
+
+  width  = image.width;
+  height = image.height;
+  if (width <= 0  ||  height <= 0) return;
+  if ((double) (width + 2) * (height + 2) >= (1 << 29)) throw "InterestMSERLinear: image too large";
+  maxSize = (int) ceil (width * height * maxSizeRatio);
+
+  if (threadRequest == 1)
+  {
+	flood (image, true);
+	flood (image, false);
+  }
+  else
+  {
+	FloodRunner runner (*this, image);
+	runner.run (0, 2);
+  }
+
+  for (int i = 0; i < 2; i++)
+  {
+	vector<PointMSER *> & regions = floods[i].regions;
+	result.insert (result.end (), regions.begin (), regions.end ());
+	regions.clear ();
+  }
+}
+
+inline void
+InterestMSERLinear::queue (Flood & f, int level, uint32_t entry)
+{
+  *f.tops[level]++ = entry;
+  f.nonempty[level >> 6] |= 1ull << (level & 63);
+}
+
+inline void
+InterestMSERLinear::push (Flood & f, int level, int seed)
+{
+  Component * c = f.idle.back ();
+  f.idle.pop_back ();
+  c->level   = level;
+  c->lower   = level;
+  c->center  = level + delta - 1;
+  c->current = level;
+  c->seed    = seed;
+  c->size    = 0;
+  memset (c->moments, 0, sizeof (c->moments));
+  f.stack.push_back (c);
+}
+
+/**
+   Follows the outline in the paper.  The current pixel is the one being
+   flooded.  Before it is added to the component on top of the stack, each
+   of its neighbors is either queued on the boundary (if it is no darker)
+   or becomes the new current pixel (if it is darker), in which case the
+   current pixel is queued to resume with its next edge later.
+**/
+void
+InterestMSERLinear::flood (const Image & image, bool sign)
+{
+  Flood & f = floods[sign ? 0 : 1];
+  f.width  = width  + 2;
+  f.height = height + 2;
+  const int pw   = f.width;
+  const int size = f.width * f.height;
+
+  // Padded copy of image, along with histogram.  Vectors are only resized,
+  // so memory from previous frames is reused.
+  int counts[256];
+  memset (counts, 0, sizeof (counts));
+  f.levels.resize (size);
+  PixelBufferPacked * buffer = (PixelBufferPacked *) image.buffer;
+  const unsigned char * source = (unsigned char *) buffer->base ();
+  for (int y = 0; y < height; y++)
+  {
+	const unsigned char * s   = source + y * buffer->stride;
+	const unsigned char * end = s + width;
+	unsigned char *       d   = &f.levels[(y + 1) * pw + 1];
+	if (sign) while (s < end) counts[*d++ =       *s++]++;
+	else      while (s < end) counts[*d++ = 255 - *s++]++;
+  }
+
+  // Mark the border accessible, so it is never entered.
+  f.accessible.assign ((size + 63) / 64, 0);
+  uint64_t * accessible = &f.accessible[0];
+  for (int x = 0; x < pw; x++)
+  {
+	int i = x;
+	accessible[i >> 6] |= 1ull << (i & 63);
+	i += (f.height - 1) * pw;
+	accessible[i >> 6] |= 1ull << (i & 63);
+  }
+  for (int y = 1; y < f.height - 1; y++)
+  {
+	int i = y * pw;
+	accessible[i >> 6] |= 1ull << (i & 63);
+	i += pw - 1;
+	accessible[i >> 6] |= 1ull << (i & 63);
+  }
+
+  // A pixel is only ever queued at its own gray-level, and at most once at
+  // a time, so the histogram bounds each stack.
+  f.boundary.resize (width * height);
+  uint32_t * b = &f.boundary[0];
+  for (int i = 0; i < 256; i++)
+  {
+	f.bottoms[i] = b;
+	f.tops[i]    = b;
+	b += counts[i];
+  }
+  memset (f.nonempty, 0, sizeof (f.nonempty));
+
+  if (f.components.size () < 257) f.components.resize (257);
+  f.idle.clear ();
+  for (int i = f.components.size () - 1; i >= 0; i--) f.idle.push_back (&f.components[i]);
+  f.stack.clear ();
+  f.regions.clear ();
+
+  // Flood
+  const unsigned char * levels = &f.levels[0];
+  const int offsets[4] = {1, pw, -1, -pw};
+  int current = pw + 1;
+  int x = 0;  // coordinates of current pixel in the original image
+  int y = 0;
+  int edge = 0;
+  int level = levels[current];
+  accessible[current >> 6] |= 1ull << (current & 63);
+  push (f, level, current);
+  while (true)
+  {
+	while (edge < 4)
+	{
+	  int n = current + offsets[edge++];
+	  uint64_t & word = accessible[n >> 6];
+	  uint64_t   bit  = 1ull << (n & 63);
+	  if (word & bit) continue;
+	  word |= bit;
+
+	  int nl = levels[n];
+	  if (nl >= level)
+	  {
+		queue (f, nl, n << 3);
+	  }
+	  else
+	  {
+		queue (f, level, (current << 3) | edge);
+		switch (edge)
+		{
+		  case 1: x++; break;
+		  case 2: y++; break;
+		  case 3: x--; break;
+		  case 4: y--; break;
+		}
+		current = n;
+		level   = nl;
+		edge    = 0;
+		push (f, level, current);
+	  }
+	}
+
+	Component * c = f.stack.back ();
+	c->size++;
+	c->moments[0] += x;
+	c->moments[1] += y;
+	c->moments[2] += x * x;
+	c->moments[3] += x * y;
+	c->moments[4] += y * y;
+
+	// Resume with the lowest pixel on the boundary
+	int nl = 0;
+	while (nl < 4  &&  ! f.nonempty[nl]) nl++;
+	if (nl == 4) break;
+	nl = nl * 64 + __builtin_ctzll (f.nonempty[nl]);
+	uint32_t e = *--f.tops[nl];
+	if (f.tops[nl] == f.bottoms[nl]) f.nonempty[nl >> 6] &= ~(1ull << (nl & 63));
+	current = e >> 3;
+	edge    = e & 7;
+	y = current / pw;
+	x = current - y * pw - 1;
+	y--;
+	if (nl != level)
+	{
+	  processStack (f, nl, sign);
+	  level = nl;
+	}
+  }
+
+  // Everything has merged into a single component.  Finish its history.
+  advance (f, f.stack.back (), 256, sign);
+  f.idle.push_back (f.stack.back ());
+  f.stack.pop_back ();
+}
+
+/**
+   This is the same bookkeeping InterestMSER::addGrayLevel() does for every
+   region after each gray-level, but here it only happens when a component
+   actually changes level.  The levels skipped over simply repeat the
+   current size.
+**/
+void
+InterestMSERLinear::advance (Flood & f, Component * c, int level, bool sign)
+{
+  for (int g = c->current; g < level; g++)
+  {
+	c->sizes[g] = c->size;
+	memcpy (c->momentHistory[g], c->moments, sizeof (c->moments));
+
+	int m = g - delta;  // middle of the rate window
+	int a = m - delta;
+	if (a < 0  ||  c->level > a) continue;
+	c->rates[m] = fabs ((float) (c->sizes[g] - c->sizes[a])) / c->sizes[m];
+
+	while (nextStable (c, m, true))
+	{
+	  // Got an MSER!  Generate shape matrix and scale from the moments.
+	  int center = c->center;
+	  double n = c->sizes[center];
+	  const double * moments = c->momentHistory[center];
+	  double x  = moments[0] / n;
+	  double y  = moments[1] / n;
+	  double xx = moments[2] / n - x * x;
+	  double xy = moments[3] / n - x * y;
+	  double yy = moments[4] / n - y * y;
+
+	  float scale = sqrt (sqrt (xx * yy - xy * xy));
+	  if (scale >= minScale)
+	  {
+		int sx = c->seed % f.width - 1;
+		int sy = c->seed / f.width - 1;
+		PointMSER * p = new PointMSER (sy * width + sx, sign ? center : 255 - center, sign);
+		p->x        = x;
+		p->y        = y;
+		p->weight   = n;
+		p->scale    = scale;
+		p->detector = PointInterest::MSER;
+
+		// Cholesky decomposition (square root matrix) of covariance
+		double l11 = sqrt (xx);
+		double l12 = xy / l11;
+		double l22 = sqrt (yy - l12 * l12);
+		p->A(0,0) = l11 / scale;
+		p->A(1,0) = l12 / scale;
+		p->A(1,1) = l22 / scale;
+
+		f.regions.push_back (p);
+	  }
+	}
+  }
+  c->current = level;
+}
+
+/**
+   The component on top of the stack has finished its current level.  If
+   the next component down is at a level above the new one, the top is
+   simply raised.  Otherwise the two merge, and the larger one's history
+   continues, as in InterestMSER.
+**/
+void
+InterestMSERLinear::processStack (Flood & f, int level, bool sign)
+{
+  vector<Component *> & s = f.stack;
+  while (true)
+  {
+	Component * top    = s.back ();
+	Component * second = s.size () > 1 ? s[s.size () - 2] : 0;
+	if (! second  ||  level < second->current)
+	{
+	  advance (f, top, level, sign);
+	  return;
+	}
+
+	advance (f, top, second->current, sign);
+	s.pop_back ();
+	Component * winner = top->size > second->size ? top : second;
+	Component * loser  = winner == top ? second : top;
+	winner->size += loser->size;
+	for (int i = 0; i < 5; i++) winner->moments[i] += loser->moments[i];
+	s.back () = winner;
+	f.idle.push_back (loser);
+
+	if (level == winner->current) return;
+  }
+}
@@ -15,6 +15,11 @@ for details.
 
 
 #include "fl/track.h"
+#include "fl/thread.h"
+
+#include <exception>
+#include <mutex>
+#include <string.h>
 
 
 // For debugging
@@ -25,6 +30,175 @@ using namespace fl;
 using namespace std;
 
 
+/**
+   Accumulates the second moment matrix, mismatch vector and squared error
+   over the window in image1, given the precomputed intensity and gradient
+   of the window in image0.
+   @param p Pixel at the top-left corner of the window in image1.  The
+   window covers one extra row and column for bilinear interpolation.
+   @param dx, dy Bilinear mixing constants for image1.
+   @param dx1, dy1 Complementary mixing constants for the gradient.  The
+   caller passes those of image0, as KLT has always done.  This measures
+   slightly better than 1-dx and 1-dy.
+   @param sums Receives gxx, gxy, gyy, ex, ey and squared error.
+**/
+static inline void
+accumulate (const float * p, int stride, int width, int height, float dx, float dy, float dx1, float dy1, const float * i0, const float * gx0, const float * gy0, float * sums)
+{
+  float gxx   = 0;
+  float gxy   = 0;
+  float gyy   = 0;
+  float ex    = 0;
+  float ey    = 0;
+  float error = 0;
+
+# if defined (__GNUC__)  &&  (defined (__x86_64__)  ||  defined (__SSE2__))
+  typedef float V __attribute__ ((vector_size (16)));
+  const int N = sizeof (V) / sizeof (float);
+  const int vectorWidth = width / N * N;
+  V zero = {};
+  V vdx  = zero + dx;
+  V vdy  = zero + dy;
+  V vdx1 = zero + dx1;
+  V vdy1 = zero + dy1;
+  V vxx  = zero;
+  V vxy  = zero;
+  V vyy  = zero;
+  V vex  = zero;
+  V vey  = zero;
+  V ve   = zero;
+# else
+  const int vectorWidth = 0;
+# endif
+
+  for (int y = 0; y < height; y++)
+  {
+	const float * p00 = p + y * stride;
+	const float * p01 = p00 + stride;
+	int x = 0;
+#   if defined (__GNUC__)  &&  (defined (__x86_64__)  ||  defined (__SSE2__))
+	// The last lane reads column x + N, which is still inside the window.
+	for (; x < vectorWidth; x += N)
+	{
+	  V a00, a10, a01, a11, i, gx, gy;
+	  memcpy (&a00, p00 + x,     sizeof (V));
+	  memcpy (&a10, p00 + x + 1, sizeof (V));
+	  memcpy (&a01, p01 + x,     sizeof (V));
+	  memcpy (&a11, p01 + x + 1, sizeof (V));
+	  memcpy (&i,   i0  + x,     sizeof (V));
+	  memcpy (&gx,  gx0 + x,     sizeof (V));
+	  memcpy (&gy,  gy0 + x,     sizeof (V));
+	  V a = a00 + vdx * (a10 - a00);
+	  V b = a01 + vdx * (a11 - a01);
+	  V diff = i - (a + vdy * (b - a));
+	  gx += vdy1 * (a10 - a00) + vdy * (a11 - a01);
+	  gy += vdx1 * (a01 - a00) + vdx * (a11 - a10);
+	  vxx += gx * gx;
+	  vxy += gx * gy;
+	  vyy += gy * gy;
+	  vex += diff * gx;
+	  vey += diff * gy;
+	  ve  += diff * diff;
+	}
+#   endif
+	for (; x < width; x++)
+	{
+	  float a = p00[x] + dx * (p00[x+1] - p00[x]);
+	  float b = p01[x] + dx * (p01[x+1] - p01[x]);
+	  float diff = i0[x] - (a + dy * (b - a));
+	  float gx = gx0[x] + dy1 * (p00[x+1] - p00[x]) + dy * (p01[x+1] - p01[x]);
+	  float gy = gy0[x] + dx1 * (p01[x] - p00[x]) + dx * (p01[x+1] - p00[x+1]);
+	  gxx   += gx * gx;
+	  gxy   += gx * gy;
+	  gyy   += gy * gy;
+	  ex    += diff * gx;
+	  ey    += diff * gy;
+	  error += diff * diff;
+	}
+	i0  += width;
+	gx0 += width;
+	gy0 += width;
+  }
+
+# if defined (__GNUC__)  &&  (defined (__x86_64__)  ||  defined (__SSE2__))
+  for (int i = 0; i < N; i++)
+  {
+	gxx   += vxx[i];
+	gxy   += vxy[i];
+	gyy   += vyy[i];
+	ex    += vex[i];
+	ey    += vey[i];
+	error += ve[i];
+  }
+# endif
+
+  sums[0] = gxx;
+  sums[1] = gxy;
+  sums[2] = gyy;
+  sums[3] = ex;
+  sums[4] = ey;
+  sums[5] = error;
+}
+
+static inline int
+trackCode (KLT & klt, Point & point)
+{
+  try
+  {
+	klt.track (point);
+  }
+  catch (int code)
+  {
+	return code;
+  }
+  return 0;
+}
+
+
+// class TrackRunner ----------------------------------------------------------
+
+namespace
+{
+/**
+   Does the work of KLT::track(PointSet&).  Points are handed out in chunks.
+**/
+class TrackRunner : public ParallelFor<int>
+{
+public:
+  TrackRunner (KLT & owner, PointSet & points, vector<int> & codes, int chunk)
+  : ParallelFor<int> (owner.threadRequest),
+	owner (owner),
+	points (points),
+	codes (codes),
+	chunk (chunk)
+  {
+  }
+
+  virtual void process (const int c)
+  {
+	try
+	{
+	  int lo = c * chunk;
+	  int hi = min ((int) points.size (), lo + chunk);
+	  for (int i = lo; i < hi; i++) codes[i] = trackCode (owner, *points[i]);
+	}
+	catch (...)  // Anything that escapes a worker thread would terminate the process, so carry it back to the caller of run().
+	{
+	  std::lock_guard<std::mutex> lock (mutexError);
+	  if (! error) error = std::current_exception ();
+	}
+  }
+
+  KLT &              owner;
+  PointSet &         points;
+  vector<int> &      codes;
+  int                chunk;
+  std::exception_ptr error;  ///< First exception other than a status code thrown by any point.
+  std::mutex         mutexError;
+};
+}
+
+
 // KLT ------------------------------------------------------------------------
 
 /**
@@ -55,6 +229,7 @@ KLT::KLT (int searchRadius, int windowRadius, float scaleRatio)
   minDisplacement = 0.1f;
   maxIterations   = 10;
   maxError        = 0.06f;
+  threadRequest   = 0;
 
   // Determine size of pyramid.
   // At any given level, the windowRadius should be at least as large as
@@ -75,8 +250,8 @@ KLT::KLT (int searchRadius, int windowRadius, float scaleRatio)
 
   // Create blurring kernels
   // Note that level 0 is a blurred but full-size version of the base image.
-  blursPre .resize (levels);
-  blursPost.resize (levels);
+  decimators.resize (levels);
+  blursPost .resize (levels);
   double currentBlur = 0.5;  // default value for base image
   double downsample  = 1;    // to produce level 0 from the base image
   const double minBlur = 0.55;  // Threshold below which it is not worth applying a blur.  Should be at least 0.5
@@ -96,12 +271,12 @@ KLT::KLT (int searchRadius, int windowRadius, float scaleRatio)
 	double applyBlur = sqrt (downsample * downsample / 4.0 - currentBlur * currentBlur);
 	if (std::isnan (applyBlur)  ||  applyBlur < minBlur)  // blur too small
 	{
-	  blursPre[level] = 0;
+	  decimators[level] = 0;
 	  blurAfterDecimation = currentBlur / downsample;
 	}
 	else
 	{
-	  blursPre[level] = new Gaussian1D (applyBlur, Boost);
+	  decimators[level] = new BlurDecimate ((int) downsample, currentBlur, 0.5);
 	  blurAfterDecimation = 0.5;
 	}
 
@@ -128,16 +303,19 @@ KLT::KLT (int searchRadius, int windowRadius, float scaleRatio)
 
 KLT::~KLT ()
 {
-  for (int i = 0; i < blursPre .size (); i++) if (blursPre [i]) delete blursPre [i];
-  for (int i = 0; i < blursPost.size (); i++) if (blursPost[i]) delete blursPost[i];
+  for (int i = 0; i < decimators.size (); i++) if (decimators[i]) delete decimators[i];
+  for (int i = 0; i < blursPost .size (); i++) if (blursPost [i]) delete blursPost [i];
 }
 
 void
 KLT::nextImage (const Image & image)
 {
+  // The current pyramid becomes the previous one as is.  Its replacement
+  // is built over the old previous pyramid.
+  pyramid0.swap (pyramid1);
+
   // Blur level 0.  No decimation or pre-blurring required.
   ImageOf<float> & p = pyramid1[0];
-  pyramid0[0] = p;
   p = image * GrayFloat;
   if (blursPost[0])
   {
@@ -153,37 +331,17 @@ KLT::nextImage (const Image & image)
   {
 	ImageOf<float> & p  = pyramid1[level];   // "picture"
 	ImageOf<float> & pp = pyramid1[level-1]; // "previous picture"
-	pyramid0[level] = p;
-	p.detach ();
-
-	int hw = pp.width  / pyramidRatio;
-	int hh = pp.height / pyramidRatio;
-	p.resize (hw, hh);
-
-	if (blursPre[level])  // downsample and decimate
+	if (decimators[level])  // blur and decimate
 	{
-	  Gaussian1D & b = *blursPre[level];
-
-	  b.direction = Horizontal;
-	  Image temp = pp * b;
-
-	  b.direction = Vertical;
-	  Point t;
-	  const float start = pyramidRatio / 2;
-	  t.y = start;
-	  for (int y = 0; y < hh; y++)
-	  {
-		t.x = start;
-		for (int x = 0; x < hw; x++)
-		{
-		  p(x,y) = b.response (temp, t);
-		  t.x += pyramidRatio;
-		}
-		t.y += pyramidRatio;
-	  }
+	  p = pp * *decimators[level];
 	}
 	else  // decimate only
 	{
+	  int hw = pp.width  / pyramidRatio;
+	  int hh = pp.height / pyramidRatio;
+	  p.detach ();
+	  p.resize (hw, hh);
+
 	  const int start = pyramidRatio / 2;
 	  int fromY = start;
 	  for (int y = 0; y < hh; y++)
@@ -293,14 +451,33 @@ KLT::track (Point & point)
   }
 }
 
+vector<int>
+KLT::track (PointSet & points)
+{
+  const int count = points.size ();
+  const int chunk = 16;
+  vector<int> codes (count, 0);
+  if (threadRequest == 1  ||  count <= chunk)
+  {
+	for (int i = 0; i < count; i++) codes[i] = trackCode (*this, *points[i]);
+  }
+  else
+  {
+	TrackRunner runner (*this, points, codes, chunk);
+	runner.run (0, (count + chunk - 1) / chunk);
+	if (runner.error) std::rethrow_exception (runner.error);
+  }
+  return codes;
+}
+
 /**
    \return RMS error of pixel intensity within window.
  **/
 float
-KLT::track (const Point & point0, const int level, Point & point1)
+KLT::track (const Point & point0, const int level, Point & point1) const
 {
-  ImageOf<float> & image0 = pyramid0[level];
-  ImageOf<float> & image1 = pyramid1[level];
+  const ImageOf<float> & image0 = pyramid0[level];
+  const ImageOf<float> & image1 = pyramid1[level];
 
   int lastH = image0.width - 1;
   int lastV = image0.height - 1;
@@ -320,7 +497,8 @@ KLT::track (const Point & point0, const int level, Point & point1)
   const int height = yh + yl + 1;
   const int pixels = width * height;
 
-  const int rowAdvance = image0.width - width;
+  const int stride0 = image0.stride / sizeof (float);
+  const int stride1 = image1.stride / sizeof (float);
 
   // Compute the constant window (from image0)
   Vector<float> gradientX0 (pixels);
@@ -336,10 +514,11 @@ KLT::track (const Point & point0, const int level, Point & point1)
   float dx1 = 1.0f - dx;
   float dy1 = 1.0f - dy;
   //   Iterate over image using 4 pointers
-  float * p00 = & image0(x,y);
-  float * p10 = p00 + 1;
-  float * p01 = p00 + image0.width;
-  float * p11 = p01 + 1;
+  const float * p00 = & image0(x,y);
+  const float * p10 = p00 + 1;
+  const float * p01 = p00 + stride0;
+  const float * p11 = p01 + 1;
+  const int rowAdvance = stride0 - width;
   float * gx0 = & gradientX0[0];
   float * gy0 = & gradientY0[0];
   float * i0 = & intensity0[0];
@@ -381,56 +560,16 @@ KLT::track (const Point & point0, const int level, Point & point1)
 	}
 
 	// Compute second moment matrix and error vector
-	float gxx = 0;
-	float gxy = 0;
-	float gyy = 0;
-	float ex = 0;
-	float ey = 0;
-	error = 0;
-	//   Determine bilinear mixing constants for image1
 	x = (int) point1.x;
 	y = (int) point1.y;
-	dx = point1.x - x;
-	dy = point1.y - y;
-	x -= xl;
-	y -= yl;
-	//   Set up pointers
-	p00 = & image1(x,y);
-	p10 = p00 + 1;
-	p01 = p00 + image1.width;
-	p11 = p01 + 1;
-	gx0 = & gradientX0[0];
-	gy0 = & gradientY0[0];
-	i0 = & intensity0[0];
-	for (int y = 0; y < height; y++)
-	{
-	  for (int x = 0; x < width; x++)
-	  {
-		// Compute intensity difference and gradient values
-		float a = *p00 + dx * (*p10 - *p00);
-		float b = *p01 + dx * (*p11 - *p01);
-		float diff = *i0++ - (a + dy * (b - a));
-		float gx = *gx0++ + dy1 * (*p10 - *p00) + dy * (*p11 - *p01);
-		float gy = *gy0++ + dx1 * (*p01 - *p00) + dx * (*p11 - *p10);
-		// Accumulate second moment matrix and error vector
-		gxx += gx * gx;
-		gxy += gx * gy;
-		gyy += gy * gy;
-		ex += diff * gx;
-		ey += diff * gy;
-		error += diff * diff;
-		// Advance to next x position
-		p00++;
-		p10++;
-		p01++;
-		p11++;
-	  }
-	  // Advance pointers to next row
-	  p00 += rowAdvance;
-	  p10 += rowAdvance;
-	  p01 += rowAdvance;
-	  p11 += rowAdvance;
-	}
+	float sums[6];
+	accumulate (& image1(x - xl, y - yl), stride1, width, height, point1.x - x, point1.y - y, dx1, dy1, & intensity0[0], & gradientX0[0], & gradientY0[0], sums);
+	const float gxx = sums[0];
+	const float gxy = sums[1];
+	const float gyy = sums[2];
+	const float ex  = sums[3];
+	const float ey  = sums[4];
+	error           = sums[5];
 
 	// Solve for displacement and update point1
 	float det = gxx * gyy - gxy * gxy;
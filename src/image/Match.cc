@@ -364,14 +364,26 @@ FixedPoint::run (const MatchSet & source, MatchSet & result) const
 
 // class NearestDescriptors ---------------------------------------------------
 
-NearestDescriptors::NearestDescriptors (PointSet & reference)
+NearestDescriptors::NearestDescriptors (PointSet & reference, Neighbor * neighbor)
+: neighbor (neighbor)
 {
+  if (! neighbor)
+  {
+	KDTreeFlat * tree = new KDTreeFlat;
+	tree->bucketSize = 2;
+	tree->k          = 2;
+	this->neighbor = tree;
+  }
+  threshold = 1.0;
+  ratio     = 0.8;
+  threads   = 0;
   set (reference);
 }
 
 NearestDescriptors::~NearestDescriptors ()
 {
   clear ();
+  delete neighbor;
 }
 
 void
@@ -384,7 +396,7 @@ NearestDescriptors::clear ()
 void
 NearestDescriptors::set (PointSet & reference)
 {
-  data.clear ();
+  clear ();
   data.reserve (reference.size ());
   PointSet::iterator i = reference.begin ();
   for (; i != reference.end (); i++)
@@ -394,35 +406,44 @@ NearestDescriptors::set (PointSet & reference)
 	if (! descriptor) continue;
 	data.push_back (new Neighbor::Entry (descriptor, p));
   }
-  tree.clear ();
-  tree.bucketSize = 2;
-  tree.k = 2;
-  tree.set (data);
+  neighbor->set (data);
 }
 
 void
 NearestDescriptors::run (PointSet & query, MatchSet & result) const
 {
+  vector<Point *> points;
+  vector<MatrixAbstract<float> *> descriptors;
+  points     .reserve (query.size ());
+  descriptors.reserve (query.size ());
   PointSet::iterator it;
   for (it = query.begin (); it != query.end (); it++)
   {
 	Point * p = *it;
 	Vector<float> * descriptor = p->descriptor ();
 	if (! descriptor) continue;
+	points     .push_back (p);
+	descriptors.push_back (descriptor);
+  }
+
+  vector<vector<MatrixAbstract<float> *> > answers;
+  neighbor->findBatch (descriptors, answers, threads);
 
-	vector<MatrixAbstract<float> *> answer;
-	tree.find (*descriptor, answer);
+  for (int i = 0; i < points.size (); i++)
+  {
+	vector<MatrixAbstract<float> *> & answer = answers[i];
 	if (answer.size () < 2) continue;
+	const MatrixAbstract<float> & descriptor = *descriptors[i];
 	Neighbor::Entry * a0 = (Neighbor::Entry *) answer[0];
 	Neighbor::Entry * a1 = (Neighbor::Entry *) answer[1];
-	double d0 = (*a0 - *descriptor).norm (2);
+	double d0 = (*a0 - descriptor).norm (2);
 	if (d0 > threshold) continue;
-	double d1 = (*a1 - *descriptor).norm (2);
-	if (d0 / d1 > 0.8) continue;
+	double d1 = (*a1 - descriptor).norm (2);
+	if (d0 / d1 > ratio) continue;
 
 	Match * m = new Match;
 	m->resize (2);
-	(*m)[0] = p;
+	(*m)[0] = points[i];
 	(*m)[1] = (Point *) a0->item;
 	result.push_back (m);
   }
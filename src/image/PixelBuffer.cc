@@ -26,7 +26,7 @@ using namespace std;
    \param newStride Desired width of one row in bytes.
  **/
 void
-fl::reshapeBuffer (Pointer & memory, int oldStride, int newStride, int newHeight, int pad)
+fl::reshapeBuffer (Pointer & memory, int oldStride, int newStride, int newHeight, int pad, int alignment)
 {
   int oldHeight = memory.size ();
   if (oldHeight <= 0)
@@ -46,7 +46,7 @@ fl::reshapeBuffer (Pointer & memory, int oldStride, int newStride, int newHeight
 	{
 	  Pointer temp (memory);
 	  memory.detach ();
-	  memory.grow (newStride * newHeight + pad);
+	  memory.grow (newStride * newHeight + pad, alignment);
 	  int count = newStride * copyHeight;
 	  memcpy ((char *) memory, (char *) temp, count);
 	  assert (count >= 0  &&  count < memory.size ());
@@ -57,7 +57,7 @@ fl::reshapeBuffer (Pointer & memory, int oldStride, int newStride, int newHeight
   {
 	Pointer temp (memory);
 	memory.detach ();
-	memory.grow (newStride * newHeight + pad);
+	memory.grow (newStride * newHeight + pad, alignment);
 	memory.clear ();
 
 	unsigned char * target = (unsigned char *) memory;
@@ -78,6 +78,18 @@ PixelBuffer::~PixelBuffer ()
 {
 }
 
+void *
+PixelBuffer::pixelRead (int x, int y)
+{
+  return pixel (x, y);
+}
+
+void *
+PixelBuffer::row (int y, void ** storage)
+{
+  return 0;
+}
+
 bool
 PixelBuffer::operator == (const PixelBuffer & that) const
 {
@@ -94,6 +106,7 @@ PixelBufferPacked::PixelBufferPacked (int depth)
   offset      = 0;
   stride      = 0;
   this->depth = depth;
+  alignment   = 0;
 }
 
 PixelBufferPacked::PixelBufferPacked (int stride, int height, int depth)
@@ -103,6 +116,7 @@ PixelBufferPacked::PixelBufferPacked (int stride, int height, int depth)
   offset       = 0;
   this->stride = stride;
   this->depth  = depth;
+  alignment    = 0;
 }
 
 PixelBufferPacked::PixelBufferPacked (void * buffer, int stride, int height, int depth)
@@ -111,6 +125,7 @@ PixelBufferPacked::PixelBufferPacked (void * buffer, int stride, int height, int
   offset       = 0;
   this->stride = stride;
   this->depth  = depth;
+  alignment    = 0;
   this->memory.attach (buffer, stride * height);
 }
 
@@ -120,6 +135,7 @@ PixelBufferPacked::PixelBufferPacked (const Pointer & buffer, int stride, int de
   this->offset = offset;
   this->stride = stride;
   this->depth  = depth;
+  alignment    = 0;
   this->memory = buffer;
 }
 
@@ -133,6 +149,18 @@ PixelBufferPacked::pixel (int x, int y)
   return & ((char *) memory)[offset + y * stride + x * depth];
 }
 
+void *
+PixelBufferPacked::pixelRead (int x, int y)
+{
+  return PixelBufferPacked::pixel (x, y);
+}
+
+void *
+PixelBufferPacked::row (int y, void ** storage)
+{
+  return & ((char *) memory)[offset + y * stride];
+}
+
 void
 PixelBufferPacked::resize (int width, int height, const PixelFormat & format, bool preserve)
 {
@@ -149,13 +177,14 @@ PixelBufferPacked::resize (int width, int height, const PixelFormat & format, bo
   {
 	offset = 0;
 	depth  = (int) format.depth;
-	stride = width * depth;
-	memory.grow (stride * height + (depth == 3 ? 1 : 0));
+	stride = Pointer::padStride (width * depth, alignment);
+	memory.grow (stride * height + (depth == 3 ? 1 : 0), alignment);
 	return;
   }
 
-  reshapeBuffer (memory, stride, width * depth, height, depth == 3 ? 1 : 0);
-  stride = width * depth;
+  int newStride = Pointer::padStride (width * depth, alignment);
+  reshapeBuffer (memory, stride, newStride, height, depth == 3 ? 1 : 0, alignment);
+  stride = newStride;
 }
 
 PixelBuffer *
@@ -163,9 +192,14 @@ PixelBufferPacked::duplicate () const
 {
   PixelBufferPacked * result = new PixelBufferPacked (depth);
   ptrdiff_t size = memory.size () - offset;
-  if (size > 0) result->memory.copyFrom (((char *) memory) + offset, size);
-  result->offset = 0;
-  result->stride = stride;
+  if (size > 0)
+  {
+	result->memory.grow (size, alignment);
+	memcpy ((char *) result->memory, ((char *) memory) + offset, size);
+  }
+  result->offset    = 0;
+  result->stride    = stride;
+  result->alignment = alignment;
   return result;
 }
 
@@ -260,6 +294,24 @@ PixelBufferPlanar::pixel (int x, int y)
   return pixelArray;
 }
 
+void *
+PixelBufferPlanar::pixelRead (int x, int y)
+{
+  return PixelBufferPlanar::pixel (x, y);
+}
+
+void *
+PixelBufferPlanar::row (int y, void ** storage)
+{
+  int y12 = y / ratioV;
+
+  storage[0] = ((char *) plane0) + y   * stride0;
+  storage[1] = ((char *) plane1) + y12 * stride12;
+  storage[2] = ((char *) plane2) + y12 * stride12;
+
+  return storage;
+}
+
 void
 PixelBufferPlanar::resize (int width, int height, const PixelFormat & format, bool preserve)
 {
@@ -380,6 +432,18 @@ PixelBufferGroups::pixel (int x, int y)
   return & pixelData;
 }
 
+void *
+PixelBufferGroups::pixelRead (int x, int y)
+{
+  return PixelBufferGroups::pixel (x, y);
+}
+
+void *
+PixelBufferGroups::row (int y, void ** storage)
+{
+  return (unsigned char *) memory + y * stride;
+}
+
 void
 PixelBufferGroups::resize (int width, int height, const PixelFormat & format, bool preserve)
 {
@@ -473,6 +537,18 @@ PixelBufferBlocks::pixel (int x, int y)
   return & pixelData;
 }
 
+void *
+PixelBufferBlocks::pixelRead (int x, int y)
+{
+  return PixelBufferBlocks::pixel (x, y);
+}
+
+void *
+PixelBufferBlocks::row (int y, void ** storage)
+{
+  return 0;
+}
+
 void
 PixelBufferBlocks::resize (int width, int height, const PixelFormat & format, bool preserve)
 {
@@ -528,10 +604,379 @@ PixelBufferBlocks::operator == (const PixelBuffer & that) const
 
 // class PixelBufferBig -------------------------------------------------------
 
-PixelBufferBig::PixelBufferBig ()
-{
+static inline void
+seekScratch (FILE * file, int64_t position)
+{
+# ifdef _MSC_VER
+  int error = _fseeki64 (file, position, SEEK_SET);
+# else
+  int error = fseeko (file, position, SEEK_SET);
+# endif
+  if (error) throw "Unable to seek in scratch file";
+}
+
+PixelBufferBig::PixelBufferBig (int tileWidth, int tileHeight, ptrdiff_t cacheBytes)
+{
+  planes           = 1;
+  width            = 0;
+  height           = 0;
+  depth            = 1;
+  this->tileWidth  = max (1, tileWidth);
+  this->tileHeight = max (1, tileHeight);
+  tileStride       = this->tileWidth;
+  tilesH           = 0;
+  tilesV           = 0;
+  last             = 0;
+  clock            = 0;
+  scratch          = 0;
+  setCache (cacheBytes);
+}
+
+PixelBufferBig::PixelBufferBig (ImageFileDelegate * source, const PixelFormat & format, int width, int height, int tileWidth, int tileHeight, ptrdiff_t cacheBytes)
+{
+  if (format.planes != 1) throw "PixelBufferBig only handles packed formats";
+
+  planes           = 1;
+  this->width      = max (0, width);
+  this->height     = max (0, height);
+  depth            = (int) format.depth;
+  this->tileWidth  = max (1, tileWidth);
+  this->tileHeight = max (1, tileHeight);
+  tileStride       = this->tileWidth * depth;
+  tilesH           = (this->width  + this->tileWidth  - 1) / this->tileWidth;
+  tilesV           = (this->height + this->tileHeight - 1) / this->tileHeight;
+  last             = 0;
+  clock            = 0;
+  scratch          = 0;
+  this->source     = source;
+  this->format     = &format;
+  tiles .resize (tilesH * tilesV, 0);
+  stored.resize (tilesH * tilesV, 0);
+  setCache (cacheBytes);
 }
 
 PixelBufferBig::~PixelBufferBig ()
 {
+  reset ();
+}
+
+void *
+PixelBufferBig::pixel (int x, int y)
+{
+  void * result = pixelRead (x, y);
+  last->dirty = true;  // Caller may write through the result.  pixelRead() leaves the tile in last.
+  return result;
+}
+
+void *
+PixelBufferBig::pixelRead (int x, int y)
+{
+  if (x < 0  ||  y < 0  ||  x >= width  ||  y >= height) throw "Pixel is outside raster";
+  int tx = x / tileWidth;
+  int ty = y / tileHeight;
+  Tile * tile = fetch (ty * tilesH + tx);
+  return (char *) tile->memory + (y - ty * tileHeight) * tileStride + (x - tx * tileWidth) * depth;
+}
+
+void
+PixelBufferBig::resize (int width, int height, const PixelFormat & format, bool preserve)
+{
+  if (format.planes != 1) throw "PixelBufferBig only handles packed formats";
+  width  = max (0, width);
+  height = max (0, height);
+  if (preserve)
+  {
+	if (width == this->width  &&  height == this->height  &&  (int) format.depth == depth) return;
+	throw "PixelBufferBig can't preserve contents while changing geometry";
+  }
+
+  reset ();
+  source.detach ();
+  this->format = &format;
+  this->width  = width;
+  this->height = height;
+  depth        = (int) format.depth;
+  tileStride   = tileWidth * depth;
+  tilesH       = (width  + tileWidth  - 1) / tileWidth;
+  tilesV       = (height + tileHeight - 1) / tileHeight;
+  tiles .resize (tilesH * tilesV, 0);
+  stored.resize (tilesH * tilesV, 0);
+  setCache (cacheBytes);
+}
+
+PixelBuffer *
+PixelBufferBig::duplicate () const
+{
+  PixelBufferBig * result = new PixelBufferBig (tileWidth, tileHeight, 0);
+  result->source     = source;
+  result->format     = format;
+  result->width      = width;
+  result->height     = height;
+  result->depth      = depth;
+  result->tileStride = tileStride;
+  result->tilesH     = tilesH;
+  result->tilesV     = tilesV;
+  result->cacheBytes = cacheBytes;
+  result->cacheTiles = cacheTiles;
+  result->tiles .resize (tiles.size (), 0);
+  result->stored.resize (tiles.size (), 0);
+
+  // Transfer every tile that may differ from source.  Pristine tiles are
+  // left for the new buffer to fetch on its own.  Resident tiles are copied
+  // directly from memory.  Stored tiles are copied between scratch files.
+  Pointer buffer (tileStride * tileHeight);
+  for (int t = 0; t < tiles.size (); t++)
+  {
+	if (! stored[t]  &&  ! (tiles[t]  &&  tiles[t]->dirty)) continue;
+	if (tiles[t])
+	{
+	  memcpy ((char *) buffer, (char *) tiles[t]->memory, buffer.size ());
+	}
+	else
+	{
+	  seekScratch (scratch, (int64_t) t * buffer.size ());
+	  if (fread ((char *) buffer, buffer.size (), 1, scratch) != 1) throw "Unable to read scratch file";
+	}
+	if (! result->scratch)
+	{
+	  result->scratch = tmpfile ();
+	  if (! result->scratch) throw "Unable to create scratch file";
+	}
+	seekScratch (result->scratch, (int64_t) t * buffer.size ());
+	if (fwrite ((char *) buffer, buffer.size (), 1, result->scratch) != 1) throw "Unable to write scratch file";
+	result->stored[t] = 1;
+  }
+  return result;
+}
+
+void
+PixelBufferBig::clear ()
+{
+  reset ();
+  source.detach ();
+  tiles .assign (tilesH * tilesV, 0);
+  stored.assign (tilesH * tilesV, 0);
+}
+
+bool
+PixelBufferBig::operator == (const PixelBuffer & that) const
+{
+  // Two big buffers never share cache or scratch, so the only way they can
+  // be identical is to be the same object.
+  return this == &that;
+}
+
+void
+PixelBufferBig::read (Image & image, int x, int y, int width, int height)
+{
+  if (width  <= 0) width  = this->width  - x;
+  if (height <= 0) height = this->height - y;
+  if (x < 0  ||  y < 0  ||  x + width > this->width  ||  y + height > this->height) throw "Region is outside raster";
+
+  image.format = format;
+  image.resize (width, height);
+  PixelBufferPacked * o = (PixelBufferPacked *) image.buffer;
+  assert (o);
+  char * target = (char *) o->base ();
+
+  // Copy one tile-row segment at a time, so each tile is looked up only once per row of tiles.
+  int yEnd = y + height;
+  int xEnd = x + width;
+  for (int ty = y; ty < yEnd;)
+  {
+	int rows = min (yEnd, (ty / tileHeight + 1) * tileHeight) - ty;
+	for (int tx = x; tx < xEnd;)
+	{
+	  int columns = min (xEnd, (tx / tileWidth + 1) * tileWidth) - tx;
+	  Tile * tile = fetch (ty / tileHeight * tilesH + tx / tileWidth);
+	  char * from = (char *) tile->memory + ty % tileHeight * tileStride + tx % tileWidth * depth;
+	  char * to   = target + (ty - y) * o->stride + (tx - x) * depth;
+	  int bytes = columns * depth;
+	  for (int r = 0; r < rows; r++)
+	  {
+		memcpy (to, from, bytes);
+		to   += o->stride;
+		from += tileStride;
+	  }
+	  tx += columns;
+	}
+	ty += rows;
+  }
+}
+
+void
+PixelBufferBig::write (const Image & image, int x, int y)
+{
+  Image converted = image * *format;
+  PixelBufferPacked * i = (PixelBufferPacked *) converted.buffer;
+  if (! i) throw "Can't write from non-packed image";
+  char * base = (char *) i->base ();
+
+  int width  = min (converted.width,  this->width  - x);
+  int height = min (converted.height, this->height - y);
+  int yEnd = y + height;
+  int xEnd = x + width;
+  for (int ty = y; ty < yEnd;)
+  {
+	int rows = min (yEnd, (ty / tileHeight + 1) * tileHeight) - ty;
+	for (int tx = x; tx < xEnd;)
+	{
+	  int columns = min (xEnd, (tx / tileWidth + 1) * tileWidth) - tx;
+	  char * to   = (char *) pixel (tx, ty);
+	  char * from = base + (ty - y) * i->stride + (tx - x) * depth;
+	  int bytes = columns * depth;
+	  for (int r = 0; r < rows; r++)
+	  {
+		memcpy (to, from, bytes);
+		to   += tileStride;
+		from += i->stride;
+	  }
+	  tx += columns;
+	}
+	ty += rows;
+  }
+}
+
+void
+PixelBufferBig::setCache (ptrdiff_t bytes)
+{
+  cacheBytes = bytes;
+  ptrdiff_t tileBytes = max ((ptrdiff_t) 1, (ptrdiff_t) tileStride * tileHeight);
+  cacheTiles = (int) max ((ptrdiff_t) 2, bytes / tileBytes);
+  while (resident.size () > cacheTiles)
+  {
+	// Discard least recently used tile
+	int oldest = 0;
+	for (int i = 1; i < resident.size (); i++) if (resident[i]->lastUse < resident[oldest]->lastUse) oldest = i;
+	Tile * tile = resident[oldest];
+	evict (tile);
+	delete tile;
+	resident.erase (resident.begin () + oldest);
+  }
+  last = 0;
+}
+
+void
+PixelBufferBig::flush ()
+{
+  for (int i = 0; i < resident.size (); i++) evict (resident[i]);
+  last = 0;
+}
+
+PixelBufferBig::Tile *
+PixelBufferBig::fetch (int index)
+{
+  Tile * tile = last;
+  if (! tile  ||  tile->index != index)
+  {
+	tile = tiles[index];
+	if (! tile) tile = load (index);
+	tile->lastUse = ++clock;
+	last = tile;
+  }
+  return tile;
+}
+
+PixelBufferBig::Tile *
+PixelBufferBig::load (int index)
+{
+  // Find a slot
+  Tile * tile;
+  if (resident.size () < cacheTiles)
+  {
+	tile = new Tile;
+	tile->index = -1;
+	tile->memory.grow (tileStride * tileHeight);
+	resident.push_back (tile);
+  }
+  else
+  {
+	// Linear search is acceptable here, because a miss costs a disk access anyway.
+	tile = resident[0];
+	for (int i = 1; i < resident.size (); i++) if (resident[i]->lastUse < tile->lastUse) tile = resident[i];
+	evict (tile);
+  }
+  tile->index   = index;
+  tile->lastUse = clock;
+  tile->dirty   = false;
+  tiles[index]  = tile;
+
+  // Fill it
+  char * memory = (char *) tile->memory;
+  if (stored[index])
+  {
+	seekScratch (scratch, (int64_t) index * tile->memory.size ());
+	if (fread (memory, tile->memory.size (), 1, scratch) != 1) throw "Unable to read scratch file";
+  }
+  else if (source.memory)
+  {
+	int x = index % tilesH * tileWidth;
+	int y = index / tilesH * tileHeight;
+	int w = min (tileWidth,  width  - x);
+	int h = min (tileHeight, height - y);
+	Image block;
+	source->read (block, x, y, w, h);
+	block *= *format;
+	// A codec that can't address regions will return the entire raster.
+	int fromX = 0;
+	int fromY = 0;
+	if (block.width != w  ||  block.height != h)
+	{
+	  if (block.width < x + w  ||  block.height < y + h) throw "Source did not deliver requested block";
+	  fromX = x;
+	  fromY = y;
+	}
+	PixelBufferPacked * i = (PixelBufferPacked *) block.buffer;
+	assert (i);
+	char * from = (char *) i->base () + fromY * i->stride + fromX * depth;
+	if (w < tileWidth  ||  h < tileHeight) tile->memory.clear ();
+	for (int r = 0; r < h; r++)
+	{
+	  memcpy (memory, from, w * depth);
+	  memory += tileStride;
+	  from   += i->stride;
+	}
+  }
+  else
+  {
+	tile->memory.clear ();
+  }
+
+  return tile;
+}
+
+void
+PixelBufferBig::evict (Tile * tile)
+{
+  if (tile->index < 0) return;
+  if (tile->dirty)
+  {
+	if (! scratch)
+	{
+	  scratch = tmpfile ();
+	  if (! scratch) throw "Unable to create scratch file";
+	}
+	seekScratch (scratch, (int64_t) tile->index * tile->memory.size ());
+	if (fwrite ((char *) tile->memory, tile->memory.size (), 1, scratch) != 1) throw "Unable to write scratch file";
+	stored[tile->index] = 1;
+	tile->dirty = false;
+  }
+  tiles[tile->index] = 0;
+  tile->index = -1;
+  if (last == tile) last = 0;
+}
+
+void
+PixelBufferBig::reset ()
+{
+  for (int i = 0; i < resident.size (); i++) delete resident[i];
+  resident.clear ();
+  tiles.clear ();
+  stored.clear ();
+  last = 0;
+  if (scratch)
+  {
+	fclose (scratch);  // tmpfile() arranges for automatic deletion
+	scratch = 0;
+  }
 }
@@ -81,10 +81,12 @@ PixelFormatGrayAlphaChar      fl::GrayAlphaChar;
 PixelFormatGrayShort          fl::GrayShort;
 PixelFormatGrayShortSigned    fl::GrayShortSigned;
 PixelFormatGrayAlphaShort     fl::GrayAlphaShort;
+PixelFormatGrayHalf           fl::GrayHalf;
 PixelFormatGrayFloat          fl::GrayFloat;
 PixelFormatGrayDouble         fl::GrayDouble;
 PixelFormatRGBAChar           fl::RGBAChar;
 PixelFormatRGBAShort          fl::RGBAShort;
+PixelFormatRGBAHalf           fl::RGBAHalf;
 PixelFormatRGBAFloat          fl::RGBAFloat;
 PixelFormatRGBChar            fl::RGBChar;
 PixelFormatPlanarRGB          fl::RGBPlanar;
@@ -126,10 +128,12 @@ static int incrementRefcount ()
   GrayShort      .PointerPolyReferenceCount++;
   GrayShortSigned.PointerPolyReferenceCount++;
   GrayAlphaShort .PointerPolyReferenceCount++;
+  GrayHalf       .PointerPolyReferenceCount++;
   GrayFloat      .PointerPolyReferenceCount++;
   GrayDouble     .PointerPolyReferenceCount++;
   RGBAChar       .PointerPolyReferenceCount++;
   RGBAShort      .PointerPolyReferenceCount++;
+  RGBAHalf       .PointerPolyReferenceCount++;
   RGBAFloat      .PointerPolyReferenceCount++;
   RGBChar        .PointerPolyReferenceCount++;
   RGBPlanar      .PointerPolyReferenceCount++;
@@ -323,6 +327,84 @@ prepareDublicate (int & shift, int bits)
 }
 
 
+namespace
+{
+/**
+   Steps through the pixels of one row, producing the same pointers that
+   PixelBuffer::pixel() would.  Used by the default span methods.  row
+   must come from PixelBuffer::row() on a buffer whose kind agrees with
+   format.planes.
+**/
+class PixelWalker
+{
+public:
+  PixelWalker (const PixelFormat & format, void * row, int x)
+  {
+	planes = format.planes;
+	if (planes == 1)
+	{
+	  step    = (int) format.depth;
+	  current = (char *) row + x * step;
+	}
+	else if (planes == 3)
+	{
+	  const PixelFormatYUV * yuv = dynamic_cast<const PixelFormatYUV *> (&format);
+	  ratioH = yuv ? yuv->ratioH : 1;
+	  phase  = x % ratioH;
+	  char ** r = (char **) row;
+	  array[0] = r[0] + x;
+	  array[1] = r[1] + x / ratioH;
+	  array[2] = r[2] + x / ratioH;
+	  current = array;
+	}
+	else  // planes == -1
+	{
+	  const Macropixel * m = dynamic_cast<const Macropixel *> (&format);
+	  ratioH = m->pixelsH;
+	  step   = m->bytes;
+	  data.address = (unsigned char *) row + (x / ratioH) * step;
+	  data.index   = x % ratioH;
+	  current = &data;
+	}
+  }
+
+  void next ()
+  {
+	if (planes == 1)
+	{
+	  current = (char *) current + step;
+	}
+	else if (planes == 3)
+	{
+	  array[0]++;
+	  if (++phase == ratioH)
+	  {
+		phase = 0;
+		array[1]++;
+		array[2]++;
+	  }
+	}
+	else
+	{
+	  if (++data.index == ratioH)
+	  {
+		data.index = 0;
+		data.address += step;
+	  }
+	}
+  }
+
+  void * current;  ///< Pointer suitable for the per-pixel methods of PixelFormat.
+  int    planes;
+  int    step;
+  int    ratioH;
+  int    phase;
+  char * array[3];
+  PixelBufferGroups::PixelData data;
+};
+}
+
+
 // class PixelFormat ----------------------------------------------------------
 
 uint8_t * PixelFormat::lutFloat2Char = PixelFormat::buildFloat2Char ();
@@ -370,6 +452,8 @@ PixelFormat::registerClasses (Archive & archive)
   archive.registerClass<PixelFormatPlanarYCbCr    > ("PixelFormatPlanarYCbCr");
   archive.registerClass<PixelFormatHSLFloat       > ("PixelFormatHSLFloat");
   archive.registerClass<PixelFormatHSVFloat       > ("PixelFormatHSVFloat");
+  archive.registerClass<PixelFormatGrayHalf       > ("PixelFormatGrayHalf");
+  archive.registerClass<PixelFormatRGBAHalf       > ("PixelFormatRGBAHalf");
 }
 
 Image
@@ -386,6 +470,7 @@ PixelFormat::filter (const Image & image)
   result.resize (image.width, image.height);
   result.timestamp = image.timestamp;
   if (result.width <= 0  ||  result.height <= 0) return result;
+  if (convert (image, result)) return result;
 
   fromAny (image, result);
 
@@ -402,47 +487,23 @@ PixelFormat::fromAny (const Image & image, Image & result) const
   // First convert to central format.
   Image central = image * RGBAChar;
 
-  // Then conver to destination format.
+  // Then conver to destination format, one row at a time.
   PixelBufferPacked * i = (PixelBufferPacked *) central.buffer;
-  PixelBufferPacked * o = (PixelBufferPacked *) result.buffer;
   assert (i);
-  uint32_t * source = (uint32_t *) i->base ();
-  const int  step   = i->stride - central.width * sizeof (uint32_t);
-  if (o)
+  const int width = central.width;
+  vector<uint32_t> span (width);
+  for (int y = 0; y < central.height; y++)
   {
-	const int destDepth = (int) depth;
-	uint8_t * dest      = (uint8_t *) o->base ();
-	uint8_t * end       = dest + o->stride * result.height;
-	uint8_t * rowEnd    = dest + result.width * destDepth;
-	while (dest < end)
+	uint32_t * source = (uint32_t *) ((char *) i->base () + y * i->stride);
+	for (int x = 0; x < width; x++)
 	{
-	  while (dest < rowEnd)
-	  {
-#       if BYTE_ORDER == LITTLE_ENDIAN
-		setRGBA (dest, bswap(*source++));
-#       elif BYTE_ORDER == BIG_ENDIAN
-		setRGBA (dest, *source++);
-#       endif
-		dest += destDepth;
-	  }
-	  source = (uint32_t *) ((char *) source + step);
-	  rowEnd += o->stride;
-	}
-  }
-  else
-  {
-	for (int y = 0; y < image.height; y++)
-	{
-	  for (int x = 0; x < image.width; x++)
-	  {
-#       if BYTE_ORDER == LITTLE_ENDIAN
-		setRGBA (result.buffer->pixel (x, y), bswap(*source++));
-#       elif BYTE_ORDER == BIG_ENDIAN
-		setRGBA (result.buffer->pixel (x, y), *source++);
-#       endif
-	  }
-	  source = (uint32_t *) ((char *) source + step);
+#     if BYTE_ORDER == LITTLE_ENDIAN
+	  span[x] = bswap (source[x]);
+#     elif BYTE_ORDER == BIG_ENDIAN
+	  span[x] = source[x];
+#     endif
 	}
+	result.setRGBA (0, y, width, &span[0]);
   }
 }
 
@@ -666,6 +727,41 @@ PixelFormat::blend (void * pixel, float values[]) const
   setRGBA (pixel, p);
 }
 
+void
+PixelFormat::getRGBA (void * row, int x, int count, uint32_t rgba[]) const
+{
+  PixelWalker w (*this, row, x);
+  for (int i = 0; i < count; i++, w.next ()) rgba[i] = getRGBA (w.current);
+}
+
+void
+PixelFormat::getRGBA (void * row, int x, int count, float values[]) const
+{
+  PixelWalker w (*this, row, x);
+  for (int i = 0; i < count; i++, w.next ()) getRGBA (w.current, values + 4 * i);
+}
+
+void
+PixelFormat::getGray (void * row, int x, int count, float gray[]) const
+{
+  PixelWalker w (*this, row, x);
+  for (int i = 0; i < count; i++, w.next ()) getGray (w.current, gray[i]);
+}
+
+void
+PixelFormat::setRGBA (void * row, int x, int count, const uint32_t rgba[]) const
+{
+  PixelWalker w (*this, row, x);
+  for (int i = 0; i < count; i++, w.next ()) setRGBA (w.current, rgba[i]);
+}
+
+void
+PixelFormat::setGray (void * row, int x, int count, const float gray[]) const
+{
+  PixelWalker w (*this, row, x);
+  for (int i = 0; i < count; i++, w.next ()) setGray (w.current, gray[i]);
+}
+
 inline uint8_t *
 PixelFormat::buildFloat2Char ()
 {
@@ -968,6 +1064,7 @@ PixelFormatGrayChar::filter (const Image & image)
   result.resize (image.width, image.height);
   result.timestamp = image.timestamp;
   if (result.width <= 0  ||  result.height <= 0) return result;
+  if (convert (image, result)) return result;
 
   if (typeid (* image.format) == typeid (PixelFormatGrayShort))
   {
@@ -1285,7 +1382,7 @@ PixelFormatGrayChar::fromAny (const Image & image, Image & result) const
 	{
 	  for (int x = 0; x < image.width; x++)
 	  {
-		*dest++ = sourceFormat->getGray (image.buffer->pixel (x, y));
+		*dest++ = sourceFormat->getGray (image.buffer->pixelRead (x, y));
 	  }
 	}
   }
@@ -1368,6 +1465,34 @@ PixelFormatGrayChar::setGray (void * pixel, float gray) const
   *((uint8_t *) pixel) = lutFloat2Char[(uint16_t) (65535 * gray)];
 }
 
+void
+PixelFormatGrayChar::getRGBA (void * row, int x, int count, uint32_t rgba[]) const
+{
+  uint8_t * p = (uint8_t *) row + x;
+  for (int i = 0; i < count; i++) rgba[i] = PixelFormatGrayChar::getRGBA (p + i);
+}
+
+void
+PixelFormatGrayChar::getGray (void * row, int x, int count, float gray[]) const
+{
+  uint8_t * p = (uint8_t *) row + x;
+  for (int i = 0; i < count; i++) PixelFormatGrayChar::getGray (p + i, gray[i]);
+}
+
+void
+PixelFormatGrayChar::setRGBA (void * row, int x, int count, const uint32_t rgba[]) const
+{
+  uint8_t * p = (uint8_t *) row + x;
+  for (int i = 0; i < count; i++) PixelFormatGrayChar::setRGBA (p + i, rgba[i]);
+}
+
+void
+PixelFormatGrayChar::setGray (void * row, int x, int count, const float gray[]) const
+{
+  uint8_t * p = (uint8_t *) row + x;
+  for (int i = 0; i < count; i++) PixelFormatGrayChar::setGray (p + i, gray[i]);
+}
+
 
 // class PixelFormatGrayAlphaChar ---------------------------------------------
 
@@ -1443,6 +1568,7 @@ PixelFormatGrayShort::filter (const Image & image)
   result.resize (image.width, image.height);
   result.timestamp = image.timestamp;
   if (result.width <= 0  ||  result.height <= 0) return result;
+  if (convert (image, result)) return result;
 
   if (typeid (*image.format) == typeid (PixelFormatGrayChar))
   {
@@ -1565,7 +1691,7 @@ PixelFormatGrayShort::fromAny (const Image & image, Image & result) const
 	  for (int x = 0; x < image.width; x++)
 	  {
 		float gray;
-		sourceFormat->getGray (image.buffer->pixel (x, y), gray);
+		sourceFormat->getGray (image.buffer->pixelRead (x, y), gray);
 		*dest++ = (uint16_t) (grayMask * gray);
 	  }
 	}
@@ -1648,6 +1774,34 @@ PixelFormatGrayShort::setGray (void * pixel, float gray) const
   *((uint16_t *) pixel) = (uint16_t) (grayMask * gray);
 }
 
+void
+PixelFormatGrayShort::getRGBA (void * row, int x, int count, uint32_t rgba[]) const
+{
+  uint16_t * p = (uint16_t *) row + x;
+  for (int i = 0; i < count; i++) rgba[i] = PixelFormatGrayShort::getRGBA (p + i);
+}
+
+void
+PixelFormatGrayShort::getGray (void * row, int x, int count, float gray[]) const
+{
+  uint16_t * p = (uint16_t *) row + x;
+  for (int i = 0; i < count; i++) PixelFormatGrayShort::getGray (p + i, gray[i]);
+}
+
+void
+PixelFormatGrayShort::setRGBA (void * row, int x, int count, const uint32_t rgba[]) const
+{
+  uint16_t * p = (uint16_t *) row + x;
+  for (int i = 0; i < count; i++) PixelFormatGrayShort::setRGBA (p + i, rgba[i]);
+}
+
+void
+PixelFormatGrayShort::setGray (void * row, int x, int count, const float gray[]) const
+{
+  uint16_t * p = (uint16_t *) row + x;
+  for (int i = 0; i < count; i++) PixelFormatGrayShort::setGray (p + i, gray[i]);
+}
+
 
 // class PixelFormatGrayShortSigned -------------------------------------------
 
@@ -1781,6 +1935,131 @@ PixelFormatGrayAlphaShort::setRGBA (void * pixel, uint32_t rgba) const
 }
 
 
+// class PixelFormatGrayHalf --------------------------------------------------
+
+PixelFormatGrayHalf::PixelFormatGrayHalf ()
+{
+  planes      = 1;
+  depth       = 2;
+  precedence  = 3;  // Above GrayShort and below GrayFloat
+  monochrome  = true;
+  hasAlpha    = false;
+}
+
+void
+PixelFormatGrayHalf::serialize (Archive & archive, uint32_t version)
+{
+  archive & *((PixelFormat *) this);
+}
+
+/**
+   Goes through float gray values, rather than the default RGBAChar, which
+   would throw away most of the precision of this format.
+**/
+void
+PixelFormatGrayHalf::fromAny (const Image & image, Image & result) const
+{
+  PixelBufferPacked * buffer = (PixelBufferPacked *) result.buffer;
+  vector<float> row (image.width);
+  for (int y = 0; y < image.height; y++)
+  {
+	image.getGray (0, y, image.width, &row[0]);
+	floatToHalf (&row[0], (uint16_t *) ((char *) buffer->base () + y * buffer->stride), image.width);
+  }
+}
+
+uint32_t
+PixelFormatGrayHalf::getRGBA (void * pixel) const
+{
+  uint32_t t = PixelFormatGrayHalf::getGray (pixel);
+  return (t << 24) | (t << 16) | (t << 8) | 0xFF;
+}
+
+void
+PixelFormatGrayHalf::getRGBA (void * pixel, float values[]) const
+{
+  float i = halfToFloat (*((uint16_t *) pixel));
+  values[0] = i;
+  values[1] = i;
+  values[2] = i;
+  values[3] = 1.0f;
+}
+
+void
+PixelFormatGrayHalf::getXYZ (void * pixel, float values[]) const
+{
+  float t = halfToFloat (*((uint16_t *) pixel));
+  values[0] = 0.950470f * t;
+  values[1] =             t;
+  values[2] = 1.088830f * t;
+}
+
+uint8_t
+PixelFormatGrayHalf::getGray (void * pixel) const
+{
+  float v = min (max (halfToFloat (*((uint16_t *) pixel)), 0.0f), 1.0f);
+  return lutFloat2Char[(uint16_t) (65535 * v)];
+}
+
+void
+PixelFormatGrayHalf::getGray (void * pixel, float & gray) const
+{
+  gray = halfToFloat (*((uint16_t *) pixel));
+}
+
+void
+PixelFormatGrayHalf::setRGBA (void * pixel, uint32_t rgba) const
+{
+  float r = lutChar2Float[(rgba & 0xFF000000) >> 24];
+  float g = lutChar2Float[(rgba &   0xFF0000) >> 16];
+  float b = lutChar2Float[(rgba &     0xFF00) >>  8];
+  *((uint16_t *) pixel) = floatToHalf (redToY * r + greenToY * g + blueToY * b);
+}
+
+void
+PixelFormatGrayHalf::setRGBA (void * pixel, float values[]) const
+{
+  *((uint16_t *) pixel) = floatToHalf (redToY * values[0] + greenToY * values[1] + blueToY * values[2]);
+}
+
+void
+PixelFormatGrayHalf::setXYZ (void * pixel, float values[]) const
+{
+  *((uint16_t *) pixel) = floatToHalf (values[1]);
+}
+
+void
+PixelFormatGrayHalf::setGray  (void * pixel, uint8_t gray) const
+{
+  *((uint16_t *) pixel) = floatToHalf (lutChar2Float[gray]);
+}
+
+void
+PixelFormatGrayHalf::setGray  (void * pixel, float gray) const
+{
+  *((uint16_t *) pixel) = floatToHalf (gray);
+}
+
+void
+PixelFormatGrayHalf::getRGBA (void * row, int x, int count, float values[]) const
+{
+  uint16_t * p = (uint16_t *) row + x;
+  for (int i = 0; i < count; i++) PixelFormatGrayHalf::getRGBA (p + i, values + 4 * i);
+}
+
+void
+PixelFormatGrayHalf::getGray (void * row, int x, int count, float gray[]) const
+{
+  halfToFloat ((uint16_t *) row + x, gray, count);
+}
+
+void
+PixelFormatGrayHalf::setGray (void * row, int x, int count, const float gray[]) const
+{
+  floatToHalf (gray, (uint16_t *) row + x, count);
+}
+
+
 // class PixelFormatGrayFloat -------------------------------------------------
 
 PixelFormatGrayFloat::PixelFormatGrayFloat ()
@@ -1812,6 +2091,7 @@ PixelFormatGrayFloat::filter (const Image & image)
   result.resize (image.width, image.height);
   result.timestamp = image.timestamp;
   if (result.width <= 0  ||  result.height <= 0) return result;
+  if (convert (image, result)) return result;
 
   if (typeid (* image.format) == typeid (PixelFormatGrayChar))
   {
@@ -2129,35 +2409,10 @@ void
 PixelFormatGrayFloat::fromAny (const Image & image, Image & result) const
 {
   float * dest = (float *) ((PixelBufferPacked *) result.buffer)->base ();
-  const PixelFormat * sourceFormat = image.format;
-
-  PixelBufferPacked * i = (PixelBufferPacked *) image.buffer;
-  if (i)
+  for (int y = 0; y < image.height; y++)
   {
-	uint8_t * source      = (uint8_t *) i->base ();
-	const int sourceDepth = (int) sourceFormat->depth;
-	const int step        = i->stride - image.width * sourceDepth;
-	float *   end         = dest + image.width * image.height;
-	while (dest < end)
-	{
-	  float * rowEnd = dest + result.width;
-	  while (dest < rowEnd)
-	  {
-		sourceFormat->getGray (source, *dest++);
-		source += sourceDepth;
-	  }
-	  source += step;
-	}
-  }
-  else
-  {
-	for (int y = 0; y < image.height; y++)
-	{
-	  for (int x = 0; x < image.width; x++)
-	  {
-		sourceFormat->getGray (image.buffer->pixel (x, y), *dest++);
-	  }
-	}
+	image.getGray (0, y, image.width, dest);
+	dest += result.width;
   }
 }
 
@@ -2234,6 +2489,41 @@ PixelFormatGrayFloat::setGray  (void * pixel, float gray) const
   *((float *) pixel) = gray;
 }
 
+void
+PixelFormatGrayFloat::getRGBA (void * row, int x, int count, uint32_t rgba[]) const
+{
+  float * p = (float *) row + x;
+  for (int i = 0; i < count; i++) rgba[i] = PixelFormatGrayFloat::getRGBA (p + i);
+}
+
+void
+PixelFormatGrayFloat::getRGBA (void * row, int x, int count, float values[]) const
+{
+  float * p = (float *) row + x;
+  for (int i = 0; i < count; i++) PixelFormatGrayFloat::getRGBA (p + i, values + 4 * i);
+}
+
+void
+PixelFormatGrayFloat::getGray (void * row, int x, int count, float gray[]) const
+{
+  float * p = (float *) row + x;
+  for (int i = 0; i < count; i++) PixelFormatGrayFloat::getGray (p + i, gray[i]);
+}
+
+void
+PixelFormatGrayFloat::setRGBA (void * row, int x, int count, const uint32_t rgba[]) const
+{
+  float * p = (float *) row + x;
+  for (int i = 0; i < count; i++) PixelFormatGrayFloat::setRGBA (p + i, rgba[i]);
+}
+
+void
+PixelFormatGrayFloat::setGray (void * row, int x, int count, const float gray[]) const
+{
+  float * p = (float *) row + x;
+  for (int i = 0; i < count; i++) PixelFormatGrayFloat::setGray (p + i, gray[i]);
+}
+
 
 // class PixelFormatGrayDouble ------------------------------------------------
 
@@ -2266,6 +2556,7 @@ PixelFormatGrayDouble::filter (const Image & image)
   result.resize (image.width, image.height);
   result.timestamp = image.timestamp;
   if (result.width <= 0  ||  result.height <= 0) return result;
+  if (convert (image, result)) return result;
 
   if (typeid (* image.format) == typeid (PixelFormatGrayChar))
   {
@@ -2612,7 +2903,7 @@ PixelFormatGrayDouble::fromAny (const Image & image, Image & result) const
 	  for (int x = 0; x < image.width; x++)
 	  {
 		float value;
-		sourceFormat->getGray (image.buffer->pixel (x, y), value);
+		sourceFormat->getGray (image.buffer->pixelRead (x, y), value);
 		*dest++ = value;
 	  }
 	}
@@ -2692,6 +2983,41 @@ PixelFormatGrayDouble::setGray  (void * pixel, float gray) const
   *((double *) pixel) = gray;
 }
 
+void
+PixelFormatGrayDouble::getRGBA (void * row, int x, int count, uint32_t rgba[]) const
+{
+  double * p = (double *) row + x;
+  for (int i = 0; i < count; i++) rgba[i] = PixelFormatGrayDouble::getRGBA (p + i);
+}
+
+void
+PixelFormatGrayDouble::getRGBA (void * row, int x, int count, float values[]) const
+{
+  double * p = (double *) row + x;
+  for (int i = 0; i < count; i++) PixelFormatGrayDouble::getRGBA (p + i, values + 4 * i);
+}
+
+void
+PixelFormatGrayDouble::getGray (void * row, int x, int count, float gray[]) const
+{
+  double * p = (double *) row + x;
+  for (int i = 0; i < count; i++) PixelFormatGrayDouble::getGray (p + i, gray[i]);
+}
+
+void
+PixelFormatGrayDouble::setRGBA (void * row, int x, int count, const uint32_t rgba[]) const
+{
+  double * p = (double *) row + x;
+  for (int i = 0; i < count; i++) PixelFormatGrayDouble::setRGBA (p + i, rgba[i]);
+}
+
+void
+PixelFormatGrayDouble::setGray (void * row, int x, int count, const float gray[]) const
+{
+  double * p = (double *) row + x;
+  for (int i = 0; i < count; i++) PixelFormatGrayDouble::setGray (p + i, gray[i]);
+}
+
 
 // class PixelFormatRGBABits --------------------------------------------------
 
@@ -2742,6 +3068,7 @@ PixelFormatRGBABits::filter (const Image & image)
   result.resize (image.width, image.height);
   result.timestamp = image.timestamp;
   if (result.width <= 0  ||  result.height <= 0) return result;
+  if (convert (image, result)) return result;
 
   if (typeid (* image.format) == typeid (PixelFormatGrayChar))
   {
@@ -3856,6 +4183,22 @@ PixelFormatRGBABits::setAlpha (void * pixel, uint8_t alpha) const
   * (uint32_t *) pixel = a | ((* (uint32_t *) pixel) & ~alphaMask);
 }
 
+void
+PixelFormatRGBABits::getRGBA (void * row, int x, int count, uint32_t rgba[]) const
+{
+  const int step = (int) depth;
+  uint8_t * p = (uint8_t *) row + x * step;
+  for (int i = 0; i < count; i++) rgba[i] = PixelFormatRGBABits::getRGBA (p + i * step);
+}
+
+void
+PixelFormatRGBABits::setRGBA (void * row, int x, int count, const uint32_t rgba[]) const
+{
+  const int step = (int) depth;
+  uint8_t * p = (uint8_t *) row + x * step;
+  for (int i = 0; i < count; i++) PixelFormatRGBABits::setRGBA (p + i * step, rgba[i]);
+}
+
 
 // class PixelFormatRGBAChar ---------------------------------------------------
 
@@ -3888,6 +4231,7 @@ PixelFormatRGBAChar::filter (const Image & image)
   result.resize (image.width, image.height);
   result.timestamp = image.timestamp;
   if (result.width <= 0  ||  result.height <= 0) return result;
+  if (convert (image, result)) return result;
 
   if (typeid (* image.format) == typeid (PixelFormatGrayChar))
   {
@@ -4150,49 +4494,17 @@ PixelFormatRGBAChar::fromPackedYUV (const Image & image, Image & result) const
 void
 PixelFormatRGBAChar::fromAny (const Image & image, Image & result) const
 {
-  const PixelFormat * sourceFormat = image.format;
-
-  PixelBufferPacked * i = (PixelBufferPacked *) image.buffer;
   PixelBufferPacked * o = (PixelBufferPacked *) result.buffer;
   assert (o);
 
-  uint32_t * dest = (uint32_t *) o->base ();
-
-  if (i)
-  {
-	uint32_t * end     = dest + result.width * result.height;
-	uint32_t * rowEnd  = dest + result.width;  // Output of this conversion must have stride == row length.
-	uint8_t * source      = (uint8_t *) i->base ();
-	const int sourceDepth = (int) sourceFormat->depth;
-	const int step        = i->stride - image.width * sourceDepth;
-	while (dest < end)
-	{
-	  while (dest < rowEnd)
-	  {
-#       if BYTE_ORDER == LITTLE_ENDIAN
-		*dest++ = bswap (sourceFormat->getRGBA (source));
-#       else
-		*dest++ = sourceFormat->getRGBA (source);
-#       endif
-		source += sourceDepth;
-	  }
-	  source += step;
-	  rowEnd += result.width;
-	}
-  }
-  else
+  uint32_t * dest = (uint32_t *) o->base ();  // Output of this conversion must have stride == row length.
+  for (int y = 0; y < image.height; y++)
   {
-	for (int y = 0; y < image.height; y++)
-	{
-	  for (int x = 0; x < image.width; x++)
-	  {
-#       if BYTE_ORDER == LITTLE_ENDIAN
-		*dest++ = bswap (sourceFormat->getRGBA (image.buffer->pixel (x, y)));
-#       else
-		*dest++ = sourceFormat->getRGBA (image.buffer->pixel (x, y));
-#       endif
-	  }
-	}
+	image.getRGBA (0, y, image.width, dest);
+#   if BYTE_ORDER == LITTLE_ENDIAN
+	for (int x = 0; x < image.width; x++) dest[x] = bswap (dest[x]);
+#   endif
+	dest += result.width;
   }
 }
 
@@ -4228,6 +4540,20 @@ PixelFormatRGBAChar::setAlpha (void * pixel, uint8_t alpha) const
   ((uint8_t *) pixel)[3] = alpha;
 }
 
+void
+PixelFormatRGBAChar::getRGBA (void * row, int x, int count, uint32_t rgba[]) const
+{
+  uint32_t * p = (uint32_t *) row + x;
+  for (int i = 0; i < count; i++) rgba[i] = PixelFormatRGBAChar::getRGBA (p + i);
+}
+
+void
+PixelFormatRGBAChar::setRGBA (void * row, int x, int count, const uint32_t rgba[]) const
+{
+  uint32_t * p = (uint32_t *) row + x;
+  for (int i = 0; i < count; i++) PixelFormatRGBAChar::setRGBA (p + i, rgba[i]);
+}
+
 
 // class PixelFormatRGBChar ---------------------------------------------------
 
@@ -4260,6 +4586,7 @@ PixelFormatRGBChar::filter (const Image & image)
   result.resize (image.width, image.height);
   result.timestamp = image.timestamp;
   if (result.width <= 0  ||  result.height <= 0) return result;
+  if (convert (image, result)) return result;
 
   if (typeid (* image.format) == typeid (PixelFormatGrayChar))
   {
@@ -4448,6 +4775,20 @@ PixelFormatRGBChar::setRGBA  (void * pixel, uint32_t rgba) const
   ((uint8_t *) pixel)[0] =  rgba >>  8;
 }
 
+void
+PixelFormatRGBChar::getRGBA (void * row, int x, int count, uint32_t rgba[]) const
+{
+  uint8_t * p = (uint8_t *) row + 3 * x;
+  for (int i = 0; i < count; i++) rgba[i] = PixelFormatRGBChar::getRGBA (p + i * 3);
+}
+
+void
+PixelFormatRGBChar::setRGBA (void * row, int x, int count, const uint32_t rgba[]) const
+{
+  uint8_t * p = (uint8_t *) row + 3 * x;
+  for (int i = 0; i < count; i++) PixelFormatRGBChar::setRGBA (p + i * 3, rgba[i]);
+}
+
 
 // class PixelFormatRGBAShort -------------------------------------------------
 
@@ -4550,6 +4891,100 @@ PixelFormatRGBShort::setRGBA (void * pixel, uint32_t rgba) const
 }
 
 
+// class PixelFormatRGBAHalf --------------------------------------------------
+
+PixelFormatRGBAHalf::PixelFormatRGBAHalf ()
+{
+  planes     = 1;
+  depth      = 4 * sizeof (uint16_t);
+  precedence = 5;  // Same information content as RGBAShort, but with floating-point range
+  monochrome = false;
+  hasAlpha   = true;
+}
+
+void
+PixelFormatRGBAHalf::serialize (Archive & archive, uint32_t version)
+{
+  archive & *((PixelFormat *) this);
+}
+
+void
+PixelFormatRGBAHalf::fromAny (const Image & image, Image & result) const
+{
+  PixelBufferPacked * buffer = (PixelBufferPacked *) result.buffer;
+  vector<float> row (image.width * 4);
+  for (int y = 0; y < image.height; y++)
+  {
+	image.getRGBA (0, y, image.width, &row[0]);
+	floatToHalf (&row[0], (uint16_t *) ((char *) buffer->base () + y * buffer->stride), image.width * 4);
+  }
+}
+
+uint32_t
+PixelFormatRGBAHalf::getRGBA (void * pixel) const
+{
+  float rgbaValues[4];
+  PixelFormatRGBAHalf::getRGBA (pixel, rgbaValues);
+  for (int i = 0; i < 4; i++)
+  {
+	rgbaValues[i] = max (rgbaValues[i], 0.0f);
+	rgbaValues[i] = min (rgbaValues[i], 1.0f);
+  }
+  uint32_t r = (uint32_t) lutFloat2Char[(uint16_t) (65535 * rgbaValues[0])] << 24;
+  uint32_t g = (uint32_t) lutFloat2Char[(uint16_t) (65535 * rgbaValues[1])] << 16;
+  uint32_t b = (uint32_t) lutFloat2Char[(uint16_t) (65535 * rgbaValues[2])] <<  8;
+  uint32_t a = (uint32_t) (255 * rgbaValues[3]);  // assume alpha is already linear
+  return r | g | b | a;
+}
+
+void
+PixelFormatRGBAHalf::getRGBA (void * pixel, float values[]) const
+{
+  values[0] = halfToFloat (((uint16_t *) pixel)[0]);
+  values[1] = halfToFloat (((uint16_t *) pixel)[1]);
+  values[2] = halfToFloat (((uint16_t *) pixel)[2]);
+  values[3] = halfToFloat (((uint16_t *) pixel)[3]);
+}
+
+uint8_t
+PixelFormatRGBAHalf::getAlpha (void * pixel) const
+{
+  return (uint8_t) (halfToFloat (((uint16_t *) pixel)[3]) * 255);
+}
+
+void
+PixelFormatRGBAHalf::setRGBA (void * pixel, uint32_t rgba) const
+{
+  uint16_t * p = (uint16_t *) pixel;
+  p[0] = floatToHalf (lutChar2Float[ rgba             >> 24]);
+  p[1] = floatToHalf (lutChar2Float[(rgba & 0xFF0000) >> 16]);
+  p[2] = floatToHalf (lutChar2Float[(rgba &   0xFF00) >>  8]);
+  p[3] = floatToHalf ((rgba & 0xFF) / 255.0f);  // Don't linearize alpha, because it is always linear
+}
+
+void
+PixelFormatRGBAHalf::setRGBA (void * pixel, float values[]) const
+{
+  uint16_t * p = (uint16_t *) pixel;
+  p[0] = floatToHalf (values[0]);
+  p[1] = floatToHalf (values[1]);
+  p[2] = floatToHalf (values[2]);
+  p[3] = floatToHalf (values[3]);
+}
+
+void
+PixelFormatRGBAHalf::setAlpha (void * pixel, uint8_t alpha) const
+{
+  ((uint16_t *) pixel)[3] = floatToHalf (alpha / 255.0f);
+}
+
+void
+PixelFormatRGBAHalf::getRGBA (void * row, int x, int count, float values[]) const
+{
+  halfToFloat ((uint16_t *) row + 4 * x, values, 4 * count);
+}
+
+
 // class PixelFormatRGBAFloat -------------------------------------------------
 
 PixelFormatRGBAFloat::PixelFormatRGBAFloat ()
@@ -4571,37 +5006,10 @@ void
 PixelFormatRGBAFloat::fromAny (const Image & image, Image & result) const
 {
   float * dest = (float *) ((PixelBufferPacked *) result.buffer)->base ();
-  const PixelFormat * sourceFormat = image.format;
-
-  PixelBufferPacked * i = (PixelBufferPacked *) image.buffer;
-  if (i)
-  {
-	uint8_t * source      = (uint8_t *) i->base ();
-	const int sourceDepth = (int) sourceFormat->depth;
-	const int step        = i->stride - image.width * sourceDepth;
-	float *   end         = dest + image.width * image.height * 4;
-	while (dest < end)
-	{
-	  float * rowEnd = dest + result.width * 4;
-	  while (dest < rowEnd)
-	  {
-		sourceFormat->getRGBA (source, dest);
-		source += sourceDepth;
-		dest += 4;
-	  }
-	  source += step;
-	}
-  }
-  else
+  for (int y = 0; y < image.height; y++)
   {
-	for (int y = 0; y < image.height; y++)
-	{
-	  for (int x = 0; x < image.width; x++)
-	  {
-		sourceFormat->getRGBA (image.buffer->pixel (x, y), dest);
-		dest += 4;
-	  }
-	}
+	image.getRGBA (0, y, image.width, dest);
+	dest += result.width * 4;
   }
 }
 
@@ -4670,6 +5078,27 @@ PixelFormatRGBAFloat::blend (void * pixel, float values[]) const
   alphaBlend (values, (float *) pixel);
 }
 
+void
+PixelFormatRGBAFloat::getRGBA (void * row, int x, int count, uint32_t rgba[]) const
+{
+  float * p = (float *) row + 4 * x;
+  for (int i = 0; i < count; i++) rgba[i] = PixelFormatRGBAFloat::getRGBA (p + i * 4);
+}
+
+void
+PixelFormatRGBAFloat::getRGBA (void * row, int x, int count, float values[]) const
+{
+  float * p = (float *) row + 4 * x;
+  for (int i = 0; i < count; i++) PixelFormatRGBAFloat::getRGBA (p + i * 4, values + 4 * i);
+}
+
+void
+PixelFormatRGBAFloat::setRGBA (void * row, int x, int count, const uint32_t rgba[]) const
+{
+  float * p = (float *) row + 4 * x;
+  for (int i = 0; i < count; i++) PixelFormatRGBAFloat::setRGBA (p + i * 4, rgba[i]);
+}
+
 
 // class PixelFormatYUV -------------------------------------------------------
 
@@ -4810,6 +5239,7 @@ PixelFormatPackedYUV::filter (const Image & image)
   result.resize (image.width, image.height);
   result.timestamp = image.timestamp;
   if (result.width <= 0  ||  result.height <= 0) return result;
+  if (convert (image, result)) return result;
 
   if ((const PixelFormatYUV *) image.format)
   {
@@ -4876,7 +5306,7 @@ PixelFormatPackedYUV::fromAny (const Image & image, Image & result) const
 			{
 			  for (int x = sampleX; x < sampleX + ratioH; x++)
 			  {
-				if (x < image.width  &&  y < image.height) rgba = sourceFormat->getRGBA (sourceBuffer->pixel (x, y));
+				if (x < image.width  &&  y < image.height) rgba = sourceFormat->getRGBA (sourceBuffer->pixelRead (x, y));
 				int sr =  rgba             >> 24;
 				int sg = (rgba & 0xFF0000) >> 16;
 				int sb = (rgba &   0xFF00) >>  8;
@@ -4969,7 +5399,7 @@ PixelFormatPackedYUV::fromAny (const Image & image, Image & result) const
 			uint32_t rgba = 0;
 			for (int p = 0; p < ratioH; p++)
 			{
-			  if (x < image.width) rgba = sourceFormat->getRGBA (sourceBuffer->pixel (x, y));
+			  if (x < image.width) rgba = sourceFormat->getRGBA (sourceBuffer->pixelRead (x, y));
 			  int sr =  rgba             >> 24;
 			  int sg = (rgba & 0xFF0000) >> 16;
 			  int sb = (rgba &   0xFF00) >>  8;
@@ -5041,7 +5471,7 @@ PixelFormatPackedYUV::fromYUV (const Image & image, Image & result) const
 			{
 			  for (int x = sampleX; x < sampleX + ratioH; x++)
 			  {
-				if (x < image.width  &&  y < image.height) yuv = sourceFormat->getYUV (sourceBuffer->pixel (x, y));
+				if (x < image.width  &&  y < image.height) yuv = sourceFormat->getYUV (sourceBuffer->pixelRead (x, y));
 				u +=  yuv & 0xFF00;
 				v += (yuv &   0xFF) << 8;
 				toGroup[(index++)->y] = yuv >> 16;  // don't mask, on assumption that higher order bits of yuv are 0
@@ -5083,7 +5513,7 @@ PixelFormatPackedYUV::fromYUV (const Image & image, Image & result) const
 		  uint32_t yuv = 0;
 		  for (int p = 0; p < ratioH; p++)
 		  {
-			if (x < image.width) yuv = sourceFormat->getYUV (sourceBuffer->pixel (x, y));
+			if (x < image.width) yuv = sourceFormat->getYUV (sourceBuffer->pixelRead (x, y));
 			u +=  yuv & 0xFF00;
 			v += (yuv &   0xFF) << 8;
 			toGroup[(*index++).y] = yuv >> 16;  // don't mask, on assumption that higher order bits of yuv are 0
@@ -5342,7 +5772,7 @@ PixelFormatPlanarYUV::fromAny (const Image & image, Image & result) const
 			uint8_t * blockRowEnd = Y + blockRowWidth;
 			while (Y < blockRowEnd)
 			{
-			  uint32_t rgba = sourceFormat->getRGBA (sourceBuffer->pixel (x++, y));
+			  uint32_t rgba = sourceFormat->getRGBA (sourceBuffer->pixelRead (x++, y));
 			  int sr =  rgba             >> 24;
 			  int sg = (rgba & 0xFF0000) >> 16;
 			  int sb = (rgba &   0xFF00) >>  8;
@@ -5440,7 +5870,7 @@ PixelFormatPlanarYUV::fromAny (const Image & image, Image & result) const
 		  {
 			for (int xx = x; xx < xend; xx++)
 			{
-			  uint32_t rgba = sourceFormat->getRGBA (sourceBuffer->pixel (xx, yy));
+			  uint32_t rgba = sourceFormat->getRGBA (sourceBuffer->pixelRead (xx, yy));
 			  int sr =  rgba             >> 24;
 			  int sg = (rgba & 0xFF0000) >> 16;
 			  int sb = (rgba &   0xFF00) >>  8;
@@ -5688,7 +6118,7 @@ PixelFormatPlanarYCbCr::fromAny (const Image & image, Image & result) const
 		  uint8_t * blockRowEnd = Y + blockRowWidth;
 		  while (Y < blockRowEnd)
 		  {
-			uint32_t rgba = sourceFormat->getRGBA (image.buffer->pixel (x++, y));
+			uint32_t rgba = sourceFormat->getRGBA (image.buffer->pixelRead (x++, y));
 			int sr =  rgba             >> 24;  // assumes 32-bit int
 			int sg = (rgba & 0xFF0000) >> 16;
 			int sb = (rgba &   0xFF00) >>  8;
@@ -0,0 +1,711 @@
+/*
+Author: Fred Rothganger
+
+Copyright 2010 Sandia Corporation.
+Under the terms of Contract DE-AC04-94AL85000 with Sandia Corporation,
+the U.S. Government retains certain rights in this software.
+Distributed under the GNU Lesser General Public License.  See the file LICENSE
+for details.
+*/
+
+
+#include "fl/image.h"
+#include "fl/cpu.h"
+#include "fl/endian.h"
+
+#include <algorithm>
+#include <string.h>
+#include <typeinfo>
+
+#if defined (__GNUC__)  &&  (defined (__x86_64__)  ||  defined (__SSE2__))  &&  BYTE_ORDER == LITTLE_ENDIAN
+#  define HAVE_VECTOR
+#  include <immintrin.h>
+#endif
+
+
+using namespace std;
+using namespace fl;
+
+
+// Same color->gray factors as PixelFormat.cc
+#define redToY   0.2126f
+#define greenToY 0.7152f
+#define blueToY  0.0722f
+
+
+// Converter registry ---------------------------------------------------------
+
+namespace
+{
+struct ConverterEntry
+{
+  const PixelFormat *       from;
+  const PixelFormat *       to;
+  PixelFormat::RowConverter converter;
+};
+}
+
+/**
+   Function-local storage, so that registration works regardless of the
+   order in which static initializers run.
+**/
+static vector<ConverterEntry> &
+converters ()
+{
+  static vector<ConverterEntry> result;
+  return result;
+}
+
+static inline bool
+matches (const PixelFormat * registered, const PixelFormat & format)
+{
+  return registered == &format  ||  (typeid (*registered) == typeid (format)  &&  *registered == format);
+}
+
+void
+PixelFormat::addConverter (const PixelFormat & from, const PixelFormat & to, RowConverter converter)
+{
+  vector<ConverterEntry> & c = converters ();
+  for (int i = 0; i < c.size (); i++)
+  {
+	if (c[i].from == &from  &&  c[i].to == &to)
+	{
+	  c[i].converter = converter;
+	  return;
+	}
+  }
+  ConverterEntry e;
+  e.from      = &from;
+  e.to        = &to;
+  e.converter = converter;
+  c.push_back (e);
+}
+
+PixelFormat::RowConverter
+PixelFormat::findConverter (const PixelFormat & from, const PixelFormat & to)
+{
+  vector<ConverterEntry> & c = converters ();
+  for (int i = 0; i < c.size (); i++)
+  {
+	if (c[i].from == &from  &&  c[i].to == &to) return c[i].converter;
+  }
+  for (int i = 0; i < c.size (); i++)
+  {
+	if (matches (c[i].from, from)  &&  matches (c[i].to, to)) return c[i].converter;
+  }
+  return 0;
+}
+
+bool
+PixelFormat::convert (const Image & image, Image & result) const
+{
+  RowConverter converter = findConverter (*image.format, *this);
+  if (! converter) return false;
+
+  // Blocked buffers can't be addressed one row at a time.
+  void * from[3];
+  void * to[3];
+  if (! image.buffer->row (0, from)  ||  ! result.buffer->row (0, to)) return false;
+
+  const int width  = min (image.width,  result.width);
+  const int height = min (image.height, result.height);
+  for (int y = 0; y < height; y++) converter (image.buffer->row (y, from), result.buffer->row (y, to), width);
+  return true;
+}
+
+
+// Scalar row converters ------------------------------------------------------
+
+namespace
+{
+/**
+   Color coefficients for YUV to RGB.  Y is multiplied by scale after
+   subtracting offset, and everything is fixed-point after bit 16.  These
+   are the same values used by the per-pixel conversions in PixelFormat.cc,
+   so results are bit-identical.
+**/
+struct StudioRange  // PlanarYCbCr
+{
+  static const int offset = 16;
+  static const int scale  = 0x12A15;
+  static const int rv     = 0x19895;
+  static const int gu     = 0x644A;
+  static const int gv     = 0xD01F;
+  static const int bu     = 0x20469;
+};
+
+struct FullRange  // PackedYUV
+{
+  static const int offset = 0;
+  static const int scale  = 0x10000;
+  static const int rv     = 0x166F7;
+  static const int gu     = 0x5879;
+  static const int gv     = 0xB6E9;
+  static const int bu     = 0x1C560;
+};
+}
+
+static inline int
+clampChar (int value)
+{
+  return min (max (value, 0), 255);
+}
+
+template<class Range, int channels>
+static inline void
+yuvToRGB (int y, int u, int v, uint8_t * to)
+{
+  y = (y - Range::offset) * Range::scale + 0x8000;
+  u -= 128;
+  v -= 128;
+  to[0] = clampChar ((y + Range::rv * v) >> 16);
+  to[1] = clampChar ((y - Range::gu * u - Range::gv * v) >> 16);
+  to[2] = clampChar ((y + Range::bu * u) >> 16);
+  if (channels == 4) to[3] = 0xFF;
+}
+
+namespace
+{
+/**
+   Planar YCbCr with horizontal chroma subsampling ratioH (YUV420, YUV411)
+   to RGBChar or RGBAChar.
+**/
+template<int ratioH, int channels>
+struct YCbCrToRGB
+{
+  static void scalar (void * from, void * to, int x, int width)
+  {
+	const uint8_t * Y  = ((uint8_t **) from)[0];
+	const uint8_t * Cb = ((uint8_t **) from)[1];
+	const uint8_t * Cr = ((uint8_t **) from)[2];
+	uint8_t * out = (uint8_t *) to + x * channels;
+	for (; x < width; x++, out += channels)
+	{
+	  yuvToRGB<StudioRange, channels> (Y[x], Cb[x / ratioH], Cr[x / ratioH], out);
+	}
+  }
+
+# ifdef HAVE_VECTOR
+  template<int bytes> static inline __attribute__ ((always_inline)) void run (void * from, void * to, int width);
+# endif
+};
+
+/**
+   Packed YUV with two pixels per 4-byte group (UYVY or YUYV) to RGBChar or
+   RGBAChar.  yFirst indicates YUYV byte order.
+**/
+template<bool yFirst, int channels>
+struct PackedYUVToRGB
+{
+  static void scalar (void * from, void * to, int x, int width)
+  {
+	const uint8_t * in  = (uint8_t *) from;
+	uint8_t *       out = (uint8_t *) to + x * channels;
+	const int y0 = yFirst ? 0 : 1;
+	const int u0 = yFirst ? 1 : 0;
+	for (; x < width; x++, out += channels)
+	{
+	  const uint8_t * group = in + (x >> 1) * 4;
+	  yuvToRGB<FullRange, channels> (group[y0 + 2 * (x & 1)], group[u0], group[u0 + 2], out);
+	}
+  }
+
+# ifdef HAVE_VECTOR
+  template<int bytes> static inline __attribute__ ((always_inline)) void run (void * from, void * to, int width);
+# endif
+};
+
+/// Luma of UYVY or YUYV to GrayChar.  This is exact, since both treat Y as non-linear sRGB gray.
+template<bool yFirst>
+struct PackedYUVToGrayChar
+{
+  static void scalar (void * from, void * to, int x, int width)
+  {
+	const uint8_t * in  = (uint8_t *) from + (yFirst ? 0 : 1);
+	uint8_t *       out = (uint8_t *) to;
+	for (; x < width; x++) out[x] = in[2 * x];
+  }
+
+# ifdef HAVE_VECTOR
+  template<int bytes> static inline __attribute__ ((always_inline)) void run (void * from, void * to, int width);
+# endif
+};
+
+struct GrayShortToGrayFloat
+{
+  static void scalar (void * from, void * to, int x, int width)
+  {
+	const uint16_t * in  = (uint16_t *) from;
+	float *          out = (float *) to;
+	for (; x < width; x++) out[x] = in[x] / 65535.0f;
+  }
+
+# ifdef HAVE_VECTOR
+  template<int bytes> static inline __attribute__ ((always_inline)) void run (void * from, void * to, int width);
+# endif
+};
+}
+
+/// Same as PixelFormat::getGray(pixel,float), which linearizes Y directly.
+template<bool yFirst>
+static void
+packedYUVToGrayFloat (void * from, void * to, int width)
+{
+  const uint8_t * in  = (uint8_t *) from + (yFirst ? 0 : 1);
+  float *         out = (float *) to;
+  const float *   lut = PixelFormat::lutChar2Float;
+  for (int x = 0; x < width; x++) out[x] = lut[in[2 * x]];
+}
+
+namespace
+{
+/**
+   Tables of linearized channel values premultiplied by their contribution
+   to Y, so that converting a pixel to gray is three loads and two adds.
+**/
+struct GrayWeights
+{
+  GrayWeights ()
+  {
+	for (int i = 0; i < 256; i++)
+	{
+	  float f = PixelFormat::lutChar2Float[i];
+	  red[i]   = redToY   * f;
+	  green[i] = greenToY * f;
+	  blue[i]  = blueToY  * f;
+	}
+  }
+
+  float red[256];
+  float green[256];
+  float blue[256];
+};
+}
+
+/**
+   8-bit RGB(A) in any byte order to GrayFloat.  r, g and b give the byte
+   offset of each channel within the pixel, and depth is the pixel size.
+**/
+template<int r, int g, int b, int depth>
+static void
+rgbCharToGrayFloat (void * from, void * to, int width)
+{
+  static GrayWeights w;  // Constructed on first use, after lutChar2Float is built.
+  const uint8_t * in  = (uint8_t *) from;
+  float *         out = (float *) to;
+  for (int x = 0; x < width; x++, in += depth)
+  {
+	out[x] = w.red[in[r]] + w.green[in[g]] + w.blue[in[b]];
+  }
+}
+
+
+// Vector row converters ------------------------------------------------------
+
+#ifdef HAVE_VECTOR
+
+namespace
+{
+template<int bytes>
+struct Lanes
+{
+  static const int count = bytes / sizeof (int32_t);
+  typedef int32_t  VI __attribute__ ((vector_size (bytes)));
+  typedef float    VF __attribute__ ((vector_size (bytes)));
+  typedef uint8_t  VB __attribute__ ((vector_size (bytes)));      ///< Same size as VI, for rearranging bytes.
+  typedef uint16_t VS __attribute__ ((vector_size (bytes / 2)));  ///< One short per lane
+  typedef uint8_t  VC __attribute__ ((vector_size (bytes / 4)));  ///< One byte per lane
+};
+
+/// Shuffle masks, which must be spelled out for each vector size.  Returned through a reference to avoid passing wide vectors by value outside of AVX code.
+template<int bytes> struct Masks;
+
+template<>
+struct Masks<16>
+{
+  typedef Lanes<16>::VI VI;
+  typedef Lanes<16>::VB VB;
+  static void even   (VI & m)            {VI t = {0, 0, 2, 2}; m = t;}
+  static void odd    (VI & m)            {VI t = {1, 1, 3, 3}; m = t;}
+  static void spread (VI & m, int ratio) {VI t2 = {0, 0, 1, 1};  VI t4 = {0, 0, 0, 0}; m = ratio == 2 ? t2 : t4;}
+  static void pack3  (VB & m)            {VB t = {0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14}; m = t;}
+};
+
+template<>
+struct Masks<32>
+{
+  typedef Lanes<32>::VI VI;
+  typedef Lanes<32>::VB VB;
+  static void even   (VI & m)            {VI t = {0, 0, 2, 2, 4, 4, 6, 6}; m = t;}
+  static void odd    (VI & m)            {VI t = {1, 1, 3, 3, 5, 5, 7, 7}; m = t;}
+  static void spread (VI & m, int ratio) {VI t2 = {0, 0, 1, 1, 2, 2, 3, 3};  VI t4 = {0, 0, 0, 0, 1, 1, 1, 1}; m = ratio == 2 ? t2 : t4;}
+  static void pack3  (VB & m)            {VB t = {0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, 16, 17, 18, 20, 21, 22, 24, 25, 26, 28, 29, 30}; m = t;}
+};
+}
+
+/**
+   Vector form of yuvToRGB().  Writes one vector's worth of pixels.
+**/
+template<int bytes, class Range, int channels>
+static inline __attribute__ ((always_inline)) void
+yuvToRGB (typename Lanes<bytes>::VI y, typename Lanes<bytes>::VI u, typename Lanes<bytes>::VI v, uint8_t * to)
+{
+  typedef typename Lanes<bytes>::VI VI;
+  typedef typename Lanes<bytes>::VB VB;
+
+  y = (y - Range::offset) * Range::scale + 0x8000;
+  u -= 128;
+  v -= 128;
+  VI r = (y + Range::rv * v) >> 16;
+  VI g = (y - Range::gu * u - Range::gv * v) >> 16;
+  VI b = (y + Range::bu * u) >> 16;
+
+  const VI zero = {};
+  const VI top  = zero + 255;
+  r = r < zero ? zero : (r > top ? top : r);
+  g = g < zero ? zero : (g > top ? top : g);
+  b = b < zero ? zero : (b > top ? top : b);
+  VI p = r | (g << 8) | (b << 16);
+
+  if (channels == 4)
+  {
+	p |= zero - 0x1000000;  // alpha = 0xFF000000
+	memcpy (to, &p, bytes);
+  }
+  else
+  {
+	VB mask;
+	Masks<bytes>::pack3 (mask);
+	VB t = __builtin_shuffle ((VB) p, mask);
+	memcpy (to, &t, bytes / 4 * 3);
+  }
+}
+
+template<int ratioH, int channels>
+template<int bytes>
+inline void
+YCbCrToRGB<ratioH, channels>::run (void * from, void * to, int width)
+{
+  typedef typename Lanes<bytes>::VI VI;
+  typedef typename Lanes<bytes>::VC VC;
+  const int lanes = Lanes<bytes>::count;
+
+  const uint8_t * Y  = ((uint8_t **) from)[0];
+  const uint8_t * Cb = ((uint8_t **) from)[1];
+  const uint8_t * Cr = ((uint8_t **) from)[2];
+  uint8_t * out = (uint8_t *) to;
+  VI spread;
+  Masks<bytes>::spread (spread, ratioH);
+
+  int x = 0;
+  for (; x + lanes <= width; x += lanes)
+  {
+	VC y;
+	VC u = {};
+	VC v = {};
+	memcpy (&y, Y  + x,          lanes);
+	memcpy (&u, Cb + x / ratioH, lanes / ratioH);
+	memcpy (&v, Cr + x / ratioH, lanes / ratioH);
+	yuvToRGB<bytes, StudioRange, channels>
+	(
+	  __builtin_convertvector (y, VI),
+	  __builtin_shuffle (__builtin_convertvector (u, VI), spread),
+	  __builtin_shuffle (__builtin_convertvector (v, VI), spread),
+	  out + x * channels
+	);
+  }
+  scalar (from, to, x, width);
+}
+
+template<bool yFirst, int channels>
+template<int bytes>
+inline void
+PackedYUVToRGB<yFirst, channels>::run (void * from, void * to, int width)
+{
+  typedef typename Lanes<bytes>::VI VI;
+  typedef typename Lanes<bytes>::VS VS;
+  const int lanes = Lanes<bytes>::count;
+
+  const uint8_t * in  = (uint8_t *) from;
+  uint8_t *       out = (uint8_t *) to;
+
+  VI even;
+  VI odd;
+  Masks<bytes>::even (even);
+  Masks<bytes>::odd  (odd);
+
+  int x = 0;
+  for (; x + lanes <= width; x += lanes)
+  {
+	// Each short holds one Y and one chroma value, with U and V alternating.
+	VS w;
+	memcpy (&w, in + 2 * x, bytes / 2);
+	VI y = __builtin_convertvector (yFirst ? w & 0xFF : w >> 8,   VI);
+	VI c = __builtin_convertvector (yFirst ? w >> 8   : w & 0xFF, VI);
+	yuvToRGB<bytes, FullRange, channels>
+	(
+	  y,
+	  __builtin_shuffle (c, even),
+	  __builtin_shuffle (c, odd),
+	  out + x * channels
+	);
+  }
+  scalar (from, to, x, width);
+}
+
+template<bool yFirst>
+template<int bytes>
+inline void
+PackedYUVToGrayChar<yFirst>::run (void * from, void * to, int width)
+{
+  typedef typename Lanes<bytes>::VS VS;
+  typedef typename Lanes<bytes>::VC VC;
+  const int lanes = Lanes<bytes>::count;
+
+  const uint8_t * in  = (uint8_t *) from;
+  uint8_t *       out = (uint8_t *) to;
+
+  int x = 0;
+  for (; x + lanes <= width; x += lanes)
+  {
+	VS w;
+	memcpy (&w, in + 2 * x, bytes / 2);
+	VC y = __builtin_convertvector (yFirst ? w & 0xFF : w >> 8, VC);
+	memcpy (out + x, &y, lanes);
+  }
+  scalar (from, to, x, width);
+}
+
+template<int bytes>
+inline void
+GrayShortToGrayFloat::run (void * from, void * to, int width)
+{
+  typedef typename Lanes<bytes>::VF VF;
+  typedef typename Lanes<bytes>::VS VS;
+  const int lanes = Lanes<bytes>::count;
+
+  const uint16_t * in  = (uint16_t *) from;
+  float *          out = (float *) to;
+
+  int x = 0;
+  for (; x + lanes <= width; x += lanes)
+  {
+	VS s;
+	memcpy (&s, in + x, bytes / 2);
+	VF f = __builtin_convertvector (s, VF) / 65535.0f;
+	memcpy (out + x, &f, bytes);
+  }
+  scalar (from, to, x, width);
+}
+
+template<class K> __attribute__ ((target ("avx2"))) static void convertAVX2 (void * from, void * to, int width) {K::template run<32> (from, to, width);}
+template<class K>                                   static void convertSSE2 (void * from, void * to, int width) {K::template run<16> (from, to, width);}
+
+template<class K>
+static void
+convertRow (void * from, void * to, int width)
+{
+  if (haveAVX2 ()) convertAVX2<K> (from, to, width);
+  else             convertSSE2<K> (from, to, width);
+}
+
+#else
+
+template<class K>
+static void
+convertRow (void * from, void * to, int width)
+{
+  K::scalar (from, to, 0, width);
+}
+
+#endif
+
+
+// Half precision -------------------------------------------------------------
+
+float
+fl::halfToFloat (uint16_t value)
+{
+  uint32_t sign     = (uint32_t) (value & 0x8000) << 16;
+  uint32_t exponent = (value >> 10) & 0x1F;
+  uint32_t mantissa = value & 0x3FF;
+  uint32_t bits;
+  if      (exponent == 0x1F) bits = sign | 0x7F800000 | (mantissa << 13) | (mantissa ? 0x400000 : 0);  // infinity or NaN.  NaN comes out quiet, same as F16C.
+  else if (exponent)         bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+  else if (mantissa == 0)    bits = sign;
+  else  // subnormal, so normalize
+  {
+	exponent = 113;
+	while (! (mantissa & 0x400))
+	{
+	  mantissa <<= 1;
+	  exponent--;
+	}
+	bits = sign | (exponent << 23) | ((mantissa & 0x3FF) << 13);
+  }
+  float result;
+  memcpy (&result, &bits, sizeof (result));
+  return result;
+}
+
+uint16_t
+fl::floatToHalf (float value)
+{
+  uint32_t bits;
+  memcpy (&bits, &value, sizeof (bits));
+  uint32_t sign = (bits >> 16) & 0x8000;
+  uint32_t a    = bits & 0x7FFFFFFF;
+
+  if (a >= 0x7F800000) return sign | 0x7C00 | (a > 0x7F800000 ? 0x200 | ((a >> 13) & 0x3FF) : 0);  // infinity or NaN.  NaN stays quiet.
+  if (a >= 0x477FF000) return sign | 0x7C00;  // 65520 and above round to infinity
+  if (a <  0x33000000) return sign;  // 2^-25 and below round to zero
+
+  uint32_t result;
+  uint32_t remainder;
+  uint32_t halfway;
+  if (a < 0x38800000)  // subnormal in half precision
+  {
+	int shift = 126 - (a >> 23);
+	uint32_t mantissa = (a & 0x7FFFFF) | 0x800000;
+	result    = mantissa >> shift;
+	remainder = mantissa & ((1u << shift) - 1);
+	halfway   = 1u << (shift - 1);
+  }
+  else
+  {
+	result    = (a >> 13) - (112 << 10);  // rebias exponent from 127 to 15
+	remainder = a & 0x1FFF;
+	halfway   = 0x1000;
+  }
+  if (remainder > halfway  ||  (remainder == halfway  &&  (result & 1))) result++;  // a carry out of the mantissa correctly bumps the exponent
+  return sign | result;
+}
+
+static void
+halfToFloatScalar (const uint16_t * from, float * to, int count)
+{
+  for (int i = 0; i < count; i++) to[i] = halfToFloat (from[i]);
+}
+
+static void
+floatToHalfScalar (const float * from, uint16_t * to, int count)
+{
+  for (int i = 0; i < count; i++) to[i] = floatToHalf (from[i]);
+}
+
+#ifdef HAVE_VECTOR
+
+__attribute__ ((target ("avx,f16c")))
+static void
+halfToFloatF16C (const uint16_t * from, float * to, int count)
+{
+  int i = 0;
+  for (; i + 8 <= count; i += 8)
+  {
+	__m128i h = _mm_loadu_si128 ((const __m128i *) (from + i));
+	_mm256_storeu_ps (to + i, _mm256_cvtph_ps (h));
+  }
+  halfToFloatScalar (from + i, to + i, count - i);
+}
+
+__attribute__ ((target ("avx,f16c")))
+static void
+floatToHalfF16C (const float * from, uint16_t * to, int count)
+{
+  int i = 0;
+  for (; i + 8 <= count; i += 8)
+  {
+	__m128i h = _mm256_cvtps_ph (_mm256_loadu_ps (from + i), _MM_FROUND_TO_NEAREST_INT);
+	_mm_storeu_si128 ((__m128i *) (to + i), h);
+  }
+  floatToHalfScalar (from + i, to + i, count - i);
+}
+
+void
+fl::halfToFloat (const uint16_t * from, float * to, int count)
+{
+  if (haveF16C ()) halfToFloatF16C   (from, to, count);
+  else             halfToFloatScalar (from, to, count);
+}
+
+void
+fl::floatToHalf (const float * from, uint16_t * to, int count)
+{
+  if (haveF16C ()) floatToHalfF16C   (from, to, count);
+  else             floatToHalfScalar (from, to, count);
+}
+
+#else
+
+void
+fl::halfToFloat (const uint16_t * from, float * to, int count)
+{
+  halfToFloatScalar (from, to, count);
+}
+
+void
+fl::floatToHalf (const float * from, uint16_t * to, int count)
+{
+  floatToHalfScalar (from, to, count);
+}
+
+#endif
+
+/// Row converters between the half and single precision formats.  channels is 1 for gray and 4 for RGBA.
+template<int channels>
+static void
+halfToFloatRow (void * from, void * to, int width)
+{
+  halfToFloat ((const uint16_t *) from, (float *) to, channels * width);
+}
+
+template<int channels>
+static void
+floatToHalfRow (void * from, void * to, int width)
+{
+  floatToHalf ((const float *) from, (uint16_t *) to, channels * width);
+}
+
+
+// Registration ---------------------------------------------------------------
+
+/**
+   Direct converters for pairs that otherwise go through a two-pass
+   conversion or a virtual call per pixel.  Pairs that already have a
+   hand-written fromXxx() in PixelFormat.cc are included only where these
+   are substantially faster.
+**/
+static int
+registerConverters ()
+{
+  PixelFormat::addConverter (YUV420, RGBChar,   convertRow<YCbCrToRGB<2, 3> >);
+  PixelFormat::addConverter (YUV420, RGBAChar,  convertRow<YCbCrToRGB<2, 4> >);
+  PixelFormat::addConverter (YUV411, RGBChar,   convertRow<YCbCrToRGB<4, 3> >);
+  PixelFormat::addConverter (YUV411, RGBAChar,  convertRow<YCbCrToRGB<4, 4> >);
+
+  PixelFormat::addConverter (UYVY,   RGBChar,   convertRow<PackedYUVToRGB<false, 3> >);
+  PixelFormat::addConverter (UYVY,   RGBAChar,  convertRow<PackedYUVToRGB<false, 4> >);
+  PixelFormat::addConverter (YUYV,   RGBChar,   convertRow<PackedYUVToRGB<true,  3> >);
+  PixelFormat::addConverter (YUYV,   RGBAChar,  convertRow<PackedYUVToRGB<true,  4> >);
+
+  PixelFormat::addConverter (UYVY,   GrayChar,  convertRow<PackedYUVToGrayChar<false> >);
+  PixelFormat::addConverter (YUYV,   GrayChar,  convertRow<PackedYUVToGrayChar<true> >);
+  PixelFormat::addConverter (UYVY,   GrayFloat, packedYUVToGrayFloat<false>);
+  PixelFormat::addConverter (YUYV,   GrayFloat, packedYUVToGrayFloat<true>);
+
+  PixelFormat::addConverter (GrayShort, GrayFloat, convertRow<GrayShortToGrayFloat>);
+
+  // The byte order of these formats in memory is the same on all machines.
+  PixelFormat::addConverter (RGBChar,  GrayFloat, rgbCharToGrayFloat<0, 1, 2, 3>);
+  PixelFormat::addConverter (RGBAChar, GrayFloat, rgbCharToGrayFloat<0, 1, 2, 4>);
+  PixelFormat::addConverter (BGRChar,  GrayFloat, rgbCharToGrayFloat<2, 1, 0, 3>);
+  PixelFormat::addConverter (BGRAChar, GrayFloat, rgbCharToGrayFloat<2, 1, 0, 4>);
+
+  PixelFormat::addConverter (GrayHalf,  GrayFloat, halfToFloatRow<1>);
+  PixelFormat::addConverter (GrayFloat, GrayHalf,  floatToHalfRow<1>);
+  PixelFormat::addConverter (RGBAHalf,  RGBAFloat, halfToFloatRow<4>);
+  PixelFormat::addConverter (RGBAFloat, RGBAHalf,  floatToHalfRow<4>);
+
+  return 1;
+}
+static int convertersRegistered = registerConverters ();
@@ -15,13 +15,362 @@ for details.
 
 
 #include "fl/convolve.h"
+#include "fl/cpu.h"
 #include "fl/lapack.h"
 
+#include <string.h>
+#if defined (__GNUC__)  &&  (defined (__x86_64__)  ||  defined (__SSE2__))
+#  include <immintrin.h>
+#  define HAVE_GATHER
+#endif
+
 
 using namespace std;
 using namespace fl;
 
 
+// Fixed-point resampling -----------------------------------------------------
+
+/**
+   Bilinear interpolation in integer arithmetic, for packed formats whose
+   channels are all T.  Source coordinates arrive in 24.8 fixed point, so
+   weights are quantized to 1/256 of a pixel.  With 8-bit weights on both
+   axes, the largest intermediate for 16-bit channels is 65535 * 256 * 256,
+   which still fits in an unsigned 32-bit integer.
+   The caller guarantees that the 2x2 neighborhood of every sample is
+   inside the image.
+**/
+template<class T, int channels>
+static inline void
+sampleInterior (const unsigned char * base, int stride, const int * X, const int * Y, int begin, int end, T * r)
+{
+  r += begin * channels;
+  for (int i = begin; i < end; i++)
+  {
+	uint32_t dx = X[i] & 0xFF;
+	uint32_t dy = Y[i] & 0xFF;
+	uint32_t dx1 = 256 - dx;
+	uint32_t dy1 = 256 - dy;
+	const T * p00 = (const T *) (base + (Y[i] >> 8) * stride) + (X[i] >> 8) * channels;
+	const T * p10 = (const T *) ((const unsigned char *) p00 + stride);
+	for (int c = 0; c < channels; c++)
+	{
+	  uint32_t a = p00[c] * dx1 + p00[c+channels] * dx;
+	  uint32_t b = p10[c] * dx1 + p10[c+channels] * dx;
+	  *r++ = (a * dy1 + b * dy + 0x8000) >> 16;
+	}
+  }
+}
+
+#ifdef HAVE_GATHER
+
+/**
+   Vectorized versions of sampleInterior().  Each processes 8 destination
+   pixels at a time, using gathers to fetch the 2x2 neighborhoods, and
+   returns the number of pixels it finished.  The caller does the rest
+   with sampleInterior().
+**/
+__attribute__ ((target ("avx2")))
+static int
+sampleGrayCharAVX2 (const unsigned char * base, int stride, int limit, const int * X, const int * Y, int count, unsigned char * r)
+{
+  const __m256i mask    = _mm256_set1_epi32 (0xFF);
+  const __m256i one     = _mm256_set1_epi32 (256);
+  const __m256i half    = _mm256_set1_epi32 (0x8000);
+  const __m256i vstride = _mm256_set1_epi32 (stride);
+  const __m256i vlimit  = _mm256_set1_epi32 (limit);
+  int i = 0;
+  for (; i + 8 <= count; i += 8)
+  {
+	__m256i x   = _mm256_loadu_si256 ((const __m256i *) (X + i));
+	__m256i y   = _mm256_loadu_si256 ((const __m256i *) (Y + i));
+	__m256i idx = _mm256_add_epi32 (_mm256_mullo_epi32 (_mm256_srai_epi32 (y, 8), vstride), _mm256_srai_epi32 (x, 8));
+	// Each gather reads 4 bytes to get 2 pixels, so it can run 2 bytes past
+	// the end of the last row.  limit is the highest safe index.  Leave any
+	// block that exceeds it to the scalar code.
+	if (_mm256_movemask_epi8 (_mm256_cmpgt_epi32 (idx, vlimit))) break;
+	__m256i top    = _mm256_i32gather_epi32 ((const int *) base,            idx, 1);
+	__m256i bottom = _mm256_i32gather_epi32 ((const int *) (base + stride), idx, 1);
+
+	__m256i dx  = _mm256_and_si256 (x, mask);
+	__m256i dy  = _mm256_and_si256 (y, mask);
+	__m256i dx1 = _mm256_sub_epi32 (one, dx);
+	__m256i dy1 = _mm256_sub_epi32 (one, dy);
+	__m256i a = _mm256_add_epi32 (_mm256_mullo_epi32 (_mm256_and_si256 (top,    mask), dx1), _mm256_mullo_epi32 (_mm256_and_si256 (_mm256_srli_epi32 (top,    8), mask), dx));
+	__m256i b = _mm256_add_epi32 (_mm256_mullo_epi32 (_mm256_and_si256 (bottom, mask), dx1), _mm256_mullo_epi32 (_mm256_and_si256 (_mm256_srli_epi32 (bottom, 8), mask), dx));
+	__m256i v = _mm256_srli_epi32 (_mm256_add_epi32 (_mm256_add_epi32 (_mm256_mullo_epi32 (a, dy1), _mm256_mullo_epi32 (b, dy)), half), 16);
+
+	v = _mm256_packus_epi32 (v, v);  // Within each 128-bit lane: 4 words, repeated
+	v = _mm256_packus_epi16 (v, v);  // Within each 128-bit lane: 4 bytes, repeated
+	int lo = _mm256_cvtsi256_si32 (v);
+	int hi = _mm256_extract_epi32 (v, 4);
+	memcpy (r + i,     &lo, 4);
+	memcpy (r + i + 4, &hi, 4);
+  }
+  return i;
+}
+
+__attribute__ ((target ("avx2")))
+static int
+sampleGrayShortAVX2 (const unsigned char * base, int stride, const int * X, const int * Y, int count, uint16_t * r)
+{
+  const __m256i mask    = _mm256_set1_epi32 (0xFF);
+  const __m256i low     = _mm256_set1_epi32 (0xFFFF);
+  const __m256i one     = _mm256_set1_epi32 (256);
+  const __m256i half    = _mm256_set1_epi32 (0x8000);
+  const __m256i vstride = _mm256_set1_epi32 (stride);
+  int i = 0;
+  for (; i + 8 <= count; i += 8)
+  {
+	__m256i x   = _mm256_loadu_si256 ((const __m256i *) (X + i));
+	__m256i y   = _mm256_loadu_si256 ((const __m256i *) (Y + i));
+	__m256i idx = _mm256_add_epi32 (_mm256_mullo_epi32 (_mm256_srai_epi32 (y, 8), vstride), _mm256_slli_epi32 (_mm256_srai_epi32 (x, 8), 1));
+	// One 4-byte gather covers exactly the 2 horizontal neighbors.
+	__m256i top    = _mm256_i32gather_epi32 ((const int *) base,            idx, 1);
+	__m256i bottom = _mm256_i32gather_epi32 ((const int *) (base + stride), idx, 1);
+
+	__m256i dx  = _mm256_and_si256 (x, mask);
+	__m256i dy  = _mm256_and_si256 (y, mask);
+	__m256i dx1 = _mm256_sub_epi32 (one, dx);
+	__m256i dy1 = _mm256_sub_epi32 (one, dy);
+	__m256i a = _mm256_add_epi32 (_mm256_mullo_epi32 (_mm256_and_si256 (top,    low), dx1), _mm256_mullo_epi32 (_mm256_srli_epi32 (top,    16), dx));
+	__m256i b = _mm256_add_epi32 (_mm256_mullo_epi32 (_mm256_and_si256 (bottom, low), dx1), _mm256_mullo_epi32 (_mm256_srli_epi32 (bottom, 16), dx));
+	__m256i v = _mm256_srli_epi32 (_mm256_add_epi32 (_mm256_add_epi32 (_mm256_mullo_epi32 (a, dy1), _mm256_mullo_epi32 (b, dy)), half), 16);
+
+	v = _mm256_packus_epi32 (v, v);
+	v = _mm256_permute4x64_epi64 (v, 0x08);  // Gather the low quadword of each 128-bit lane
+	_mm_storeu_si128 ((__m128i *) (r + i), _mm256_castsi256_si128 (v));
+  }
+  return i;
+}
+
+__attribute__ ((target ("avx2")))
+static int
+sampleRGBACharAVX2 (const unsigned char * base, int stride, const int * X, const int * Y, int count, uint32_t * r)
+{
+  const __m256i mask    = _mm256_set1_epi32 (0xFF);
+  const __m256i one     = _mm256_set1_epi32 (256);
+  const __m256i half    = _mm256_set1_epi32 (0x8000);
+  const __m256i vstride = _mm256_set1_epi32 (stride);
+  int i = 0;
+  for (; i + 8 <= count; i += 8)
+  {
+	__m256i x   = _mm256_loadu_si256 ((const __m256i *) (X + i));
+	__m256i y   = _mm256_loadu_si256 ((const __m256i *) (Y + i));
+	__m256i idx = _mm256_add_epi32 (_mm256_mullo_epi32 (_mm256_srai_epi32 (y, 8), vstride), _mm256_slli_epi32 (_mm256_srai_epi32 (x, 8), 2));
+	__m256i p00 = _mm256_i32gather_epi32 ((const int *) base,                idx, 1);
+	__m256i p01 = _mm256_i32gather_epi32 ((const int *) (base + 4),          idx, 1);
+	__m256i p10 = _mm256_i32gather_epi32 ((const int *) (base + stride),     idx, 1);
+	__m256i p11 = _mm256_i32gather_epi32 ((const int *) (base + stride + 4), idx, 1);
+
+	__m256i dx  = _mm256_and_si256 (x, mask);
+	__m256i dy  = _mm256_and_si256 (y, mask);
+	__m256i dx1 = _mm256_sub_epi32 (one, dx);
+	__m256i dy1 = _mm256_sub_epi32 (one, dy);
+	__m256i result = _mm256_setzero_si256 ();
+	for (int c = 0; c < 4; c++)
+	{
+	  __m256i a = _mm256_add_epi32 (_mm256_mullo_epi32 (_mm256_and_si256 (p00, mask), dx1), _mm256_mullo_epi32 (_mm256_and_si256 (p01, mask), dx));
+	  __m256i b = _mm256_add_epi32 (_mm256_mullo_epi32 (_mm256_and_si256 (p10, mask), dx1), _mm256_mullo_epi32 (_mm256_and_si256 (p11, mask), dx));
+	  __m256i v = _mm256_srli_epi32 (_mm256_add_epi32 (_mm256_add_epi32 (_mm256_mullo_epi32 (a, dy1), _mm256_mullo_epi32 (b, dy)), half), 16);
+	  result = _mm256_or_si256 (result, _mm256_sllv_epi32 (v, _mm256_set1_epi32 (8 * c)));
+	  p00 = _mm256_srli_epi32 (p00, 8);
+	  p01 = _mm256_srli_epi32 (p01, 8);
+	  p10 = _mm256_srli_epi32 (p10, 8);
+	  p11 = _mm256_srli_epi32 (p11, 8);
+	}
+	_mm256_storeu_si256 ((__m256i *) (r + i), result);
+  }
+  return i;
+}
+
+#endif
+
+/**
+   Bilinear sample at fixed-point position (x,y) that is not entirely inside
+   the image.  Follows the same edge rules as the float code in
+   Transform::filter(): samples within half a pixel of the border replicate
+   the outermost pixels, and anything further out is zero.
+**/
+template<class T, int channels>
+static inline void
+sampleEdge (const unsigned char * base, int stride, int lastX, int lastY, int x, int y, T * r)
+{
+  if (x < -128  ||  x >= lastX * 256 + 128  ||  y < -128  ||  y >= lastY * 256 + 128)
+  {
+	for (int c = 0; c < channels; c++) r[c] = 0;
+	return;
+  }
+
+  int fromX = x >> 8;
+  int fromY = y >> 8;
+  uint32_t dx = x & 0xFF;
+  uint32_t dy = y & 0xFF;
+  if (x < 0) fromX = 0;
+  if (y < 0) fromY = 0;
+  const T * p00 = (const T *) (base + fromY * stride) + fromX * channels;
+  const T * p01 = p00 + channels;
+  const T * p10 = (const T *) ((const unsigned char *) p00 + stride);
+  const T * p11 = p10 + channels;
+  if (x < 0  ||  fromX == lastX)
+  {
+	p01 = p00;
+	p11 = p10;
+	dx  = 0;
+  }
+  if (y < 0  ||  fromY == lastY)
+  {
+	p10 = p00;
+	p11 = p01;
+	dy  = 0;
+  }
+  uint32_t dx1 = 256 - dx;
+  uint32_t dy1 = 256 - dy;
+  for (int c = 0; c < channels; c++)
+  {
+	uint32_t a = p00[c] * dx1 + p01[c] * dx;
+	uint32_t b = p10[c] * dx1 + p11[c] * dx;
+	r[c] = (a * dy1 + b * dy + 0x8000) >> 16;
+  }
+}
+
+/**
+   Converts a source coordinate to 24.8 fixed point, rounding toward
+   negative infinity.  Clamps far-away points (say, near the horizon of a
+   homography) so they can't overflow.  A point exactly on the horizon
+   divides by zero, so non-finite values map to a coordinate that is
+   outside any image, which zero-fills the pixel.
+**/
+static inline int
+toFixed (double a)
+{
+  if (! std::isfinite (a)) a = -1e6;
+  a = min (max (a, -1e6), 1e6) * 256;
+  int result = (int) a;  // truncates toward zero, so adjust negative values
+  return result - (a < result);
+}
+
+/**
+   Warps one packed image whose channels are all T, without leaving T.
+   Coordinates are generated as in Transform::filter(), then converted to
+   fixed point one row at a time.  Runs of pixels whose 2x2 neighborhood
+   lies inside the source image go to the vector samplers, and everything
+   else to sampleEdge().  Rows between lo and hi are known to be inside,
+   so they skip classification.
+**/
+template<class T, int channels>
+static void
+warpFixed (const Image & image, Image & result, const MatrixFixed<double,3,3> & H, int lo, int hi)
+{
+  PixelBufferPacked * source = (PixelBufferPacked *) image.buffer;
+  PixelBufferPacked * target = (PixelBufferPacked *) result.buffer;
+  const unsigned char * base = (const unsigned char *) source->base ();
+  const int stride = source->stride;
+  const int lastX  = image.width  - 1;
+  const int lastY  = image.height - 1;
+  const int w      = result.width;
+
+  const double H00 = H(0,0);
+  const double H10 = H(1,0);
+  const double H20 = H(2,0);
+  const double H01 = H(0,1);
+  const double H11 = H(1,1);
+  const double H21 = H(2,1);
+  double tx = -H00 - H01 + H(0,2);
+  double ty = -H10 - H11 + H(1,2);
+  double tz = -H20 - H21 + 1.0;
+  const bool affine = tz == 1.0;
+
+  vector<int> X (w);
+  vector<int> Y (w);
+  for (int toY = 0; toY < result.height; toY++)
+  {
+	T * r = (T *) ((char *) target->base () + toY * target->stride);
+	double x = tx += H01;
+	double y = ty += H11;
+	double z = tz += H21;
+	if (affine  &&  abs (x) + abs (H00) * w < 1e6  &&  abs (y) + abs (H10) * w < 1e6)
+	{
+	  // Step along the row in 32.32 fixed point.  The accumulated error
+	  // over even a very long row is far below the 1/256 pixel resolution
+	  // of the samplers.
+	  const double scale = 4294967296.0;
+	  int64_t fx  = (int64_t) floor ((x + H00) * scale);
+	  int64_t fy  = (int64_t) floor ((y + H10) * scale);
+	  int64_t fdx = (int64_t) floor (H00 * scale);
+	  int64_t fdy = (int64_t) floor (H10 * scale);
+	  for (int toX = 0; toX < w; toX++)
+	  {
+		X[toX] = (int) (fx >> 24);
+		Y[toX] = (int) (fy >> 24);
+		fx += fdx;
+		fy += fdy;
+	  }
+	}
+	else if (affine)
+	{
+	  for (int toX = 0; toX < w; toX++)
+	  {
+		x += H00;
+		y += H10;
+		X[toX] = toFixed (x);
+		Y[toX] = toFixed (y);
+	  }
+	}
+	else
+	{
+	  for (int toX = 0; toX < w; toX++)
+	  {
+		x += H00;
+		y += H10;
+		z += H20;
+		X[toX] = toFixed (x / z);
+		Y[toX] = toFixed (y / z);
+	  }
+	}
+
+	// prepareResult() finds the interior rows with exact arithmetic, but the
+	// steppers round.  On a mirrored transform, a row that ends exactly on
+	// column 0 can step a hair past it and produce X = -1.  Coordinates are
+	// monotonic along a row, so checking the endpoints covers the rest.
+	bool interior = toY >= lo  &&  toY <= hi;
+	if (interior  &&  w > 0)
+	{
+	  const int e = w - 1;
+	  interior =  X[0] >= 0  &&  (X[0] >> 8) < lastX  &&  Y[0] >= 0  &&  (Y[0] >> 8) < lastY
+	          &&  X[e] >= 0  &&  (X[e] >> 8) < lastX  &&  Y[e] >= 0  &&  (Y[e] >> 8) < lastY;
+	}
+	int i = 0;
+	while (i < w)
+	{
+	  int end = w;
+	  if (! interior)
+	  {
+		end = i;
+		while (end < w  &&  X[end] >= 0  &&  (X[end] >> 8) < lastX  &&  Y[end] >= 0  &&  (Y[end] >> 8) < lastY) end++;
+	  }
+
+	  int done = 0;
+#     ifdef HAVE_GATHER
+	  if (haveAVX2 ())
+	  {
+		int count = end - i;
+		if (sizeof (T) == 1  &&  channels == 1) done = sampleGrayCharAVX2  (base, stride, (lastY - 1) * stride + lastX - 3, &X[i], &Y[i], count, (unsigned char *) r + i);
+		if (sizeof (T) == 2  &&  channels == 1) done = sampleGrayShortAVX2 (base, stride,                                   &X[i], &Y[i], count, (uint16_t *)      r + i);
+		if (sizeof (T) == 1  &&  channels == 4) done = sampleRGBACharAVX2  (base, stride,                                   &X[i], &Y[i], count, (uint32_t *)      r + i);
+	  }
+#     endif
+	  sampleInterior<T,channels> (base, stride, &X[0], &Y[0], i + done, end, r);
+
+	  for (i = end; i < w  &&  (X[i] < 0  ||  (X[i] >> 8) >= lastX  ||  Y[i] < 0  ||  (Y[i] >> 8) >= lastY); i++)
+	  {
+		sampleEdge<T,channels> (base, stride, lastX, lastY, X[i], Y[i], r + i * channels);
+	  }
+	}
+  }
+}
+
+
 // class Transform ------------------------------------------------------------
 
 Transform::Transform (const Matrix<double> & A, bool inverse)
@@ -93,20 +442,8 @@ Transform::initialize (const Matrix<double> & A, bool inverse)
 Image
 Transform::filter (const Image & image)
 {
-  if (image.format->monochrome)
-  {
-	if (*image.format != GrayFloat  &&  *image.format != GrayDouble)
-	{
-	  return filter (image * GrayFloat);
-	}
-  }
-  else  // color format
-  {
-	if (*image.format != RGBAFloat)
-	{
-	  return filter (image * RGBAFloat);
-	}
-  }
+  const PixelFormat & working = workingFormat (image);
+  if (working != *image.format) return filter (image * working);
 
   MatrixFixed<double,3,3> H;  // homography from destination image to source image
   int w;
@@ -115,6 +452,18 @@ Transform::filter (const Image & image)
   int hi;
   prepareResult (image, w, h, H, lo, hi);
 
+  // 8 and 16 bit formats are resampled in fixed point, so they never need a
+  // round trip through float.
+  if (*image.format == GrayChar  ||  *image.format == GrayShort  ||  *image.format == RGBChar  ||  *image.format == RGBAChar)
+  {
+	Image result (w, h, *image.format);
+	if      (*image.format == GrayChar)  warpFixed<uint8_t, 1> (image, result, H, lo, hi);
+	else if (*image.format == GrayShort) warpFixed<uint16_t,1> (image, result, H, lo, hi);
+	else if (*image.format == RGBChar)   warpFixed<uint8_t, 3> (image, result, H, lo, hi);
+	else                                 warpFixed<uint8_t, 4> (image, result, H, lo, hi);
+	return result;
+  }
+
   const int    iLastX1 = image.width  - 1;
   const int    iLastY1 = image.height - 1;
   const double lastX5  = image.width  - 0.5;
@@ -618,6 +967,27 @@ Transform::filter (const Image & image)
   }
 }
 
+/**
+   Determines the format that filter() will actually resample in.  If this
+   differs from the format of image, then filter() converts first.
+**/
+const PixelFormat &
+Transform::workingFormat (const Image & image)
+{
+  const PixelFormat & format = *image.format;
+  if (format == GrayChar  ||  format == GrayShort  ||  format == RGBChar  ||  format == RGBAChar)
+  {
+	if ((PixelBufferPacked *) image.buffer) return format;
+  }
+  if (format.monochrome)
+  {
+	if (format != GrayFloat  &&  format != GrayDouble) return GrayFloat;
+	return format;
+  }
+  if (format != RGBAFloat) return RGBAFloat;
+  return format;
+}
+
 /**
    Set up viewport (of resulting image) so its center hits at a specified
    point in source image.
@@ -682,6 +1052,12 @@ Transform::operator * (const Transform & that) const
   }
 }
 
+Transform *
+Transform::clone () const
+{
+  return new Transform (*this);
+}
+
 inline void
 Transform::twistCorner (const double inx, const double iny, double & l, double & r, double & t, double & b)
 {
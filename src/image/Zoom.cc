@@ -34,23 +34,19 @@ Zoom::filter (const Image & image)
 {
   Image result (image.width * scaleX, image.height * scaleY, *image.format);
 
+  vector<uint32_t> source (image.width);
+  vector<uint32_t> row    (result.width);
   int sy = 0;
   for (int y = 0; y < image.height; y++)
   {
+	image.getRGBA (0, y, image.width, &source[0]);
 	int sx = 0;
 	for (int x = 0; x < image.width; x++)
 	{
-	  unsigned int rgba = image.getRGBA (x, y);
-
-	  for (int v = 0; v < scaleY; v++)
-	  {
-		for (int u = 0; u < scaleX; u++)
-		{
-		  result.setRGBA (sx + u, sy + v, rgba);
-		}
-	  }
+	  for (int u = 0; u < scaleX; u++) row[sx + u] = source[x];
 	  sx += scaleX;
 	}
+	for (int v = 0; v < scaleY; v++) result.setRGBA (0, sy + v, result.width, &row[0]);
 	sy += scaleY;
   }
 
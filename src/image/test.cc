@@ -25,7 +25,10 @@ for details.
 #endif
 
 #include <float.h>
+#include <iomanip>
 #include <typeinfo>
+#include <algorithm>
+#include <stdexcept>
 
 // For debugging only
 //#include "fl/slideshow.h"
@@ -138,6 +141,156 @@ testTransform (Image & image)
   }
 }
 
+/**
+   Checks the fixed-point path of Transform against exact bilinear
+   interpolation, using a sub-pixel translation so the expected weights are
+   known.  Each channel value is compared in the stored (non-linear) space,
+   since that is where the fixed-point code works.
+**/
+void
+testTransformFixed (const PixelFormat & format)
+{
+  const int width  = 203;  // odd sizes, so vector loops have tails
+  const int height = 77;
+  Image image (width, height, format);
+  PixelBufferPacked * buffer = (PixelBufferPacked *) image.buffer;
+  const int depth    = buffer->depth;
+  const int channels = format == GrayShort ? 1 : depth;
+  const int maximum  = format == GrayShort ? 65535 : 255;
+  for (int y = 0; y < height; y++)
+  {
+	unsigned char * row = (unsigned char *) buffer->base () + y * buffer->stride;
+	for (int i = 0; i < width * depth; i++) row[i] = rand ();
+  }
+
+  const double dx = 0.25;
+  const double dy = 0.5;
+  Matrix<double> S (3, 3);
+  S.identity ();
+  S(0,2) = -dx;
+  S(1,2) = -dy;
+  Transform t (S);
+  t.setWindow ((width - 1) / 2.0, (height - 1) / 2.0, width, height);
+  Image result = image * t;
+  if (*result.format != format  ||  result.width != width  ||  result.height != height) throw "Transform did not preserve integer format";
+
+  PixelBufferPacked * rbuffer = (PixelBufferPacked *) result.buffer;
+  for (int y = 0; y < height - 1; y++)
+  {
+	for (int x = 0; x < width - 1; x++)
+	{
+	  for (int c = 0; c < channels; c++)
+	  {
+		double p[4];
+		int    got;
+		for (int j = 0; j < 2; j++)
+		{
+		  for (int i = 0; i < 2; i++)
+		  {
+			unsigned char * pixel = (unsigned char *) buffer->base () + (y + j) * buffer->stride + (x + i) * depth;
+			p[j*2+i] = format == GrayShort ? ((uint16_t *) pixel)[0] : pixel[c];
+		  }
+		}
+		unsigned char * pixel = (unsigned char *) rbuffer->base () + y * rbuffer->stride + x * depth;
+		got = format == GrayShort ? ((uint16_t *) pixel)[0] : pixel[c];
+		double a = p[0] * (1 - dx) + p[1] * dx;
+		double b = p[2] * (1 - dx) + p[3] * dx;
+		double expected = a * (1 - dy) + b * dy;
+		if (abs (got - expected) > 0.5 + 1e-6 * maximum)
+		{
+		  cout << x << " " << y << " " << c << " expected " << expected << " got " << got << endl;
+		  throw "Transform fixed-point interpolation is wrong";
+		}
+	  }
+	}
+  }
+}
+
+/**
+   Warps a black image framed by a one-pixel white border that lies outside
+   the image proper.  A mirrored transform whose rows end exactly on column
+   0 makes the fixed-point stepper round past the edge, so any sample that
+   strays outside the image shows up as a non-black pixel.
+**/
+void
+testTransformMirrored (const PixelFormat & format)
+{
+  for (int width = 10; width < 100; width += 3)
+  {
+	const int height = 9;
+	Image outer (width + 2, height + 2, format);
+	outer.clear (0xFFFFFFFF);
+	PixelBufferPacked * o = (PixelBufferPacked *) outer.buffer;
+	Image image (format);
+	image.buffer = new PixelBufferPacked (o->memory, o->stride, o->depth, o->offset + o->stride + (int) o->depth);
+	image.width  = width;
+	image.height = height;
+	for (int y = 0; y < height; y++)
+	{
+	  for (int x = 0; x < width; x++) image.setGray (x, y, 0.0f);
+	}
+
+	Matrix<double> A (3, 3);
+	A.identity ();
+	A(0,0) = -3;
+	A(0,2) = 3 * (width - 1);
+	Transform t (A);
+	t.setWindowEdges (3, 0, 3 * (width - 1), height - 1);  // Right edge of result maps exactly onto column 0.
+	Image result = image * t;
+	for (int y = 0; y < result.height; y++)
+	{
+	  for (int x = 0; x < result.width; x++)
+	  {
+		float value;
+		result.getGray (x, y, value);
+		if (value != 0)
+		{
+		  cout << typeid (format).name () << " " << width << ": " << x << " " << y << " " << value << endl;
+		  throw "Mirrored Transform read outside source image";
+		}
+	  }
+	}
+  }
+}
+
+/**
+   Warps a white image through a homography whose denominator is exactly
+   zero at column 64 of the result, where the numerator is also zero.  The
+   source coordinate there is NaN, and the surrounding columns map far
+   outside the image, so all of them must come out black.
+**/
+void
+testTransformHorizon (const PixelFormat & format)
+{
+  Image image (100, 100, format);
+  image.clear (0xFFFFFFFF);
+
+  // x = c + r - 64, y = c + r, z = 1 - c / 64, where c and r are the
+  // column and row of the result.  All steps are exact in binary.
+  Matrix<double> IA (3, 3);
+  IA.identity ();
+  IA(0,1) = 1;
+  IA(0,2) = -64;
+  IA(1,0) = 1;
+  IA(2,0) = -1.0 / 64;
+  Transform t (IA, true);
+  t.setWindowEdges (0, 0, 99, 9);
+  Image result = image * t;
+  for (int y = 0; y < result.height; y++)
+  {
+	for (int x = 63; x <= 65; x++)
+	{
+	  float value;
+	  result.getGray (x, y, value);
+	  if (value != 0)
+	  {
+		cout << typeid (format).name () << ": " << x << " " << y << " " << value << endl;
+		throw "Transform sampled a point at infinity";
+	  }
+	}
+  }
+}
+
 /**
    This is kind of a mini ConvolutionDiscrete1D.  It is meant to be a reliable
    comparison point for that code.
@@ -1024,6 +1177,331 @@ testPixelFormat ()
 # endif
 }
 
+static void
+fillRandom (Pointer & memory)
+{
+  uint8_t * p   = (uint8_t *) memory;
+  uint8_t * end = p + memory.size ();
+  while (p < end) *p++ = rand () & 0xFF;
+}
+
+static void
+fillRandom (Image & image)
+{
+  if (PixelBufferPacked * p = (PixelBufferPacked *) image.buffer)
+  {
+	fillRandom (p->memory);
+  }
+  else if (PixelBufferPlanar * p = (PixelBufferPlanar *) image.buffer)
+  {
+	fillRandom (p->plane0);
+	fillRandom (p->plane1);
+	fillRandom (p->plane2);
+  }
+  else if (PixelBufferGroups * p = (PixelBufferGroups *) image.buffer)
+  {
+	fillRandom (p->memory);
+  }
+}
+
+/**
+   Checks every registered direct converter against the per-pixel
+   accessors of the source format, then prints a timing matrix of all
+   conversions among the common formats.
+**/
+void
+testPixelFormatConvert ()
+{
+  fl::PixelFormat * formats[] = {&GrayChar, &GrayShort, &GrayFloat, &RGBChar, &RGBAChar, &BGRChar, &BGRAChar, &UYVY, &YUYV, &YUV420, &YUV411};
+  const char *      names[]   = {"GrayChar", "GrayShort", "GrayFloat", "RGBChar", "RGBAChar", "BGRChar", "BGRAChar", "UYVY", "YUYV", "YUV420", "YUV411"};
+  const int count = sizeof (formats) / sizeof (formats[0]);
+
+  // Correctness.  Sources are filled with raw random bytes, so YUV formats
+  // include plenty of out-of-gamut values that exercise clamping.  The odd
+  // width exercises the scalar tail of each vector converter.
+  int tested = 0;
+  for (int i = 0; i < count; i++)
+  {
+	for (int j = 0; j < count; j++)
+	{
+	  if (! fl::PixelFormat::findConverter (*formats[i], *formats[j])) continue;
+	  tested++;
+
+	  int width = 203;
+	  if (const PixelFormatYUV * yuv = dynamic_cast<const PixelFormatYUV *> (formats[i])) width = width / yuv->ratioH * yuv->ratioH;
+	  Image source (width, 38, *formats[i]);
+	  fillRandom (source);
+	  Image result = source * *formats[j];
+	  bool linear = ! formats[i]->monochrome  &&  ! dynamic_cast<const PixelFormatYUV *> (formats[i]);  // RGB to gray, which uses linear weights rather than getGray()
+
+	  for (int y = 0; y < source.height; y++)
+	  {
+		for (int x = 0; x < source.width; x++)
+		{
+		  bool good;
+		  if (formats[j] == &GrayFloat)
+		  {
+			float expected;
+			if (linear)
+			{
+			  float values[4];
+			  source.getRGBA (x, y, values);
+			  expected = 0.2126f * values[0] + 0.7152f * values[1] + 0.0722f * values[2];
+			}
+			else
+			{
+			  source.getGray (x, y, expected);
+			}
+			float actual;
+			result.getGray (x, y, actual);
+			good = fabs (actual - expected) < 1e-6;
+		  }
+		  else if (formats[j] == &GrayChar)
+		  {
+			good = result.getGray (x, y) == source.getGray (x, y);
+		  }
+		  else
+		  {
+			good = result.getRGBA (x, y) == source.getRGBA (x, y);
+		  }
+		  if (! good)
+		  {
+			cout << names[i] << " to " << names[j] << ": mismatch at " << x << " " << y << " " << hex << source.getRGBA (x, y) << " " << result.getRGBA (x, y) << dec << endl;
+			throw "Direct PixelFormat converter disagrees with per-pixel accessors";
+		  }
+		}
+	  }
+	}
+  }
+  if (tested == 0) throw "No direct PixelFormat converters registered";
+
+  // Threads converting the same planar image at once must not trample each
+  // other's row addresses.
+  Image planar (1024, 256, YUV420);
+  fillRandom (planar);
+  Image expected = planar * RGBAChar;
+  vector<Image> converted (4);
+  vector<std::thread> workers;
+  for (int t = 0; t < converted.size (); t++)
+  {
+	workers.push_back (std::thread ([&planar, &converted, t] ()
+	{
+	  for (int k = 0; k < 20; k++) converted[t] = planar * RGBAChar;
+	}));
+  }
+  for (int t = 0; t < workers.size (); t++) workers[t].join ();
+  for (int t = 0; t < converted.size (); t++)
+  {
+	PixelBufferPacked * a = (PixelBufferPacked *) converted[t].buffer;
+	PixelBufferPacked * b = (PixelBufferPacked *) expected.buffer;
+	if (memcmp (a->base (), b->base (), b->stride * expected.height)) throw "Concurrent conversion of planar image differs";
+  }
+
+  // Benchmark matrix.  An asterisk marks pairs that use a direct converter.
+  Image rgba (1920, 1080, RGBAChar);
+  fillRandom (rgba);
+  cout << "PixelFormat conversion, ms per " << rgba.width << "x" << rgba.height << " image (* = direct converter)" << endl;
+  cout << "          ";
+  for (int j = 0; j < count; j++) cout << setw (10) << names[j];
+  cout << endl;
+  for (int i = 0; i < count; i++)
+  {
+	Image source = rgba * *formats[i];
+	cout << setw (10) << names[i];
+	for (int j = 0; j < count; j++)
+	{
+	  if (i == j)
+	  {
+		cout << setw (10) << "-";
+		continue;
+	  }
+	  double best = INFINITY;
+	  for (int k = 0; k < 3; k++)  // best of several runs, to exclude first-touch page faults
+	  {
+		Stopwatch timer;
+		Image result = source * *formats[j];
+		timer.stop ();
+		best = min (best, timer.total ());
+	  }
+	  char cell[32];
+	  sprintf (cell, "%.1f%s", best * 1000, fl::PixelFormat::findConverter (*formats[i], *formats[j]) ? "*" : "");
+	  cout << setw (10) << cell;
+	}
+	cout << endl;
+  }
+
+  cout << "PixelFormat converters pass (" << tested << " pairs)" << endl;
+}
+
+/**
+   Checks the binary16 conversions, both scalar and array (which may use
+   F16C), then the half formats and half-precision DoG storage.
+**/
+void
+testPixelFormatHalf ()
+{
+  // Every half value survives a round trip, and both paths agree.
+  vector<uint16_t> halves (0x10000);
+  vector<float>    floats (0x10000);
+  vector<uint16_t> back   (0x10000);
+  for (int i = 0; i < 0x10000; i++) halves[i] = i;
+  halfToFloat (&halves[0], &floats[0], 0x10000);
+  floatToHalf (&floats[0], &back[0], 0x10000);
+  for (int i = 0; i < 0x10000; i++)
+  {
+	float f = halfToFloat ((uint16_t) i);
+	bool nan = (i & 0x7C00) == 0x7C00  &&  (i & 0x3FF);
+	if (memcmp (&f, &floats[i], sizeof (f))) throw "halfToFloat array disagrees with scalar";
+	if (nan) continue;
+	if (floatToHalf (f) != i  ||  back[i] != i)
+	{
+	  cout << hex << i << " " << floatToHalf (f) << " " << back[i] << dec << endl;
+	  throw "half did not survive round trip";
+	}
+  }
+
+  // Rounding, including ties, subnormals and overflow.
+  float cases[] = {1.0f + 1.0f / 2048, 1.0f + 3.0f / 2048, 65504.0f, 65519.0f, 65520.0f, 1e9f, 2.9802322e-8f, 3.0e-8f, 1e-30f, 6.0e-5f, -0.33333334f};
+  uint16_t expected[] = {0x3C00, 0x3C02, 0x7BFF, 0x7BFF, 0x7C00, 0x7C00, 0x0000, 0x0001, 0x0000, 0x03EF, 0xB555};
+  const int count = sizeof (cases) / sizeof (cases[0]);
+  floatToHalf (cases, &back[0], count);
+  for (int i = 0; i < count; i++)
+  {
+	if (floatToHalf (cases[i]) != expected[i]  ||  back[i] != expected[i])
+	{
+	  cout << cases[i] << " " << hex << floatToHalf (cases[i]) << " " << back[i] << " " << expected[i] << dec << endl;
+	  throw "floatToHalf rounded incorrectly";
+	}
+  }
+  for (int i = 0; i < 0x10000; i++) floats[i] = (rand () - RAND_MAX / 2) / (float) RAND_MAX * 4;
+  floatToHalf (&floats[0], &back[0], 0x10000);
+  for (int i = 0; i < 0x10000; i++) if (back[i] != floatToHalf (floats[i])) throw "floatToHalf array disagrees with scalar";
+
+  // Image conversion
+  Image image (dataDir + "test.jpg");
+  Image gray = image * GrayFloat;
+  Image half = gray * GrayHalf;
+  if (*half.format != GrayHalf) throw "Conversion to GrayHalf failed";
+  ImageOf<float> wide = half * GrayFloat;
+  ImageOf<float> g = gray;
+  for (int y = 0; y < g.height; y++)
+  {
+	for (int x = 0; x < g.width; x++)
+	{
+	  if (fabs (wide(x,y) - g(x,y)) > fabs (g(x,y)) / 2048 + 1e-7) throw "GrayHalf lost too much precision";
+	}
+  }
+  Image rgba = image * RGBAChar;
+  Image rgbaBack = rgba * RGBAHalf * RGBAFloat * RGBAChar;
+  for (int y = 0; y < rgba.height; y++)
+  {
+	for (int x = 0; x < rgba.width; x++)
+	{
+	  if (rgba.getRGBA (x, y) != rgbaBack.getRGBA (x, y)) throw "RGBAChar did not survive trip through RGBAHalf";
+	}
+  }
+
+  // DoG storage.  Both entries must coexist in the cache.
+  ImageCache cache;
+  cache.setOriginal (image);
+  ImageOf<float> dogFloat =  cache.get (new EntryDOG (2.0f, 1.6f, 0, GrayFloat))->image;
+  Image          dogHalf  =  cache.get (new EntryDOG (2.0f, 1.6f, 0, GrayHalf ))->image;
+  if (*dogHalf.format != GrayHalf  ||  dogHalf.width != dogFloat.width  ||  dogHalf.height != dogFloat.height) throw "Half DoG has wrong format or size";
+  ImageOf<float> dogWide = dogHalf * GrayFloat;
+  for (int y = 0; y < dogFloat.height; y++)
+  {
+	for (int x = 0; x < dogFloat.width; x++)
+	{
+	  if (fabs (dogWide(x,y) - dogFloat(x,y)) > fabs (dogFloat(x,y)) / 2048 + 1e-7) throw "Half DoG differs from float DoG";
+	}
+  }
+
+  cout << "PixelFormat half passes" << endl;
+}
+
+/**
+   Checks the span accessors against the per-pixel accessors.  Spans start
+   and end mid-row, so that planar and grouped formats begin partway
+   through a macropixel.
+**/
+void
+testPixelFormatSpan ()
+{
+  fl::PixelFormat * formats[] = {&GrayChar, &GrayShort, &GrayHalf, &GrayFloat, &GrayDouble, &RGBAChar, &RGBChar, &RGBAHalf, &RGBAFloat, &BGRChar, &B5G5R5, &CMYK, &UYVY, &UYYVYY, &YUV420, &YUV411, &RGBPlanar};
+  const char *      names[]   = {"GrayChar", "GrayShort", "GrayHalf", "GrayFloat", "GrayDouble", "RGBAChar", "RGBChar", "RGBAHalf", "RGBAFloat", "BGRChar", "B5G5R5", "CMYK", "UYVY", "UYYVYY", "YUV420", "YUV411", "RGBPlanar"};
+  const int count = sizeof (formats) / sizeof (formats[0]);
+
+  const int x0    = 5;
+  const int width = 37;
+  vector<uint32_t> rgba   (width);
+  vector<float>    values (4 * width);
+  vector<float>    gray   (width);
+  for (int i = 0; i < count; i++)
+  {
+	Image image (48, 6, *formats[i]);
+	fillRandom (image);
+	if (*formats[i] == GrayFloat  ||  *formats[i] == GrayDouble  ||  *formats[i] == RGBAFloat  ||  *formats[i] == GrayHalf  ||  *formats[i] == RGBAHalf) image = Image (image * RGBAChar) * *formats[i];  // random bits make poor floats
+
+	for (int y = 0; y < image.height; y++)
+	{
+	  image.getRGBA (x0, y, width, &rgba[0]);
+	  image.getRGBA (x0, y, width, &values[0]);
+	  image.getGray (x0, y, width, &gray[0]);
+	  for (int x = 0; x < width; x++)
+	  {
+		float v[4];
+		float g;
+		image.getRGBA (x0 + x, y, v);
+		image.getGray (x0 + x, y, g);
+		if (   rgba[x] != image.getRGBA (x0 + x, y)
+		    || memcmp (v, &values[4 * x], sizeof (v))
+		    || g != gray[x])
+		{
+		  cout << names[i] << ": get mismatch at " << x0 + x << " " << y << endl;
+		  throw "Span getter disagrees with per-pixel accessor";
+		}
+	  }
+	}
+
+	Image pixels (image.width, image.height, *formats[i]);
+	Image spans  (image.width, image.height, *formats[i]);
+	pixels.clear ();
+	spans .clear ();
+	for (int y = 0; y < image.height; y++)
+	{
+	  for (int x = 0; x < width; x++)
+	  {
+		rgba[x] = (rand () << 8) | 0xFF;
+		gray[x] = rand () / (float) RAND_MAX;
+	  }
+	  int half = image.height / 2;
+	  if (y < half)
+	  {
+		spans.setRGBA (x0, y, width, &rgba[0]);
+		for (int x = 0; x < width; x++) pixels.setRGBA (x0 + x, y, rgba[x]);
+	  }
+	  else
+	  {
+		spans.setGray (x0, y, width, &gray[0]);
+		for (int x = 0; x < width; x++) pixels.setGray (x0 + x, y, gray[x]);
+	  }
+	}
+	for (int y = 0; y < image.height; y++)
+	{
+	  for (int x = 0; x < image.width; x++)
+	  {
+		if (pixels.getRGBA (x, y) != spans.getRGBA (x, y))
+		{
+		  cout << names[i] << ": set mismatch at " << x << " " << y << endl;
+		  throw "Span setter disagrees with per-pixel accessor";
+		}
+	  }
+	}
+  }
+
+  cout << "PixelFormat spans pass" << endl;
+}
+
 // AbsoluteValue -- float and double
 void
 testAbsoluteValue ()
@@ -1161,6 +1639,48 @@ testConvolutionDiscrete1D ()
 # endif
 }
 
+/**
+   Runs a wide kernel over images of every width up to a few multiples of
+   the vector lane count, so each row kernel meets every possible leftover
+   tail, and over heights both shorter and taller than the kernel.  Unlike
+   testConvolutionDiscrete1D(), needs no input file.
+**/
+void
+testConvolutionDiscrete1DLanes ()
+{
+  Gaussian1D wide (4, Crop, GrayDouble);
+
+  BorderMode modes[] = {Crop, ZeroFill, Boost, UseZeros, Copy, Undefined};
+  fl::PixelFormat * formats[] = {&GrayFloat, &GrayDouble};
+  for (int f = 0; f < 2; f++)
+  {
+	fl::PixelFormat & format = *formats[f];
+	ConvolutionDiscrete1D kernel = wide * format;
+	for (int w = 1; w <= 40; w++)
+	{
+	  Image image (w, 41 - w, format);
+	  for (int y = 0; y < image.height; y++)
+	  {
+		for (int x = 0; x < image.width; x++)
+		{
+		  image.setGray (x, y, (float) rand () / RAND_MAX);
+		}
+	  }
+
+	  for (int m = 0; m < sizeof (modes) / sizeof (modes[0]); m++)
+	  {
+		kernel.mode = modes[m];
+		kernel.direction = Vertical;
+		testConvolutionDiscrete1D (image, kernel);
+		kernel.direction = Horizontal;
+		testConvolutionDiscrete1D (image, kernel);
+	  }
+	}
+  }
+
+  cout << "ConvolutionDiscrete1D lanes pass" << endl;
+}
+
 // ConvolutionDiscrete1D::normalFloats -- float double
 void
 testConvolutionDiscrete1DnormalFloats ()
@@ -1196,62 +1716,400 @@ testConvolutionDiscrete1DnormalFloats ()
   cout << "ConvolutionDiscrete1D::normalFloats passes" << endl;
 }
 
-// ConvolutionDiscrete2D::normalFloats -- float double
+// ConvolutionRecursive1D
+// GaussianRecursive1D
+// GaussianDerivativeRecursive1D
+// GaussianDerivativeSecondRecursive1D
 void
-testConvolutionDiscrete2DnormalFloats ()
+testConvolutionRecursive1D ()
 {
-  ImageOf<float> imagef (1, 1, GrayFloat);
-  imagef(0,0) = FLT_MIN / 2.0f;
-  ConvolutionDiscrete2D cf (imagef);
-  cf.normalFloats ();
-  if (imagef(0,0))
+  ImageOf<double> image (211, 157, GrayDouble);
+  ImageOf<double> transposed (image.height, image.width, GrayDouble);
+  for (int y = 0; y < image.height; y++)
   {
-	cout << "pixel is " << imagef(0,0) << endl;
-	throw "Convolution2D::normalFloats(float) failed";
+	for (int x = 0; x < image.width; x++)
+	{
+	  transposed(y,x) = image(x,y) = randf ();
+	}
   }
 
-  imagef(0,0) = FLT_MIN;
-  cf.normalFloats ();
-  if (! imagef(0,0))
+  const double sigma = 4;
+  const int border = (int) ceil (5 * sigma);
+  vector<ConvolutionRecursive1D *> recursive;
+  vector<ConvolutionDiscrete1D *>  discrete;
+  recursive.push_back (new GaussianRecursive1D                 (sigma, Horizontal));
+  recursive.push_back (new GaussianDerivativeRecursive1D       (sigma, Horizontal));
+  recursive.push_back (new GaussianDerivativeSecondRecursive1D (sigma, Horizontal));
+  discrete .push_back (new Gaussian1D                 (sigma, Boost, GrayDouble, Horizontal));
+  discrete .push_back (new GaussianDerivative1D       (sigma, Boost, GrayDouble, Horizontal));
+  discrete .push_back (new GaussianDerivativeSecond1D (sigma, Boost, GrayDouble, Horizontal));
+  double sign[] = {1, -1, 1};  // GaussianDerivativeRecursive1D has always had the opposite sign from GaussianDerivative1D.
+  for (int i = 0; i < recursive.size (); i++)
   {
-	cout << "pixel should have been nonzero" << endl;
-	throw "Convolution2D::normalFloats(float) failed";
-  }
+	ConvolutionRecursive1D & r = *recursive[i];
 
-  ImageOf<double> imaged (1, 1, GrayDouble);
-  imaged(0,0) = DBL_MIN / 2.0;
-  ConvolutionDiscrete2D cd (imaged);
-  cd.normalFloats ();
-  if (imaged(0,0))
-  {
-	cout << "pixel is " << imaged(0,0) << endl;
-	throw "Convolution2D::normalFloats(double) failed";
+	// Away from the borders, the recursive filter should approximate the discrete one.
+	ImageOf<double> horizontal = image * r;
+	ImageOf<double> expected   = image * *discrete[i];
+	double peak  = 0;
+	double worst = 0;
+	for (int y = 0; y < image.height; y++)
+	{
+	  for (int x = border; x < image.width - border; x++)
+	  {
+		peak  = max (peak,  fabs (expected(x,y)));
+		worst = max (worst, fabs (horizontal(x,y) - sign[i] * expected(x,y)));
+	  }
+	}
+	if (worst > 0.02 * peak)
+	{
+	  cout << typeid (r).name () << " " << worst << " " << peak << endl;
+	  throw "ConvolutionRecursive1D does not approximate discrete kernel";
+	}
+
+	// The vertical pass (adjacent columns in vector lanes) must agree with
+	// the horizontal pass (transposed blocks of rows), serial or threaded,
+	// including the partial block at the edge.
+	r.direction = Vertical;
+	ImageOf<double> vertical = transposed * r;
+	r.minimumPixels = 0;
+	r.threadRequest = 3;
+	ImageOf<double> threaded = transposed * r;
+	for (int y = 0; y < image.height; y++)
+	{
+	  for (int x = 0; x < image.width; x++)
+	  {
+		if (fabs (vertical(y,x) - horizontal(x,y)) > 1e-12  ||  threaded(y,x) != vertical(y,x))
+		{
+		  cout << typeid (r).name () << " " << x << " " << y << " " << horizontal(x,y) << " " << vertical(y,x) << " " << threaded(y,x) << endl;
+		  throw "ConvolutionRecursive1D vertical pass differs from horizontal";
+		}
+	  }
+	}
+
+	// Sequences shorter than the filter order.
+	ImageOf<double> tiny (3, 2, GrayDouble);
+	tiny.clear (0x808080FF);
+	ImageOf<double> small = tiny * r;
+	r.direction = Horizontal;
+	small = small * r;
+	if (small.width != 3  ||  small.height != 2) throw "ConvolutionRecursive1D changed size of tiny image";
+
+	delete recursive[i];
+	delete discrete[i];
   }
 
-  cout << "ConvolutionDiscrete2D::normalFloats passes" << endl;
+  cout << "ConvolutionRecursive1D passes" << endl;
 }
 
-// DescriptorFilters::prepareFilterMatrix
-// DescriptorFilters::serialize
-// Rescale::Rescale
-// Rescale::filter
-// Rotate180
+// ConvolutionDiscrete2D::filter -- {crop, zerofill, boost, usezeros, copy, undefined} X {float double} X {separable, general}
+// ConvolutionDiscrete2D::response -- {boost  etc} X {float double}
+// ConvolutionDiscrete2D::separable
+// ConvolutionFourier -- via ConvolutionDiscrete2D::filter when HAVE_FFTW
 void
-testDescriptorFilters ()
+testConvolutionDiscrete2D ()
 {
-# ifdef HAVE_LAPACK
-  DescriptorFilters desc;
-
-  CanvasImage circle (11, 11, GrayFloat);
-  circle.clear ();
-  circle.drawCircle (Point (5, 5), 5);
-  desc.filters.push_back (circle);
+# if defined (HAVE_JPEG)
+  Image test (dataDir + "test.jpg");
+  Image patch (*test.format);
+  Image tiny  (*test.format);
+  patch.bitblt (test, 0, 0, test.width / 2, test.height / 2, 61, 47);
+  tiny .bitblt (test, 0, 0, test.width / 2, test.height / 2, 5,  4);
+  vector<Image *> images;
+  images.push_back (&patch);
+  images.push_back (&tiny);
+
+  ConvolutionDiscrete2D even (Crop, GrayDouble);  // even-sized, not separable
+  even.resize (4, 6);
+  ImageOf<double> E (even);
+  double sum = 0;
+  for (int y = 0; y < E.height; y++) for (int x = 0; x < E.width; x++) sum += E(x,y) = 0.1 + randfb ();
+  for (int y = 0; y < E.height; y++) for (int x = 0; x < E.width; x++) E(x,y) /= sum;
+  vector<ConvolutionDiscrete2D> kernels;
+  kernels.push_back (Gaussian2D (1.5, Crop, GrayDouble));
+  kernels.push_back (GaussianDerivativeSecond (0, 1, 1.2, 1.2, 0.3, Crop, GrayDouble));
+  kernels.push_back (Laplacian (1.0, Crop, GrayDouble));
+  kernels.push_back (even);
+  bool expectSeparable[] = {true, false, false, false};
 
-  CanvasImage square (21, 21, GrayFloat);
-  square.clear ();
-  PointAffine pa;
-  pa.x = 10;
-  pa.y = 10;
+  vector<BorderMode> modes;
+  modes.push_back (Crop);
+  modes.push_back (ZeroFill);
+  modes.push_back (Boost);
+  modes.push_back (UseZeros);
+  modes.push_back (Copy);
+  modes.push_back (Undefined);
+
+  vector<fl::PixelFormat *> formats;
+  formats.push_back (&GrayFloat);
+  formats.push_back (&GrayDouble);
+
+  for (int f = 0; f < formats.size (); f++)
+  {
+	fl::PixelFormat & format = *formats[f];
+	for (int k = 0; k < kernels.size (); k++)
+	{
+	  ConvolutionDiscrete2D kernel = kernels[k] * format;
+	  ConvolutionDiscrete1D horizontal;
+	  ConvolutionDiscrete1D vertical;
+	  if (kernel.separable (horizontal, vertical) != expectSeparable[k]) throw "ConvolutionDiscrete2D::separable gave wrong answer";
+
+	  ImageOf<double> K = kernels[k];
+	  double total = 0;
+	  for (int y = 0; y < K.height; y++) for (int x = 0; x < K.width; x++) total += K(x,y);
+
+	  int left   = (kernel.width  - 1) - kernel.width  / 2;
+	  int top    = (kernel.height - 1) - kernel.height / 2;
+	  int right  = kernel.width  / 2;
+	  int bottom = kernel.height / 2;
+
+	  for (int i = 0; i < images.size (); i++)
+	  {
+		Image image = *images[i] * format;
+		for (int m = 0; m < modes.size (); m++)
+		{
+		  kernel.mode = modes[m];
+		  if (kernel.mode == Boost  &&  fabs (total - 1) > 1e-6) continue;  // Boost is only meaningful for kernels that sum to 1
+		  Image result = image * kernel;
+
+		  int expectedWidth  = image.width;
+		  int expectedHeight = image.height;
+		  int offsetX = 0;
+		  int offsetY = 0;
+		  if (kernel.mode == Crop)
+		  {
+			expectedWidth  = max (0, image.width  - (kernel.width  - 1));
+			expectedHeight = max (0, image.height - (kernel.height - 1));
+			if (expectedWidth == 0  ||  expectedHeight == 0) expectedWidth = expectedHeight = 0;
+			offsetX = left;
+			offsetY = top;
+		  }
+		  if (result.width != expectedWidth  ||  result.height != expectedHeight)
+		  {
+			cout << "Expected size = " << expectedWidth << "x" << expectedHeight << "   got " << result.width << "x" << result.height << endl;
+			throw "ConvolutionDiscrete2D fails";
+		  }
+
+		  for (int y = 0; y < result.height; y++)
+		  {
+			int fromY = y + offsetY;
+			for (int x = 0; x < result.width; x++)
+			{
+			  int fromX = x + offsetX;
+			  bool border = fromX < left  ||  fromX >= image.width - right  ||  fromY < top  ||  fromY >= image.height - bottom;
+
+			  float expected;
+			  if (border  &&  kernel.mode == Undefined) continue;
+			  if      (border  &&  kernel.mode == ZeroFill) expected = 0;
+			  else if (border  &&  kernel.mode == Copy)     image.getGray (fromX, fromY, expected);
+			  else expected = kernel.response (image, Point (fromX, fromY));
+
+			  float actual;
+			  result.getGray (x, y, actual);
+			  if (fabs (actual - expected) > 1e-5)
+			  {
+				cout << "kernel " << k << " mode " << kernel.mode << " at " << x << " " << y << ": " << actual << " != " << expected << endl;
+				throw "ConvolutionDiscrete2D fails";
+			  }
+			}
+		  }
+
+#         ifdef HAVE_FFTW
+		  // Force the frequency-domain path, and check it against the direct one.
+		  double saveCost = ConvolutionDiscrete2D::fourierCost;
+		  ConvolutionDiscrete2D::fourierCost = 0;
+		  Image fourier = image * kernel;
+		  ConvolutionDiscrete2D::fourierCost = saveCost;
+		  if (fourier.width != result.width  ||  fourier.height != result.height) throw "ConvolutionFourier produced wrong size";
+		  for (int y = 0; y < result.height; y++)
+		  {
+			for (int x = 0; x < result.width; x++)
+			{
+			  int fromX = x + offsetX;
+			  int fromY = y + offsetY;
+			  bool border = fromX < left  ||  fromX >= image.width - right  ||  fromY < top  ||  fromY >= image.height - bottom;
+			  if (border  &&  kernel.mode == Undefined) continue;
+
+			  float expected;
+			  float actual;
+			  result .getGray (x, y, expected);
+			  fourier.getGray (x, y, actual);
+			  if (fabs (actual - expected) > 1e-5)
+			  {
+				cout << "kernel " << k << " mode " << kernel.mode << " at " << x << " " << y << ": " << actual << " != " << expected << endl;
+				throw "ConvolutionFourier fails";
+			  }
+			}
+		  }
+#         endif
+		}
+	  }
+	}
+  }
+
+  cout << "ConvolutionDiscrete2D passes" << endl;
+# else
+  cout << "WARNING: ConvolutionDiscrete2D not tested due to lack of JPEG" << endl;
+# endif
+}
+
+/**
+   Applies ConvolutionFourier directly, with one prepared image shared by a
+   bank of kernels, and compares against the direct convolution from
+   ConvolutionDiscrete2D.  The image spans several tiles in each direction,
+   so the overlap-add seams are covered.  Needs no input file.
+**/
+void
+testConvolutionFourier ()
+{
+# ifdef HAVE_FFTW
+  vector<ConvolutionDiscrete2D> kernels;
+  kernels.push_back (Gaussian2D (2.0, Crop, GrayDouble));
+  kernels.push_back (GaussianDerivativeSecond (0, 1, 1.5, 1.5, 0.3, Crop, GrayDouble));
+  kernels.push_back (Laplacian (1.5, Crop, GrayDouble));
+  int maxWidth  = 0;
+  int maxHeight = 0;
+  for (int k = 0; k < kernels.size (); k++)
+  {
+	maxWidth  = max (maxWidth,  kernels[k].width);
+	maxHeight = max (maxHeight, kernels[k].height);
+  }
+
+  BorderMode modes[] = {Crop, ZeroFill, Boost, UseZeros, Copy, Undefined};
+  fl::PixelFormat * formats[] = {&GrayFloat, &GrayDouble};
+  for (int f = 0; f < 2; f++)
+  {
+	fl::PixelFormat & format = *formats[f];
+	float tolerance = &format == &GrayFloat ? 1e-4 : 1e-5;  // getGray() reads back as float
+
+	Image image (150, 130, format);
+	for (int y = 0; y < image.height; y++)
+	{
+	  for (int x = 0; x < image.width; x++)
+	  {
+		image.setGray (x, y, (float) rand () / RAND_MAX);
+	  }
+	}
+
+	ConvolutionFourier<float>  fourierFloat  (maxWidth, maxHeight);
+	ConvolutionFourier<double> fourierDouble (maxWidth, maxHeight);
+	if (&format == &GrayFloat) fourierFloat .prepare (image);
+	else                       fourierDouble.prepare (image);
+	if (max (fourierFloat.tilesH, fourierDouble.tilesH) < 2  ||  max (fourierFloat.tilesV, fourierDouble.tilesV) < 2) throw "ConvolutionFourier test image does not span several tiles";
+
+	for (int k = 0; k < kernels.size (); k++)
+	{
+	  ConvolutionDiscrete2D kernel = kernels[k] * format;
+	  ImageOf<double> K = kernels[k];
+	  double total = 0;
+	  for (int y = 0; y < K.height; y++) for (int x = 0; x < K.width; x++) total += K(x,y);
+
+	  int left   = (kernel.width  - 1) - kernel.width  / 2;
+	  int top    = (kernel.height - 1) - kernel.height / 2;
+	  int right  = kernel.width  / 2;
+	  int bottom = kernel.height / 2;
+
+	  for (int m = 0; m < sizeof (modes) / sizeof (modes[0]); m++)
+	  {
+		kernel.mode = modes[m];
+		if (kernel.mode == Boost  &&  fabs (total - 1) > 1e-6) continue;
+
+		double saveCost = ConvolutionDiscrete2D::fourierCost;
+		ConvolutionDiscrete2D::fourierCost = INFINITY;  // force the direct path
+		Image direct = image * kernel;
+		ConvolutionDiscrete2D::fourierCost = saveCost;
+
+		Image fourier = &format == &GrayFloat ? fourierFloat.filter (kernel) : fourierDouble.filter (kernel);
+		if (fourier.width != direct.width  ||  fourier.height != direct.height) throw "ConvolutionFourier produced wrong size";
+
+		int offsetX = kernel.mode == Crop ? left : 0;
+		int offsetY = kernel.mode == Crop ? top  : 0;
+		for (int y = 0; y < direct.height; y++)
+		{
+		  int fromY = y + offsetY;
+		  for (int x = 0; x < direct.width; x++)
+		  {
+			int fromX = x + offsetX;
+			bool border = fromX < left  ||  fromX >= image.width - right  ||  fromY < top  ||  fromY >= image.height - bottom;
+			if (border  &&  kernel.mode == Undefined) continue;
+
+			float expected;
+			float actual;
+			direct .getGray (x, y, expected);
+			fourier.getGray (x, y, actual);
+			if (fabs (actual - expected) > tolerance)
+			{
+			  cout << "kernel " << k << " mode " << kernel.mode << " at " << x << " " << y << ": " << actual << " != " << expected << endl;
+			  throw "ConvolutionFourier differs from direct convolution";
+			}
+		  }
+		}
+	  }
+	}
+  }
+
+  cout << "ConvolutionFourier passes" << endl;
+# else
+  cout << "WARNING: ConvolutionFourier not tested due to lack of FFTW" << endl;
+# endif
+}
+
+// ConvolutionDiscrete2D::normalFloats -- float double
+void
+testConvolutionDiscrete2DnormalFloats ()
+{
+  ImageOf<float> imagef (1, 1, GrayFloat);
+  imagef(0,0) = FLT_MIN / 2.0f;
+  ConvolutionDiscrete2D cf (imagef);
+  cf.normalFloats ();
+  if (imagef(0,0))
+  {
+	cout << "pixel is " << imagef(0,0) << endl;
+	throw "Convolution2D::normalFloats(float) failed";
+  }
+
+  imagef(0,0) = FLT_MIN;
+  cf.normalFloats ();
+  if (! imagef(0,0))
+  {
+	cout << "pixel should have been nonzero" << endl;
+	throw "Convolution2D::normalFloats(float) failed";
+  }
+
+  ImageOf<double> imaged (1, 1, GrayDouble);
+  imaged(0,0) = DBL_MIN / 2.0;
+  ConvolutionDiscrete2D cd (imaged);
+  cd.normalFloats ();
+  if (imaged(0,0))
+  {
+	cout << "pixel is " << imaged(0,0) << endl;
+	throw "Convolution2D::normalFloats(double) failed";
+  }
+
+  cout << "ConvolutionDiscrete2D::normalFloats passes" << endl;
+}
+
+// DescriptorFilters::prepareFilterMatrix
+// DescriptorFilters::serialize
+// Rescale::Rescale
+// Rescale::filter
+// Rotate180
+void
+testDescriptorFilters ()
+{
+# ifdef HAVE_LAPACK
+  DescriptorFilters desc;
+
+  CanvasImage circle (11, 11, GrayFloat);
+  circle.clear ();
+  circle.drawCircle (Point (5, 5), 5);
+  desc.filters.push_back (circle);
+
+  CanvasImage square (21, 21, GrayFloat);
+  square.clear ();
+  PointAffine pa;
+  pa.x = 10;
+  pa.y = 10;
   pa.A(0,0) = 10;
   pa.A(1,1) = 10;
   square.drawParallelogram (pa);
@@ -1315,6 +2173,23 @@ testDescriptorFilters ()
 // DescriptorTextonScale
 // DescriptorOrientation
 // DescriptorOrientationHistogram
+/// Fails on every point except the first, which values() describes on the calling thread.
+class ThrowingDescriptor : public Descriptor
+{
+public:
+  virtual Vector<float> value (ImageCache & cache, const PointAffine & point)
+  {
+	if (point.x != 0) throw std::runtime_error ("ThrowingDescriptor");
+	Vector<float> result (1);
+	result[0] = 0;
+	return result;
+  }
+  using Descriptor::value;
+  virtual int dimension () {return 1;}
+};
+
+// Descriptor::values
+// EntryGradient
 void
 testDescriptors ()
 {
@@ -1391,6 +2266,100 @@ testDescriptors ()
   if (value.rows () != 1) throw "Unexpected default size for orientation descriptor.";
   if (abs (value[0]) > 1e-1) throw "Unexpected orientation";
   cout << "DescriptorOrientationHistogram passes" << endl;
+
+# ifdef HAVE_JPEG
+  // Batched description must match value() point by point.  The combo mixes
+  // descriptors that get cloned (SIFT, color histogram) with one that is
+  // shared among threads (patch).
+  Image photo (dataDir + "test.jpg");
+  ImageCache::shared.setOriginal (photo);
+  PointSet points;
+  InterestDOG dog;
+  dog.run (ImageCache::shared, points);
+  PointAffine * affine = new PointAffine (*points[0]);
+  affine->scale = 4;
+  affine->A(0,1) = 0.5;
+  points.push_back (affine);
+
+  DescriptorCombo combo;
+  combo.add (new DescriptorSIFT);
+  combo.add (new DescriptorColorHistogram3D);
+  combo.add (new DescriptorPatch (10, 1));
+  Matrix<float> expected (combo.dimension (), points.size ());
+  for (int i = 0; i < points.size (); i++)
+  {
+	PointAffine * a = dynamic_cast<PointAffine *> (points[i]);
+	if (a) value = combo.value (ImageCache::shared, *a);
+	else   value = combo.value (ImageCache::shared, PointAffine (*(PointInterest *) points[i]));
+	expected.column (i) = value;
+  }
+  Matrix<float> serial = combo.values (ImageCache::shared, points, 1);
+  Matrix<float> threaded = combo.values (ImageCache::shared, points, 4);
+  if (threaded.rows () != expected.rows ()  ||  threaded.columns () != expected.columns ()) throw "Descriptor::values returned wrong shape";
+  if ((serial - expected).norm (INFINITY) != 0) throw "Descriptor::values differs from value";
+  if ((threaded - expected).norm (INFINITY) != 0) throw "Descriptor::values differs when threaded";
+
+  // An exception on a worker thread must reach the caller rather than end the process.
+  PointSet line;
+  for (int i = 0; i < 100; i++) line.push_back (new PointAffine (Point (i, 0)));
+  ThrowingDescriptor thrower;
+  bool caught = false;
+  try
+  {
+	thrower.values (ImageCache::shared, line, 4);
+  }
+  catch (const std::runtime_error & error)
+  {
+	caught = true;
+  }
+  if (! caught) throw "Descriptor::values lost an exception from a worker thread";
+  cout << "Descriptor::values passes on " << points.size () << " points" << endl;
+
+  // EntryGradient holds the same differences as FiniteDifference.
+  PointerPoly<EntryGradient> gradient = (EntryGradient *) ImageCache::shared.acquire (new EntryGradient (2, photo.width / 2));
+  ImageOf<float> level = ImageCache::shared.get (new EntryPyramid (GrayFloat, 2, photo.width / 2))->image;
+  ImageOf<float> magnitude = gradient->image;
+  ImageOf<float> I_x = level * FiniteDifference (Horizontal);
+  ImageOf<float> I_y = level * FiniteDifference (Vertical);
+  for (int y = 0; y < level.height; y++)
+  {
+	for (int x = 0; x < level.width; x++)
+	{
+	  float dx = I_x(x,y);
+	  float dy = I_y(x,y);
+	  if (magnitude(x,y) != sqrtf (dx * dx + dy * dy)  ||  gradient->angle(x,y) != (float) atan2 (dy, dx)) throw "EntryGradient differs from FiniteDifference";
+	}
+  }
+  cout << "EntryGradient passes" << endl;
+
+  // Points without shape change are sampled straight from EntryGradient.
+  // Away from the image border, that should agree with describing a
+  // rectified patch, which is still used when A is not identity.
+  DescriptorSIFT sift2;
+  DescriptorOrientationHistogram doh2;
+  int count = 0;
+  for (int i = 0; i < points.size () - 1; i++)
+  {
+	PointAffine p (*points[i]);
+	p.scale = ((PointInterest *) points[i])->scale;
+	p.angle = i % 7;
+	float radius = M_SQRT2 * sift2.supportRadial * p.scale;
+	if (p.x < radius  ||  p.y < radius  ||  p.x > photo.width - 1 - radius  ||  p.y > photo.height - 1 - radius) continue;
+	count++;
+
+	PointAffine q = p;
+	q.A(0,0) = 1 + 1e-12;
+	if (sift2.value (ImageCache::shared, p).dot (sift2.value (ImageCache::shared, q)) < 0.99) throw "Sampled SIFT differs from patch SIFT";
+
+	Vector<float> a = doh2.value (ImageCache::shared, p);
+	Vector<float> b = doh2.value (ImageCache::shared, q);
+	if (a.rows () == 0  ||  b.rows () == 0) throw "DescriptorOrientationHistogram found no peak";
+	float difference = fabs (a[0] - b[0]);
+	if (min (difference, (float) TWOPI - difference) > TWOPI / doh2.bins) throw "Sampled orientation differs from patch orientation";
+  }
+  if (count < 20) throw "Too few interior points to compare sampled descriptors";
+  cout << "Sampled DescriptorSIFT and DescriptorOrientationHistogram pass on " << count << " points" << endl;
+# endif
 }
 
 // Assumes that both images are pretty much in raw RGB, with little conversion
@@ -1424,8 +2393,8 @@ compareImages (const Image & A, const Image & B)
 void
 probeCache (ImageCache & cache, Image & test, const PixelFormat & format, float scale, int width, int tolerance)
 {
-  EntryPyramid * o = (EntryPyramid *) cache.get (new EntryPyramid (format, scale, width));
-  if (! o) throw "ImageCache failed to return a result";
+  PointerPoly<EntryPyramid> o = (EntryPyramid *) cache.acquire (new EntryPyramid (format, scale, width));
+  if (! o.memory) throw "ImageCache failed to return a result";
   if (o->image.width != width  ||  o->scale != scale  ||  *o->image.format != format)
   {
 	throw "ImageCache returned a result that doesn't match the query.";
@@ -1470,19 +2439,19 @@ testImageCache ()
   // Test automatic octave selection
   cache.clear ();
   cache.setOriginal (test);
-  ImageCacheEntry * o = cache.get (new EntryPyramid (GrayFloat, 8.1));
+  PointerPoly<ImageCacheEntry> o = cache.acquire (new EntryPyramid (GrayFloat, 8.1));
   if (cache.cache.size () != 6) throw "Unexpected number of entries in cache.";
   if (o->image.width != 20) throw "Unexpected size of result image.";
 
   // Test tolerance for very similar scales
-  ImageCacheEntry * e = cache.get (new EntryPyramid (GrayFloat, 8.11));
+  PointerPoly<ImageCacheEntry> e = cache.acquire (new EntryPyramid (GrayFloat, 8.11));
   if (cache.cache.size () != 6) throw "Unexpected number of entries in cache.";
   if (e != o) throw "Unexpected cache entry";
 
   // Test detection of sufficiently dissimilar scales
-  e = cache.get (new EntryPyramid (GrayFloat, 8.2));
+  e = cache.acquire (new EntryPyramid (GrayFloat, 8.2));
   if (cache.cache.size () != 7) throw "Unexpected number of entries in cache.";
-  if (e == 0) throw "Unexpected cache entry";
+  if (! e.memory) throw "Unexpected cache entry";
 
   cerr << cache << endl;
 
@@ -1498,6 +2467,198 @@ testImageCache ()
 # endif
 }
 
+class EntryClears : public ImageCacheEntry
+{
+public:
+  virtual void generate (ImageCache & cache)
+  {
+	cache.clear ();
+  }
+};
+
+class EntryThrows : public ImageCacheEntry
+{
+public:
+  EntryThrows (bool & destroyed) : destroyed (destroyed) {}
+  virtual ~EntryThrows () {destroyed = true;}
+  virtual void generate (ImageCache & cache)
+  {
+	throw "EntryThrows";
+  }
+  bool & destroyed;
+};
+
+// ImageCache::get -- concurrent requests for overlapping and distinct entries
+void
+testImageCacheThreads ()
+{
+# ifdef HAVE_JPEG
+  Image test (dataDir + "test.jpg");
+  test *= GrayFloat;
+
+  // Each thread asks for the same set of entries in a different order, so
+  // some requests collide on an in-flight entry and others run side by side.
+  vector<float> scales;
+  for (float s = 1; s < 16; s *= 1.4142f) scales.push_back (s);
+
+  ImageCache cache;
+  cache.setOriginal (test);
+  const int threadCount = 8;
+  vector<vector<PointerPoly<ImageCacheEntry> > > results (threadCount, vector<PointerPoly<ImageCacheEntry> > (scales.size ()));
+  vector<const char *> errors (threadCount, (const char *) 0);
+  vector<std::thread> threads;
+  for (int t = 0; t < threadCount; t++)
+  {
+	threads.push_back (std::thread ([&, t] ()
+	{
+	  try
+	  {
+		for (int j = 0; j < scales.size (); j++)
+		{
+		  int i = (j + t) % scales.size ();
+		  if (t % 2) i = scales.size () - 1 - i;
+		  results[t][i] = cache.acquire (new EntryDOG (scales[i] * 1.4142f, scales[i]));
+		}
+	  }
+	  catch (const char * message)
+	  {
+		errors[t] = message;
+	  }
+	}));
+  }
+  for (int t = 0; t < threadCount; t++) threads[t].join ();
+  for (int t = 0; t < threadCount; t++) if (errors[t]) throw errors[t];
+
+  // Which pyramid levels feed each entry depends on the order of generation,
+  // so the only firm requirement is that everyone shares a single result.
+  if (! cache.pending.empty ()) throw "ImageCache left entries pending";
+  for (int i = 0; i < scales.size (); i++)
+  {
+	PointerPoly<ImageCacheEntry> e = results[0][i];
+	if (! e.memory  ||  e->image.width == 0  ||  e->image.height == 0) throw "ImageCache returned empty entry";
+	for (int t = 1; t < threadCount; t++) if (results[t][i] != e) throw "ImageCache generated same entry more than once";
+
+	// Each DoG is the difference of two levels of its own size, no matter
+	// which sizes other threads happened to generate first.
+	ImageOf<float> dog   = e->image;
+	ImageOf<float> plus  = cache.get (new EntryPyramid (GrayFloat, scales[i] * 1.4142f, dog.width))->image;
+	ImageOf<float> minus = cache.get (new EntryPyramid (GrayFloat, scales[i],           dog.width))->image;
+	if (plus.height != dog.height  ||  minus.height != dog.height) throw "EntryDOG does not match the size of its pyramid levels";
+	for (int y = 0; y < dog.height; y++)
+	{
+	  for (int x = 0; x < dog.width; x++)
+	  {
+		if (dog(x,y) != plus(x,y) - minus(x,y)) throw "EntryDOG is not the difference of its pyramid levels";
+	  }
+	}
+  }
+
+  // Flushing from inside generate() would wait on itself forever.
+  bool caught = false;
+  try
+  {
+	cache.get (new EntryClears);
+  }
+  catch (const char * message)
+  {
+	caught = true;
+  }
+  if (! caught  ||  ! cache.pending.empty ()) throw "ImageCache::clear not detected from within generate()";
+
+  // A query whose generate() fails is still owned by the cache, so it must be deleted.
+  bool destroyed = false;
+  caught = false;
+  try
+  {
+	cache.get (new EntryThrows (destroyed));
+  }
+  catch (const char * message)
+  {
+	caught = true;
+  }
+  if (! caught  ||  ! destroyed  ||  ! cache.pending.empty ()) throw "ImageCache leaked a query whose generate() threw";
+
+  cout << "ImageCache threads pass" << endl;
+# else
+  cout << "WARNING: ImageCache threads not tested due to lack of JPEG." << endl;
+# endif
+}
+
+// ImageCache::budget -- eviction order, pinning, counters
+void
+testImageCacheBudget ()
+{
+# ifdef HAVE_JPEG
+  Image test (dataDir + "test.jpg");
+  test *= GrayFloat;
+
+  ImageCache cache;
+  cache.setOriginal (test);
+  ptrdiff_t originalBytes = cache.memory;
+
+  // Unlimited by default
+  PointerPoly<ImageCacheEntry> a = cache.acquire (new EntryPyramid (GrayFloat, 2));
+  PointerPoly<ImageCacheEntry> b = cache.acquire (new EntryPyramid (GrayFloat, 4));
+  if (cache.evictions != 0) throw "ImageCache evicted without a budget";
+  if (cache.misses < 2) throw "ImageCache miss count is wrong";  // Could be more, as intermediate octaves are generated implicitly.
+  uint64_t hits   = cache.hits;
+  uint64_t misses = cache.misses;
+  cache.acquire (new EntryPyramid (GrayFloat, 2));
+  if (cache.hits != hits + 1  ||  cache.misses != misses) throw "ImageCache hit count is wrong";
+
+  a->cost = 1000;
+  cache.touch (a);
+  cache.touch (b);
+
+  // Entries held by the caller are exempt, even when over budget.
+  ImageCacheEntry * expensive = a.memory;
+  ImageCacheEntry * cheap     = b.memory;
+  cache.budget = originalBytes;
+  cache.evict ();
+  if (cache.cache.find (expensive) == cache.cache.end ()  ||  cache.cache.find (cheap) == cache.cache.end ()) throw "ImageCache evicted an entry that is still held";
+  if (cache.cache.size () != 3) throw "ImageCache kept an entry that is not held";
+
+  // Once released, the expensive entry outlives the cheap one.
+  a = 0;
+  b = 0;
+  uint64_t evictions = cache.evictions;
+  cache.budget = cache.memory - 1;
+  cache.evict ();
+  if (cache.evictions != evictions + 1) throw "ImageCache evicted wrong number of entries";
+  if (find (cache.cache.begin (), cache.cache.end (), expensive) == cache.cache.end ()) throw "ImageCache evicted the expensive entry";  // Search by identity, since the entries are no longer held.
+  if (cache.memory > cache.budget) throw "ImageCache exceeds budget";
+
+  // A tight budget leaves only the original, which is pinned, plus the entry just requested.
+  cache.budget = originalBytes;
+  PointerPoly<ImageCacheEntry> c = cache.acquire (new EntryPyramid (GrayFloat, 8));
+  if (cache.cache.size () != 2) throw "ImageCache failed to trim to budget";
+  if (cache.cache.find (cache.original) == cache.cache.end ()) throw "ImageCache evicted the original";
+  if (cache.cache.find (c.memory) == cache.cache.end ()) throw "ImageCache evicted the entry it just returned";
+  if (cache.memory != originalBytes + c->memory ()) throw "ImageCache memory accounting is wrong";
+
+  // A held entry survives later requests, and stays readable after clear().
+  PointerPoly<ImageCacheEntry> d = cache.acquire (new EntryPyramid (GrayFloat, 16));
+  if (cache.cache.find (c.memory) == cache.cache.end ()) throw "ImageCache evicted an entry that is still held";
+  Image before = c->image;
+  cache.clear ();
+  if (c.refcount () != 1  ||  c->image.width != before.width  ||  c->image.buffer != before.buffer) throw "ImageCache::clear destroyed an entry that is still held";
+
+  // The raw-pointer API pins its result, so the pointer stays valid under a budget.
+  c = 0;
+  d = 0;
+  cache.setOriginal (test);
+  cache.budget = originalBytes;
+  EntryPyramid * raw = (EntryPyramid *) cache.get (new EntryPyramid (GrayFloat, 4));
+  cache.acquire (new EntryPyramid (GrayFloat, 16));
+  if (! raw->pinned  ||  find (cache.cache.begin (), cache.cache.end (), raw) == cache.cache.end ()) throw "ImageCache evicted an entry returned by get()";
+  if (raw->image.width != test.width / 8) throw "ImageCache entry returned by get() is damaged";
+
+  cout << "ImageCache budget passes" << endl;
+# else
+  cout << "WARNING: ImageCache budget not tested due to lack of JPEG." << endl;
+# endif
+}
+
 void
 testImageFileFormat ()
 {
@@ -1611,15 +2772,89 @@ testInterest ()
   InterestMSER mser;
   testInterest (mser, image, 205);
 
+  // The linear-time engine should find nearly the same regions, with the
+  // same result serially, concurrently, and on reused working memory.
+  {
+	PointSet expected;
+	mser.run (image, expected);
+	ImageOf<unsigned char> gray (image);
+	InterestMSERLinear linear;
+	linear.threadRequest = 1;
+	PointSet serial;
+	linear.run (image, serial);
+	linear.threadRequest = 0;
+	PointSet parallel;
+	linear.run (image, parallel);
+	if (parallel.size () != serial.size ()) throw "InterestMSERLinear depends on threading";
+	int matched = 0;
+	for (int i = 0; i < serial.size (); i++)
+	{
+	  PointMSER & p = *(PointMSER *) serial[i];
+	  PointMSER & q = *(PointMSER *) parallel[i];
+	  if (p.x != q.x  ||  p.y != q.y  ||  p.index != q.index  ||  p.threshold != q.threshold  ||  p.sign != q.sign) throw "InterestMSERLinear depends on threading";
+	  unsigned char seed = gray (p.index % image.width, p.index / image.width);
+	  if (p.sign ? seed > p.threshold : seed < p.threshold) throw "InterestMSERLinear index is outside region";
+	  for (int j = 0; j < expected.size (); j++)
+	  {
+		PointMSER & e = *(PointMSER *) expected[j];
+		if (e.sign == p.sign  &&  e.threshold == p.threshold  &&  e.weight == p.weight  &&  fabs (e.x - p.x) < 1e-3  &&  fabs (e.y - p.y) < 1e-3  &&  fabs (e.scale - p.scale) < 1e-3)
+		{
+		  matched++;
+		  break;
+		}
+	  }
+	}
+	if (matched < 0.95 * expected.size ()  ||  matched < 0.95 * serial.size ())
+	{
+	  cerr << "InterestMSERLinear matched " << matched << " of " << expected.size () << " regions" << endl;
+	  throw "InterestMSERLinear fails";
+	}
+  }
+
   InterestHarrisLaplacian hl;
   testInterest (hl, image, 841);
 
   InterestHessian s;
   testInterest (s, image, 5000);
 
+  // Large scales run on downsampled octaves, but should still be found in
+  // original image coordinates.
+  if (s.ratios.back () < 4) throw "InterestHessian does not use pyramid";
+  InterestHessian large (50, 0.02, 1, 12, 25);
+  PointSet points;
+  large.run (image, points);
+  if (points.size () == 0) throw "InterestHessian found no large-scale points";
+  for (int i = 0; i < points.size (); i++)
+  {
+	PointInterest & p = *(PointInterest *) points[i];
+	if (p.scale < 8  ||  p.x < 0  ||  p.y < 0  ||  p.x >= image.width  ||  p.y >= image.height) throw "InterestHessian returned point at wrong scale or location";
+  }
+
   InterestDOG dog;
   testInterest (dog, image, 58);
 
+  // Octaves searched on several threads must give exactly the serial result,
+  // even when the cache budget forces eviction of everything not in use.
+  vector<PointSet> found (3);
+  for (int t = 0; t < 3; t++)
+  {
+	ImageCache cache;
+	cache.setOriginal (image);
+	if (t == 2) cache.budget = 1;
+	dog.threadRequest = t ? 3 : 1;
+	dog.run (cache, found[t]);
+  }
+  for (int t = 1; t < 3; t++)
+  {
+	if (found[0].size () != found[t].size ()) throw "Threaded InterestDOG found different number of points";
+	for (int i = 0; i < found[0].size (); i++)
+	{
+	  PointInterest & a = *(PointInterest *) found[0][i];
+	  PointInterest & b = *(PointInterest *) found[t][i];
+	  if (a.x != b.x  ||  a.y != b.y  ||  a.scale != b.scale  ||  a.weight != b.weight) throw "Threaded InterestDOG found different points";
+	}
+  }
+
   cout << "InterestOperators pass" << endl;
 # else
   cout << "WARNING: Interest operators not tested due to lack of JPEG" << endl;
@@ -1723,6 +2958,54 @@ testTransform ()
   image.format = &GrayDouble;
   image.resize (640, 480);
   testTransform (image);
+
+  // Integer formats stay in fixed point
+  const PixelFormat * formats[] = {&GrayChar, &GrayShort, &RGBChar, &RGBAChar};
+  for (int i = 0; i < 4; i++)
+  {
+	Image native (640, 480, *formats[i]);
+	testTransform (native);
+	testTransformFixed (*formats[i]);
+	testTransformMirrored (*formats[i]);
+	testTransformHorizon (*formats[i]);
+  }
+
+  //   8-dof homography, against the float path.  GrayShort is linear, so
+  //   both paths interpolate the same values.
+  Image ramp (320, 240, GrayShort);
+  for (int y = 0; y < ramp.height; y++)
+  {
+	for (int x = 0; x < ramp.width; x++)
+	{
+	  ramp.setGray (x, y, (float) (0.5 + 0.25 * sin (x / 9.0) + 0.2 * cos (y / 7.0)));
+	}
+  }
+  Matrix<double> H (3, 3);
+  H.identity ();
+  H(0,0) = 0.9;
+  H(0,1) = 0.1;
+  H(1,0) = -0.05;
+  H(2,0) = 2e-4;
+  H(2,1) = 1e-4;
+  Transform t (H);
+  Image fixed   = ramp * t;
+  Image floated = (ramp * GrayFloat) * t;
+  if (fixed.width != floated.width  ||  fixed.height != floated.height) throw "Transform: fixed and float paths disagree on size";
+  for (int y = 0; y < fixed.height; y++)
+  {
+	for (int x = 0; x < fixed.width; x++)
+	{
+	  float a;
+	  float b;
+	  fixed  .getGray (x, y, a);
+	  floated.getGray (x, y, b);
+	  if (abs (a - b) > 0.002)
+	  {
+		cout << x << " " << y << " fixed " << a << " float " << b << endl;
+		throw "Transform: fixed-point 8-dof warp differs from float";
+	  }
+	}
+  }
   cout << "Transform passes" << endl;
 # else
   cout << "WARNING: Transform not tested due to lack of LAPACK" << endl;
@@ -2011,6 +3294,11 @@ testKLT (int searchRadius = 15, int windowRadius = 3, float scaleRatio = 1.0f)
 	  klt.nextImage (image0);
 	  klt.nextImage (image1);
 
+	  // The batch interface should give exactly the same answers.
+	  PointSet batch;
+	  for (int j = 0; j < points.size (); j++) batch.push_back (new PointInterest (*points[j]));
+	  vector<int> codes = klt.track (batch);
+
 	  for (int j = 0; j < points.size (); j++)
 	  {
 		PointInterest original = *points[j];
@@ -2030,6 +3318,7 @@ testKLT (int searchRadius = 15, int windowRadius = 3, float scaleRatio = 1.0f)
 		  e = error;
 		  //cerr << "klt exception " << error << endl;
 		}
+		if (codes[j] != e  ||  batch[j]->x != p.x  ||  batch[j]->y != p.y) throw "KLT::track(PointSet) differs from track(Point)";
 		double d = expected.distance (p);
 		if (d < 0.5) succeeded++;
 		else if (e && (   expected.x < -0.5  ||  expected.x > windowWidth  - 0.5
@@ -2054,6 +3343,525 @@ testKLT (int searchRadius = 15, int windowRadius = 3, float scaleRatio = 1.0f)
 # endif
 }
 
+/**
+   Throws an error that is not a KLT status code, to check that
+   KLT::track(PointSet&) carries it out of its worker threads.
+**/
+class ThrowingKLT : public KLT
+{
+public:
+  ThrowingKLT () : KLT (15, 3) {}
+
+  virtual void track (Point & point)
+  {
+	if (point.x == 50) throw std::runtime_error ("ThrowingKLT");
+	throw 1;
+  }
+  using KLT::track;
+};
+
+void
+testKLTThrow ()
+{
+  ThrowingKLT klt;
+  klt.threadRequest = 4;
+  PointSet points;
+  for (int i = 0; i < 100; i++) points.push_back (new PointInterest (Point (i, 0)));
+  bool caught = false;
+  try
+  {
+	klt.track (points);
+  }
+  catch (const std::runtime_error & error)
+  {
+	caught = true;
+  }
+  if (! caught) throw "KLT::track(PointSet) lost an exception from a worker thread";
+
+  cout << "KLT exceptions pass" << endl;
+}
+
+/**
+   Synthesizes a large raster on demand, so we can test PixelBufferBig
+   without a huge file on disk.  Honors the region parameters of read(),
+   which is the property PixelBufferBig depends on, unless regions is
+   cleared to imitate a codec that always decodes the whole raster.
+**/
+class ImageFileDelegateSynthetic : public ImageFileDelegate
+{
+public:
+  ImageFileDelegateSynthetic (int width, int height)
+  : width (width), height (height), reads (0), regions (true)
+  {
+  }
+
+  static uint8_t value (int x, int y)
+  {
+	return (x * 7 + y * 13 + x * y) & 0xFF;
+  }
+
+  virtual void read (Image & image, int x, int y, int width, int height)
+  {
+	reads++;
+	if (! regions)
+	{
+	  x      = 0;
+	  y      = 0;
+	  width  = 0;
+	  height = 0;
+	}
+	if (width  <= 0) width  = this->width  - x;
+	if (height <= 0) height = this->height - y;
+	image.format = &GrayChar;
+	image.resize (width, height);
+	for (int r = 0; r < height; r++)
+	{
+	  for (int c = 0; c < width; c++)
+	  {
+		image.setGray (c, r, value (x + c, y + r));
+	  }
+	}
+  }
+
+  virtual void write (const Image & image, int x, int y)
+  {
+	throw "Synthetic image is read-only";
+  }
+
+  virtual void get (const string & name, string & value)
+  {
+	char buffer[32];
+	if      (name == "width")       sprintf (buffer, "%i", width);
+	else if (name == "height")      sprintf (buffer, "%i", height);
+	else if (name == "blockWidth")  sprintf (buffer, "%i", 128);
+	else if (name == "blockHeight") sprintf (buffer, "%i", 128);
+	else return;
+	value = buffer;
+  }
+  using Metadata::get;
+
+  int  width;
+  int  height;
+  int  reads;
+  bool regions;
+};
+
+void
+testPixelBufferBig ()
+{
+  // 64K x 64K gray image, which is 4GB, but only 1MB of cache.
+  ImageFileDelegateSynthetic * synthetic = new ImageFileDelegateSynthetic (0x10000, 0x10000);
+  ImageFile file;
+  file.delegate = synthetic;
+  Image image;
+  file.attach (image, 0x100000);
+  PixelBufferBig * big = (PixelBufferBig *) image.buffer;
+  if (! big  ||  image.width != 0x10000  ||  image.height != 0x10000  ||  *image.format != GrayChar) throw "ImageFile::attach produced wrong image";
+  if (big->cacheTiles != 64) throw "PixelBufferBig has wrong cache size";
+
+  // Random access
+  for (int i = 0; i < 10000; i++)
+  {
+	int x = rand () % image.width;
+	int y = rand () % image.height;
+	if (image.getGray (x, y) != ImageFileDelegateSynthetic::value (x, y)) throw "PixelBufferBig returned wrong value";
+  }
+  if (big->resident.size () > big->cacheTiles) throw "PixelBufferBig exceeded its cache";
+  for (int i = 0; i < big->resident.size (); i++)
+  {
+	if (big->resident[i]->index >= 0  &&  big->resident[i]->dirty) throw "Reading through PixelBufferBig dirtied a tile";
+  }
+  if (big->scratch) throw "PixelBufferBig saved tiles that were only read";
+
+  // Coordinates outside the raster
+  bool caught = false;
+  try
+  {
+	big->pixelRead (-1, 0);
+  }
+  catch (const char * message)
+  {
+	caught = true;
+  }
+  if (! caught) throw "PixelBufferBig::pixelRead accepted a point outside the raster";
+  caught = false;
+  try
+  {
+	big->pixel (0, image.height);
+  }
+  catch (const char * message)
+  {
+	caught = true;
+  }
+  if (! caught) throw "PixelBufferBig::pixel accepted a point outside the raster";
+
+  // Sequential access within one tile should not cause any further reads
+  int reads = synthetic->reads;
+  for (int y = 0; y < 128; y++) for (int x = 0; x < 128; x++) image.getGray (x, y);
+  for (int y = 0; y < 128; y++) for (int x = 0; x < 128; x++) image.getGray (x, y);
+  if (synthetic->reads > reads + 1) throw "PixelBufferBig failed to cache tile";
+
+  // Region extraction straddling tile boundaries, followed by a filter
+  Image region;
+  big->flush ();
+  big->read (region, 1000, 2000, 300, 200);
+  for (int i = 0; i < big->resident.size (); i++)
+  {
+	if (big->resident[i]->index >= 0  &&  big->resident[i]->dirty) throw "PixelBufferBig::read dirtied a tile";
+  }
+  for (int y = 0; y < region.height; y++)
+  {
+	for (int x = 0; x < region.width; x++)
+	{
+	  if (region.getGray (x, y) != ImageFileDelegateSynthetic::value (1000 + x, 2000 + y)) throw "PixelBufferBig::read returned wrong value";
+	}
+  }
+  region *= Rotate180 ();
+
+  // Modifications must survive eviction, whether made by write() or through pixel()
+  big->write (region, 5000, 5000);
+  uint8_t changed = ~ImageFileDelegateSynthetic::value (3, 3);
+  image.setGray (3, 3, changed);
+  for (int i = 0; i < 1000; i++) image.getGray (rand () % image.width, rand () % image.height);  // flush cache
+  if (image.getGray (3, 3) != changed) throw "PixelBufferBig lost change made through pixel()";
+  for (int y = 0; y < region.height; y++)
+  {
+	for (int x = 0; x < region.width; x++)
+	{
+	  if (image.getGray (5000 + x, 5000 + y) != region.getGray (x, y)) throw "PixelBufferBig lost modified tile";
+	}
+  }
+
+  // Duplicate carries modified tiles, and is independent afterward
+  Image copy (image);
+  copy.buffer = image.buffer->duplicate ();
+  image.setGray (5000, 5000, (uint8_t) ~region.getGray (0, 0));
+  if (copy.getGray (5000, 5000) != region.getGray (0, 0)) throw "PixelBufferBig::duplicate is not independent";
+  if (copy.getGray (1, 1) != ImageFileDelegateSynthetic::value (1, 1)) throw "PixelBufferBig::duplicate lost source";
+
+  // Blank raster with no source
+  Image blank (GrayFloat);
+  blank.buffer = new PixelBufferBig (64, 64, 0x10000);
+  blank.resize (1000, 1000);
+  for (int y = 0; y < blank.height; y += 3) blank.setGray (y, y, (float) y);
+  for (int y = 0; y < blank.height; y++)
+  {
+	float g;
+	blank.getGray (y, y, g);
+	if (g != (y % 3 ? 0 : y)) throw "PixelBufferBig failed to preserve scratch data";
+  }
+
+  // A codec that can't read regions is decoded once, into an ordinary buffer.
+  ImageFileDelegateSynthetic * whole = new ImageFileDelegateSynthetic (300, 200);
+  whole->regions = false;
+  file.delegate = whole;
+  Image small;
+  file.attach (small);
+  if (! dynamic_cast<PixelBufferPacked *> (small.buffer.memory)  ||  small.width != 300  ||  small.height != 200) throw "ImageFile::attach did not fall back to a packed buffer";
+  for (int y = 0; y < small.height; y++)
+  {
+	for (int x = 0; x < small.width; x++)
+	{
+	  if (small.getGray (x, y) != ImageFileDelegateSynthetic::value (x, y)) throw "ImageFile::attach fallback returned wrong value";
+	}
+  }
+  if (whole->reads != 1) throw "ImageFile::attach decoded the raster more than once";
+
+  cout << "PixelBufferBig passes" << endl;
+}
+
+// Padded strides in PixelBufferPacked
+void
+testPixelBufferAligned ()
+{
+  Image plain (1024, 100, RGBChar);
+  fillRandom (plain);
+
+  Image padded (RGBChar);
+  PixelBufferPacked * buffer = new PixelBufferPacked;
+  buffer->alignment = 64;
+  padded.buffer = buffer;
+  padded.resize (plain.width, plain.height);
+  if (buffer->stride != Pointer::padStride (plain.width * 3, 64)  ||  buffer->stride % 64) throw "PixelBufferPacked did not pad stride";
+  for (int y = 0; y < padded.height; y++)
+  {
+	void * storage[3];
+	if ((uintptr_t) buffer->row (y, storage) % 64) throw "PixelBufferPacked row is not aligned";
+  }
+  padded.bitblt (plain);
+
+  // Conversions and filters must respect the padded stride
+  if (compareImages (padded * GrayFloat, plain * GrayFloat) != 0) throw "Conversion of padded image differs";
+  Image blurred = padded * GrayFloat * Gaussian2D (1.5);
+  if (compareImages (blurred, plain * GrayFloat * Gaussian2D (1.5)) != 0) throw "Filtered padded image differs";
+
+  // Preserving resize keeps contents and padding
+  padded.resize (plain.width + 7, plain.height, true);
+  if (buffer->stride % 64) throw "PixelBufferPacked lost padding on resize";
+  for (int y = 0; y < plain.height; y++)
+  {
+	for (int x = 0; x < plain.width; x++)
+	{
+	  if (padded.getRGBA (x, y) != plain.getRGBA (x, y)) throw "PixelBufferPacked lost contents on resize";
+	}
+  }
+
+  cout << "PixelBufferPacked alignment passes" << endl;
+}
+
+void
+testFilterParallelCompare (const Image & image, Filter & f, const char * name)
+{
+  Image expected = image * f;
+  FilterParallel p (f, 4);
+  Image actual = image * p;
+  if (actual.width != expected.width  ||  actual.height != expected.height  ||  *actual.format != *expected.format)
+  {
+	cout << name << ": got " << actual.width << "x" << actual.height << ", expected " << expected.width << "x" << expected.height << endl;
+	throw "FilterParallel produced wrong size or format";
+  }
+  for (int y = 0; y < expected.height; y++)
+  {
+	for (int x = 0; x < expected.width; x++)
+	{
+	  if (fabs (actual.getGray (x, y) - expected.getGray (x, y)) > 1e-4f)
+	  {
+		cout << name << ": mismatch at " << x << " " << y << " " << actual.getGray (x, y) << " " << expected.getGray (x, y) << endl;
+		throw "FilterParallel differs from serial result";
+	  }
+	}
+  }
+}
+
+class ThrowingFilter : public Filter
+{
+public:
+  virtual Image filter (const Image & image)
+  {
+	throw std::runtime_error ("ThrowingFilter");
+  }
+};
+
+void
+testFilterParallel ()
+{
+  Image image (dataDir + "test.jpg");
+  image *= GrayFloat;
+
+  Gaussian1D g1 (2.5, Crop, GrayFloat, Vertical);
+  testFilterParallelCompare (image, g1, "Gaussian1D Crop");
+  g1.mode = Boost;
+  testFilterParallelCompare (image, g1, "Gaussian1D Boost");
+  g1.mode = ZeroFill;
+  testFilterParallelCompare (image, g1, "Gaussian1D ZeroFill");
+  Gaussian2D g2 (1.5, Crop, GrayFloat);
+  testFilterParallelCompare (image, g2, "Gaussian2D Crop");
+  g2.mode = UseZeros;
+  testFilterParallelCompare (image, g2, "Gaussian2D UseZeros");
+  FiniteDifference d (Vertical);
+  testFilterParallelCompare (image, d, "FiniteDifference");
+  Median m (3);
+  testFilterParallelCompare (image, m, "Median");
+  Transform t (0.3);
+  testFilterParallelCompare (image, t, "Transform");
+  TransformGauss tg (1.3, 1.3);
+  testFilterParallelCompare (image, tg, "TransformGauss");
+  testFilterParallelCompare (image * RGBAChar, GrayChar, "PixelFormat");
+
+  // Exceptions of any type thrown inside a band reach the caller.
+  ThrowingFilter thrower;
+  FilterParallel p (thrower, 0, 0, false, 4);
+  bool caught = false;
+  try
+  {
+	image * p;
+  }
+  catch (const std::runtime_error & error)
+  {
+	caught = true;
+  }
+  if (! caught) throw "FilterParallel lost an exception thrown by a band";
+
+  cout << "FilterParallel passes" << endl;
+}
+
+void
+testFilterPipelineCompare (const Image & image, FilterPipeline & pipeline, const char * name)
+{
+  Image expected = image;
+  for (int i = 0; i < pipeline.stages.size (); i++) expected *= *pipeline.stages[i].filter;
+  Image actual = image * pipeline;
+  if (actual.width != expected.width  ||  actual.height != expected.height  ||  *actual.format != *expected.format)
+  {
+	cout << name << ": got " << actual.width << "x" << actual.height << ", expected " << expected.width << "x" << expected.height << endl;
+	throw "FilterPipeline produced wrong size or format";
+  }
+  for (int y = 0; y < expected.height; y++)
+  {
+	for (int x = 0; x < expected.width; x++)
+	{
+	  if (fabs (actual.getGray (x, y) - expected.getGray (x, y)) > 1e-4f)
+	  {
+		cout << name << ": mismatch at " << x << " " << y << " " << actual.getGray (x, y) << " " << expected.getGray (x, y) << endl;
+		throw "FilterPipeline differs from serial result";
+	  }
+	}
+  }
+}
+
+void
+testFilterPipeline ()
+{
+  Image image (dataDir + "test.jpg");
+
+  Gaussian1D gx (2.5, Boost, GrayFloat, Horizontal);
+  Gaussian1D gy (2.5, Boost, GrayFloat, Vertical);
+  Gaussian1D gc (1.5, Crop,  GrayFloat, Vertical);
+  FiniteDifference d (Vertical);
+  Median m (2);
+  TransformGauss t (0.5, 0.5);
+
+  FilterPipeline p;
+  p.append (GrayFloat) .append (gx) .append (gy);
+  testFilterPipelineCompare (image, p, "Gaussian");
+  p.stripRows = 7;  // raised to twice the combined halo
+  testFilterPipelineCompare (image, p, "Gaussian short strips");
+
+  FilterPipeline q;
+  q.stripRows = 40;
+  q.append (GrayFloat) .append (gc) .append (d) .append (t) .append (m) .append (gy);
+  testFilterPipelineCompare (image, q, "Crop, FiniteDifference, Transform, Median");
+
+  // UYVY yields a groups buffer, which can't be kept in a window, so this run falls back to whole-image evaluation.
+  FilterPipeline r;
+  r.stripRows = 16;
+  r.append (UYVY) .append (RGBAChar) .append (GrayFloat) .append (gy);
+  testFilterPipelineCompare (image * RGBAChar, r, "YUV");
+
+  cout << "FilterPipeline passes" << endl;
+}
+
+// IntegralImage
+// FilterHessianBox
+// FilterHarrisBox
+// EntryIntegral
+void
+testIntegralImage ()
+{
+  ImageOf<float> image (73, 61, GrayFloat);
+  for (int y = 0; y < image.height; y++)
+  {
+	for (int x = 0; x < image.width; x++)
+	{
+	  image(x,y) = randf ();
+	}
+  }
+
+  Image integral = image * IntegralImage ();
+  if (integral.width != image.width + 1  ||  integral.height != image.height + 1) throw "IntegralImage has wrong size";
+  for (int i = 0; i < 100; i++)
+  {
+	int x0 = rand () % image.width;
+	int y0 = rand () % image.height;
+	int x1 = x0 + 1 + rand () % (image.width  - x0);
+	int y1 = y0 + 1 + rand () % (image.height - y0);
+	double expected = 0;
+	for (int y = y0; y < y1; y++)
+	{
+	  for (int x = x0; x < x1; x++)
+	  {
+		expected += image(x,y);
+	  }
+	}
+	double actual = IntegralImage::sum (integral, x0, y0, x1, y1);
+	if (fabs (actual - expected) > 1e-9 * (x1 - x0) * (y1 - y0))
+	{
+	  cout << x0 << " " << y0 << " " << x1 << " " << y1 << " " << actual << " " << expected << endl;
+	  throw "IntegralImage box sum is wrong";
+	}
+  }
+
+  // A quadratic has constant Hessian, which the box filter should reproduce
+  // exactly, scaled like a Gaussian derivative of the effective sigma.
+  const double a = 0.01;
+  const double b = 0.02;
+  const double c = 0.005;
+  ImageOf<float> quadratic (60, 60, GrayFloat);
+  for (int y = 0; y < quadratic.height; y++)
+  {
+	for (int x = 0; x < quadratic.width; x++)
+	{
+	  double u = x - 30;
+	  double v = y - 30;
+	  quadratic(x,y) = a * u * u + b * v * v + c * u * v;
+	}
+  }
+  for (int d = 0; d < 2; d++)
+  {
+	FilterHessianBox h (2.0, d);
+	ImageOf<float> result = quadratic * h;
+	if (result.width != quadratic.width - 2 * h.offset) throw "FilterHessianBox has wrong size";
+	double s2 = h.sigma * h.sigma;
+	double expected = d ? s2 * s2 * (4 * a * b - c * c) : s2 * (2 * a + 2 * b);
+	for (int y = 0; y < result.height; y++)
+	{
+	  for (int x = 0; x < result.width; x++)
+	  {
+		if (fabs (result(x,y) - expected) > 1e-3 * fabs (expected))
+		{
+		  cout << x << " " << y << " " << result(x,y) << " " << expected << endl;
+		  throw "FilterHessianBox gives wrong response";
+		}
+	  }
+	}
+  }
+
+  // A ramp has a constant gradient, so the Harris response is purely the trace term.
+  const double g = 0.05;
+  ImageOf<float> ramp (50, 40, GrayFloat);
+  for (int y = 0; y < ramp.height; y++)
+  {
+	for (int x = 0; x < ramp.width; x++)
+	{
+	  ramp(x,y) = g * x;
+	}
+  }
+  FilterHarrisBox hb (1.0, 1.4);
+  ImageOf<float> response = ramp * hb;
+  if (response.width != ramp.width - 2 * hb.offset  ||  response.height != ramp.height - 2 * hb.offset) throw "FilterHarrisBox has wrong size";
+  double t = hb.sigmaD * hb.sigmaD * g * g;
+  double expected = -FilterHarris::alpha * t * t;
+  for (int y = 0; y < response.height; y++)
+  {
+	for (int x = 0; x < response.width; x++)
+	{
+	  if (fabs (response(x,y) - expected) > 1e-3 * fabs (expected))
+	  {
+		cout << x << " " << y << " " << response(x,y) << " " << expected << endl;
+		throw "FilterHarrisBox gives wrong response";
+	  }
+	}
+  }
+
+  // All the box filters of one scale share a single cached integral image.
+  Image photo (dataDir + "test.jpg");
+  photo *= GrayChar;
+  ImageCache cache;
+  cache.setOriginal (photo);
+  PointerPoly<ImageCacheEntry> e = cache.acquire (new EntryIntegral);
+  if (cache.acquire (new EntryIntegral) != e) throw "EntryIntegral not reused";
+
+  InterestHessian s;
+  s.box = true;
+  testInterest (s, photo, 5000);
+
+  InterestHarris h;
+  h.box = true;
+  testInterest (h, photo, 181);
+
+  cout << "IntegralImage passes" << endl;
+}
+
 // alpha blending
 void
 testAlpha ()
@@ -2156,13 +3964,17 @@ main (int argc, char * argv[])
 	testAbsoluteValue ();
 	testCanvasImage ();
 	testConvolutionDiscrete1D ();
+	testConvolutionDiscrete1DLanes ();
 	testConvolutionDiscrete1DnormalFloats ();
-	// ConvolutionDiscrete2D::filter -- {zerofill, usezeros, boost, crop} X {float double}
-	// ConvolutionDiscrete2D::response -- {boost  etc} X {float double}
+	testConvolutionDiscrete2D ();
+	testConvolutionFourier ();
 	testConvolutionDiscrete2DnormalFloats ();
+	testConvolutionRecursive1D ();
 	testDescriptorFilters ();
 	testDescriptors ();
 	testImageCache ();
+	testImageCacheThreads ();
+	testImageCacheBudget ();
 	testImageFileFormat ();
 	testIntensityFilters ();
 	testInterest ();
@@ -2171,7 +3983,16 @@ main (int argc, char * argv[])
 	testVideo ();
 	testBitblt ();
 	testKLT ();
+	testKLTThrow ();
+	testPixelBufferBig ();
+	testPixelBufferAligned ();
+	testFilterParallel ();
+	testFilterPipeline ();
+	testIntegralImage ();
 	testAlpha ();
+	testPixelFormatConvert ();
+	testPixelFormatSpan ();
+	testPixelFormatHalf ();
 	testPixelFormat ();  // The most expensive test, so do last.
   }
   catch (const char * error)
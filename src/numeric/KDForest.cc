@@ -0,0 +1,302 @@
+/*
+Author: Fred Rothganger
+
+Copyright 2010 Sandia Corporation.
+Under the terms of Contract DE-AC04-94AL85000 with Sandia Corporation,
+the U.S. Government retains certain rights in this software.
+Distributed under the GNU Lesser General Public License.  See the file LICENSE
+for details.
+*/
+
+
+#include "fl/neighbor.h"
+
+#include <algorithm>
+#include <functional>
+#include <string.h>
+
+
+using namespace fl;
+using namespace std;
+
+
+// class KDForest -------------------------------------------------------------
+
+KDForest::KDForest (int trees, int checks)
+: trees (trees),
+  checks (checks)
+{
+  dimensions = 0;
+  stride     = 0;
+  k          = 5;
+  bucketSize = 1;
+  radius     = INFINITY;
+  candidates = 5;
+  sample     = 100;
+  seed       = 1;
+}
+
+KDForest::~KDForest ()
+{
+}
+
+void
+KDForest::clear ()
+{
+  points.clear ();
+  items.clear ();
+  nodes.clear ();
+  order.clear ();
+}
+
+void
+KDForest::set (const vector<MatrixAbstract<float> *> & data)
+{
+  clear ();
+  int count = data.size ();
+  if (count == 0) return;
+
+  dimensions = data[0]->rows ();
+  stride     = (dimensions + 7) / 8 * 8;
+  points.resize (count * stride, 0.0f);
+  items = data;
+  lo.resize (dimensions);
+  hi.resize (dimensions);
+  lo.clear ( INFINITY);
+  hi.clear (-INFINITY);
+  for (int i = 0; i < count; i++)
+  {
+	const float * a = &(*data[i])[0];  // Same assumption as KDTree: the values for each vector are contiguous.
+	memcpy (&points[i * stride], a, dimensions * sizeof (float));
+	for (int d = 0; d < dimensions; d++)
+	{
+	  lo[d] = min (lo[d], a[d]);
+	  hi[d] = max (hi[d], a[d]);
+	}
+  }
+
+  random.seed (seed);
+  nodes.resize (trees);
+  order.resize (trees);
+  for (int t = 0; t < trees; t++)
+  {
+	vector<int> & o = order[t];
+	o.resize (count);
+	for (int i = 0; i < count; i++) o[i] = i;
+	nodes[t].reserve (2 * (count / max (1, bucketSize) + 1));
+	construct (t, 0, count);
+  }
+}
+
+int
+KDForest::construct (int tree, int begin, int end)
+{
+  vector<Node> & n = nodes[tree];
+  vector<int>  & o = order[tree];
+  int count = end - begin;
+
+  int index = n.size ();
+  n.push_back (Node ());
+  if (count <= max (1, bucketSize))
+  {
+	n[index].dimension = -1;
+	n[index].low       = begin;
+	n[index].high      = end;
+	return index;
+  }
+
+  // Estimate mean and variance from a sample of the points.  The first few
+  // entries of each range are as good as any, since order is arbitrary.
+  int s = min (count, sample);
+  vector<double> mean     (dimensions, 0.0);
+  vector<double> variance (dimensions, 0.0);
+  for (int i = begin; i < begin + s; i++)
+  {
+	const float * p = &points[o[i] * stride];
+	for (int d = 0; d < dimensions; d++) mean[d] += p[d];
+  }
+  for (int d = 0; d < dimensions; d++) mean[d] /= s;
+  for (int i = begin; i < begin + s; i++)
+  {
+	const float * p = &points[o[i] * stride];
+	for (int d = 0; d < dimensions; d++)
+	{
+	  double t = p[d] - mean[d];
+	  variance[d] += t * t;
+	}
+  }
+
+  // Pick randomly among the dimensions with highest variance.
+  vector<pair<double, int> > ranked (dimensions);
+  for (int d = 0; d < dimensions; d++) ranked[d] = make_pair (variance[d], d);
+  int top = min (candidates, dimensions);
+  partial_sort (ranked.begin (), ranked.begin () + top, ranked.end (), greater<pair<double, int> > ());
+  int dimension = ranked[random () % top].second;
+  float mid = mean[dimension];
+
+  // Partition at the mean.  If that fails to separate anything (say, the
+  // sample missed an outlier), fall back to the median.
+  const float * base = &points[dimension];
+  const int     st   = stride;
+  int cut = partition (o.begin () + begin, o.begin () + end, [base, st, mid] (int i) {return base[i * st] < mid;}) - o.begin ();
+  if (cut == begin  ||  cut == end)
+  {
+	cut = begin + count / 2;
+	nth_element (o.begin () + begin, o.begin () + cut, o.begin () + end, [base, st] (int a, int b) {return base[a * st] < base[b * st];});
+	mid = base[o[cut] * stride];
+  }
+
+  // Track the bounding box of each cell, so search can maintain exact lower
+  // bounds on distance the same way KDTree does.
+  float nodeLo = lo[dimension];
+  float nodeHi = hi[dimension];
+
+  hi[dimension] = mid;
+  int lowNode = construct (tree, begin, cut);
+  hi[dimension] = nodeHi;
+
+  lo[dimension] = mid;
+  int highNode = construct (tree, cut, end);
+  lo[dimension] = nodeLo;
+
+  Node & node = n[index];  // reference taken only now, since recursion may reallocate nodes
+  node.dimension = dimension;
+  node.lo        = nodeLo;
+  node.hi        = nodeHi;
+  node.mid       = mid;
+  node.low       = lowNode;
+  node.high      = highNode;
+  return index;
+}
+
+void
+KDForest::find (const MatrixAbstract<float> & query, vector<MatrixAbstract<float> *> & result) const
+{
+  if (items.empty ()) return;
+
+  vector<float> padded (stride, 0.0f);
+  const float * q = &query[0];
+  for (int d = 0; d < dimensions; d++) padded[d] = q[d];
+
+  vector<int>   indices;
+  vector<float> distances;
+  search (&padded[0], indices, distances);
+
+  result.reserve (result.size () + indices.size ());
+  for (int i = 0; i < indices.size (); i++) result.push_back (items[indices[i]]);
+}
+
+void
+KDForest::search (const float * query, vector<int> & indices, vector<float> & distances) const
+{
+  indices.clear ();
+  distances.clear ();
+  if (items.empty ()) return;
+
+  // Distance of query from bounding rectangle of all points
+  float distance = 0;
+  for (int i = 0; i < dimensions; i++)
+  {
+	float d = max (0.0f, lo[i] - query[i]) + max (0.0f, query[i] - hi[i]);
+	distance += d * d;
+  }
+
+  // Branches waiting to be explored, across all trees.  Each is labeled
+  // with (tree, node).
+  typedef pair<float, pair<int, int> > Branch;
+  typedef pair<float, int> Item;
+  vector<Branch> queue;
+  vector<Item>   best;  // max-heap of the k nearest points found so far
+  queue.reserve (256);
+  best.reserve (k + 1);
+  // The same point appears in every tree, so only measure it once.  Rather
+  // than clear a flag per point on every query, stamp each visited point
+  // with a number unique to this query.  The stamps are scratch space owned
+  // by the thread, so concurrent queries don't collide.
+  static thread_local vector<uint32_t> visited;
+  static thread_local uint32_t         epoch = 0;
+  if (visited.size () < items.size ()) visited.resize (items.size (), 0);
+  if (++epoch == 0)  // wrapped around, so old stamps could look current
+  {
+	fill (visited.begin (), visited.end (), 0);
+	epoch = 1;
+  }
+  float r2 = radius * radius;
+  int checked = 0;
+
+  for (int t = 0; t < trees; t++) queue.push_back (Branch (distance, make_pair (t, 0)));
+
+  while (queue.size ())
+  {
+	if (checked >= checks  &&  best.size () == k) break;
+
+	pop_heap (queue.begin (), queue.end (), greater<Branch> ());
+	distance = queue.back ().first;
+	int t    = queue.back ().second.first;
+	int b    = queue.back ().second.second;
+	queue.pop_back ();
+	if (distance >= r2) break;
+
+	const vector<Node> & n = nodes[t];
+	const vector<int>  & o = order[t];
+
+	// Descend to the nearer leaf, queueing the farther child at each branch.
+	// As in KDTree, the nearer child inherits the distance of its parent.
+	const Node * node = &n[b];
+	while (node->dimension >= 0)
+	{
+	  float qmid = query[node->dimension];
+	  float newOffset = qmid - node->mid;
+	  int nearNode;
+	  int farNode;
+	  float oldOffset;
+	  if (newOffset < 0)
+	  {
+		nearNode  = node->low;
+		farNode   = node->high;
+		oldOffset = max (node->lo - qmid, 0.0f);
+	  }
+	  else
+	  {
+		nearNode  = node->high;
+		farNode   = node->low;
+		oldOffset = max (qmid - node->hi, 0.0f);
+	  }
+	  float farDistance = distance + newOffset * newOffset - oldOffset * oldOffset;
+	  if (farDistance < r2)
+	  {
+		queue.push_back (Branch (farDistance, make_pair (t, farNode)));
+		push_heap (queue.begin (), queue.end (), greater<Branch> ());
+	  }
+	  node = &n[nearNode];
+	}
+
+	for (int j = node->low; j < node->high; j++)
+	{
+	  int i = o[j];
+	  if (visited[i] == epoch) continue;
+	  visited[i] = epoch;
+	  checked++;
+
+	  float total = KDTreeFlat::distance (&points[i * stride], query, stride, r2);
+	  if (total >= r2) continue;
+	  best.push_back (Item (total, i));
+	  push_heap (best.begin (), best.end ());
+	  if (best.size () > k)
+	  {
+		pop_heap (best.begin (), best.end ());
+		best.pop_back ();
+	  }
+	  if (best.size () == k) r2 = min (r2, best.front ().first);
+	}
+  }
+
+  sort_heap (best.begin (), best.end ());
+  indices  .resize (best.size ());
+  distances.resize (best.size ());
+  for (int i = 0; i < best.size (); i++)
+  {
+	distances[i] = best[i].first;
+	indices[i]   = best[i].second;
+  }
+}
@@ -0,0 +1,352 @@
+/*
+Author: Fred Rothganger
+
+Copyright 2010 Sandia Corporation.
+Under the terms of Contract DE-AC04-94AL85000 with Sandia Corporation,
+the U.S. Government retains certain rights in this software.
+Distributed under the GNU Lesser General Public License.  See the file LICENSE
+for details.
+*/
+
+
+#include "fl/neighbor.h"
+#include "fl/cpu.h"
+
+#include <algorithm>
+#include <functional>
+#include <string.h>
+
+
+using namespace fl;
+using namespace std;
+
+
+// Distance kernels -----------------------------------------------------------
+
+/**
+   Squared Euclidean distance between two rows of length stride.  Checks
+   the running total against limit every 32 elements, so that far points
+   can be rejected early without giving up vectorization.
+**/
+static inline float
+distanceScalar (const float * a, const float * b, int stride, float limit)
+{
+  float total = 0;
+  for (int i = 0; i < stride; i += 32)
+  {
+	int end = min (i + 32, stride);
+	for (int j = i; j < end; j++)
+	{
+	  float t = a[j] - b[j];
+	  total += t * t;
+	}
+	if (total >= limit) break;
+  }
+  return total;
+}
+
+#if defined (__GNUC__)  &&  (defined (__x86_64__)  ||  defined (__SSE2__))
+
+namespace
+{
+template<int bytes>
+struct Lanes
+{
+  typedef float V __attribute__ ((vector_size (bytes)));
+  static const int count = bytes / sizeof (float);
+};
+}
+
+/**
+   Vector version of distanceScalar().  stride must be a multiple of the
+   number of lanes.
+**/
+template<int bytes>
+static inline __attribute__ ((always_inline)) float
+distanceVector (const float * a, const float * b, int stride, float limit)
+{
+  typedef typename Lanes<bytes>::V V;
+  const int lanes = Lanes<bytes>::count;
+
+  float total = 0;
+  for (int i = 0; i < stride; i += 32)
+  {
+	int end = min (i + 32, stride);
+	V sum = {};
+	for (int j = i; j < end; j += lanes)
+	{
+	  V x;
+	  V y;
+	  memcpy (&x, a + j, bytes);
+	  memcpy (&y, b + j, bytes);
+	  V t = x - y;
+	  sum += t * t;
+	}
+	for (int l = 0; l < lanes; l++) total += sum[l];
+	if (total >= limit) break;
+  }
+  return total;
+}
+
+__attribute__ ((target ("avx2"))) static float distanceAVX2 (const float * a, const float * b, int stride, float limit) {return distanceVector<32> (a, b, stride, limit);}
+static float distanceSSE2 (const float * a, const float * b, int stride, float limit) {return distanceVector<16> (a, b, stride, limit);}
+
+float
+KDTreeFlat::distance (const float * a, const float * b, int stride, float limit)
+{
+  if (haveAVX2 ()) return distanceAVX2 (a, b, stride, limit);
+  return distanceSSE2 (a, b, stride, limit);
+}
+
+#else
+
+float
+KDTreeFlat::distance (const float * a, const float * b, int stride, float limit)
+{
+  return distanceScalar (a, b, stride, limit);
+}
+
+#endif
+
+
+// class KDTreeFlat -----------------------------------------------------------
+
+KDTreeFlat::KDTreeFlat ()
+{
+  dimensions = 0;
+  stride     = 0;
+  bucketSize = 5;
+  k          = 5;
+  radius     = INFINITY;
+  epsilon    = 1e-4;
+  maxNodes   = INT_MAX;
+}
+
+KDTreeFlat::~KDTreeFlat ()
+{
+}
+
+void
+KDTreeFlat::clear ()
+{
+  points.clear ();
+  items.clear ();
+  nodes.clear ();
+}
+
+void
+KDTreeFlat::set (const vector<MatrixAbstract<float> *> & data)
+{
+  clear ();
+  int count = data.size ();
+  if (count == 0) return;
+
+  dimensions = data[0]->rows ();
+  stride     = (dimensions + 7) / 8 * 8;
+  lo.resize (dimensions);
+  hi.resize (dimensions);
+  lo.clear ( INFINITY);
+  hi.clear (-INFINITY);
+
+  // Gather into contiguous memory in original order, so construction
+  // doesn't chase pointers.  Same assumption as KDTree: the values for each
+  // vector are contiguous.
+  vector<float> raw (count * stride, 0.0f);
+  for (int i = 0; i < count; i++)
+  {
+	const float * a = &(*data[i])[0];
+	float * r = &raw[i * stride];
+	for (int d = 0; d < dimensions; d++)
+	{
+	  float v = a[d];
+	  r[d]  = v;
+	  lo[d] = min (lo[d], v);
+	  hi[d] = max (hi[d], v);
+	}
+  }
+
+  vector<int> order (count);
+  for (int i = 0; i < count; i++) order[i] = i;
+  nodes.reserve (2 * (count / max (1, bucketSize) + 1));
+  construct (order, 0, count, &raw[0]);
+
+  // Store points in leaf order, so each leaf scans one contiguous block.
+  points.resize (count * stride);
+  items.resize (count);
+  for (int i = 0; i < count; i++)
+  {
+	int o = order[i];
+	memcpy (&points[i * stride], &raw[o * stride], stride * sizeof (float));
+	items[i] = data[o];
+  }
+}
+
+int
+KDTreeFlat::construct (vector<int> & order, int begin, int end, const float * raw)
+{
+  int count = end - begin;
+  if (count == 0) return -1;
+
+  int index = nodes.size ();
+  nodes.push_back (Node ());
+  if (count <= max (1, bucketSize))
+  {
+	Node & n = nodes[index];
+	n.dimension = -1;
+	n.low       = begin;
+	n.high      = end;
+	return index;
+  }
+
+  // Split along the longest side of the current bounding box.
+  int d = 0;
+  float longest = 0;
+  for (int i = 0; i < dimensions; i++)
+  {
+	float length = hi[i] - lo[i];
+	if (length > longest)
+	{
+	  d = i;
+	  longest = length;
+	}
+  }
+  const int s = stride;
+  int cut = begin + count / 2;
+  nth_element (order.begin () + begin, order.begin () + cut, order.begin () + end, [raw, s, d] (int a, int b)
+  {
+	return raw[a * s + d] < raw[b * s + d];
+  });
+
+  float nodeLo = lo[d];
+  float nodeHi = hi[d];
+  float mid    = raw[order[cut] * stride + d];
+
+  hi[d] = mid;
+  int lowNode = construct (order, begin, cut, raw);
+  hi[d] = nodeHi;
+
+  lo[d] = mid;
+  int highNode = construct (order, cut, end, raw);
+  lo[d] = nodeLo;  // restore, so that when recursion unwinds the box is still correct
+
+  Node & n = nodes[index];  // reference taken only now, since recursion may reallocate nodes
+  n.dimension = d;
+  n.lo        = nodeLo;
+  n.hi        = nodeHi;
+  n.mid       = mid;
+  n.low       = lowNode;
+  n.high      = highNode;
+  return index;
+}
+
+void
+KDTreeFlat::find (const MatrixAbstract<float> & query, vector<MatrixAbstract<float> *> & result) const
+{
+  if (nodes.empty ()) return;
+
+  vector<float> padded (stride, 0.0f);
+  const float * q = &query[0];
+  for (int d = 0; d < dimensions; d++) padded[d] = q[d];
+
+  vector<int>   indices;
+  vector<float> distances;
+  search (&padded[0], indices, distances);
+
+  result.reserve (result.size () + indices.size ());
+  for (int i = 0; i < indices.size (); i++) result.push_back (items[indices[i]]);
+}
+
+void
+KDTreeFlat::search (const float * query, vector<int> & indices, vector<float> & distances) const
+{
+  indices.clear ();
+  distances.clear ();
+  if (nodes.empty ()) return;
+
+  // Determine distance of query from bounding rectangle for entire tree
+  float distance = 0;
+  for (int i = 0; i < dimensions; i++)
+  {
+	float d = max (0.0f, lo[i] - query[i]) + max (0.0f, query[i] - hi[i]);
+	distance += d * d;
+  }
+
+  typedef pair<float, int> Item;
+  vector<Item> queue;  // min-heap of nodes waiting to be expanded
+  vector<Item> best;   // max-heap of the k nearest points found so far
+  queue.reserve (64);
+  best.reserve (k + 1);
+  float r2 = radius * radius;  // this may shrink monotonically once we find enough neighbors
+  float oneEpsilon = (1 + epsilon) * (1 + epsilon);
+
+  queue.push_back (Item (distance, 0));
+  int visited = 0;
+  while (queue.size ())
+  {
+	pop_heap (queue.begin (), queue.end (), greater<Item> ());
+	distance  = queue.back ().first;
+	int index = queue.back ().second;
+	queue.pop_back ();
+	if (distance * oneEpsilon > r2) break;
+
+	// Descend to the nearer leaf, queueing the farther child at each branch.
+	// As in KDTree, the nearer child inherits the distance of its parent.
+	const Node * n = &nodes[index];
+	while (n->dimension >= 0)
+	{
+	  float qmid = query[n->dimension];
+	  float newOffset = qmid - n->mid;
+	  int nearNode;
+	  int farNode;
+	  float oldOffset;
+	  if (newOffset < 0)
+	  {
+		nearNode  = n->low;
+		farNode   = n->high;
+		oldOffset = max (n->lo - qmid, 0.0f);
+	  }
+	  else
+	  {
+		nearNode  = n->high;
+		farNode   = n->low;
+		oldOffset = max (qmid - n->hi, 0.0f);
+	  }
+	  if (farNode >= 0)
+	  {
+		queue.push_back (Item (distance + newOffset * newOffset - oldOffset * oldOffset, farNode));
+		push_heap (queue.begin (), queue.end (), greater<Item> ());
+	  }
+	  if (nearNode < 0) break;
+	  n = &nodes[nearNode];
+	}
+
+	if (n->dimension < 0)
+	{
+	  const float * p = &points[n->low * stride];
+	  for (int i = n->low; i < n->high; i++, p += stride)
+	  {
+		float total = KDTreeFlat::distance (p, query, stride, r2);
+		if (total >= r2) continue;
+		best.push_back (Item (total, i));
+		push_heap (best.begin (), best.end ());
+		if (best.size () > k)
+		{
+		  pop_heap (best.begin (), best.end ());
+		  best.pop_back ();
+		}
+		if (best.size () == k) r2 = min (r2, best.front ().first);
+	  }
+	}
+
+	if (++visited >= maxNodes) break;
+  }
+
+  sort_heap (best.begin (), best.end ());
+  indices  .resize (best.size ());
+  distances.resize (best.size ());
+  for (int i = 0; i < best.size (); i++)
+  {
+	distances[i] = best[i].first;
+	indices[i]   = best[i].second;
+  }
+}
@@ -0,0 +1,392 @@
+/*
+Author: Fred Rothganger
+
+Copyright 2010 Sandia Corporation.
+Under the terms of Contract DE-AC04-94AL85000 with Sandia Corporation,
+the U.S. Government retains certain rights in this software.
+Distributed under the GNU Lesser General Public License.  See the file LICENSE
+for details.
+*/
+
+
+#define flNumeric_MS_EVIL
+#include "fl/matrix.h"
+#include "fl/cpu.h"
+#include "fl/thread.h"
+
+#include <algorithm>
+#include <string.h>
+
+
+using namespace fl;
+using namespace std;
+
+
+#ifdef __GNUC__
+
+// Blocking parameters -------------------------------------------------------
+
+/**
+   Sizes of the blocks that the product is carved into.  A panel of kc rows
+   of B (by up to nc columns) is packed once and shared by all threads.  Each
+   work unit packs an mc by kc block of A, which should stay resident in L2
+   while the micro-kernel sweeps across the panel of B.
+**/
+static const int kc = 256;
+static const int mc = 128;
+static const int nc = 4096;
+
+namespace
+{
+template<class T, int bytes>
+struct Kernel
+{
+  typedef T V __attribute__ ((vector_size (bytes)));
+  static const int lanes = bytes / sizeof (T);
+  static const int MR    = 2 * lanes;  ///< rows of C held in registers
+  static const int NR    = 4;          ///< columns of C held in registers
+};
+}
+
+
+// Packing -------------------------------------------------------------------
+
+/**
+   Copies rows [0,m) and columns [0,k) of A into consecutive panels of MR
+   rows each.  Within a panel, the MR values for one column are contiguous,
+   so the micro-kernel reads A with unit stride.  A partial last panel is
+   padded with zeros.
+**/
+template<class T, int MR>
+static inline void
+packA (int m, int k, const T * a, int aR, int aC, T * p)
+{
+  const int panel = MR;
+  for (int i = 0; i < m; i += MR)
+  {
+	int rows = min (panel, m - i);
+	const T * column = a + i * aR;
+	for (int j = 0; j < k; j++)
+	{
+	  const T * r = column;
+	  int q = 0;
+	  for (; q < rows; q++, r += aR) *p++ = *r;
+	  for (; q < MR;   q++)          *p++ = (T) 0;
+	  column += aC;
+	}
+  }
+}
+
+/**
+   Same as packA(), but for panels of NR columns of B, with the NR values
+   for one row contiguous.
+**/
+template<class T, int NR>
+static inline void
+packB (int k, int n, const T * b, int bR, int bC, T * p)
+{
+  const int panel = NR;
+  for (int j = 0; j < n; j += NR)
+  {
+	int columns = min (panel, n - j);
+	const T * row = b + j * bC;
+	for (int i = 0; i < k; i++)
+	{
+	  const T * c = row;
+	  int q = 0;
+	  for (; q < columns; q++, c += bC) *p++ = *c;
+	  for (; q < NR;      q++)          *p++ = (T) 0;
+	  row += bR;
+	}
+  }
+}
+
+
+// Micro-kernel --------------------------------------------------------------
+
+/**
+   Multiplies one packed panel of A (MR x k) by one packed panel of B (k x
+   NR), and either stores or adds the result to the m x n corner of C.
+**/
+template<class T, int bytes>
+static inline __attribute__ ((always_inline)) void
+microKernel (int k, const T * a, const T * b, T * c, int ldc, int m, int n, bool accumulate)
+{
+  typedef Kernel<T,bytes> K;
+  typedef typename K::V V;
+  const int lanes = K::lanes;
+  const int MR    = K::MR;
+  const int NR    = K::NR;
+
+  V c00 = {};
+  V c01 = {};
+  V c10 = {};
+  V c11 = {};
+  V c20 = {};
+  V c21 = {};
+  V c30 = {};
+  V c31 = {};
+  for (int p = 0; p < k; p++)
+  {
+	V a0;
+	V a1;
+	memcpy (&a0, a,         bytes);
+	memcpy (&a1, a + lanes, bytes);
+	T b0 = b[0];
+	T b1 = b[1];
+	T b2 = b[2];
+	T b3 = b[3];
+	c00 += a0 * b0;
+	c01 += a1 * b0;
+	c10 += a0 * b1;
+	c11 += a1 * b1;
+	c20 += a0 * b2;
+	c21 += a1 * b2;
+	c30 += a0 * b3;
+	c31 += a1 * b3;
+	a += MR;
+	b += NR;
+  }
+
+  V result[NR][2] = {{c00, c01}, {c10, c11}, {c20, c21}, {c30, c31}};
+  if (m == MR)
+  {
+	for (int j = 0; j < n; j++)
+	{
+	  T * column = c + j * ldc;
+	  for (int h = 0; h < 2; h++)
+	  {
+		V t = result[j][h];
+		if (accumulate)
+		{
+		  V old;
+		  memcpy (&old, column + h * lanes, bytes);
+		  t += old;
+		}
+		memcpy (column + h * lanes, &t, bytes);
+	  }
+	}
+  }
+  else  // Partial panel.  Go through scratch memory so we don't write past the last row.
+  {
+	T t[NR][MR];
+	memcpy (t, result, sizeof (t));
+	for (int j = 0; j < n; j++)
+	{
+	  T * column = c + j * ldc;
+	  if (accumulate) for (int i = 0; i < m; i++) column[i] += t[j][i];
+	  else            for (int i = 0; i < m; i++) column[i]  = t[j][i];
+	}
+  }
+}
+
+/**
+   Sweeps the micro-kernel over one packed block of A (m x k) and one packed
+   panel of B (k x n).
+**/
+template<class T, int bytes>
+static inline __attribute__ ((always_inline)) void
+macroKernel (int m, int n, int k, const T * a, const T * b, T * c, int ldc, bool accumulate)
+{
+  const int MR = Kernel<T,bytes>::MR;
+  const int NR = Kernel<T,bytes>::NR;
+  for (int j = 0; j < n; j += NR)
+  {
+	const T * bp = b + j * k;
+	int columns = min (NR, n - j);
+	for (int i = 0; i < m; i += MR)
+	{
+	  microKernel<T,bytes> (k, a + i * k, bp, c + j * ldc + i, ldc, min (MR, m - i), columns, accumulate);
+	}
+  }
+}
+
+#if defined (__x86_64__)  ||  defined (__SSE2__)
+
+__attribute__ ((target ("avx2,fma"))) static void macroAVX2 (int m, int n, int k, const float  * a, const float  * b, float  * c, int ldc, bool accumulate) {macroKernel<float, 32> (m, n, k, a, b, c, ldc, accumulate);}
+__attribute__ ((target ("avx2,fma"))) static void macroAVX2 (int m, int n, int k, const double * a, const double * b, double * c, int ldc, bool accumulate) {macroKernel<double,32> (m, n, k, a, b, c, ldc, accumulate);}
+static void macroSSE2 (int m, int n, int k, const float  * a, const float  * b, float  * c, int ldc, bool accumulate) {macroKernel<float, 16> (m, n, k, a, b, c, ldc, accumulate);}
+static void macroSSE2 (int m, int n, int k, const double * a, const double * b, double * c, int ldc, bool accumulate) {macroKernel<double,16> (m, n, k, a, b, c, ldc, accumulate);}
+
+#endif
+
+
+// class Multiply -------------------------------------------------------------
+
+namespace
+{
+/**
+   Holds the state of one call to multiplyBlocked().  Each work unit is one
+   block of rowsPerBlock rows of A, multiplied against the currently packed
+   panel of B.  The packing layout depends on the register width, so all
+   work units follow the same choice as pack().
+**/
+template<class T>
+class Multiply
+{
+public:
+  Multiply (int m, int n, int k, const T * a, int aR, int aC, const T * b, int bR, int bC, T * c, int ldc, int rowsPerBlock)
+  : m (m), n (n), k (k),
+	a (a), aR (aR), aC (aC),
+	b (b), bR (bR), bC (bC),
+	c (c), ldc (ldc),
+	rowsPerBlock (rowsPerBlock)
+  {
+	packedB.resize ((min (nc, n) + 8) * min (kc, k));
+  }
+
+  void pack ()
+  {
+	const T * B = b + pc * bR + jc * bC;
+#   if defined (__x86_64__)  ||  defined (__SSE2__)
+	if (haveAVX2 ()  &&  haveFMA ())
+	{
+	  packB<T,Kernel<T,32>::NR> (kcc, ncc, B, bR, bC, &packedB[0]);
+	  return;
+	}
+#   endif
+	packB<T,Kernel<T,16>::NR> (kcc, ncc, B, bR, bC, &packedB[0]);
+  }
+
+  void process (const int block)
+  {
+	static thread_local vector<T> packedA;
+	packedA.resize ((mc + 16) * kc);
+
+	int ic  = block * rowsPerBlock;
+	int mcc = min (rowsPerBlock, m - ic);
+	const T * A = a + ic * aR + pc * aC;
+	T *       C = c + ic + jc * ldc;
+	bool accumulate = pc > 0;
+#   if defined (__x86_64__)  ||  defined (__SSE2__)
+	if (haveAVX2 ()  &&  haveFMA ())
+	{
+	  packA<T,Kernel<T,32>::MR> (mcc, kcc, A, aR, aC, &packedA[0]);
+	  macroAVX2 (mcc, ncc, kcc, &packedA[0], &packedB[0], C, ldc, accumulate);
+	  return;
+	}
+	packA<T,Kernel<T,16>::MR> (mcc, kcc, A, aR, aC, &packedA[0]);
+	macroSSE2 (mcc, ncc, kcc, &packedA[0], &packedB[0], C, ldc, accumulate);
+#   else
+	packA<T,Kernel<T,16>::MR> (mcc, kcc, A, aR, aC, &packedA[0]);
+	macroKernel<T,16> (mcc, ncc, kcc, &packedA[0], &packedB[0], C, ldc, accumulate);
+#   endif
+  }
+
+  const int m;
+  const int n;
+  const int k;
+  const T * a;
+  const int aR;
+  const int aC;
+  const T * b;
+  const int bR;
+  const int bC;
+  T *       c;
+  const int ldc;
+  const int rowsPerBlock;
+
+  vector<T> packedB;
+  int jc;
+  int ncc;
+  int pc;
+  int kcc;
+};
+
+template<class T>
+class MultiplyRunner : public ParallelFor<int>
+{
+public:
+  MultiplyRunner (Multiply<T> & job, int threads)
+  : ParallelFor<int> (threads),
+	job (job)
+  {
+  }
+
+  virtual void process (const int block)
+  {
+	job.process (block);
+  }
+
+  Multiply<T> & job;
+};
+}
+
+template<class T>
+static void
+multiply (int m, int n, int k, const T * a, int aR, int aC, const T * b, int bR, int bC, T * c, int ldc, float threadRequest)
+{
+  if (m <= 0  ||  n <= 0) return;
+  if (k <= 0)
+  {
+	for (int j = 0; j < n; j++) memset (c + j * ldc, 0, m * sizeof (T));
+	return;
+  }
+
+  // Only spin up threads when there is enough work to amortize them.  Spread
+  // rows evenly, so that a short-and-wide problem still keeps every thread
+  // busy, but keep each block a multiple of the widest register panel.
+  int threads = 1;
+  if ((double) m * n * k >= 1e6)
+  {
+	threads = (int) threadRequest;
+	if (threadRequest == 0) threads = hardwareThreads ();
+	else if (threadRequest != threads) threads = (int) ceil (hardwareThreads () * threadRequest);
+	threads = max (1, threads);
+  }
+  int rowsPerBlock = mc;
+  if (threads > 1)
+  {
+	int rows = (m + threads - 1) / threads;
+	rows = (rows + 15) / 16 * 16;
+	rowsPerBlock = min (mc, rows);
+  }
+  int blocks = (m + rowsPerBlock - 1) / rowsPerBlock;
+  threads = min (threads, blocks);
+
+  Multiply<T> job (m, n, k, a, aR, aC, b, bR, bC, c, ldc, rowsPerBlock);
+  MultiplyRunner<T> * runner = 0;
+  if (threads > 1) runner = new MultiplyRunner<T> (job, threads);
+  for (job.jc = 0; job.jc < n; job.jc += nc)
+  {
+	job.ncc = min (nc, n - job.jc);
+	for (job.pc = 0; job.pc < k; job.pc += kc)
+	{
+	  job.kcc = min (kc, k - job.pc);
+	  job.pack ();
+	  if (runner) runner->run (0, blocks);
+	  else for (int i = 0; i < blocks; i++) job.process (i);
+	}
+  }
+  delete runner;
+}
+
+bool
+fl::multiplyBlocked (int m, int n, int k, const float * a, int aR, int aC, const float * b, int bR, int bC, float * c, int ldc, float threadRequest)
+{
+  multiply (m, n, k, a, aR, aC, b, bR, bC, c, ldc, threadRequest);
+  return true;
+}
+
+bool
+fl::multiplyBlocked (int m, int n, int k, const double * a, int aR, int aC, const double * b, int bR, int bC, double * c, int ldc, float threadRequest)
+{
+  multiply (m, n, k, a, aR, aC, b, bR, bC, c, ldc, threadRequest);
+  return true;
+}
+
+#else
+
+bool
+fl::multiplyBlocked (int m, int n, int k, const float * a, int aR, int aC, const float * b, int bR, int bC, float * c, int ldc, float threadRequest)
+{
+  return false;
+}
+
+bool
+fl::multiplyBlocked (int m, int n, int k, const double * a, int aR, int aC, const double * b, int bR, int bC, double * c, int ldc, float threadRequest)
+{
+  return false;
+}
+
+#endif
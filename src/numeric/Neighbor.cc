@@ -10,12 +10,61 @@ for details.
 
 
 #include "fl/neighbor.h"
+#include "fl/thread.h"
+
+#include <exception>
+#include <mutex>
 
 
 using namespace fl;
 using namespace std;
 
 
+// class BatchRunner ----------------------------------------------------------
+
+namespace
+{
+/**
+   Does the work of Neighbor::findBatch().  Each work unit is a block of
+   consecutive queries, to keep contention on the shared counter low.
+**/
+class BatchRunner : public ParallelFor<int>
+{
+public:
+  BatchRunner (const Neighbor & neighbor, const vector<MatrixAbstract<float> *> & queries, vector<vector<MatrixAbstract<float> *> > & results, float threadRequest)
+  : ParallelFor<int> (threadRequest),
+	neighbor (neighbor),
+	queries (queries),
+	results (results)
+  {
+  }
+
+  virtual void process (const int block)
+  {
+	try
+	{
+	  int start = block * blockSize;
+	  int stop  = min (start + blockSize, (int) queries.size ());
+	  for (int i = start; i < stop; i++) neighbor.find (*queries[i], results[i]);
+	}
+	catch (...)  // Anything that escapes a worker thread would terminate the process, so carry it back to the caller of run().
+	{
+	  std::lock_guard<std::mutex> lock (mutexError);
+	  if (! error) error = std::current_exception ();
+	}
+  }
+
+  static const int blockSize = 16;
+
+  const Neighbor &                           neighbor;
+  const vector<MatrixAbstract<float> *> &    queries;
+  vector<vector<MatrixAbstract<float> *> > & results;
+  std::exception_ptr                         error;  ///< First exception thrown by any query.
+  std::mutex                                 mutexError;
+};
+}
+
+
 // class Neighbor -------------------------------------------------------------
 
 Neighbor::~Neighbor ()
@@ -29,6 +78,23 @@ Neighbor::serialize (Archive & archive, uint32_t version)
 {
 }
 
+void
+Neighbor::findBatch (const vector<MatrixAbstract<float> *> & queries, vector<vector<MatrixAbstract<float> *> > & results, float threadRequest) const
+{
+  int count = queries.size ();
+  results.resize (count);
+  int blocks = (count + BatchRunner::blockSize - 1) / BatchRunner::blockSize;
+  if (blocks < 2)
+  {
+	for (int i = 0; i < count; i++) find (*queries[i], results[i]);
+	return;
+  }
+
+  BatchRunner runner (*this, queries, results, threadRequest);
+  runner.run (0, blocks);
+  if (runner.error) std::rethrow_exception (runner.error);
+}
+
 
 // class Entry ----------------------------------------------------------------
 
@@ -25,6 +25,7 @@ for details.
 #include <limits>
 #include <complex>
 #include <typeinfo>
+#include <stdexcept>
 
 
 using namespace std;
@@ -599,6 +600,66 @@ testOperator ()
   cout << "operators pass" << endl;
 }
 
+template<class T>
+void
+testMultiply ()
+{
+  T epsilon = sqrt (numeric_limits<T>::epsilon ());
+  double oldBLAS    = MatrixStrided<T>::crossoverBLAS;
+  double oldBlocked = MatrixStrided<T>::crossoverBlocked;
+  float  oldThreads = MatrixStrided<T>::threadsBlocked;
+  MatrixStrided<T>::threadsBlocked = 4;  // exercise the threaded path even on a small machine
+
+  // Shapes chosen to cover partial register panels and several cache blocks along each dimension.
+  int shapes[][3] = {{1, 1, 1}, {5, 3, 7}, {17, 13, 9}, {33, 270, 300}, {300, 5, 513}, {257, 131, 263}};
+  for (int s = 0; s < sizeof (shapes) / sizeof (shapes[0]); s++)
+  {
+	int m = shapes[s][0];
+	int n = shapes[s][1];
+	int k = shapes[s][2];
+	Matrix<T> A = makeMatrix (m, k);
+	Matrix<T> B = makeMatrix (k, n);
+	Matrix<T> At = ~makeMatrix (k, m);  // strideR != 1
+	At = ~At;
+	Matrix<T> Bt = makeMatrix (n, k);
+	MatrixStrided<T> A2 = ~Matrix<T> (makeMatrix (k + 1, m + 2)).region (1, 2);  // transposed view with offset
+
+	MatrixStrided<T>::crossoverBLAS    = INFINITY;
+	MatrixStrided<T>::crossoverBlocked = INFINITY;
+	Matrix<T> expected   = A * B;
+	Matrix<T> expectedT  = A * ~Bt;
+	Matrix<T> expected2  = A2 * B;
+	Matrix<T> expectedTT = A.transposeTimes (A);
+	Matrix<T> expectedTS = B.transposeSquare ();
+
+	MatrixStrided<T>::crossoverBlocked = 0;
+	Matrix<T> result   = A * B;
+	Matrix<T> resultT  = A * ~Bt;
+	Matrix<T> result2  = A2 * B;
+	Matrix<T> resultTT = A.transposeTimes (A);
+	Matrix<T> resultTS = B.transposeSquare ();
+
+	T scale = epsilon * k;
+	if ((result   - expected  ).norm (INFINITY) > scale) throw "blocked A * B differs from simple loop";
+	if ((resultT  - expectedT ).norm (INFINITY) > scale) throw "blocked A * ~B differs from simple loop";
+	if ((result2  - expected2 ).norm (INFINITY) > scale) throw "blocked product of strided view differs from simple loop";
+	if ((resultTT - expectedTT).norm (INFINITY) > scale) throw "blocked transposeTimes differs from simple loop";
+	for (int c = 0; c < n; c++)
+	{
+	  for (int r = 0; r <= c; r++)
+	  {
+		if (abs (resultTS(r,c) - expectedTS(r,c)) > scale) throw "blocked transposeSquare differs from simple loop";
+	  }
+	}
+  }
+
+  MatrixStrided<T>::crossoverBLAS    = oldBLAS;
+  MatrixStrided<T>::crossoverBlocked = oldBlocked;
+  MatrixStrided<T>::threadsBlocked   = oldThreads;
+
+  cout << "multiply passes" << endl;
+}
+
 template<class T>
 void
 testReshape ()
@@ -694,6 +755,18 @@ testStrided ()
   if (B.rows () != 4  ||  B.columns () != 1) throw "strided column unexpected size";
   for (int i = 0; i < 4; i++) if (B[i] != i + 7) throw "strided column unexpected value";
 
+  // Padded columns
+  Matrix<T> C;
+  Matrix<T> dense (7, 5);
+  C.resize (7, 5, 64);
+  if (C.rows () != 7  ||  C.columns () != 5  ||  C.strideC * sizeof (T) % 64) throw "padded resize unexpected stride";
+  for (int c = 0; c < 5; c++)
+  {
+	if ((uintptr_t) &C(0,c) % 64) throw "padded column is not aligned";
+	for (int r = 0; r < 7; r++) C(r,c) = dense(r,c) = r * 5 + c;
+  }
+  if ((~C * C - ~dense * dense).norm (INFINITY) != 0) throw "product with padded matrix unexpected value";
+
   cout << "MatrixStrided passes" << endl;
 }
 
@@ -1185,12 +1258,154 @@ testNeighbor ()
   cout << "KDTree passes" << endl;
 }
 
+class ThrowingNeighbor : public Neighbor
+{
+public:
+  virtual void set (const vector<MatrixAbstract<float> *> & data) {}
+  virtual void find (const MatrixAbstract<float> & query, vector<MatrixAbstract<float> *> & result) const
+  {
+	throw std::runtime_error ("ThrowingNeighbor");
+  }
+};
+
+void
+testKDTreeFlat ()
+{
+  int count = 20000;
+  int dimension = 60;  // not a multiple of 8, to exercise padding
+  int k = 5;
+  int probes = 200;
+
+  vector<MatrixAbstract<float> *> points;
+  for (int i = 0; i < count; i++) points.push_back (new Vector<float> (makeMatrix (dimension, 1)));
+  vector<MatrixAbstract<float> *> queries;
+  for (int i = 0; i < probes; i++) queries.push_back (new Vector<float> (makeMatrix (dimension, 1)));
+
+  KDTree tree;
+  tree.k = k;
+  tree.set (points);
+  KDTreeFlat flat;
+  flat.k = k;
+  flat.set (points);
+
+  // Exact search should agree with KDTree, and batch search with single queries.
+  vector<vector<MatrixAbstract<float> *> > batch;
+  flat.findBatch (queries, batch, 4);
+  if (batch.size () != probes) throw "KDTreeFlat::findBatch returned wrong number of results";
+  for (int i = 0; i < probes; i++)
+  {
+	vector<MatrixAbstract<float> *> expected;
+	tree.find (*queries[i], expected);
+	vector<MatrixAbstract<float> *> result;
+	flat.find (*queries[i], result);
+	if (result.size () != k) throw "KDTreeFlat k not honored";
+	if (result != expected) throw "KDTreeFlat disagrees with KDTree";
+	if (batch[i] != result) throw "KDTreeFlat::findBatch disagrees with find";
+  }
+
+  // Radius limit
+  vector<MatrixAbstract<float> *> result;
+  flat.find (*queries[0], result);
+  float radius = ((*queries[0] - *result[1]).norm (2) + (*queries[0] - *result[2]).norm (2)) / 2;
+  flat.radius = radius;
+  result.clear ();
+  flat.find (*queries[0], result);
+  if (result.size () != 2) throw "KDTreeFlat radius not honored";
+
+  // An exception in one query must reach the caller rather than end the process.
+  ThrowingNeighbor thrower;
+  bool caught = false;
+  try
+  {
+	thrower.findBatch (queries, batch, 4);
+  }
+  catch (const std::runtime_error & error)
+  {
+	caught = true;
+  }
+  if (! caught) throw "Neighbor::findBatch lost an exception from a worker thread";
+
+  for (int i = 0; i < points.size (); i++) delete points[i];
+  for (int i = 0; i < queries.size (); i++) delete queries[i];
+
+  cout << "KDTreeFlat passes" << endl;
+}
+
+void
+testKDForest ()
+{
+  int count = 20000;
+  int dimension = 64;
+  int clusters = 200;
+  int probes = 200;
+
+  // Clustered data, which is more like real descriptors than a uniform cloud.
+  vector<Vector<float> > centers;
+  for (int i = 0; i < clusters; i++) centers.push_back (makeMatrix (dimension, 1));
+  vector<MatrixAbstract<float> *> points;
+  vector<MatrixAbstract<float> *> queries;
+  for (int i = 0; i < count + probes; i++)
+  {
+	Vector<float> noise = makeMatrix (dimension, 1);
+	Vector<float> * p = new Vector<float> (centers[rand () % clusters] + noise * 0.1f);
+	if (i < count) points .push_back (p);
+	else           queries.push_back (p);
+  }
+
+  KDTreeFlat exact;
+  exact.k = 1;
+  exact.set (points);
+  KDForest forest (4, count);
+  forest.k = 1;
+  forest.set (points);
+
+  // With an unlimited budget, the forest must be exact.
+  vector<vector<MatrixAbstract<float> *> > expected;
+  vector<vector<MatrixAbstract<float> *> > result;
+  exact .findBatch (queries, expected);
+  forest.findBatch (queries, result);
+  for (int i = 0; i < probes; i++)
+  {
+	if (result[i].size () != 1) throw "KDForest k not honored";
+	if (result[i] != expected[i]) throw "KDForest with full budget is not exact";
+  }
+
+  // With a small budget, most answers should still be right.
+  forest.checks = 200;
+  result.clear ();
+  forest.findBatch (queries, result);
+  int correct = 0;
+  for (int i = 0; i < probes; i++) if (result[i] == expected[i]) correct++;
+  float recall = (float) correct / probes;
+  cerr << "KDForest recall = " << recall << endl;
+  if (recall < 0.8) throw "KDForest recall too low";
+
+  // The same seed builds the same forest, and building it leaves the
+  // process-wide rand() alone.
+  srand (7);
+  int expectedRand = rand ();
+  srand (7);
+  KDForest again (4, 200);
+  again.k = 1;
+  again.set (points);
+  if (rand () != expectedRand) throw "KDForest::set disturbed rand()";
+  vector<vector<MatrixAbstract<float> *> > repeated;
+  again.findBatch (queries, repeated);
+  if (repeated != result) throw "KDForest is not reproducible from its seed";
+
+  for (int i = 0; i < points.size (); i++) delete points[i];
+  for (int i = 0; i < queries.size (); i++) delete queries[i];
+
+  cout << "KDForest passes" << endl;
+}
+
 template<class T>
 void
 testAll ()
 {
   testSearch<T> ();
   testOperator<T> ();
+  testMultiply<T> ();
   testReshape<T> ();
   testStrided<T> ();
   testNorm<T> ();
@@ -1216,6 +1431,8 @@ main (int argc, char * argv[])
 	testAll<float> ();
 	testCluster ();  // right now, ClusterMethod is only in float
 	testNeighbor ();  // only in float
+	testKDTreeFlat ();
+	testKDForest ();
 
 	cout << "====================================================================" << endl;
 	cout << "running all tests for double" << endl;